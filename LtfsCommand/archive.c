@@ -0,0 +1,1048 @@
+/*
+ *   File:   archive.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pch.h"
+#include "archive.h"
+#include "ingest.h"
+#include "lock.h"
+#include "ltfsidx.h"
+#include "mapping.h"
+#include "media.h"
+#include "tape.h"
+#include "util.h"
+
+typedef struct ARCHIVE_NODE
+{
+    LPSTR Path;
+    ULONGLONG Bytes;        // Everything underneath
+    DWORD FileCount;
+    ULONGLONG OwnBytes;     // Just the files directly in it
+    DWORD OwnFiles;
+    DWORD FirstChild;
+    DWORD NextSibling;
+} ARCHIVE_NODE, *PARCHIVE_NODE;
+
+typedef struct ARCHIVE_TREE
+{
+    LPCSTR SourceDir;
+    PARCHIVE_NODE Nodes;
+    DWORD NodeCount;
+    DWORD NodeCapacity;
+} ARCHIVE_TREE, *PARCHIVE_TREE;
+
+typedef struct ARCHIVE_WORKER
+{
+    PARCHIVE_PLAN Plan;
+    DWORD Drive;
+    DWORD Algorithm;
+    PCRITICAL_SECTION ConsoleLock;
+} ARCHIVE_WORKER, *PARCHIVE_WORKER;
+
+static BOOL ArchiveFindDrives(PARCHIVE_PLAN plan);
+static DWORD ArchiveAddNode(PARCHIVE_TREE tree, LPCSTR path);
+static BOOL ArchiveScan(PARCHIVE_TREE tree, DWORD index);
+static void ArchiveDestroyTree(PARCHIVE_TREE tree);
+static BOOL ArchiveSplit(PARCHIVE_PLAN plan, PARCHIVE_TREE tree, DWORD index, DWORD group, ULONGLONG largest);
+static BOOL ArchiveAddUnit(PARCHIVE_PLAN plan, LPCSTR path, BOOL recurse, ULONGLONG bytes, DWORD fileCount, DWORD group, DWORD cartridge);
+static DWORD ArchiveAddCartridge(PARCHIVE_PLAN plan, DWORD drive, DWORD sequence, ULONGLONG capacity);
+static BOOL ArchivePackUnits(PARCHIVE_PLAN plan, DWORD groupCount);
+static ULONGLONG ArchiveUsableCapacity(ULONGLONG capacity, DWORD compressionRatio);
+static int ArchiveCompareUnitSize(const void *a, const void *b);
+static int ArchiveCompareUnitPath(void *context, const void *a, const void *b);
+static DWORD WINAPI ArchiveDriveWorker(LPVOID param);
+static BOOL ArchiveWaitForCartridge(PARCHIVE_WORKER worker, PARCHIVE_CARTRIDGE cartridge);
+
+// Plans an archive set across every cartridge it's going to need, starting with whatever is loaded in the mapped drives.
+//
+// The source is broken into units along directory lines: a directory goes onto one cartridge in one piece if it can
+// possibly fit on one. Only directories too big for any cartridge get broken up, into their loose files and each of their
+// subdirectories, and so on down. Units are then packed first fit decreasing, except that a unit tries the cartridge its
+// siblings went to before anything else, which keeps related material together without costing much space.
+//
+// Capacity is what the drive says is left (in native bytes) times the compression ratio it has seen on that cartridge,
+// less a reserve for the index copies and for the new data not compressing quite as well. When the loaded cartridges are
+// full the plan carries on onto fresh ones, queued on whichever drive has the least to write, and each drive works
+// through its own queue in parallel with the others.
+
+BOOL ArchivePlanCreate(LPCSTR sourceDir, PARCHIVE_PLAN *plan)
+{
+    PARCHIVE_PLAN newPlan;
+    ARCHIVE_TREE tree;
+    ULONGLONG largest = 0;
+    DWORD root;
+    BOOL result;
+    DWORD i;
+
+    newPlan = (PARCHIVE_PLAN)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(ARCHIVE_PLAN));
+
+    if (!newPlan)
+        return FALSE;
+
+    memset(&tree, 0, sizeof(tree));
+
+    strcpy_s(newPlan->SourceDir, _countof(newPlan->SourceDir), sourceDir);
+    tree.SourceDir = newPlan->SourceDir;
+
+    result = ArchiveFindDrives(newPlan);
+
+    if (result)
+    {
+        root = ArchiveAddNode(&tree, "");
+        result = root != MAXDWORD && ArchiveScan(&tree, root);
+    }
+
+    if (result)
+    {
+        // Nothing gets split finer than it has to be to fit on the biggest cartridge we could be given.
+        for (i = 0; i < newPlan->DriveCount; i++)
+        {
+            largest = max(largest, ArchiveUsableCapacity(newPlan->Drives[i].Remaining, newPlan->Drives[i].CompressionRatio));
+            largest = max(largest, ArchiveUsableCapacity(newPlan->Drives[i].Maximum, newPlan->Drives[i].CompressionRatio));
+        }
+
+        result = ArchiveSplit(newPlan, &tree, root, root, largest);
+    }
+
+    if (result)
+        result = ArchivePackUnits(newPlan, tree.NodeCount);
+
+    ArchiveDestroyTree(&tree);
+
+    if (!result)
+    {
+        ArchivePlanDestroy(newPlan);
+        return FALSE;
+    }
+
+    *plan = newPlan;
+    return TRUE;
+}
+
+BOOL ArchivePlanSave(PARCHIVE_PLAN plan, LPCSTR planFile)
+{
+    FILE *file;
+    BOOL result = TRUE;
+    DWORD i;
+
+    if (fopen_s(&file, planFile, "w") != 0)
+        return FALSE;
+
+    // S source, D drive as planned, C cartridge, U unit. Units name their cartridge by drive and sequence, '-' if unplaced.
+    if (fprintf(file, "S\t%s\n", plan->SourceDir) < 0)
+        result = FALSE;
+
+    for (i = 0; result && i < plan->DriveCount; i++)
+    {
+        PARCHIVE_DRIVE drive = &plan->Drives[i];
+
+        if (fprintf(file, "D\t%c\t%llu\t%llu\t%u\n", drive->DriveLetter, drive->Remaining, drive->Maximum, drive->CompressionRatio) < 0)
+            result = FALSE;
+    }
+
+    for (i = 0; result && i < plan->CartridgeCount; i++)
+    {
+        PARCHIVE_CARTRIDGE cartridge = &plan->Cartridges[i];
+
+        if (fprintf(file, "C\t%c\t%u\t%llu\n", plan->Drives[cartridge->Drive].DriveLetter, cartridge->Sequence, cartridge->Capacity) < 0)
+            result = FALSE;
+    }
+
+    for (i = 0; result && i < plan->UnitCount; i++)
+    {
+        PARCHIVE_UNIT unit = &plan->Units[i];
+        CHAR letter = '-';
+        DWORD sequence = 0;
+
+        if (unit->Cartridge != ARCHIVE_UNPLACED)
+        {
+            letter = plan->Drives[plan->Cartridges[unit->Cartridge].Drive].DriveLetter;
+            sequence = plan->Cartridges[unit->Cartridge].Sequence;
+        }
+
+        if (fprintf(file, "U\t%c\t%u\t%c\t%llu\t%u\t%s\n", letter, sequence, unit->Recurse ? 'R' : 'F', unit->Bytes, unit->FileCount,
+            *unit->Path ? unit->Path : ".") < 0)
+        {
+            result = FALSE;
+        }
+    }
+
+    if (fclose(file) != 0)
+        result = FALSE;
+
+    return result;
+}
+
+BOOL ArchivePlanLoad(LPCSTR planFile, PARCHIVE_PLAN *plan)
+{
+    FILE *file;
+    CHAR line[ARCHIVE_MAX_PLAN_LINE];
+    PARCHIVE_PLAN newPlan;
+    BOOL result = TRUE;
+    DWORD i;
+
+    if (fopen_s(&file, planFile, "r") != 0)
+        return FALSE;
+
+    newPlan = (PARCHIVE_PLAN)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(ARCHIVE_PLAN));
+    result = newPlan != NULL;
+
+    if (result)
+    {
+        newPlan->Drives = (PARCHIVE_DRIVE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(ARCHIVE_DRIVE) * (MAX_DRIVE_LETTER - MIN_DRIVE_LETTER + 1));
+        result = newPlan->Drives != NULL;
+    }
+
+    while (result && fgets(line, sizeof(line), file))
+    {
+        LPSTR context = NULL;
+        LPSTR type;
+        LPSTR letter;
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        type = strtok_s(line, "\t", &context);
+
+        if (type && type[0] == 'S')
+        {
+            strcpy_s(newPlan->SourceDir, _countof(newPlan->SourceDir), context);
+            continue;
+        }
+
+        letter = strtok_s(NULL, "\t", &context);
+
+        if (!type || !letter)
+            continue;
+
+        if (type[0] == 'D')
+        {
+            LPSTR remaining = strtok_s(NULL, "\t", &context);
+            LPSTR maximum = strtok_s(NULL, "\t", &context);
+            LPSTR ratio = strtok_s(NULL, "\t", &context);
+            PARCHIVE_DRIVE drive;
+
+            if (!remaining || !maximum || !ratio || newPlan->DriveCount > MAX_DRIVE_LETTER - MIN_DRIVE_LETTER)
+                continue;
+
+            drive = &newPlan->Drives[newPlan->DriveCount++];
+            drive->DriveLetter = (CHAR)toupper(letter[0]);
+            _snprintf_s(drive->Target, _countof(drive->Target), _TRUNCATE, "%c:", drive->DriveLetter);
+            drive->Remaining = _strtoui64(remaining, NULL, 10);
+            drive->Maximum = _strtoui64(maximum, NULL, 10);
+            drive->CompressionRatio = strtoul(ratio, NULL, 10);
+        }
+        else if (type[0] == 'C')
+        {
+            LPSTR sequence = strtok_s(NULL, "\t", &context);
+            LPSTR capacity = strtok_s(NULL, "\t", &context);
+
+            if (!sequence || !capacity)
+                continue;
+
+            for (i = 0; i < newPlan->DriveCount; i++)
+            {
+                if (newPlan->Drives[i].DriveLetter == toupper(letter[0]))
+                {
+                    result = ArchiveAddCartridge(newPlan, i, strtoul(sequence, NULL, 10), _strtoui64(capacity, NULL, 10)) != MAXDWORD;
+                    break;
+                }
+            }
+        }
+        else if (type[0] == 'U')
+        {
+            LPSTR sequence = strtok_s(NULL, "\t", &context);
+            LPSTR recurse = strtok_s(NULL, "\t", &context);
+            LPSTR bytes = strtok_s(NULL, "\t", &context);
+            LPSTR files = strtok_s(NULL, "\t", &context);
+            LPSTR path = context;
+            DWORD cartridge = ARCHIVE_UNPLACED;
+
+            if (!sequence || !recurse || !bytes || !files || !path || !*path)
+                continue;
+
+            for (i = 0; i < newPlan->CartridgeCount; i++)
+            {
+                PARCHIVE_CARTRIDGE candidate = &newPlan->Cartridges[i];
+
+                if (newPlan->Drives[candidate->Drive].DriveLetter == toupper(letter[0]) && candidate->Sequence == strtoul(sequence, NULL, 10))
+                {
+                    cartridge = i;
+                    break;
+                }
+            }
+
+            result = ArchiveAddUnit(newPlan, strcmp(path, ".") ? path : "", recurse[0] == 'R', _strtoui64(bytes, NULL, 10), strtoul(files, NULL, 10), 0, cartridge);
+        }
+    }
+
+    fclose(file);
+
+    if (result && (!newPlan->SourceDir[0] || !newPlan->DriveCount))
+        result = FALSE;
+
+    if (!result)
+    {
+        ArchivePlanDestroy(newPlan);
+        return FALSE;
+    }
+
+    *plan = newPlan;
+    return TRUE;
+}
+
+void ArchivePlanPrint(PARCHIVE_PLAN plan)
+{
+    DWORD i, j, k;
+
+    printf("\r\nArchive plan for %s: %u cartridge(s) across %u drive(s)\r\n", plan->SourceDir, plan->CartridgeCount, plan->DriveCount);
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        PARCHIVE_DRIVE drive = &plan->Drives[i];
+
+        printf("\r\n%c: %llu MB left of %llu MB, %.2f:1 compression, %llu MB planned\r\n", drive->DriveLetter, drive->Remaining / 1000000,
+            drive->Maximum / 1000000, (double)drive->CompressionRatio / 100.0, drive->PlannedBytes / 1000000);
+
+        for (j = 0; j < plan->CartridgeCount; j++)
+        {
+            PARCHIVE_CARTRIDGE cartridge = &plan->Cartridges[j];
+
+            if (cartridge->Drive != i)
+                continue;
+
+            printf("    %s: %u unit(s), %llu of %llu MB (%.1f%%)\r\n", cartridge->Sequence ? "Fresh cartridge" : "Loaded cartridge", cartridge->UnitCount,
+                cartridge->PlannedBytes / 1000000, cartridge->Capacity / 1000000,
+                cartridge->Capacity ? (double)cartridge->PlannedBytes * 100.0 / (double)cartridge->Capacity : 0.0);
+
+            for (k = 0; k < plan->UnitCount; k++)
+            {
+                PARCHIVE_UNIT unit = &plan->Units[k];
+
+                if (unit->Cartridge == j)
+                    printf("        %s%s - %u file(s), %llu MB\r\n", *unit->Path ? unit->Path : ".", unit->Recurse ? "" : " (files only)", unit->FileCount, unit->Bytes / 1000000);
+            }
+        }
+    }
+
+    if (plan->UnitsUnplaced)
+    {
+        printf("\r\n%u unit(s), %llu MB, too big for any cartridge and will be skipped:\r\n", plan->UnitsUnplaced, plan->BytesUnplaced / 1000000);
+
+        for (k = 0; k < plan->UnitCount; k++)
+        {
+            if (plan->Units[k].Cartridge == ARCHIVE_UNPLACED)
+                printf("    %s\r\n", *plan->Units[k].Path ? plan->Units[k].Path : ".");
+        }
+    }
+}
+
+BOOL ArchivePlanRun(PARCHIVE_PLAN plan, DWORD algorithm, PARCHIVE_STATS stats)
+{
+    CRITICAL_SECTION consoleLock;
+    PARCHIVE_WORKER workers;
+    HANDLE *threads;
+    ULONGLONG startTime = GetTickCount64();
+    DWORD threadCount = 0;
+    BOOL result = TRUE;
+    DWORD i;
+
+    memset(stats, 0, sizeof(ARCHIVE_STATS));
+
+    // The plan may be from an earlier run, so the device names are looked up again now.
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        if (plan->Drives[i].CartridgeCount && !MappingResolveDevice(plan->Drives[i].Target, plan->Drives[i].DeviceName, _countof(plan->Drives[i].DeviceName), FALSE))
+        {
+            fprintf(stderr, "\r\nMapping for %c: does not exist or its drive is not attached.\r\n", plan->Drives[i].DriveLetter);
+            result = FALSE;
+        }
+    }
+
+    if (!result)
+        return FALSE;
+
+    workers = (PARCHIVE_WORKER)LocalAlloc(LMEM_FIXED, sizeof(ARCHIVE_WORKER) * plan->DriveCount);
+    threads = (HANDLE *)LocalAlloc(LMEM_FIXED, sizeof(HANDLE) * plan->DriveCount);
+
+    result = workers && threads;
+
+    if (result)
+    {
+        InitializeCriticalSection(&consoleLock);
+
+        for (i = 0; i < plan->DriveCount; i++)
+        {
+            if (!plan->Drives[i].CartridgeCount)
+                continue;
+
+            workers[threadCount].Plan = plan;
+            workers[threadCount].Drive = i;
+            workers[threadCount].Algorithm = algorithm;
+            workers[threadCount].ConsoleLock = &consoleLock;
+
+            threads[threadCount] = CreateThread(NULL, 0, ArchiveDriveWorker, &workers[threadCount], 0, NULL);
+
+            if (!threads[threadCount])
+            {
+                result = FALSE;
+                break;
+            }
+
+            threadCount++;
+        }
+
+        for (i = 0; i < threadCount; i++)
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+
+        DeleteCriticalSection(&consoleLock);
+    }
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        stats->FilesWritten += plan->Drives[i].FilesWritten;
+        stats->FilesFailed += plan->Drives[i].FilesFailed;
+        stats->BytesWritten += plan->Drives[i].BytesWritten;
+    }
+
+    stats->Cartridges = plan->CartridgeCount;
+    stats->UnitsUnplaced = plan->UnitsUnplaced;
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    if (threads)
+        LocalFree(threads);
+
+    if (workers)
+        LocalFree(workers);
+
+    return result && !stats->FilesFailed;
+}
+
+void ArchivePlanDestroy(PARCHIVE_PLAN plan)
+{
+    DWORD i;
+
+    if (!plan)
+        return;
+
+    for (i = 0; i < plan->UnitCount; i++)
+    {
+        if (plan->Units[i].Path)
+            LocalFree(plan->Units[i].Path);
+    }
+
+    if (plan->Units)
+        LocalFree(plan->Units);
+
+    if (plan->Cartridges)
+        LocalFree(plan->Cartridges);
+
+    if (plan->Drives)
+        LocalFree(plan->Drives);
+
+    LocalFree(plan);
+}
+
+static BOOL ArchiveFindDrives(PARCHIVE_PLAN plan)
+{
+    CHAR driveLetter;
+
+    plan->Drives = (PARCHIVE_DRIVE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(ARCHIVE_DRIVE) * (MAX_DRIVE_LETTER - MIN_DRIVE_LETTER + 1));
+
+    if (!plan->Drives)
+        return FALSE;
+
+    // Any mapped drive with a cartridge in it that will tell us how much room is left. LTFS puts file data in the
+    // second partition, so that's the one that counts.
+    for (driveLetter = MIN_DRIVE_LETTER; driveLetter <= MAX_DRIVE_LETTER; driveLetter++)
+    {
+        PARCHIVE_DRIVE drive = &plan->Drives[plan->DriveCount];
+        HANDLE driveLock;
+        HANDLE handle;
+
+        _snprintf_s(drive->Target, _countof(drive->Target), _TRUNCATE, "%c:", driveLetter);
+
+        if (!MappingResolveDevice(drive->Target, drive->DeviceName, _countof(drive->DeviceName), FALSE))
+            continue;
+
+        if (!LockDrive(drive->Target, &driveLock))
+        {
+            fprintf(stderr, "%c: timed out waiting for another operation, not using this drive.\r\n", driveLetter);
+            continue;
+        }
+
+        // A mounted volume could be written to at any moment, so the space left isn't worth asking about, and the
+        // commands would land in between LTFS's own.
+        if (TapeIsBusy(drive->DeviceName))
+        {
+            fprintf(stderr, "%c: %s is in use, not using this drive. Load with loadonly before planning.\r\n", driveLetter, drive->DeviceName);
+            LockRelease(driveLock);
+            continue;
+        }
+
+        handle = TapeOpen(drive->DeviceName);
+
+        if (handle != INVALID_HANDLE_VALUE)
+        {
+            if (TapeGetCapacity(handle, LTFS_DATA_PARTITION, &drive->Remaining, &drive->Maximum) && drive->Maximum)
+            {
+                // Nothing written to this cartridge yet means no ratio. Assume none rather than guess high.
+                if (!TapeGetCompressionRatio(handle, &drive->CompressionRatio) || drive->CompressionRatio < 100)
+                    drive->CompressionRatio = 100;
+
+                drive->DriveLetter = driveLetter;
+                plan->DriveCount++;
+            }
+            else
+            {
+                fprintf(stderr, "%c: cannot read the remaining capacity, not using this drive.\r\n", driveLetter);
+            }
+
+            CloseHandle(handle);
+        }
+
+        LockRelease(driveLock);
+    }
+
+    if (!plan->DriveCount)
+    {
+        fprintf(stderr, "\r\nNo free mapped tape drives with a cartridge loaded.\r\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static DWORD ArchiveAddNode(PARCHIVE_TREE tree, LPCSTR path)
+{
+    size_t length = strlen(path) + 1;
+    PARCHIVE_NODE node;
+
+    if (tree->NodeCount == tree->NodeCapacity)
+    {
+        DWORD newCapacity = tree->NodeCapacity ? tree->NodeCapacity * 2 : 256;
+        PARCHIVE_NODE nodes = (PARCHIVE_NODE)LocalAlloc(LMEM_FIXED, sizeof(ARCHIVE_NODE) * newCapacity);
+
+        if (!nodes)
+            return MAXDWORD;
+
+        if (tree->Nodes)
+        {
+            memcpy(nodes, tree->Nodes, sizeof(ARCHIVE_NODE) * tree->NodeCount);
+            LocalFree(tree->Nodes);
+        }
+
+        tree->Nodes = nodes;
+        tree->NodeCapacity = newCapacity;
+    }
+
+    node = &tree->Nodes[tree->NodeCount];
+    memset(node, 0, sizeof(ARCHIVE_NODE));
+
+    node->Path = (LPSTR)LocalAlloc(LMEM_FIXED, length);
+
+    if (!node->Path)
+        return MAXDWORD;
+
+    strcpy_s(node->Path, length, path);
+    node->FirstChild = MAXDWORD;
+    node->NextSibling = MAXDWORD;
+
+    return tree->NodeCount++;
+}
+
+static BOOL ArchiveScan(PARCHIVE_TREE tree, DWORD index)
+{
+    CHAR searchPath[MAX_PATH];
+    WIN32_FIND_DATA findData;
+    DWORD lastChild = MAXDWORD;
+    HANDLE find;
+    BOOL result = TRUE;
+
+    // Nodes move when the array grows, so everything here goes by index.
+    _snprintf_s(searchPath, _countof(searchPath), _TRUNCATE, "%s\\%s%s*", tree->SourceDir, tree->Nodes[index].Path, *tree->Nodes[index].Path ? "\\" : "");
+
+    find = FindFirstFile(searchPath, &findData);
+
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Cannot read directory %s\\%s\r\n", tree->SourceDir, tree->Nodes[index].Path);
+        return FALSE;
+    }
+
+    do
+    {
+        CHAR path[MAX_PATH];
+
+        if (!strcmp(findData.cFileName, ".") || !strcmp(findData.cFileName, ".."))
+            continue;
+
+        _snprintf_s(path, _countof(path), _TRUNCATE, "%s%s%s", tree->Nodes[index].Path, *tree->Nodes[index].Path ? "\\" : "", findData.cFileName);
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            DWORD child = ArchiveAddNode(tree, path);
+
+            result = child != MAXDWORD && ArchiveScan(tree, child);
+
+            if (result)
+            {
+                if (lastChild == MAXDWORD)
+                    tree->Nodes[index].FirstChild = child;
+                else
+                    tree->Nodes[lastChild].NextSibling = child;
+
+                lastChild = child;
+                tree->Nodes[index].Bytes += tree->Nodes[child].Bytes;
+                tree->Nodes[index].FileCount += tree->Nodes[child].FileCount;
+            }
+        }
+        else
+        {
+            ULONGLONG size = ((ULONGLONG)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+
+            tree->Nodes[index].OwnBytes += size;
+            tree->Nodes[index].OwnFiles++;
+            tree->Nodes[index].Bytes += size;
+            tree->Nodes[index].FileCount++;
+        }
+
+    } while (result && FindNextFile(find, &findData));
+
+    FindClose(find);
+
+    return result;
+}
+
+static void ArchiveDestroyTree(PARCHIVE_TREE tree)
+{
+    DWORD i;
+
+    for (i = 0; i < tree->NodeCount; i++)
+        LocalFree(tree->Nodes[i].Path);
+
+    if (tree->Nodes)
+        LocalFree(tree->Nodes);
+}
+
+static BOOL ArchiveSplit(PARCHIVE_PLAN plan, PARCHIVE_TREE tree, DWORD index, DWORD group, ULONGLONG largest)
+{
+    PARCHIVE_NODE node = &tree->Nodes[index];
+    BOOL result = TRUE;
+    DWORD child;
+
+    // Empty directories don't get written anyway.
+    if (!node->FileCount)
+        return TRUE;
+
+    if (node->Bytes <= largest)
+        return ArchiveAddUnit(plan, node->Path, TRUE, node->Bytes, node->FileCount, group, ARCHIVE_UNPLACED);
+
+    // Won't go on any one cartridge. Its loose files stay together, and the subdirectories get the same treatment. They
+    // all share this directory as their group.
+    if (node->OwnFiles)
+        result = ArchiveAddUnit(plan, node->Path, FALSE, node->OwnBytes, node->OwnFiles, index, ARCHIVE_UNPLACED);
+
+    for (child = node->FirstChild; result && child != MAXDWORD; child = tree->Nodes[child].NextSibling)
+        result = ArchiveSplit(plan, tree, child, index, largest);
+
+    return result;
+}
+
+static BOOL ArchiveAddUnit(PARCHIVE_PLAN plan, LPCSTR path, BOOL recurse, ULONGLONG bytes, DWORD fileCount, DWORD group, DWORD cartridge)
+{
+    size_t length = strlen(path) + 1;
+    PARCHIVE_UNIT unit;
+
+    if (plan->UnitCount == plan->UnitCapacity)
+    {
+        DWORD newCapacity = plan->UnitCapacity ? plan->UnitCapacity * 2 : 64;
+        PARCHIVE_UNIT units = (PARCHIVE_UNIT)LocalAlloc(LMEM_FIXED, sizeof(ARCHIVE_UNIT) * newCapacity);
+
+        if (!units)
+            return FALSE;
+
+        if (plan->Units)
+        {
+            memcpy(units, plan->Units, sizeof(ARCHIVE_UNIT) * plan->UnitCount);
+            LocalFree(plan->Units);
+        }
+
+        plan->Units = units;
+        plan->UnitCapacity = newCapacity;
+    }
+
+    unit = &plan->Units[plan->UnitCount];
+    unit->Path = (LPSTR)LocalAlloc(LMEM_FIXED, length);
+
+    if (!unit->Path)
+        return FALSE;
+
+    strcpy_s(unit->Path, length, path);
+    unit->Recurse = recurse;
+    unit->Bytes = bytes;
+    unit->FileCount = fileCount;
+    unit->Group = group;
+    unit->Cartridge = cartridge;
+
+    if (cartridge == ARCHIVE_UNPLACED)
+    {
+        plan->UnitsUnplaced++;
+        plan->BytesUnplaced += bytes;
+    }
+    else
+    {
+        plan->Cartridges[cartridge].PlannedBytes += bytes;
+        plan->Cartridges[cartridge].UnitCount++;
+        plan->Drives[plan->Cartridges[cartridge].Drive].PlannedBytes += bytes;
+    }
+
+    plan->UnitCount++;
+
+    return TRUE;
+}
+
+static DWORD ArchiveAddCartridge(PARCHIVE_PLAN plan, DWORD drive, DWORD sequence, ULONGLONG capacity)
+{
+    PARCHIVE_CARTRIDGE cartridge;
+
+    if (plan->CartridgeCount == plan->CartridgeCapacity)
+    {
+        DWORD newCapacity = plan->CartridgeCapacity ? plan->CartridgeCapacity * 2 : 16;
+        PARCHIVE_CARTRIDGE cartridges = (PARCHIVE_CARTRIDGE)LocalAlloc(LMEM_FIXED, sizeof(ARCHIVE_CARTRIDGE) * newCapacity);
+
+        if (!cartridges)
+            return MAXDWORD;
+
+        if (plan->Cartridges)
+        {
+            memcpy(cartridges, plan->Cartridges, sizeof(ARCHIVE_CARTRIDGE) * plan->CartridgeCount);
+            LocalFree(plan->Cartridges);
+        }
+
+        plan->Cartridges = cartridges;
+        plan->CartridgeCapacity = newCapacity;
+    }
+
+    cartridge = &plan->Cartridges[plan->CartridgeCount];
+    memset(cartridge, 0, sizeof(ARCHIVE_CARTRIDGE));
+
+    cartridge->Drive = drive;
+    cartridge->Sequence = sequence;
+    cartridge->Capacity = capacity;
+
+    plan->Drives[drive].CartridgeCount = max(plan->Drives[drive].CartridgeCount, sequence + 1);
+
+    return plan->CartridgeCount++;
+}
+
+static BOOL ArchivePackUnits(PARCHIVE_PLAN plan, DWORD groupCount)
+{
+    PDWORD groupCartridge;
+    DWORD i, j;
+
+    groupCartridge = (PDWORD)LocalAlloc(LMEM_FIXED, sizeof(DWORD) * (groupCount + 1));
+
+    if (!groupCartridge)
+        return FALSE;
+
+    for (i = 0; i < groupCount; i++)
+        groupCartridge[i] = ARCHIVE_UNPLACED;
+
+    // Units came out of the split unplaced and counted as such. They're about to be counted again properly.
+    plan->UnitsUnplaced = 0;
+    plan->BytesUnplaced = 0;
+
+    // What's already loaded gets filled first, it's there and costs nobody a trip to the shelf.
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        ULONGLONG capacity = ArchiveUsableCapacity(plan->Drives[i].Remaining, plan->Drives[i].CompressionRatio);
+
+        if (capacity && ArchiveAddCartridge(plan, i, 0, capacity) == MAXDWORD)
+        {
+            LocalFree(groupCartridge);
+            return FALSE;
+        }
+    }
+
+    qsort(plan->Units, plan->UnitCount, sizeof(ARCHIVE_UNIT), ArchiveCompareUnitSize);
+
+    for (i = 0; i < plan->UnitCount; i++)
+    {
+        PARCHIVE_UNIT unit = &plan->Units[i];
+        DWORD cartridge = groupCartridge[unit->Group];
+
+        if (cartridge != ARCHIVE_UNPLACED && plan->Cartridges[cartridge].Capacity - plan->Cartridges[cartridge].PlannedBytes < unit->Bytes)
+            cartridge = ARCHIVE_UNPLACED;
+
+        for (j = 0; cartridge == ARCHIVE_UNPLACED && j < plan->CartridgeCount; j++)
+        {
+            if (plan->Cartridges[j].Capacity - plan->Cartridges[j].PlannedBytes >= unit->Bytes)
+                cartridge = j;
+        }
+
+        if (cartridge == ARCHIVE_UNPLACED)
+        {
+            PARCHIVE_DRIVE drive = NULL;
+
+            // Nothing open has room. Start a fresh cartridge on whichever drive will otherwise finish first.
+            for (j = 0; j < plan->DriveCount; j++)
+            {
+                if (ArchiveUsableCapacity(plan->Drives[j].Maximum, plan->Drives[j].CompressionRatio) < unit->Bytes)
+                    continue;
+
+                if (!drive || plan->Drives[j].PlannedBytes < drive->PlannedBytes)
+                    drive = &plan->Drives[j];
+            }
+
+            if (drive)
+            {
+                // Sequence 0 is always the loaded one, even if it was too full to get anything.
+                cartridge = ArchiveAddCartridge(plan, (DWORD)(drive - plan->Drives), max(drive->CartridgeCount, 1),
+                    ArchiveUsableCapacity(drive->Maximum, drive->CompressionRatio));
+
+                if (cartridge == MAXDWORD)
+                {
+                    LocalFree(groupCartridge);
+                    return FALSE;
+                }
+            }
+        }
+
+        unit->Cartridge = cartridge;
+
+        if (cartridge == ARCHIVE_UNPLACED)
+        {
+            plan->UnitsUnplaced++;
+            plan->BytesUnplaced += unit->Bytes;
+            continue;
+        }
+
+        plan->Cartridges[cartridge].PlannedBytes += unit->Bytes;
+        plan->Cartridges[cartridge].UnitCount++;
+        plan->Drives[plan->Cartridges[cartridge].Drive].PlannedBytes += unit->Bytes;
+        groupCartridge[unit->Group] = cartridge;
+    }
+
+    LocalFree(groupCartridge);
+
+    return TRUE;
+}
+
+static ULONGLONG ArchiveUsableCapacity(ULONGLONG capacity, DWORD compressionRatio)
+{
+    ULONGLONG usable = capacity / 100 * compressionRatio;
+
+    usable -= usable / 100 * ARCHIVE_RESERVE_PERCENT;
+
+    return usable > ARCHIVE_INDEX_RESERVE ? usable - ARCHIVE_INDEX_RESERVE : 0;
+}
+
+static int ArchiveCompareUnitSize(const void *a, const void *b)
+{
+    const ARCHIVE_UNIT *unitA = (const ARCHIVE_UNIT *)a;
+    const ARCHIVE_UNIT *unitB = (const ARCHIVE_UNIT *)b;
+
+    // Biggest first. Same size goes by path so the plan comes out the same every time.
+    if (unitA->Bytes != unitB->Bytes)
+        return unitA->Bytes > unitB->Bytes ? -1 : 1;
+
+    return _stricmp(unitA->Path, unitB->Path);
+}
+
+static int ArchiveCompareUnitPath(void *context, const void *a, const void *b)
+{
+    PARCHIVE_PLAN plan = (PARCHIVE_PLAN)context;
+
+    return _stricmp(plan->Units[*(const DWORD *)a].Path, plan->Units[*(const DWORD *)b].Path);
+}
+
+static DWORD WINAPI ArchiveDriveWorker(LPVOID param)
+{
+    PARCHIVE_WORKER worker = (PARCHIVE_WORKER)param;
+    PARCHIVE_PLAN plan = worker->Plan;
+    PARCHIVE_DRIVE drive = &plan->Drives[worker->Drive];
+    PDWORD order;
+    BOOL abandon = FALSE;
+    DWORD sequence, i, j;
+
+    order = (PDWORD)LocalAlloc(LMEM_FIXED, sizeof(DWORD) * (plan->UnitCount + 1));
+
+    if (!order)
+        return 0;
+
+    for (sequence = 0; sequence < drive->CartridgeCount; sequence++)
+    {
+        PARCHIVE_CARTRIDGE cartridge = NULL;
+        CHAR mediaDesc[64];
+        DWORD nativeMBs = 0;
+        DWORD unitCount = 0;
+
+        for (i = 0; i < plan->CartridgeCount; i++)
+        {
+            if (plan->Cartridges[i].Drive == worker->Drive && plan->Cartridges[i].Sequence == sequence)
+            {
+                cartridge = &plan->Cartridges[i];
+                break;
+            }
+        }
+
+        if (!cartridge)
+            continue;
+
+        for (j = 0; j < plan->UnitCount; j++)
+        {
+            if (plan->Units[j].Cartridge == i)
+                order[unitCount++] = j;
+        }
+
+        // In path order on the tape, so reading a directory back later is one pass rather than a tour of the cartridge.
+        qsort_s(order, unitCount, sizeof(DWORD), ArchiveCompareUnitPath, plan);
+
+        if (!abandon && sequence > 0 && !ArchiveWaitForCartridge(worker, cartridge))
+        {
+            EnterCriticalSection(worker->ConsoleLock);
+            fprintf(stderr, "%c: gave up waiting for a fresh cartridge.\r\n", drive->DriveLetter);
+            LeaveCriticalSection(worker->ConsoleLock);
+
+            abandon = TRUE;
+        }
+
+        if (abandon)
+        {
+            for (j = 0; j < unitCount; j++)
+                drive->FilesFailed += plan->Units[order[j]].FileCount;
+
+            continue;
+        }
+
+        if (MediaGetDescription(drive->Target, drive->DeviceName, mediaDesc, _countof(mediaDesc)))
+            nativeMBs = IngestNativeRate(mediaDesc);
+
+        for (j = 0; j < unitCount; j++)
+        {
+            PARCHIVE_UNIT unit = &plan->Units[order[j]];
+            CHAR sourceDir[MAX_PATH];
+            INGEST_STATS stats;
+
+            _snprintf_s(sourceDir, _countof(sourceDir), _TRUNCATE, "%s%s%s", plan->SourceDir, *unit->Path ? "\\" : "", unit->Path);
+
+            EnterCriticalSection(worker->ConsoleLock);
+            printf("%c: cartridge %u, writing %s%s (%u file(s), %llu MB)\r\n", drive->DriveLetter, sequence + 1, *unit->Path ? unit->Path : ".",
+                unit->Recurse ? "" : " (files only)", unit->FileCount, unit->Bytes / 1000000);
+            LeaveCriticalSection(worker->ConsoleLock);
+
+            IngestFiles(sourceDir, drive->DriveLetter, unit->Path, unit->Recurse, worker->Algorithm, nativeMBs, &stats);
+
+            drive->FilesWritten += stats.FilesWritten;
+            drive->FilesFailed += stats.FilesFailed + (unit->FileCount > stats.FilesFound ? unit->FileCount - stats.FilesFound : 0);
+            drive->BytesWritten += stats.BytesWritten;
+            drive->WritingMs += stats.WritingMs;
+
+            EnterCriticalSection(worker->ConsoleLock);
+            printf("%c: finished %s, %u of %u file(s), %.1f MB/s\r\n", drive->DriveLetter, *unit->Path ? unit->Path : ".", stats.FilesWritten, stats.FilesFound,
+                stats.ElapsedMs ? (double)stats.BytesWritten / 1000.0 / (double)stats.ElapsedMs : 0.0);
+            LeaveCriticalSection(worker->ConsoleLock);
+        }
+    }
+
+    LocalFree(order);
+
+    return 0;
+}
+
+static BOOL ArchiveWaitForCartridge(PARCHIVE_WORKER worker, PARCHIVE_CARTRIDGE cartridge)
+{
+    PARCHIVE_DRIVE drive = &worker->Plan->Drives[worker->Drive];
+    ULONGLONG startTime = GetTickCount64();
+    BOOL prompted = FALSE;
+    HANDLE driveLock;
+    BOOL ejected;
+
+    // Writing goes through the filesystem and needs no lock, but changing cartridges is the drive itself.
+    if (!LockDrive(drive->Target, &driveLock))
+        return FALSE;
+
+    // The full one has to come out through the filesystem, so the index is written before it goes.
+    ejected = TapeEject(drive->DeviceName);
+
+    MediaInvalidate(drive->Target);
+    LockRelease(driveLock);
+
+    if (!ejected)
+    {
+        EnterCriticalSection(worker->ConsoleLock);
+        fprintf(stderr, "%c: failed to eject. Ensure no files are open on the volume.\r\n", drive->DriveLetter);
+        LeaveCriticalSection(worker->ConsoleLock);
+
+        return FALSE;
+    }
+
+    while (GetTickCount64() - startTime < ARCHIVE_LOAD_TIMEOUT)
+    {
+        HANDLE handle;
+        ULONGLONG remaining = 0;
+        BOOL loaded = FALSE;
+
+        if (!LockDrive(drive->Target, &driveLock))
+            continue;
+
+        handle = TapeOpen(drive->DeviceName);
+
+        if (handle != INVALID_HANDLE_VALUE && TapeTestUnitReady(handle, NULL))
+        {
+            loaded = TapeGetCapacity(handle, LTFS_DATA_PARTITION, &remaining, NULL);
+
+            // The plan assumed a fresh one. Anything with less room than that would have us stopping half way.
+            if (loaded && ArchiveUsableCapacity(remaining, drive->CompressionRatio) < cartridge->PlannedBytes)
+            {
+                EnterCriticalSection(worker->ConsoleLock);
+                fprintf(stderr, "%c: cartridge only has %llu MB left, %llu MB is needed. Unloading.\r\n", drive->DriveLetter,
+                    remaining / 1000000, cartridge->PlannedBytes / 1000000);
+                LeaveCriticalSection(worker->ConsoleLock);
+
+                TapeUnload(handle);
+                MediaInvalidate(drive->Target);
+                loaded = FALSE;
+                prompted = FALSE;
+            }
+        }
+
+        if (handle != INVALID_HANDLE_VALUE)
+            CloseHandle(handle);
+
+        LockRelease(driveLock);
+
+        if (loaded && PollFileSystem(drive->Target))
+            return TRUE;
+
+        if (!prompted)
+        {
+            EnterCriticalSection(worker->ConsoleLock);
+            printf("%c: please load a formatted cartridge with at least %llu MB free into %s\r\n", drive->DriveLetter,
+                cartridge->PlannedBytes / 1000000, drive->DeviceName);
+            LeaveCriticalSection(worker->ConsoleLock);
+
+            prompted = TRUE;
+        }
+
+        Sleep(ARCHIVE_POLL_INTERVAL);
+    }
+
+    return FALSE;
+}
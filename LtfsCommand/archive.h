@@ -0,0 +1,96 @@
+/*
+ *   File:   archive.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsreg.h"
+
+#define ARCHIVE_RESERVE_PERCENT     3       // Held back in case the data doesn't compress as well as what's already on the cartridge
+#define ARCHIVE_INDEX_RESERVE       (2ULL * 1024 * 1024 * 1024)    // Index copies LTFS leaves in the data partition
+#define ARCHIVE_LOAD_TIMEOUT        (60 * 60 * 1000)
+#define ARCHIVE_POLL_INTERVAL       5000
+#define ARCHIVE_MAX_PLAN_LINE       (MAX_PATH + 128)
+#define ARCHIVE_UNPLACED            MAXDWORD
+
+typedef struct ARCHIVE_UNIT
+{
+    LPSTR Path;             // Relative to the source directory, empty for the top
+    BOOL Recurse;           // Everything under Path, or only the files directly in it
+    ULONGLONG Bytes;
+    DWORD FileCount;
+    DWORD Group;            // The directory it came out of. Siblings try to stay together.
+    DWORD Cartridge;
+} ARCHIVE_UNIT, *PARCHIVE_UNIT;
+
+typedef struct ARCHIVE_CARTRIDGE
+{
+    DWORD Drive;
+    DWORD Sequence;         // 0 is whatever is loaded now, after that fresh cartridges
+    ULONGLONG Capacity;
+    ULONGLONG PlannedBytes;
+    DWORD UnitCount;
+} ARCHIVE_CARTRIDGE, *PARCHIVE_CARTRIDGE;
+
+typedef struct ARCHIVE_DRIVE
+{
+    CHAR DriveLetter;
+    CHAR Target[MAX_MOUNT_TARGET];      // X:, for finding and locking the drive
+    CHAR DeviceName[MAX_DEVICE_NAME];
+    ULONGLONG Remaining;
+    ULONGLONG Maximum;
+    DWORD CompressionRatio; // x100
+    ULONGLONG PlannedBytes;
+    DWORD CartridgeCount;
+    DWORD FilesWritten;
+    DWORD FilesFailed;
+    ULONGLONG BytesWritten;
+    ULONGLONG WritingMs;
+} ARCHIVE_DRIVE, *PARCHIVE_DRIVE;
+
+typedef struct ARCHIVE_PLAN
+{
+    CHAR SourceDir[MAX_PATH];
+    DWORD DriveCount;
+    PARCHIVE_DRIVE Drives;
+    DWORD CartridgeCount;
+    DWORD CartridgeCapacity;
+    PARCHIVE_CARTRIDGE Cartridges;
+    DWORD UnitCount;
+    DWORD UnitCapacity;
+    PARCHIVE_UNIT Units;
+    DWORD UnitsUnplaced;
+    ULONGLONG BytesUnplaced;
+} ARCHIVE_PLAN, *PARCHIVE_PLAN;
+
+typedef struct ARCHIVE_STATS
+{
+    DWORD Cartridges;
+    DWORD FilesWritten;
+    DWORD FilesFailed;
+    DWORD UnitsUnplaced;
+    ULONGLONG BytesWritten;
+    ULONGLONG ElapsedMs;
+} ARCHIVE_STATS, *PARCHIVE_STATS;
+
+BOOL ArchivePlanCreate(LPCSTR sourceDir, PARCHIVE_PLAN *plan);
+BOOL ArchivePlanSave(PARCHIVE_PLAN plan, LPCSTR planFile);
+BOOL ArchivePlanLoad(LPCSTR planFile, PARCHIVE_PLAN *plan);
+void ArchivePlanPrint(PARCHIVE_PLAN plan);
+BOOL ArchivePlanRun(PARCHIVE_PLAN plan, DWORD algorithm, PARCHIVE_STATS stats);
+void ArchivePlanDestroy(PARCHIVE_PLAN plan);
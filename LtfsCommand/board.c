@@ -0,0 +1,392 @@
+/*
+ *   File:   board.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include <cfgmgr32.h>
+#include "board.h"
+
+#define BOARD_TICKS_PER_SECOND  10000000ULL     // FILETIME is in 100ns units
+#define BOARD_SETTLE_MS         2000            // Quiet time after a drive comes or goes before updating
+
+typedef struct BOARD_SERVER
+{
+    HANDLE Signal;
+    volatile LONG Stop;
+} BOARD_SERVER, *PBOARD_SERVER;
+
+static DWORD CALLBACK BoardNotify(HCMNOTIFICATION notification, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA eventData, DWORD eventDataSize);
+static BOOL WINAPI BoardCtrlHandler(DWORD ctrlType);
+static void BoardFill(PSTATUS_REPORT report, PBOARD_SNAPSHOT snapshot);
+static void BoardPublish(PSTATUS_BOARD board, PBOARD_SNAPSHOT snapshot);
+static ULONGLONG BoardNow();
+
+// The console control handler doesn't get a context, so this has to live here.
+static BOARD_SERVER BoardServer;
+
+// One process does the asking and puts the answer in shared memory, where anything that wants to know can read it
+// without touching a drive or the registry. Readers never take a lock, so the board is guarded by a sequence number
+// instead: it's odd while a snapshot is being written and goes up again once it's done. A reader copies the snapshot
+// out between two reads of the sequence, and if they differ, or it was odd to begin with, it goes round again. Updates
+// are a single copy from a snapshot put together beforehand, so that hardly ever happens.
+
+BOOL BoardServe(DWORD interval, PBOARD_SERVE_STATS stats)
+{
+    CM_NOTIFY_FILTER filter;
+    HCMNOTIFICATION notification = NULL;
+    PBOARD_SNAPSHOT snapshot;
+    PSTATUS_BOARD board = NULL;
+    HANDLE mapping;
+
+    memset(stats, 0, sizeof(BOARD_SERVE_STATS));
+    memset(&BoardServer, 0, sizeof(BoardServer));
+
+    mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(STATUS_BOARD), BOARD_NAME);
+
+    if (!mapping)
+        return FALSE;
+
+    // Two publishers would tread on each other's sequence numbers.
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(mapping);
+        return FALSE;
+    }
+
+    board = (PSTATUS_BOARD)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(STATUS_BOARD));
+    snapshot = (PBOARD_SNAPSHOT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(BOARD_SNAPSHOT));
+    BoardServer.Signal = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if (!board || !snapshot || !BoardServer.Signal)
+    {
+        if (board)
+            UnmapViewOfFile(board);
+
+        if (snapshot)
+            LocalFree(snapshot);
+
+        if (BoardServer.Signal)
+            CloseHandle(BoardServer.Signal);
+
+        CloseHandle(mapping);
+        return FALSE;
+    }
+
+    // New pages come zeroed, so until the magic goes in readers know there's nothing there yet.
+    board->Size = sizeof(STATUS_BOARD);
+    board->PublisherId = GetCurrentProcessId();
+
+    memset(&filter, 0, sizeof(filter));
+    filter.cbSize = sizeof(filter);
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    filter.u.DeviceInterface.ClassGuid = GUID_DEVINTERFACE_TAPE;
+
+    // Without it a drive coming or going just waits for the next update.
+    if (CM_Register_Notification(&filter, NULL, BoardNotify, &notification) != CR_SUCCESS)
+        notification = NULL;
+
+    SetConsoleCtrlHandler(BoardCtrlHandler, TRUE);
+
+    while (!BoardServer.Stop)
+    {
+        PSTATUS_REPORT report;
+
+        // Media checks younger than the interval are reused unless a tape has gone in or out, so a drive that's
+        // sitting there costs one change count query per update.
+        if (StatusCollect(interval, &report))
+        {
+            BoardFill(report, snapshot);
+            snapshot->Updates = ++stats->Updates;
+            BoardPublish(board, snapshot);
+
+            stats->TotalCollectMs += report->ElapsedMs;
+            stats->MaxCollectMs = max(stats->MaxCollectMs, report->ElapsedMs);
+
+            StatusDestroy(report);
+        }
+
+        // Drives come and go in bursts, so wait for things to go quiet before looking.
+        if (WaitForSingleObject(BoardServer.Signal, interval * 1000) == WAIT_OBJECT_0)
+            while (!BoardServer.Stop && WaitForSingleObject(BoardServer.Signal, BOARD_SETTLE_MS) == WAIT_OBJECT_0);
+    }
+
+    if (notification)
+        CM_Unregister_Notification(notification);
+
+    SetConsoleCtrlHandler(BoardCtrlHandler, FALSE);
+
+    UnmapViewOfFile(board);
+    CloseHandle(mapping);
+    LocalFree(snapshot);
+    CloseHandle(BoardServer.Signal);
+
+    return TRUE;
+}
+
+BOOL BoardRead(PBOARD_SNAPSHOT snapshot, PDWORD publisherId, PDWORD retries)
+{
+    HANDLE mapping;
+    PSTATUS_BOARD board;
+    LONG before;
+    LONG after;
+    DWORD attempt;
+    BOOL success = FALSE;
+
+    mapping = OpenFileMapping(FILE_MAP_READ, FALSE, BOARD_NAME);
+
+    if (!mapping)
+        return FALSE;
+
+    board = (PSTATUS_BOARD)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (!board)
+    {
+        CloseHandle(mapping);
+        return FALSE;
+    }
+
+    // Nothing published yet, or published by a build with a different layout.
+    if (board->Magic == BOARD_MAGIC && board->Size == sizeof(STATUS_BOARD))
+    {
+        for (attempt = 0; attempt < BOARD_READ_RETRIES && !success; attempt++)
+        {
+            // Right away the first few times, an update takes microseconds. After that the publisher has
+            // probably been switched out half way through one, so give it a chance to finish.
+            if (attempt)
+                Sleep(attempt < 10 ? 0 : 1);
+
+            before = board->Sequence;
+            MemoryBarrier();
+
+            if (before & 1)
+                continue;
+
+            memcpy(snapshot, (PVOID)&board->Snapshot, sizeof(BOARD_SNAPSHOT));
+            MemoryBarrier();
+
+            after = board->Sequence;
+            success = before == after;
+        }
+
+        *publisherId = board->PublisherId;
+        *retries = attempt - 1;
+    }
+
+    UnmapViewOfFile(board);
+    CloseHandle(mapping);
+
+    return success;
+}
+
+// Turns the board back into the report it was made from, so it prints the same way as a status taken there and then.
+
+BOOL BoardGetReport(PSTATUS_REPORT *report, PDWORD publisherId)
+{
+    PBOARD_SNAPSHOT snapshot;
+    PSTATUS_REPORT newReport = NULL;
+    DWORD retries;
+    ULONGLONG now;
+    ULONGLONG age = 0;
+    BOOL success;
+    DWORD i;
+
+    snapshot = (PBOARD_SNAPSHOT)LocalAlloc(LMEM_FIXED, sizeof(BOARD_SNAPSHOT));
+
+    if (!snapshot)
+        return FALSE;
+
+    success = BoardRead(snapshot, publisherId, &retries);
+
+    if (success)
+    {
+        newReport = (PSTATUS_REPORT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(STATUS_REPORT));
+        success = newReport != NULL;
+    }
+
+    if (success)
+    {
+        newReport->DriveCount = min(snapshot->DriveCount, BOARD_MAX_DRIVES);
+        newReport->MappingCount = min(snapshot->MappingCount, BOARD_MAX_MAPPINGS);
+        newReport->Drives = (PSTATUS_DRIVE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(STATUS_DRIVE) * max(newReport->DriveCount, 1));
+        newReport->Mappings = (PSTATUS_MAPPING)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(STATUS_MAPPING) * max(newReport->MappingCount, 1));
+        success = newReport->Drives && newReport->Mappings;
+    }
+
+    if (success)
+    {
+        now = BoardNow();
+        age = now > snapshot->PublishedTime ? (now - snapshot->PublishedTime) / BOARD_TICKS_PER_SECOND : 0;
+
+        newReport->ServiceValid = snapshot->ServiceValid;
+        newReport->ServiceState = snapshot->ServiceState;
+        newReport->UnmappedDrives = snapshot->UnmappedDrives;
+        newReport->ReadyCount = snapshot->ReadyCount;
+        newReport->ElapsedMs = snapshot->CollectMs;
+
+        // Another process wrote these, so nothing is taken on trust to be terminated.
+        for (i = 0; i < newReport->DriveCount; i++)
+        {
+            PBOARD_DRIVE from = &snapshot->Drives[i];
+            PSTATUS_DRIVE to = &newReport->Drives[i];
+
+            strncpy_s(to->DeviceName, _countof(to->DeviceName), from->DeviceName, _TRUNCATE);
+            strncpy_s((char *)to->Drive.SerialNumber, _countof(to->Drive.SerialNumber), from->SerialNumber, _TRUNCATE);
+            strncpy_s((char *)to->Drive.VendorId, _countof(to->Drive.VendorId), from->VendorId, _TRUNCATE);
+            strncpy_s((char *)to->Drive.ProductId, _countof(to->Drive.ProductId), from->ProductId, _TRUNCATE);
+            to->MappingCount = from->MappingCount;
+        }
+
+        for (i = 0; i < newReport->MappingCount; i++)
+        {
+            PBOARD_MAPPING from = &snapshot->Mappings[i];
+            PSTATUS_MAPPING to = &newReport->Mappings[i];
+
+            strncpy_s(to->Target, _countof(to->Target), from->Target, _TRUNCATE);
+            strncpy_s(to->DeviceName, _countof(to->DeviceName), from->DeviceName, _TRUNCATE);
+            strncpy_s(to->SerialNumber, _countof(to->SerialNumber), from->SerialNumber, _TRUNCATE);
+            strncpy_s(to->AttachedAs, _countof(to->AttachedAs), from->AttachedAs, _TRUNCATE);
+            to->DriveLetter = from->DriveLetter;
+            to->Attached = from->Attached;
+            to->MountPoint = from->MountPoint;
+            to->MountState = from->MountState;
+            to->MediaValid = from->MediaValid;
+
+            if (!from->MediaValid)
+                continue;
+
+            strcpy_s(to->Media.Target, _countof(to->Media.Target), to->Target);
+            strcpy_s(to->Media.DeviceName, _countof(to->Media.DeviceName), from->Attached ? to->AttachedAs : to->DeviceName);
+            strncpy_s(to->Media.MediaDesc, _countof(to->Media.MediaDesc), from->MediaDesc, _TRUNCATE);
+            strncpy_s(to->Media.Barcode, _countof(to->Media.Barcode), from->Barcode, _TRUNCATE);
+            to->Media.Checked = TRUE;
+            to->Media.Loaded = from->Loaded;
+            to->Media.Busy = from->Busy;
+
+            // A check that was live when it went up is as old as the board now, except for a drive that was in use
+            // and had never been checked, which still hasn't.
+            to->Media.Cached = from->Cached || !from->Busy;
+            to->Media.AgeSeconds = from->MediaAgeSeconds + age;
+        }
+    }
+
+    LocalFree(snapshot);
+
+    if (!success)
+    {
+        StatusDestroy(newReport);
+        return FALSE;
+    }
+
+    newReport->AgeSeconds = age;
+    *report = newReport;
+
+    return TRUE;
+}
+
+static DWORD CALLBACK BoardNotify(HCMNOTIFICATION notification, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA eventData, DWORD eventDataSize)
+{
+    if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL || action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL)
+        SetEvent(BoardServer.Signal);
+
+    return ERROR_SUCCESS;
+}
+
+static BOOL WINAPI BoardCtrlHandler(DWORD ctrlType)
+{
+    InterlockedExchange(&BoardServer.Stop, TRUE);
+    SetEvent(BoardServer.Signal);
+
+    return TRUE;
+}
+
+static void BoardFill(PSTATUS_REPORT report, PBOARD_SNAPSHOT snapshot)
+{
+    DWORD i;
+
+    memset(snapshot, 0, sizeof(BOARD_SNAPSHOT));
+
+    snapshot->PublishedTime = BoardNow();
+    snapshot->CollectMs = report->ElapsedMs;
+    snapshot->ServiceValid = report->ServiceValid;
+    snapshot->ServiceState = report->ServiceState;
+    snapshot->UnmappedDrives = report->UnmappedDrives;
+    snapshot->ReadyCount = report->ReadyCount;
+
+    // Anything past the end doesn't fit, but still counts towards the totals.
+    snapshot->DriveCount = min(report->DriveCount, BOARD_MAX_DRIVES);
+    snapshot->MappingCount = min(report->MappingCount, BOARD_MAX_MAPPINGS);
+
+    for (i = 0; i < snapshot->DriveCount; i++)
+    {
+        PSTATUS_DRIVE from = &report->Drives[i];
+        PBOARD_DRIVE to = &snapshot->Drives[i];
+
+        strcpy_s(to->DeviceName, _countof(to->DeviceName), from->DeviceName);
+        strcpy_s(to->SerialNumber, _countof(to->SerialNumber), (char *)from->Drive.SerialNumber);
+        strcpy_s(to->VendorId, _countof(to->VendorId), (char *)from->Drive.VendorId);
+        strcpy_s(to->ProductId, _countof(to->ProductId), (char *)from->Drive.ProductId);
+        to->MappingCount = from->MappingCount;
+    }
+
+    for (i = 0; i < snapshot->MappingCount; i++)
+    {
+        PSTATUS_MAPPING from = &report->Mappings[i];
+        PBOARD_MAPPING to = &snapshot->Mappings[i];
+
+        strcpy_s(to->Target, _countof(to->Target), from->Target);
+        strcpy_s(to->DeviceName, _countof(to->DeviceName), from->DeviceName);
+        strcpy_s(to->SerialNumber, _countof(to->SerialNumber), from->SerialNumber);
+        strcpy_s(to->AttachedAs, _countof(to->AttachedAs), from->AttachedAs);
+        to->DriveLetter = from->DriveLetter;
+        to->Attached = from->Attached;
+        to->MountPoint = from->MountPoint;
+        to->MountState = from->MountState;
+        to->MediaValid = from->MediaValid && from->Media.Checked;
+
+        if (!to->MediaValid)
+            continue;
+
+        strcpy_s(to->MediaDesc, _countof(to->MediaDesc), from->Media.MediaDesc);
+        strcpy_s(to->Barcode, _countof(to->Barcode), from->Media.Barcode);
+        to->Loaded = from->Media.Loaded;
+        to->Busy = from->Media.Busy;
+        to->Cached = from->Media.Cached;
+        to->MediaAgeSeconds = from->Media.AgeSeconds;
+    }
+}
+
+static void BoardPublish(PSTATUS_BOARD board, PBOARD_SNAPSHOT snapshot)
+{
+    // Odd from here, so a reader part way through a copy knows to throw it away.
+    InterlockedIncrement(&board->Sequence);
+
+    memcpy((PVOID)&board->Snapshot, snapshot, sizeof(BOARD_SNAPSHOT));
+
+    // Both are full barriers, so none of the copy can be seen after the sequence is even again.
+    InterlockedIncrement(&board->Sequence);
+
+    board->Magic = BOARD_MAGIC;
+}
+
+static ULONGLONG BoardNow()
+{
+    FILETIME now;
+
+    GetSystemTimeAsFileTime(&now);
+
+    return ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+}
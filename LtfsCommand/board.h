@@ -0,0 +1,97 @@
+/*
+ *   File:   board.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsreg.h"
+#include "tape.h"
+#include "media.h"
+#include "status.h"
+
+#define BOARD_NAME              "Global\\LtfsCmdStatusBoard"
+#define BOARD_MAGIC             0x4452424C      // LBRD
+#define BOARD_MAX_DRIVES        32
+#define BOARD_MAX_MAPPINGS      64
+#define BOARD_DEFAULT_INTERVAL  10              // Seconds between updates when no drive comes or goes
+#define BOARD_READ_RETRIES      1000
+
+// Everything in here is fixed size and free of pointers, so any process can map it and read it as it is.
+
+typedef struct BOARD_DRIVE
+{
+    CHAR DeviceName[MAX_DEVICE_NAME];
+    CHAR SerialNumber[MAX_SERIAL_NUMBER];
+    CHAR VendorId[MEMBER_SIZE(INQUIRYDATA, VendorId) + 1];
+    CHAR ProductId[MEMBER_SIZE(INQUIRYDATA, ProductId) + 1];
+    DWORD MappingCount;
+} BOARD_DRIVE, *PBOARD_DRIVE;
+
+typedef struct BOARD_MAPPING
+{
+    CHAR Target[MAX_MOUNT_TARGET];
+    CHAR DeviceName[MAX_DEVICE_NAME];
+    CHAR SerialNumber[MAX_SERIAL_NUMBER];
+    CHAR AttachedAs[MAX_DEVICE_NAME];
+    CHAR MediaDesc[MEDIA_MAX_DESC];
+    CHAR Barcode[TAPE_MAM_BARCODE_LEN + 1];
+    CHAR DriveLetter;
+    BOOL Attached;
+    BOOL MountPoint;
+    BOOL MediaValid;
+    BOOL Loaded;
+    BOOL Busy;
+    BOOL Cached;
+    ULONGLONG MediaAgeSeconds;          // As of when it was published
+    DWORD MountState;
+} BOARD_MAPPING, *PBOARD_MAPPING;
+
+typedef struct BOARD_SNAPSHOT
+{
+    ULONGLONG PublishedTime;            // FILETIME
+    ULONGLONG Updates;
+    ULONGLONG CollectMs;
+    BOOL ServiceValid;
+    DWORD ServiceState;
+    DWORD DriveCount;
+    DWORD UnmappedDrives;
+    DWORD MappingCount;
+    DWORD ReadyCount;
+    BOARD_DRIVE Drives[BOARD_MAX_DRIVES];
+    BOARD_MAPPING Mappings[BOARD_MAX_MAPPINGS];
+} BOARD_SNAPSHOT, *PBOARD_SNAPSHOT;
+
+typedef struct STATUS_BOARD
+{
+    DWORD Magic;                        // Set once the first snapshot is in
+    DWORD Size;                         // Of the whole board, so a reader built against another layout can tell
+    DWORD PublisherId;
+    volatile LONG Sequence;             // Odd while a snapshot is being written
+    BOARD_SNAPSHOT Snapshot;
+} STATUS_BOARD, *PSTATUS_BOARD;
+
+typedef struct BOARD_SERVE_STATS
+{
+    ULONGLONG Updates;
+    ULONGLONG MaxCollectMs;
+    ULONGLONG TotalCollectMs;
+} BOARD_SERVE_STATS, *PBOARD_SERVE_STATS;
+
+BOOL BoardServe(DWORD interval, PBOARD_SERVE_STATS stats);
+BOOL BoardRead(PBOARD_SNAPSHOT snapshot, PDWORD publisherId, PDWORD retries);
+BOOL BoardGetReport(PSTATUS_REPORT *report, PDWORD publisherId);
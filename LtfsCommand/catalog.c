@@ -0,0 +1,475 @@
+/*
+ *   File:   catalog.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "catalog.h"
+
+// The catalog is a plain text file, one record per line, tab separated, so it can be grepped and diffed:
+//
+//   V  <volume uuid>  <barcode>
+//   F  <volume uuid>  <partition>  <start block>  <length>  <path>
+//   M  <container path>  <offset>  <length>  <path>
+//
+// Paths are relative to the volume root. Volume records always come before the files that refer to them. Members don't
+// name a volume: they're found through the container's own F record, once the volume holding it has been catalogued.
+
+#define MAX_CATALOG_LINE    (MAX_PATH * 4 + 128)
+
+static DWORD CatalogFindVolume(PCATALOG catalog, LPCSTR uuid);
+static DWORD CatalogAddVolumeRecord(PCATALOG catalog, LPCSTR uuid, LPCSTR barcode);
+static BOOL CatalogAddEntry(PCATALOG catalog, LPCSTR path, DWORD volume, BYTE partition, ULONGLONG startBlock, ULONGLONG length);
+static int CatalogCompareEntries(const void *a, const void *b);
+static BOOL CatalogAddMember(PCATALOG catalog, LPCSTR container, LPCSTR path, ULONGLONG offset, ULONGLONG length);
+static int CatalogCompareMembers(const void *a, const void *b);
+
+BOOL CatalogLoad(LPCSTR catalogFile, PCATALOG *catalog)
+{
+    FILE *file;
+    CHAR line[MAX_CATALOG_LINE];
+    PCATALOG newCatalog;
+    DWORD lastVolume = MAXDWORD;
+    BOOL result = TRUE;
+
+    newCatalog = (PCATALOG)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(CATALOG));
+
+    if (!newCatalog)
+        return FALSE;
+
+    // A catalog that doesn't exist yet is just an empty one.
+    if (GetFileAttributes(catalogFile) == INVALID_FILE_ATTRIBUTES)
+    {
+        *catalog = newCatalog;
+        return TRUE;
+    }
+
+    if (fopen_s(&file, catalogFile, "r") != 0)
+    {
+        CatalogDestroy(newCatalog);
+        return FALSE;
+    }
+
+    while (result && fgets(line, sizeof(line), file))
+    {
+        LPSTR context = NULL;
+        LPSTR type;
+        LPSTR uuid;
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        type = strtok_s(line, "\t", &context);
+        uuid = strtok_s(NULL, "\t", &context);
+
+        if (!type || !uuid)
+            continue;
+
+        if (type[0] == 'V')
+        {
+            LPSTR barcode = strtok_s(NULL, "\t", &context);
+            result = CatalogAddVolumeRecord(newCatalog, uuid, barcode ? barcode : "") != MAXDWORD;
+        }
+        else if (type[0] == 'F')
+        {
+            LPSTR partition = strtok_s(NULL, "\t", &context);
+            LPSTR startBlock = strtok_s(NULL, "\t", &context);
+            LPSTR length = strtok_s(NULL, "\t", &context);
+            LPSTR path = context;
+
+            if (!partition || !startBlock || !length || !path || !*path)
+                continue;
+
+            if (lastVolume == MAXDWORD || strcmp(newCatalog->Volumes[lastVolume].Uuid, uuid) != 0)
+                lastVolume = CatalogFindVolume(newCatalog, uuid);
+
+            if (lastVolume == MAXDWORD)
+                continue;
+
+            result = CatalogAddEntry(newCatalog, path, lastVolume, (BYTE)(tolower(partition[0]) - 'a'), _strtoui64(startBlock, NULL, 10), _strtoui64(length, NULL, 10));
+        }
+        else if (type[0] == 'M')
+        {
+            LPSTR offset = strtok_s(NULL, "\t", &context);
+            LPSTR length = strtok_s(NULL, "\t", &context);
+            LPSTR path = context;
+
+            if (!offset || !length || !path || !*path)
+                continue;
+
+            // The second field is the container rather than a volume for these.
+            result = CatalogAddMember(newCatalog, uuid, path, _strtoui64(offset, NULL, 10), _strtoui64(length, NULL, 10));
+        }
+    }
+
+    fclose(file);
+
+    if (!result)
+    {
+        CatalogDestroy(newCatalog);
+        return FALSE;
+    }
+
+    qsort(newCatalog->Entries, newCatalog->EntryCount, sizeof(CATALOG_ENTRY), CatalogCompareEntries);
+    qsort(newCatalog->Members, newCatalog->MemberCount, sizeof(CATALOG_MEMBER), CatalogCompareMembers);
+
+    *catalog = newCatalog;
+    return TRUE;
+}
+
+BOOL CatalogSave(PCATALOG catalog, LPCSTR catalogFile)
+{
+    CHAR tempFile[MAX_PATH];
+    FILE *file;
+    BOOL result = TRUE;
+    DWORD i;
+
+    // Write alongside and swap in, so a failure half way through doesn't cost us the old catalog.
+    _snprintf_s(tempFile, _countof(tempFile), _TRUNCATE, "%s.tmp", catalogFile);
+
+    if (fopen_s(&file, tempFile, "w") != 0)
+        return FALSE;
+
+    for (i = 0; result && i < catalog->VolumeCount; i++)
+        result = fprintf(file, "V\t%s\t%s\n", catalog->Volumes[i].Uuid, catalog->Volumes[i].Barcode) > 0;
+
+    for (i = 0; result && i < catalog->EntryCount; i++)
+    {
+        PCATALOG_ENTRY entry = &catalog->Entries[i];
+
+        result = fprintf(file, "F\t%s\t%c\t%llu\t%llu\t%s\n", catalog->Volumes[entry->Volume].Uuid, 'a' + entry->Partition,
+            entry->StartBlock, entry->Length, entry->Path) > 0;
+    }
+
+    for (i = 0; result && i < catalog->MemberCount; i++)
+    {
+        PCATALOG_MEMBER member = &catalog->Members[i];
+
+        result = fprintf(file, "M\t%s\t%llu\t%llu\t%s\n", member->Container, member->Offset, member->Length, member->Path) > 0;
+    }
+
+    if (fclose(file) != 0)
+        result = FALSE;
+
+    if (result)
+        result = MoveFileEx(tempFile, catalogFile, MOVEFILE_REPLACE_EXISTING);
+
+    if (!result)
+        DeleteFile(tempFile);
+
+    return result;
+}
+
+void CatalogDestroy(PCATALOG catalog)
+{
+    DWORD i;
+
+    if (!catalog)
+        return;
+
+    for (i = 0; i < catalog->EntryCount; i++)
+        LocalFree(catalog->Entries[i].Path);
+
+    if (catalog->Entries)
+        LocalFree(catalog->Entries);
+
+    for (i = 0; i < catalog->MemberCount; i++)
+    {
+        LocalFree(catalog->Members[i].Path);
+        LocalFree(catalog->Members[i].Container);
+    }
+
+    if (catalog->Members)
+        LocalFree(catalog->Members);
+
+    if (catalog->Volumes)
+        LocalFree(catalog->Volumes);
+
+    LocalFree(catalog);
+}
+
+BOOL CatalogAddVolume(PCATALOG catalog, PLTFS_INDEX index, LPCSTR barcode)
+{
+    PLTFS_FILE file;
+    DWORD volume;
+    DWORD i, j;
+
+    volume = CatalogFindVolume(catalog, index->VolumeUuid);
+
+    if (volume == MAXDWORD)
+    {
+        volume = CatalogAddVolumeRecord(catalog, index->VolumeUuid, barcode);
+
+        if (volume == MAXDWORD)
+            return FALSE;
+    }
+    else
+    {
+        if (barcode && *barcode)
+            strcpy_s(catalog->Volumes[volume].Barcode, sizeof(catalog->Volumes[volume].Barcode), barcode);
+
+        // Replace rather than merge: the index we've been given is the current state of the volume.
+        for (i = 0, j = 0; i < catalog->EntryCount; i++)
+        {
+            if (catalog->Entries[i].Volume == volume)
+                LocalFree(catalog->Entries[i].Path);
+            else
+                catalog->Entries[j++] = catalog->Entries[i];
+        }
+
+        catalog->EntryCount = j;
+    }
+
+    for (file = index->Files; file != NULL; file = file->Next)
+    {
+        BYTE partition = file->ExtentCount ? file->Extents[0].Partition : 0;
+        ULONGLONG startBlock = file->ExtentCount ? file->Extents[0].StartBlock : 0;
+
+        if (!CatalogAddEntry(catalog, file->Path, volume, partition, startBlock, file->Length))
+            return FALSE;
+    }
+
+    qsort(catalog->Entries, catalog->EntryCount, sizeof(CATALOG_ENTRY), CatalogCompareEntries);
+
+    return TRUE;
+}
+
+PCATALOG_ENTRY CatalogFindFile(PCATALOG catalog, LPCSTR path)
+{
+    CHAR normalised[MAX_PATH * 4];
+    CATALOG_ENTRY key;
+    PCATALOG_ENTRY found;
+
+    if (!catalog->EntryCount)
+        return NULL;
+
+    LtfsIndexNormalisePath(path, normalised, _countof(normalised));
+
+    key.Path = normalised;
+    key.Volume = 0;
+
+    found = (PCATALOG_ENTRY)bsearch(&key, catalog->Entries, catalog->EntryCount, sizeof(CATALOG_ENTRY), CatalogCompareEntries);
+
+    // Volume is the tie breaker, so step back to the first volume holding this path.
+    while (found && found > catalog->Entries && _stricmp(found[-1].Path, normalised) == 0)
+        found--;
+
+    return found;
+}
+
+BOOL CatalogAddContainer(PCATALOG catalog, LPCSTR container, PCATALOG_MEMBER members, DWORD memberCount)
+{
+    CHAR normalised[MAX_PATH * 4];
+    DWORD i, j;
+
+    LtfsIndexNormalisePath(container, normalised, _countof(normalised));
+
+    // Same as a volume, a container that's been written again replaces what we had for it.
+    for (i = 0, j = 0; i < catalog->MemberCount; i++)
+    {
+        if (_stricmp(catalog->Members[i].Container, normalised) == 0)
+        {
+            LocalFree(catalog->Members[i].Path);
+            LocalFree(catalog->Members[i].Container);
+        }
+        else
+        {
+            catalog->Members[j++] = catalog->Members[i];
+        }
+    }
+
+    catalog->MemberCount = j;
+
+    for (i = 0; i < memberCount; i++)
+    {
+        CHAR path[MAX_PATH * 4];
+
+        LtfsIndexNormalisePath(members[i].Path, path, _countof(path));
+
+        if (!CatalogAddMember(catalog, normalised, path, members[i].Offset, members[i].Length))
+            return FALSE;
+    }
+
+    qsort(catalog->Members, catalog->MemberCount, sizeof(CATALOG_MEMBER), CatalogCompareMembers);
+
+    return TRUE;
+}
+
+PCATALOG_MEMBER CatalogFindMember(PCATALOG catalog, LPCSTR path)
+{
+    CHAR normalised[MAX_PATH * 4];
+    CATALOG_MEMBER key;
+
+    if (!catalog->MemberCount)
+        return NULL;
+
+    LtfsIndexNormalisePath(path, normalised, _countof(normalised));
+
+    key.Path = normalised;
+
+    return (PCATALOG_MEMBER)bsearch(&key, catalog->Members, catalog->MemberCount, sizeof(CATALOG_MEMBER), CatalogCompareMembers);
+}
+
+static DWORD CatalogFindVolume(PCATALOG catalog, LPCSTR uuid)
+{
+    DWORD i;
+
+    for (i = 0; i < catalog->VolumeCount; i++)
+    {
+        if (_stricmp(catalog->Volumes[i].Uuid, uuid) == 0)
+            return i;
+    }
+
+    return MAXDWORD;
+}
+
+static DWORD CatalogAddVolumeRecord(PCATALOG catalog, LPCSTR uuid, LPCSTR barcode)
+{
+    PCATALOG_VOLUME volume;
+
+    if (catalog->VolumeCount == catalog->VolumeCapacity)
+    {
+        DWORD newCapacity = catalog->VolumeCapacity ? catalog->VolumeCapacity * 2 : 16;
+        PCATALOG_VOLUME volumes = (PCATALOG_VOLUME)LocalAlloc(LMEM_FIXED, sizeof(CATALOG_VOLUME) * newCapacity);
+
+        if (!volumes)
+            return MAXDWORD;
+
+        if (catalog->Volumes)
+        {
+            memcpy(volumes, catalog->Volumes, sizeof(CATALOG_VOLUME) * catalog->VolumeCount);
+            LocalFree(catalog->Volumes);
+        }
+
+        catalog->Volumes = volumes;
+        catalog->VolumeCapacity = newCapacity;
+    }
+
+    volume = &catalog->Volumes[catalog->VolumeCount];
+
+    strncpy_s(volume->Uuid, sizeof(volume->Uuid), uuid, _TRUNCATE);
+    strncpy_s(volume->Barcode, sizeof(volume->Barcode), barcode ? barcode : "", _TRUNCATE);
+
+    return catalog->VolumeCount++;
+}
+
+static BOOL CatalogAddEntry(PCATALOG catalog, LPCSTR path, DWORD volume, BYTE partition, ULONGLONG startBlock, ULONGLONG length)
+{
+    PCATALOG_ENTRY entry;
+    size_t pathLength = strlen(path) + 1;
+
+    if (catalog->EntryCount == catalog->EntryCapacity)
+    {
+        DWORD newCapacity = catalog->EntryCapacity ? catalog->EntryCapacity * 2 : 1024;
+        PCATALOG_ENTRY entries = (PCATALOG_ENTRY)LocalAlloc(LMEM_FIXED, sizeof(CATALOG_ENTRY) * newCapacity);
+
+        if (!entries)
+            return FALSE;
+
+        if (catalog->Entries)
+        {
+            memcpy(entries, catalog->Entries, sizeof(CATALOG_ENTRY) * catalog->EntryCount);
+            LocalFree(catalog->Entries);
+        }
+
+        catalog->Entries = entries;
+        catalog->EntryCapacity = newCapacity;
+    }
+
+    entry = &catalog->Entries[catalog->EntryCount];
+    entry->Path = (LPSTR)LocalAlloc(LMEM_FIXED, pathLength);
+
+    if (!entry->Path)
+        return FALSE;
+
+    strcpy_s(entry->Path, pathLength, path);
+    entry->Volume = volume;
+    entry->Partition = partition;
+    entry->StartBlock = startBlock;
+    entry->Length = length;
+
+    catalog->EntryCount++;
+
+    return TRUE;
+}
+
+static int CatalogCompareEntries(const void *a, const void *b)
+{
+    const CATALOG_ENTRY *entryA = (const CATALOG_ENTRY *)a;
+    const CATALOG_ENTRY *entryB = (const CATALOG_ENTRY *)b;
+    int result = _stricmp(entryA->Path, entryB->Path);
+
+    if (result != 0)
+        return result;
+
+    return entryA->Volume < entryB->Volume ? -1 : (entryA->Volume > entryB->Volume ? 1 : 0);
+}
+
+static BOOL CatalogAddMember(PCATALOG catalog, LPCSTR container, LPCSTR path, ULONGLONG offset, ULONGLONG length)
+{
+    PCATALOG_MEMBER member;
+    size_t containerLength = strlen(container) + 1;
+    size_t pathLength = strlen(path) + 1;
+
+    if (catalog->MemberCount == catalog->MemberCapacity)
+    {
+        DWORD newCapacity = catalog->MemberCapacity ? catalog->MemberCapacity * 2 : 1024;
+        PCATALOG_MEMBER members = (PCATALOG_MEMBER)LocalAlloc(LMEM_FIXED, sizeof(CATALOG_MEMBER) * newCapacity);
+
+        if (!members)
+            return FALSE;
+
+        if (catalog->Members)
+        {
+            memcpy(members, catalog->Members, sizeof(CATALOG_MEMBER) * catalog->MemberCount);
+            LocalFree(catalog->Members);
+        }
+
+        catalog->Members = members;
+        catalog->MemberCapacity = newCapacity;
+    }
+
+    member = &catalog->Members[catalog->MemberCount];
+    member->Path = (LPSTR)LocalAlloc(LMEM_FIXED, pathLength);
+    member->Container = (LPSTR)LocalAlloc(LMEM_FIXED, containerLength);
+
+    if (!member->Path || !member->Container)
+    {
+        if (member->Path)
+            LocalFree(member->Path);
+
+        if (member->Container)
+            LocalFree(member->Container);
+
+        return FALSE;
+    }
+
+    strcpy_s(member->Path, pathLength, path);
+    strcpy_s(member->Container, containerLength, container);
+    member->Offset = offset;
+    member->Length = length;
+
+    catalog->MemberCount++;
+
+    return TRUE;
+}
+
+static int CatalogCompareMembers(const void *a, const void *b)
+{
+    const CATALOG_MEMBER *memberA = (const CATALOG_MEMBER *)a;
+    const CATALOG_MEMBER *memberB = (const CATALOG_MEMBER *)b;
+
+    return _stricmp(memberA->Path, memberB->Path);
+}
@@ -0,0 +1,69 @@
+/*
+ *   File:   catalog.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsidx.h"
+
+#define CATALOG_BARCODE_LENGTH  33
+
+typedef struct CATALOG_VOLUME
+{
+    CHAR Uuid[LTFS_UUID_LENGTH];
+    CHAR Barcode[CATALOG_BARCODE_LENGTH];
+} CATALOG_VOLUME, *PCATALOG_VOLUME;
+
+typedef struct CATALOG_ENTRY
+{
+    LPSTR Path;
+    DWORD Volume;
+    BYTE Partition;
+    ULONGLONG StartBlock;
+    ULONGLONG Length;
+} CATALOG_ENTRY, *PCATALOG_ENTRY;
+
+// A small file packed into a container. The container itself is an ordinary file on the volume with its own entry.
+typedef struct CATALOG_MEMBER
+{
+    LPSTR Path;
+    LPSTR Container;
+    ULONGLONG Offset;
+    ULONGLONG Length;
+} CATALOG_MEMBER, *PCATALOG_MEMBER;
+
+typedef struct CATALOG
+{
+    DWORD VolumeCount;
+    DWORD VolumeCapacity;
+    PCATALOG_VOLUME Volumes;
+    DWORD EntryCount;
+    DWORD EntryCapacity;
+    PCATALOG_ENTRY Entries;
+    DWORD MemberCount;
+    DWORD MemberCapacity;
+    PCATALOG_MEMBER Members;
+} CATALOG, *PCATALOG;
+
+BOOL CatalogLoad(LPCSTR catalogFile, PCATALOG *catalog);
+BOOL CatalogSave(PCATALOG catalog, LPCSTR catalogFile);
+void CatalogDestroy(PCATALOG catalog);
+BOOL CatalogAddVolume(PCATALOG catalog, PLTFS_INDEX index, LPCSTR barcode);
+PCATALOG_ENTRY CatalogFindFile(PCATALOG catalog, LPCSTR path);
+BOOL CatalogAddContainer(PCATALOG catalog, LPCSTR container, PCATALOG_MEMBER members, DWORD memberCount);
+PCATALOG_MEMBER CatalogFindMember(PCATALOG catalog, LPCSTR path);
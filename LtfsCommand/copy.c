@@ -0,0 +1,283 @@
+/*
+ *   File:   copy.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "copy.h"
+#include "ring.h"
+#include "tape.h"
+
+typedef struct COPY_CONTEXT
+{
+    HANDLE Source;
+    HANDLE Target;
+    PCOPY_STATS Stats;
+    BUFFER_RING Ring;
+    volatile LONG Queued;
+    volatile LONG ReadDone;
+    BOOL Failed;
+} COPY_CONTEXT, *PCOPY_CONTEXT;
+
+static BOOL CopyReadSource(PCOPY_CONTEXT context);
+static DWORD WINAPI CopyWriter(LPVOID param);
+
+// Blocks go from one drive to the other through a ring of one block per slot. The source drive reads straight into a slot
+// and the target drive writes straight out of it, so the data is never copied in between.
+//
+// Both drives want to stream. Left to themselves they'd run in lockstep with the ring sat permanently full or empty,
+// stopping and starting on every block that freed up, which is exactly how a drive ends up shoe-shining. So each side
+// works with some hysteresis: the target doesn't start until the ring is mostly full, and once it runs dry it waits for
+// it to fill up again. The source, when it fills the ring, waits until it has mostly drained. Either drive then gets a long
+// uninterrupted run each time it starts, and the stall counts in the stats show how well matched the two were.
+
+BOOL CopyTape(LPCSTR sourceDrive, LPCSTR targetDrive, PCOPY_STATS stats)
+{
+    COPY_CONTEXT context;
+    HANDLE writerThread;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL result;
+
+    memset(stats, 0, sizeof(COPY_STATS));
+    memset(&context, 0, sizeof(context));
+
+    context.Stats = stats;
+    context.Target = INVALID_HANDLE_VALUE;
+    context.Source = TapeOpen(sourceDrive);
+    result = context.Source != INVALID_HANDLE_VALUE;
+
+    if (result)
+    {
+        context.Target = TapeOpen(targetDrive);
+        result = context.Target != INVALID_HANDLE_VALUE;
+    }
+
+    if (result)
+        result = RingCreate(&context.Ring, COPY_SLOT_COUNT, LTFS_MAX_BLOCK_SIZE);
+
+    if (result)
+    {
+        writerThread = CreateThread(NULL, 0, CopyWriter, &context, 0, NULL);
+        result = writerThread != NULL;
+
+        if (result)
+        {
+            result = CopyReadSource(&context);
+
+            WaitForSingleObject(writerThread, INFINITE);
+            CloseHandle(writerThread);
+
+            result = result && !context.Failed;
+        }
+
+        RingDestroy(&context.Ring);
+    }
+
+    if (context.Target != INVALID_HANDLE_VALUE)
+        CloseHandle(context.Target);
+
+    if (context.Source != INVALID_HANDLE_VALUE)
+        CloseHandle(context.Source);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result;
+}
+
+static BOOL CopyReadSource(PCOPY_CONTEXT context)
+{
+    PBUFFER_RING ring = &context->Ring;
+    PCOPY_STATS stats = context->Stats;
+    PRING_SLOT slot = NULL;
+    DWORD partition;
+    BOOL result = TRUE;
+
+    for (partition = 0; result && partition < COPY_MAX_PARTITIONS; partition++)
+    {
+        ULONGLONG block = 0;
+
+        if (!TapeLocate(context->Source, TAPE_LOCATE_BLOCK, partition, 0, NULL))
+        {
+            result = partition > 0;
+            break;
+        }
+
+        stats->PartitionCount++;
+
+        for (;;)
+        {
+            TAPE_SENSE sense;
+            ULONG bytesRead;
+
+            if (!slot)
+            {
+                // Ring's full. Rather than pick up again the moment one slot frees, let the target get well ahead first.
+                if (context->Queued >= (LONG)ring->SlotCount)
+                {
+                    ULONGLONG waitStart = GetTickCount64();
+
+                    while (context->Queued > COPY_LOW_WATERMARK && !ring->Aborted)
+                        Sleep(COPY_POLL_INTERVAL);
+
+                    stats->SourceStalls++;
+                    stats->SourceWaitMs += GetTickCount64() - waitStart;
+                }
+
+                slot = RingAcquireFree(ring);
+
+                if (!slot)
+                {
+                    result = FALSE;
+                    break;
+                }
+            }
+
+            if (TapeRead(context->Source, slot->Buffer, ring->SlotSize, &bytesRead, &sense))
+            {
+                slot->Length = bytesRead;
+                stats->Blocks++;
+                stats->Bytes += bytesRead;
+            }
+            else if (sense.Filemark)
+            {
+                slot->Flags = COPY_SLOT_FILEMARK;
+                stats->Filemarks++;
+            }
+            else if (sense.SenseKey == SCSI_SENSE_BLANK_CHECK || (sense.EndOfMedium && sense.SenseKey != SCSI_SENSE_MEDIUM_ERROR))
+            {
+                break;
+            }
+            else
+            {
+                // Same as the image dump. Skipping a block would leave every block after it in the wrong place.
+                fprintf(stderr, "Read error in partition %u at block %llu\r\n", partition, block);
+                result = FALSE;
+                break;
+            }
+
+            // Counted before it's committed, so the writer can never take it below zero.
+            slot->Item = partition;
+            slot->Offset = block++;
+            InterlockedIncrement(&context->Queued);
+            RingCommit(ring, slot);
+            slot = NULL;
+        }
+    }
+
+    InterlockedExchange(&context->ReadDone, TRUE);
+
+    if (result)
+    {
+        if (!slot)
+            slot = RingAcquireFree(ring);
+
+        result = slot != NULL;
+
+        if (result)
+        {
+            slot->Flags = RING_SLOT_END;
+            RingCommit(ring, slot);
+        }
+    }
+    else
+    {
+        RingAbort(ring);
+    }
+
+    return result;
+}
+
+static DWORD WINAPI CopyWriter(LPVOID param)
+{
+    PCOPY_CONTEXT context = (PCOPY_CONTEXT)param;
+    PBUFFER_RING ring = &context->Ring;
+    PCOPY_STATS stats = context->Stats;
+    DWORD partition = MAXDWORD;
+    BOOL streaming = FALSE;
+    BOOL started = FALSE;
+    BOOL result = TRUE;
+
+    while (result)
+    {
+        PRING_SLOT slot;
+        TAPE_SENSE sense;
+
+        // Wait for a good run's worth in the ring before starting the drive, and again whenever it runs dry.
+        // Once the source has finished there's nothing more coming, so whatever's left just goes.
+        if (!streaming)
+        {
+            ULONGLONG waitStart = GetTickCount64();
+
+            while (context->Queued < COPY_HIGH_WATERMARK && !context->ReadDone && !ring->Aborted)
+                Sleep(COPY_POLL_INTERVAL);
+
+            if (started)
+            {
+                stats->TargetStalls++;
+                stats->TargetWaitMs += GetTickCount64() - waitStart;
+            }
+
+            streaming = TRUE;
+            started = TRUE;
+        }
+
+        slot = RingAcquireFull(ring);
+
+        if (!slot)
+            break;
+
+        if (slot->Flags & RING_SLOT_END)
+        {
+            RingRelease(ring, slot);
+            break;
+        }
+
+        // The target has to be partitioned the same as the source already. Every partition of an LTFS volume has
+        // something in it, so this always gets to each one in turn.
+        if (slot->Item != partition)
+        {
+            partition = slot->Item;
+            result = TapeLocate(context->Target, TAPE_LOCATE_BLOCK, partition, 0, NULL);
+
+            if (!result)
+                fprintf(stderr, "Cannot move to partition %u on the target. It must be partitioned the same as the source.\r\n", partition);
+        }
+
+        if (result)
+        {
+            if (slot->Flags & COPY_SLOT_FILEMARK)
+                result = TapeWriteFilemarks(context->Target, 1, &sense);
+            else
+                result = TapeWrite(context->Target, slot->Buffer, slot->Length, &sense);
+
+            if (!result)
+                fprintf(stderr, "Write failed in partition %u at block %llu\r\n", partition, slot->Offset);
+        }
+
+        RingRelease(ring, slot);
+
+        if (!InterlockedDecrement(&context->Queued) && !context->ReadDone)
+            streaming = FALSE;
+    }
+
+    if (!result)
+    {
+        context->Failed = TRUE;
+        RingAbort(ring);
+    }
+
+    return 0;
+}
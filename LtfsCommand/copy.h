@@ -0,0 +1,45 @@
+/*
+ *   File:   copy.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsidx.h"
+
+#define COPY_MAX_PARTITIONS     4
+#define COPY_SLOT_COUNT         512     // One block per slot, so up to 512MB in flight
+#define COPY_HIGH_WATERMARK     (COPY_SLOT_COUNT * 3 / 4)
+#define COPY_LOW_WATERMARK      (COPY_SLOT_COUNT / 4)
+#define COPY_POLL_INTERVAL      20
+
+#define COPY_SLOT_FILEMARK      0x10    // A filemark rather than a block, no data
+
+typedef struct COPY_STATS
+{
+    DWORD PartitionCount;
+    ULONGLONG Blocks;
+    ULONGLONG Filemarks;
+    ULONGLONG Bytes;
+    ULONGLONG ElapsedMs;
+    DWORD SourceStalls;
+    DWORD TargetStalls;
+    ULONGLONG SourceWaitMs;
+    ULONGLONG TargetWaitMs;
+} COPY_STATS, *PCOPY_STATS;
+
+BOOL CopyTape(LPCSTR sourceDrive, LPCSTR targetDrive, PCOPY_STATS stats);
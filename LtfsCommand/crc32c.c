@@ -0,0 +1,153 @@
+/*
+ *   File:   crc32c.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "crc32c.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42
+#endif
+
+#define CRC32C_POLYNOMIAL   0x82F63B78  // Reflected
+
+static DWORD Crc32cTable[8][256];
+static INIT_ONCE Crc32cInitOnce = INIT_ONCE_STATIC_INIT;
+static BOOL Crc32cUseHardware;
+
+static BOOL CALLBACK Crc32cInit(PINIT_ONCE initOnce, PVOID parameter, PVOID *context);
+
+DWORD Crc32c(DWORD crc, const void *data, size_t length)
+{
+    InitOnceExecuteOnce(&Crc32cInitOnce, Crc32cInit, NULL, NULL);
+
+    if (Crc32cUseHardware)
+        return Crc32cHardware(crc, data, length);
+
+    return Crc32cPortable(crc, data, length);
+}
+
+DWORD Crc32cPortable(DWORD crc, const void *data, size_t length)
+{
+    const BYTE *pos = (const BYTE *)data;
+
+    InitOnceExecuteOnce(&Crc32cInitOnce, Crc32cInit, NULL, NULL);
+
+    crc = ~crc;
+
+    // Slicing-by-8: eight table lookups per 8 bytes instead of one per byte. Assumes little endian, as Windows is.
+    while (length >= 8)
+    {
+        DWORD low = crc ^ ((DWORD)pos[0] | ((DWORD)pos[1] << 8) | ((DWORD)pos[2] << 16) | ((DWORD)pos[3] << 24));
+        DWORD high = (DWORD)pos[4] | ((DWORD)pos[5] << 8) | ((DWORD)pos[6] << 16) | ((DWORD)pos[7] << 24);
+
+        crc = Crc32cTable[7][low & 0xFF] ^ Crc32cTable[6][(low >> 8) & 0xFF] ^
+            Crc32cTable[5][(low >> 16) & 0xFF] ^ Crc32cTable[4][low >> 24] ^
+            Crc32cTable[3][high & 0xFF] ^ Crc32cTable[2][(high >> 8) & 0xFF] ^
+            Crc32cTable[1][(high >> 16) & 0xFF] ^ Crc32cTable[0][high >> 24];
+
+        pos += 8;
+        length -= 8;
+    }
+
+    while (length--)
+        crc = Crc32cTable[0][(crc ^ *pos++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+DWORD Crc32cHardware(DWORD crc, const void *data, size_t length)
+{
+#ifdef CRC32C_HAVE_SSE42
+    const BYTE *pos = (const BYTE *)data;
+
+    crc = ~crc;
+
+    // One crc32 instruction per 8 bytes is a few GB/s per core, several times what any tape drive can stream,
+    // so there's no need for the three-way interleave or a PCLMULQDQ fold here.
+    while (length && ((ULONG_PTR)pos & 7))
+    {
+        crc = _mm_crc32_u8(crc, *pos++);
+        length--;
+    }
+
+#ifdef _M_X64
+    while (length >= 8)
+    {
+        crc = (DWORD)_mm_crc32_u64(crc, *(const unsigned __int64 *)pos);
+        pos += 8;
+        length -= 8;
+    }
+#endif
+
+    while (length >= 4)
+    {
+        crc = _mm_crc32_u32(crc, *(const unsigned int *)pos);
+        pos += 4;
+        length -= 4;
+    }
+
+    while (length--)
+        crc = _mm_crc32_u8(crc, *pos++);
+
+    return ~crc;
+#else
+    return Crc32cPortable(crc, data, length);
+#endif
+}
+
+BOOL Crc32cHardwareAvailable()
+{
+    InitOnceExecuteOnce(&Crc32cInitOnce, Crc32cInit, NULL, NULL);
+
+    return Crc32cUseHardware;
+}
+
+static BOOL CALLBACK Crc32cInit(PINIT_ONCE initOnce, PVOID parameter, PVOID *context)
+{
+    DWORD i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+        DWORD crc = i;
+
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+
+        Crc32cTable[0][i] = crc;
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 1; j < 8; j++)
+            Crc32cTable[j][i] = (Crc32cTable[j - 1][i] >> 8) ^ Crc32cTable[0][Crc32cTable[j - 1][i] & 0xFF];
+    }
+
+#ifdef CRC32C_HAVE_SSE42
+    {
+        int cpuInfo[4];
+
+        // CPUID leaf 1, ECX bit 20 is SSE4.2.
+        __cpuid(cpuInfo, 1);
+        Crc32cUseHardware = (cpuInfo[2] & (1 << 20)) != 0;
+    }
+#endif
+
+    return TRUE;
+}
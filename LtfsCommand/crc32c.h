@@ -0,0 +1,28 @@
+/*
+ *   File:   crc32c.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+// CRC32C (Castagnoli) as used by Logical Block Protection. Pass 0 to start, or a previous result to continue.
+
+DWORD Crc32c(DWORD crc, const void *data, size_t length);
+DWORD Crc32cPortable(DWORD crc, const void *data, size_t length);
+DWORD Crc32cHardware(DWORD crc, const void *data, size_t length);
+BOOL Crc32cHardwareAvailable();
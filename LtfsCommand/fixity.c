@@ -0,0 +1,523 @@
+/*
+ *   File:   fixity.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "fixity.h"
+#include "recall.h"
+#include "ring.h"
+#include "util.h"
+
+typedef struct FIXITY_ENTRY
+{
+    LPCSTR Path;
+    CHAR Digest[FIXITY_MAX_DIGEST];
+    BOOL Failed;
+} FIXITY_ENTRY, *PFIXITY_ENTRY;
+
+struct FIXITY_CONTEXT;
+
+typedef struct FIXITY_WORKER
+{
+    struct FIXITY_CONTEXT *Context;
+    BUFFER_RING Ring;
+    HANDLE Thread;
+} FIXITY_WORKER, *PFIXITY_WORKER;
+
+typedef struct FIXITY_CONTEXT
+{
+    CHAR DriveLetter;
+    DWORD Algorithm;
+    BOOL Check;
+    PRECALL_ITEM Items;
+    DWORD ItemCount;
+    PFIXITY_ENTRY Entries;
+    DWORD WorkerCount;
+    FIXITY_WORKER Workers[FIXITY_MAX_WORKERS];
+    CRITICAL_SECTION Lock;
+    PFIXITY_STATS Stats;
+} FIXITY_CONTEXT, *PFIXITY_CONTEXT;
+
+static BOOL FixityRun(CHAR driveLetter, DWORD algorithm, PLTFS_INDEX index, BOOL check, FILE *manifest, PFIXITY_STATS stats);
+static BOOL FixityEnumerate(CHAR driveLetter, LPCSTR directory, PRECALL_ITEM *items, PDWORD itemCount, PDWORD capacity);
+static BOOL FixityAddItem(LPCSTR path, PRECALL_ITEM *items, PDWORD itemCount, PDWORD capacity);
+static void FixityReadFiles(PFIXITY_CONTEXT context);
+static PFIXITY_WORKER FixityPickWorker(PFIXITY_CONTEXT context);
+static DWORD WINAPI FixityWorker(LPVOID param);
+static void FixityFinishFile(PFIXITY_CONTEXT context, PRECALL_ITEM item, PFIXITY_ENTRY entry, ULONGLONG bytes);
+
+BOOL FixityAlgorithmFromName(LPCSTR name, PDWORD algorithm)
+{
+    if (!_stricmp(name, "sha256"))
+        *algorithm = FIXITY_SHA256;
+    else if (!_stricmp(name, "xxh64") || !_stricmp(name, "xxhash"))
+        *algorithm = FIXITY_XXH64;
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+LPCSTR FixityAttributeName(DWORD algorithm)
+{
+    return algorithm == FIXITY_XXH64 ? "ltfs.hash.xxh64sum" : "ltfs.hash.sha256sum";
+}
+
+BOOL FixityCreateManifest(CHAR driveLetter, DWORD algorithm, PLTFS_INDEX index, FILE *manifest, PFIXITY_STATS stats)
+{
+    return FixityRun(driveLetter, algorithm, index, FALSE, manifest, stats);
+}
+
+BOOL FixityCheckAttributes(CHAR driveLetter, DWORD algorithm, PLTFS_INDEX index, PFIXITY_STATS stats)
+{
+    return FixityRun(driveLetter, algorithm, index, TRUE, NULL, stats);
+}
+
+static BOOL FixityRun(CHAR driveLetter, DWORD algorithm, PLTFS_INDEX index, BOOL check, FILE *manifest, PFIXITY_STATS stats)
+{
+    PFIXITY_CONTEXT context;
+    RECALL_STATS recallStats;
+    SYSTEM_INFO systemInfo;
+    PRECALL_ITEM items = NULL;
+    DWORD itemCount = 0;
+    DWORD capacity = 0;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL result;
+    DWORD i;
+
+    memset(stats, 0, sizeof(FIXITY_STATS));
+
+    if (!FixityEnumerate(driveLetter, "", &items, &itemCount, &capacity))
+    {
+        RecallDestroyFileList(items, itemCount);
+        return FALSE;
+    }
+
+    stats->FilesFound = itemCount;
+
+    // Read in tape order, not directory order. Directory order on a volume that's been written to over time jumps all
+    // over the cartridge and the drive spends more time locating than reading.
+    memset(&recallStats, 0, sizeof(RECALL_STATS));
+    RecallOrderItems(driveLetter, items, itemCount, index, &recallStats);
+    stats->FilesUnplaced = recallStats.FilesUnplaced;
+
+    context = (PFIXITY_CONTEXT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(FIXITY_CONTEXT));
+    result = context != NULL;
+
+    if (result)
+    {
+        context->Entries = (PFIXITY_ENTRY)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(FIXITY_ENTRY) * (itemCount ? itemCount : 1));
+        result = context->Entries != NULL;
+    }
+
+    if (result)
+    {
+        context->DriveLetter = driveLetter;
+        context->Algorithm = algorithm;
+        context->Check = check;
+        context->Items = items;
+        context->ItemCount = itemCount;
+        context->Stats = stats;
+
+        // Entries are kept in the order the files were found, so the manifest comes out in directory order however they were read.
+        for (i = 0; i < itemCount; i++)
+            context->Entries[items[i].Order].Path = items[i].Path;
+
+        InitializeCriticalSection(&context->Lock);
+
+        // Each file goes to one worker in its entirety, as a hash can't be split. Files are spread between workers instead,
+        // each with its own ring so that chunks of one file can't be picked up out of order by someone else.
+        GetSystemInfo(&systemInfo);
+        context->WorkerCount = min(max(systemInfo.dwNumberOfProcessors - 1, 1), FIXITY_MAX_WORKERS);
+
+        for (i = 0; i < context->WorkerCount; i++)
+        {
+            PFIXITY_WORKER worker = &context->Workers[i];
+
+            worker->Context = context;
+
+            if (!RingCreate(&worker->Ring, FIXITY_SLOTS_PER_WORKER, FIXITY_SLOT_SIZE))
+                break;
+
+            worker->Thread = CreateThread(NULL, 0, FixityWorker, worker, 0, NULL);
+
+            if (!worker->Thread)
+            {
+                RingDestroy(&worker->Ring);
+                break;
+            }
+        }
+
+        context->WorkerCount = i;
+        stats->WorkerCount = i;
+
+        result = context->WorkerCount > 0;
+
+        if (result)
+            FixityReadFiles(context);
+
+        for (i = 0; i < context->WorkerCount; i++)
+        {
+            WaitForSingleObject(context->Workers[i].Thread, INFINITE);
+            CloseHandle(context->Workers[i].Thread);
+            RingDestroy(&context->Workers[i].Ring);
+        }
+
+        DeleteCriticalSection(&context->Lock);
+    }
+
+    if (result && manifest)
+    {
+        // Same layout as sha256sum and xxhsum, so the manifest can be checked with either on any platform.
+        for (i = 0; i < itemCount; i++)
+        {
+            PFIXITY_ENTRY entry = &context->Entries[i];
+            CHAR path[MAX_PATH];
+
+            if (entry->Failed)
+                continue;
+
+            strcpy_s(path, _countof(path), entry->Path);
+            StringReplace(path, "\\", "/", _countof(path));
+
+            fprintf(manifest, "%s  %s\n", entry->Digest, path);
+        }
+    }
+
+    if (context)
+    {
+        if (context->Entries)
+            LocalFree(context->Entries);
+
+        LocalFree(context);
+    }
+
+    RecallDestroyFileList(items, itemCount);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result && stats->FilesFailed == 0 && stats->FilesMismatched == 0;
+}
+
+static BOOL FixityEnumerate(CHAR driveLetter, LPCSTR directory, PRECALL_ITEM *items, PDWORD itemCount, PDWORD capacity)
+{
+    CHAR searchPath[MAX_PATH];
+    WIN32_FIND_DATA findData;
+    HANDLE find;
+    BOOL result = TRUE;
+
+    _snprintf_s(searchPath, _countof(searchPath), _TRUNCATE, "%c:\\%s%s*", driveLetter, directory, *directory ? "\\" : "");
+
+    find = FindFirstFile(searchPath, &findData);
+
+    // An empty volume has no entries at all, not even . and ..
+    if (find == INVALID_HANDLE_VALUE)
+        return GetLastError() == ERROR_FILE_NOT_FOUND;
+
+    do
+    {
+        CHAR path[MAX_PATH];
+
+        if (!strcmp(findData.cFileName, ".") || !strcmp(findData.cFileName, ".."))
+            continue;
+
+        _snprintf_s(path, _countof(path), _TRUNCATE, "%s%s%s", directory, *directory ? "\\" : "", findData.cFileName);
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            result = FixityEnumerate(driveLetter, path, items, itemCount, capacity);
+        else
+            result = FixityAddItem(path, items, itemCount, capacity);
+
+    } while (result && FindNextFile(find, &findData));
+
+    FindClose(find);
+
+    return result;
+}
+
+static BOOL FixityAddItem(LPCSTR path, PRECALL_ITEM *items, PDWORD itemCount, PDWORD capacity)
+{
+    PRECALL_ITEM list = *items;
+    size_t length = strlen(path) + 1;
+
+    if (*itemCount == *capacity)
+    {
+        DWORD newCapacity = *capacity ? *capacity * 2 : 256;
+        PRECALL_ITEM newList = (PRECALL_ITEM)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(RECALL_ITEM) * newCapacity);
+
+        if (!newList)
+            return FALSE;
+
+        if (list)
+        {
+            memcpy(newList, list, sizeof(RECALL_ITEM) * *itemCount);
+            LocalFree(list);
+        }
+
+        list = newList;
+        *items = newList;
+        *capacity = newCapacity;
+    }
+
+    list[*itemCount].Path = (LPSTR)LocalAlloc(LMEM_FIXED, length);
+
+    if (!list[*itemCount].Path)
+        return FALSE;
+
+    strcpy_s(list[*itemCount].Path, length, path);
+    list[*itemCount].Order = *itemCount;
+    (*itemCount)++;
+
+    return TRUE;
+}
+
+static void FixityReadFiles(PFIXITY_CONTEXT context)
+{
+    DWORD i;
+
+    for (i = 0; i < context->ItemCount; i++)
+    {
+        PFIXITY_WORKER worker = FixityPickWorker(context);
+        CHAR sourcePath[MAX_PATH];
+        LARGE_INTEGER fileSize;
+        ULONGLONG offset = 0;
+        HANDLE handle;
+        PRING_SLOT slot;
+        BOOL last = FALSE;
+
+        _snprintf_s(sourcePath, _countof(sourcePath), _TRUNCATE, "%c:\\%s", context->DriveLetter, context->Items[i].Path);
+
+        handle = CreateFile(sourcePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+        if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &fileSize))
+        {
+            if (handle != INVALID_HANDLE_VALUE)
+                CloseHandle(handle);
+
+            slot = RingAcquireFree(&worker->Ring);
+
+            if (!slot)
+                break;
+
+            slot->Item = i;
+            slot->Flags = RING_SLOT_FIRST | RING_SLOT_LAST | RING_SLOT_ERROR;
+            RingCommit(&worker->Ring, slot);
+            continue;
+        }
+
+        do
+        {
+            DWORD bytesRead = 0;
+            BOOL result;
+
+            slot = RingAcquireFree(&worker->Ring);
+
+            if (!slot)
+                break;
+
+            result = ReadFile(handle, slot->Buffer, worker->Ring.SlotSize, &bytesRead, NULL);
+
+            slot->Item = i;
+            slot->Offset = offset;
+            slot->Length = result ? bytesRead : 0;
+            slot->Flags = offset == 0 ? RING_SLOT_FIRST : 0;
+
+            offset += slot->Length;
+            last = !result || bytesRead == 0 || offset >= (ULONGLONG)fileSize.QuadPart;
+
+            if (!result || (bytesRead == 0 && offset < (ULONGLONG)fileSize.QuadPart))
+                slot->Flags |= RING_SLOT_ERROR;
+
+            if (last)
+                slot->Flags |= RING_SLOT_LAST;
+
+            RingCommit(&worker->Ring, slot);
+
+        } while (!last);
+
+        CloseHandle(handle);
+
+        if (!slot)
+            break;
+    }
+
+    // Every worker has its own ring, so each needs its own end marker.
+    for (i = 0; i < context->WorkerCount; i++)
+    {
+        if (!RingSubmitEnd(&context->Workers[i].Ring))
+            RingAbort(&context->Workers[i].Ring);
+    }
+}
+
+static PFIXITY_WORKER FixityPickWorker(PFIXITY_CONTEXT context)
+{
+    PFIXITY_WORKER best = &context->Workers[0];
+    LONG64 bestDepth = MAXLONG64;
+    DWORD i;
+
+    // Whoever has the least queued up. This is only a snapshot, but it's enough to stop one big file holding up the next
+    // few small ones behind it, and it doesn't matter when it's wrong.
+    for (i = 0; i < context->WorkerCount; i++)
+    {
+        LONG64 depth = context->Workers[i].Ring.Head - context->Workers[i].Ring.Tail;
+
+        if (depth < bestDepth)
+        {
+            best = &context->Workers[i];
+            bestDepth = depth;
+        }
+    }
+
+    return best;
+}
+
+static DWORD WINAPI FixityWorker(LPVOID param)
+{
+    PFIXITY_WORKER worker = (PFIXITY_WORKER)param;
+    PFIXITY_CONTEXT context = worker->Context;
+    FIXITY_HASH hash;
+    ULONGLONG bytes = 0;
+
+    for (;;)
+    {
+        PRING_SLOT slot = RingAcquireFull(&worker->Ring);
+        PRECALL_ITEM item;
+        PFIXITY_ENTRY entry;
+
+        if (!slot)
+            break;
+
+        if (slot->Flags & RING_SLOT_END)
+        {
+            RingRelease(&worker->Ring, slot);
+            break;
+        }
+
+        item = &context->Items[slot->Item];
+        entry = &context->Entries[item->Order];
+
+        if (slot->Flags & RING_SLOT_FIRST)
+        {
+            FixityHashInit(&hash, context->Algorithm);
+            bytes = 0;
+        }
+
+        if (slot->Flags & RING_SLOT_ERROR)
+            entry->Failed = TRUE;
+
+        if (!entry->Failed && slot->Length)
+        {
+            FixityHashUpdate(&hash, slot->Buffer, slot->Length);
+            bytes += slot->Length;
+        }
+
+        if (slot->Flags & RING_SLOT_LAST)
+        {
+            if (!entry->Failed)
+                FixityHashFinal(&hash, entry->Digest, _countof(entry->Digest));
+
+            FixityFinishFile(context, item, entry, bytes);
+        }
+
+        RingRelease(&worker->Ring, slot);
+    }
+
+    return 0;
+}
+
+static void FixityFinishFile(PFIXITY_CONTEXT context, PRECALL_ITEM item, PFIXITY_ENTRY entry, ULONGLONG bytes)
+{
+    CHAR expected[FIXITY_MAX_DIGEST + 16];
+    BOOL haveExpected = FALSE;
+
+    // The attribute comes out of the in-memory index, so reading it doesn't move the tape.
+    if (context->Check && !entry->Failed)
+    {
+        CHAR sourcePath[MAX_PATH];
+
+        _snprintf_s(sourcePath, _countof(sourcePath), _TRUNCATE, "%c:\\%s", context->DriveLetter, item->Path);
+        haveExpected = ReadExtendedAttribute(sourcePath, FixityAttributeName(context->Algorithm), expected, sizeof(expected));
+    }
+
+    EnterCriticalSection(&context->Lock);
+
+    if (entry->Failed)
+    {
+        fprintf(stderr, "Failed to read %s\r\n", item->Path);
+        context->Stats->FilesFailed++;
+    }
+    else
+    {
+        context->Stats->FilesHashed++;
+        context->Stats->BytesHashed += bytes;
+
+        if (context->Check)
+        {
+            if (!haveExpected)
+            {
+                context->Stats->FilesWithoutHash++;
+            }
+            else if (_stricmp(expected, entry->Digest))
+            {
+                fprintf(stderr, "Mismatch: %s\r\n", item->Path);
+                context->Stats->FilesMismatched++;
+            }
+            else
+            {
+                context->Stats->FilesMatched++;
+            }
+        }
+    }
+
+    LeaveCriticalSection(&context->Lock);
+}
+
+void FixityHashInit(PFIXITY_HASH hash, DWORD algorithm)
+{
+    hash->Algorithm = algorithm;
+
+    if (algorithm == FIXITY_XXH64)
+        Xxh64Init(&hash->Xxh64, 0);
+    else
+        Sha256Init(&hash->Sha256);
+}
+
+void FixityHashUpdate(PFIXITY_HASH hash, const void *data, size_t length)
+{
+    if (hash->Algorithm == FIXITY_XXH64)
+        Xxh64Update(&hash->Xxh64, data, length);
+    else
+        Sha256Update(&hash->Sha256, data, length);
+}
+
+void FixityHashFinal(PFIXITY_HASH hash, LPSTR digest, size_t digestLength)
+{
+    BYTE sha256[SHA256_DIGEST_LENGTH];
+    DWORD i;
+
+    if (hash->Algorithm == FIXITY_XXH64)
+    {
+        // Big endian, as xxhsum prints it.
+        sprintf_s(digest, digestLength, "%016llx", Xxh64Final(&hash->Xxh64));
+        return;
+    }
+
+    Sha256Final(&hash->Sha256, sha256);
+
+    for (i = 0; i < SHA256_DIGEST_LENGTH; i++)
+        sprintf_s(digest + i * 2, digestLength - i * 2, "%02x", sha256[i]);
+}
@@ -0,0 +1,61 @@
+/*
+ *   File:   fixity.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsidx.h"
+#include "sha256.h"
+#include "xxhash.h"
+
+#define FIXITY_SHA256               0
+#define FIXITY_XXH64                1
+
+#define FIXITY_MAX_WORKERS          8
+#define FIXITY_SLOTS_PER_WORKER     4
+#define FIXITY_SLOT_SIZE            (4 * 1024 * 1024)
+#define FIXITY_MAX_DIGEST           (SHA256_DIGEST_LENGTH * 2 + 1)
+
+typedef struct FIXITY_HASH
+{
+    DWORD Algorithm;
+    SHA256_CONTEXT Sha256;
+    XXH64_CONTEXT Xxh64;
+} FIXITY_HASH, *PFIXITY_HASH;
+
+typedef struct FIXITY_STATS
+{
+    DWORD FilesFound;
+    DWORD FilesHashed;
+    DWORD FilesFailed;
+    DWORD FilesUnplaced;
+    DWORD FilesMatched;
+    DWORD FilesMismatched;
+    DWORD FilesWithoutHash;
+    DWORD WorkerCount;
+    ULONGLONG BytesHashed;
+    ULONGLONG ElapsedMs;
+} FIXITY_STATS, *PFIXITY_STATS;
+
+BOOL FixityAlgorithmFromName(LPCSTR name, PDWORD algorithm);
+LPCSTR FixityAttributeName(DWORD algorithm);
+BOOL FixityCreateManifest(CHAR driveLetter, DWORD algorithm, PLTFS_INDEX index, FILE *manifest, PFIXITY_STATS stats);
+BOOL FixityCheckAttributes(CHAR driveLetter, DWORD algorithm, PLTFS_INDEX index, PFIXITY_STATS stats);
+void FixityHashInit(PFIXITY_HASH hash, DWORD algorithm);
+void FixityHashUpdate(PFIXITY_HASH hash, const void *data, size_t length);
+void FixityHashFinal(PFIXITY_HASH hash, LPSTR digest, size_t digestLength);
@@ -149,3 +149,59 @@ BOOL FuseStopService()
 
     return success;
 }
+
+BOOL FuseGetServiceState(PDWORD state)
+{
+    SC_HANDLE smHandle;
+    SC_HANDLE serviceHandle;
+    DWORD bytesNeeded;
+    SERVICE_STATUS_PROCESS serviceData;
+    BOOL success;
+
+    // Only looking, so only asking for enough access to look.
+    smHandle = OpenSCManager(NULL, NULL, SC_MANAGER_CONNECT);
+
+    if (!smHandle)
+        return FALSE;
+
+    serviceHandle = OpenService(smHandle, "fuse4winsvc", SERVICE_QUERY_STATUS);
+
+    if (!serviceHandle)
+    {
+        CloseServiceHandle(smHandle);
+        return FALSE;
+    }
+
+    success = QueryServiceStatusEx(serviceHandle, SC_STATUS_PROCESS_INFO, (LPBYTE)&serviceData, sizeof(serviceData), &bytesNeeded);
+
+    if (success)
+        *state = serviceData.dwCurrentState;
+
+    CloseServiceHandle(serviceHandle);
+    CloseServiceHandle(smHandle);
+
+    return success;
+}
+
+LPCSTR FuseServiceStateName(DWORD state)
+{
+    switch (state)
+    {
+    case SERVICE_STOPPED:
+        return "stopped";
+    case SERVICE_START_PENDING:
+        return "starting";
+    case SERVICE_STOP_PENDING:
+        return "stopping";
+    case SERVICE_RUNNING:
+        return "running";
+    case SERVICE_CONTINUE_PENDING:
+        return "resuming";
+    case SERVICE_PAUSE_PENDING:
+        return "pausing";
+    case SERVICE_PAUSED:
+        return "paused";
+    default:
+        return "unknown";
+    }
+}
@@ -22,3 +22,5 @@
 
 BOOL FuseStartService();
 BOOL FuseStopService();
+BOOL FuseGetServiceState(PDWORD state);
+LPCSTR FuseServiceStateName(DWORD state);
@@ -0,0 +1,998 @@
+/*
+ *   File:   image.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "image.h"
+#include "ring.h"
+#include "tape.h"
+
+// Extra slot flags, on top of the ring's own.
+#define IMAGE_SLOT_STORED       0x10    // Chunk isn't compressed
+
+#define IMAGE_IO_SIZE           (64 * 1024 * 1024)
+
+// Chunks go through three stages: the producer fills a slot, any free worker compresses (or decompresses) it into the
+// slot's own output buffer, and the consumer takes them back in chunk order. Ring tickets are handed out in order, so
+// chunk N is always in slot N % IMAGE_SLOT_COUNT, and the consumer only needs to wait for that slot to be done. The
+// slot isn't released back to the producer until the consumer has finished with it.
+
+typedef struct IMAGE_PIPELINE
+{
+    BUFFER_RING Ring;
+    PBYTE Output;
+    DWORD OutputLength[IMAGE_SLOT_COUNT];
+    HANDLE Done[IMAGE_SLOT_COUNT];
+    BOOL Decompress;
+    DWORD WorkerCount;
+    HANDLE Workers[IMAGE_MAX_WORKERS];
+} IMAGE_PIPELINE, *PIMAGE_PIPELINE;
+
+typedef struct IMAGE_TRANSFER
+{
+    HANDLE Tape;
+    PTAPE_IMAGE Image;
+    PTAPE_LAYOUT Layout;
+    IMAGE_PIPELINE Pipeline;
+    PIMAGE_STATS Stats;
+    BOOL Failed;
+} IMAGE_TRANSFER, *PIMAGE_TRANSFER;
+
+static BOOL ImageDumpRead(PIMAGE_TRANSFER transfer);
+static DWORD WINAPI ImageDumpWriter(LPVOID param);
+static DWORD WINAPI ImageRestoreReader(LPVOID param);
+static BOOL ImageRestoreWrite(PIMAGE_TRANSFER transfer);
+static BOOL ImageAddObject(PTAPE_IMAGE image, DWORD chunk, DWORD offset, DWORD length);
+static BOOL ImageAddChunk(PTAPE_IMAGE image, ULONGLONG offset, DWORD compressedLength, DWORD length, DWORD flags);
+static BOOL ImageLoadChunk(PTAPE_IMAGE image, DWORD chunk);
+static BOOL ImageWriteAll(HANDLE file, const void *data, ULONGLONG length);
+static BOOL ImageReadAll(HANDLE file, ULONGLONG offset, PVOID data, ULONGLONG length);
+static BOOL ImagePipelineCreate(PIMAGE_PIPELINE pipeline, BOOL decompress);
+static void ImagePipelineFinish(PIMAGE_PIPELINE pipeline, PRING_SLOT slot);
+static PRING_SLOT ImagePipelineNext(PIMAGE_PIPELINE pipeline, DWORD chunk, PBYTE *data, PDWORD length);
+static void ImagePipelineDestroy(PIMAGE_PIPELINE pipeline);
+static DWORD WINAPI ImagePipelineWorker(LPVOID param);
+
+BOOL ImageDump(LPCSTR tapeDrive, LPCSTR imageFile, PTAPE_LAYOUT layout, PIMAGE_STATS stats)
+{
+    IMAGE_TRANSFER transfer;
+    HANDLE writerThread = NULL;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL result;
+
+    memset(stats, 0, sizeof(IMAGE_STATS));
+    memset(&transfer, 0, sizeof(transfer));
+
+    transfer.Stats = stats;
+    transfer.Layout = layout;
+    transfer.Tape = TapeOpen(tapeDrive);
+
+    if (transfer.Tape == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    transfer.Image = (PTAPE_IMAGE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(TAPE_IMAGE));
+    result = transfer.Image != NULL;
+
+    if (result)
+    {
+        memcpy(transfer.Image->Header.Magic, IMAGE_MAGIC, sizeof(transfer.Image->Header.Magic));
+        transfer.Image->Header.Version = IMAGE_VERSION;
+
+        transfer.Image->File = CreateFile(imageFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        result = transfer.Image->File != INVALID_HANDLE_VALUE;
+    }
+
+    // Placeholder, the real header goes in at the end once we know where everything is.
+    if (result)
+        result = ImageWriteAll(transfer.Image->File, &transfer.Image->Header, sizeof(IMAGE_HEADER));
+
+    if (result)
+        result = ImagePipelineCreate(&transfer.Pipeline, FALSE);
+
+    if (result)
+    {
+        stats->WorkerCount = transfer.Pipeline.WorkerCount;
+
+        writerThread = CreateThread(NULL, 0, ImageDumpWriter, &transfer, 0, NULL);
+        result = writerThread != NULL;
+
+        if (result)
+        {
+            // The tape is read on this thread and nothing else happens here, so the drive is never kept waiting
+            // unless all of the slots are full.
+            result = ImageDumpRead(&transfer);
+
+            WaitForSingleObject(writerThread, INFINITE);
+            CloseHandle(writerThread);
+
+            result = result && !transfer.Failed;
+        }
+        else
+        {
+            RingAbort(&transfer.Pipeline.Ring);
+        }
+
+        ImagePipelineDestroy(&transfer.Pipeline);
+    }
+
+    if (result)
+    {
+        PTAPE_IMAGE image = transfer.Image;
+
+        image->Header.ChunkTableOffset = stats->ImageBytes;
+        image->Header.ObjectTableOffset = image->Header.ChunkTableOffset + sizeof(IMAGE_CHUNK) * (ULONGLONG)image->Header.ChunkCount;
+
+        result = ImageWriteAll(image->File, image->Chunks, sizeof(IMAGE_CHUNK) * (ULONGLONG)image->Header.ChunkCount) &&
+            ImageWriteAll(image->File, image->Objects, sizeof(IMAGE_OBJECT) * image->Header.ObjectCount);
+
+        stats->ImageBytes = image->Header.ObjectTableOffset + sizeof(IMAGE_OBJECT) * image->Header.ObjectCount;
+
+        if (result)
+        {
+            LARGE_INTEGER start;
+
+            start.QuadPart = 0;
+            result = SetFilePointerEx(image->File, start, NULL, FILE_BEGIN) && ImageWriteAll(image->File, &image->Header, sizeof(IMAGE_HEADER));
+        }
+    }
+
+    if (transfer.Image)
+    {
+        BOOL created = transfer.Image->File && transfer.Image->File != INVALID_HANDLE_VALUE;
+
+        if (created && !CloseHandle(transfer.Image->File))
+            result = FALSE;
+
+        transfer.Image->File = NULL;
+
+        // Half an image is no use to anybody.
+        if (created && !result)
+            DeleteFile(imageFile);
+
+        ImageClose(transfer.Image);
+    }
+
+    CloseHandle(transfer.Tape);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result;
+}
+
+BOOL ImageRestore(LPCSTR imageFile, LPCSTR tapeDrive, PIMAGE_STATS stats)
+{
+    IMAGE_TRANSFER transfer;
+    HANDLE readerThread;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL result;
+
+    memset(stats, 0, sizeof(IMAGE_STATS));
+    memset(&transfer, 0, sizeof(transfer));
+
+    transfer.Stats = stats;
+
+    if (!ImageOpen(imageFile, &transfer.Image))
+        return FALSE;
+
+    transfer.Tape = TapeOpen(tapeDrive);
+    result = transfer.Tape != INVALID_HANDLE_VALUE;
+
+    if (result)
+        result = ImagePipelineCreate(&transfer.Pipeline, TRUE);
+
+    if (result)
+    {
+        stats->WorkerCount = transfer.Pipeline.WorkerCount;
+        stats->ImageBytes = transfer.Image->Header.ObjectTableOffset + sizeof(IMAGE_OBJECT) * transfer.Image->Header.ObjectCount;
+
+        readerThread = CreateThread(NULL, 0, ImageRestoreReader, &transfer, 0, NULL);
+        result = readerThread != NULL;
+
+        if (result)
+        {
+            // Mirror image of the dump: the image file is read on the other thread and this one does nothing but write to tape.
+            result = ImageRestoreWrite(&transfer);
+
+            WaitForSingleObject(readerThread, INFINITE);
+            CloseHandle(readerThread);
+
+            result = result && !transfer.Failed;
+        }
+        else
+        {
+            RingAbort(&transfer.Pipeline.Ring);
+        }
+
+        ImagePipelineDestroy(&transfer.Pipeline);
+    }
+
+    if (transfer.Tape != INVALID_HANDLE_VALUE)
+        CloseHandle(transfer.Tape);
+
+    ImageClose(transfer.Image);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result;
+}
+
+BOOL ImageOpen(LPCSTR imageFile, PTAPE_IMAGE *image)
+{
+    PTAPE_IMAGE newImage;
+    BOOL result;
+
+    newImage = (PTAPE_IMAGE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(TAPE_IMAGE));
+
+    if (!newImage)
+        return FALSE;
+
+    newImage->CachedChunk = MAXDWORD;
+    newImage->File = CreateFile(imageFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+
+    result = newImage->File != INVALID_HANDLE_VALUE;
+
+    if (result)
+    {
+        result = ImageReadAll(newImage->File, 0, &newImage->Header, sizeof(IMAGE_HEADER)) &&
+            !memcmp(newImage->Header.Magic, IMAGE_MAGIC, sizeof(newImage->Header.Magic)) &&
+            newImage->Header.Version == IMAGE_VERSION &&
+            newImage->Header.PartitionCount <= IMAGE_MAX_PARTITIONS;
+
+        if (!result)
+            fprintf(stderr, "%s is not a tape image\r\n", imageFile);
+    }
+
+    if (result)
+    {
+        newImage->Chunks = (PIMAGE_CHUNK)LocalAlloc(LMEM_FIXED, sizeof(IMAGE_CHUNK) * ((SIZE_T)newImage->Header.ChunkCount + 1));
+        newImage->Objects = (PIMAGE_OBJECT)LocalAlloc(LMEM_FIXED, sizeof(IMAGE_OBJECT) * ((SIZE_T)newImage->Header.ObjectCount + 1));
+
+        result = newImage->Chunks && newImage->Objects &&
+            ImageReadAll(newImage->File, newImage->Header.ChunkTableOffset, newImage->Chunks, sizeof(IMAGE_CHUNK) * (ULONGLONG)newImage->Header.ChunkCount) &&
+            ImageReadAll(newImage->File, newImage->Header.ObjectTableOffset, newImage->Objects, sizeof(IMAGE_OBJECT) * newImage->Header.ObjectCount);
+    }
+
+    if (result)
+        result = CreateDecompressor(COMPRESS_ALGORITHM_XPRESS, NULL, &newImage->Decompressor);
+
+    if (!result)
+    {
+        ImageClose(newImage);
+        return FALSE;
+    }
+
+    *image = newImage;
+    return TRUE;
+}
+
+BOOL ImageReadBlock(PTAPE_IMAGE image, DWORD partition, ULONGLONG block, PVOID buffer, DWORD bufferLength, PDWORD bytesRead, PBOOL filemark)
+{
+    PIMAGE_OBJECT object;
+
+    if (partition >= image->Header.PartitionCount || block >= image->Header.Partitions[partition].ObjectCount)
+        return FALSE;
+
+    // Straight to the object, then to its chunk. Only the one chunk has to be read and expanded.
+    object = &image->Objects[image->Header.Partitions[partition].FirstObject + block];
+
+    *bytesRead = 0;
+    *filemark = object->Length == IMAGE_FILEMARK;
+
+    if (*filemark)
+        return TRUE;
+
+    if (object->Length > bufferLength)
+        return FALSE;
+
+    if (!ImageLoadChunk(image, object->Chunk))
+        return FALSE;
+
+    memcpy(buffer, image->Cache + object->Offset, object->Length);
+    *bytesRead = object->Length;
+
+    return TRUE;
+}
+
+// The index partition ends ... FM [index] FM, same as on tape. Both filemarks are in the object table, so the index
+// can be sized and pulled out without reading anything else.
+
+BOOL ImageReadIndex(PTAPE_IMAGE image, PLTFS_INDEX *index)
+{
+    PIMAGE_PARTITION partition;
+    ULONGLONG first, last, block;
+    PBYTE xml;
+    size_t length = 0;
+    BOOL filemark;
+    BOOL result = TRUE;
+
+    if (image->Header.PartitionCount <= LTFS_INDEX_PARTITION)
+        return FALSE;
+
+    partition = &image->Header.Partitions[LTFS_INDEX_PARTITION];
+
+    for (last = partition->ObjectCount; last > 0 && image->Objects[partition->FirstObject + last - 1].Length != IMAGE_FILEMARK; last--);
+
+    if (last-- == 0)
+        return FALSE;
+
+    for (first = last; first > 0 && image->Objects[partition->FirstObject + first - 1].Length != IMAGE_FILEMARK; first--);
+
+    // first is now the index's first block and last the filemark after it.
+    if (first == 0 || first == last)
+        return FALSE;
+
+    for (block = first; block < last; block++)
+        length += image->Objects[partition->FirstObject + block].Length;
+
+    xml = (PBYTE)LocalAlloc(LMEM_FIXED, length + 1);
+
+    if (!xml)
+        return FALSE;
+
+    length = 0;
+
+    for (block = first; result && block < last; block++)
+    {
+        DWORD bytesRead;
+
+        result = ImageReadBlock(image, LTFS_INDEX_PARTITION, block, xml + length, IMAGE_MAX_BLOCK_SIZE, &bytesRead, &filemark);
+        length += bytesRead;
+    }
+
+    if (result)
+    {
+        xml[length] = '\0';
+        result = LtfsIndexParse((LPCSTR)xml, length, index);
+    }
+
+    LocalFree(xml);
+
+    return result;
+}
+
+void ImageClose(PTAPE_IMAGE image)
+{
+    if (!image)
+        return;
+
+    if (image->File && image->File != INVALID_HANDLE_VALUE)
+        CloseHandle(image->File);
+
+    if (image->Decompressor)
+        CloseDecompressor(image->Decompressor);
+
+    if (image->Chunks)
+        LocalFree(image->Chunks);
+
+    if (image->Objects)
+        LocalFree(image->Objects);
+
+    if (image->Cache)
+        LocalFree(image->Cache);
+
+    if (image->CompressedCache)
+        LocalFree(image->CompressedCache);
+
+    LocalFree(image);
+}
+
+static BOOL ImageDumpRead(PIMAGE_TRANSFER transfer)
+{
+    PTAPE_IMAGE image = transfer->Image;
+    PBUFFER_RING ring = &transfer->Pipeline.Ring;
+    PRING_SLOT slot = NULL;
+    DWORD chunk = 0;
+    DWORD partitionCount = transfer->Layout ? min(transfer->Layout->PartitionCount, IMAGE_MAX_PARTITIONS) : IMAGE_MAX_PARTITIONS;
+    DWORD partition;
+    BOOL result = TRUE;
+
+    for (partition = 0; result && partition < partitionCount; partition++)
+    {
+        PIMAGE_PARTITION imagePartition = &image->Header.Partitions[partition];
+
+        // Same as the layout scan, just try each partition until one isn't there. With a map, we already know.
+        if (!TapeLocate(transfer->Tape, TAPE_LOCATE_BLOCK, partition, 0, NULL))
+        {
+            if (transfer->Layout)
+                fprintf(stderr, "Partition %u is in the map but not on the tape\r\n", partition);
+
+            result = partition > 0 && !transfer->Layout;
+            break;
+        }
+
+        image->Header.PartitionCount++;
+        imagePartition->FirstObject = image->Header.ObjectCount;
+
+        for (;;)
+        {
+            TAPE_SENSE sense;
+            ULONG bytesRead;
+
+            // The map says where the data ends, so stop there rather than read on until the drive finds blank tape.
+            // Older drives can take a long time to decide, and some will carry on into whatever was there before.
+            if (transfer->Layout && image->Header.ObjectCount - imagePartition->FirstObject >= transfer->Layout->Partitions[partition].EndOfData)
+                break;
+
+            if (!slot)
+            {
+                slot = RingAcquireFree(ring);
+
+                if (!slot)
+                {
+                    result = FALSE;
+                    break;
+                }
+
+                slot->Item = chunk;
+            }
+
+            // Ship the chunk as soon as the biggest possible block wouldn't fit in what's left of it.
+            if (ring->SlotSize - slot->Length < IMAGE_MAX_BLOCK_SIZE)
+            {
+                RingCommit(ring, slot);
+                slot = NULL;
+                chunk++;
+                continue;
+            }
+
+            if (TapeRead(transfer->Tape, slot->Buffer + slot->Length, IMAGE_MAX_BLOCK_SIZE, &bytesRead, &sense))
+            {
+                result = ImageAddObject(image, chunk, slot->Length, bytesRead);
+                slot->Length += bytesRead;
+
+                transfer->Stats->Blocks++;
+                transfer->Stats->Bytes += bytesRead;
+            }
+            else if (sense.Filemark)
+            {
+                result = ImageAddObject(image, chunk, slot->Length, IMAGE_FILEMARK);
+                transfer->Stats->Filemarks++;
+            }
+            else if (sense.SenseKey == SCSI_SENSE_BLANK_CHECK || (sense.EndOfMedium && sense.SenseKey != SCSI_SENSE_MEDIUM_ERROR))
+            {
+                // Short of where the map has the data ending, so it was made from some other tape.
+                if (transfer->Layout)
+                {
+                    fprintf(stderr, "Partition %u ends at block %llu, the map has it at %llu\r\n", partition,
+                        image->Header.ObjectCount - imagePartition->FirstObject, transfer->Layout->Partitions[partition].EndOfData);
+                    result = FALSE;
+                }
+
+                break;
+            }
+            else
+            {
+                // A hole in the image would put every block after it in the wrong place on restore, so there's no carrying on.
+                fprintf(stderr, "Read error in partition %u at block %llu\r\n", partition, image->Header.ObjectCount - imagePartition->FirstObject);
+                result = FALSE;
+            }
+
+            if (!result)
+                break;
+        }
+
+        imagePartition->ObjectCount = image->Header.ObjectCount - imagePartition->FirstObject;
+    }
+
+    transfer->Stats->PartitionCount = image->Header.PartitionCount;
+
+    // The last chunk goes out however little is in it, even if that's only filemarks, so every object has a chunk.
+    if (slot && result)
+    {
+        RingCommit(ring, slot);
+        slot = NULL;
+    }
+
+    ImagePipelineFinish(&transfer->Pipeline, slot);
+
+    return result;
+}
+
+static DWORD WINAPI ImageDumpWriter(LPVOID param)
+{
+    PIMAGE_TRANSFER transfer = (PIMAGE_TRANSFER)param;
+    PTAPE_IMAGE image = transfer->Image;
+    ULONGLONG offset = sizeof(IMAGE_HEADER);
+    DWORD chunk;
+
+    for (chunk = 0; ; chunk++)
+    {
+        PRING_SLOT slot;
+        PBYTE data;
+        DWORD length;
+
+        slot = ImagePipelineNext(&transfer->Pipeline, chunk, &data, &length);
+
+        if (slot->Flags & RING_SLOT_END)
+            break;
+
+        if (!ImageAddChunk(image, offset, length, slot->Length, (slot->Flags & IMAGE_SLOT_STORED) ? IMAGE_CHUNK_STORED : 0) ||
+            !ImageWriteAll(image->File, data, length))
+        {
+            fprintf(stderr, "Failed to write image\r\n");
+            transfer->Failed = TRUE;
+            RingAbort(&transfer->Pipeline.Ring);
+            break;
+        }
+
+        offset += length;
+
+        RingRelease(&transfer->Pipeline.Ring, slot);
+    }
+
+    transfer->Stats->ImageBytes = offset;
+
+    return 0;
+}
+
+static DWORD WINAPI ImageRestoreReader(LPVOID param)
+{
+    PIMAGE_TRANSFER transfer = (PIMAGE_TRANSFER)param;
+    PTAPE_IMAGE image = transfer->Image;
+    PBUFFER_RING ring = &transfer->Pipeline.Ring;
+    PRING_SLOT slot = NULL;
+    DWORD chunk;
+
+    for (chunk = 0; chunk < image->Header.ChunkCount; chunk++)
+    {
+        PIMAGE_CHUNK imageChunk = &image->Chunks[chunk];
+
+        slot = RingAcquireFree(ring);
+
+        if (!slot)
+            return 1;
+
+        if (imageChunk->CompressedLength > ring->SlotSize || imageChunk->Length > IMAGE_CHUNK_SIZE ||
+            !ImageReadAll(image->File, imageChunk->Offset, slot->Buffer, imageChunk->CompressedLength))
+        {
+            fprintf(stderr, "Failed to read chunk %u from image\r\n", chunk);
+            transfer->Failed = TRUE;
+            break;
+        }
+
+        slot->Item = chunk;
+        slot->Length = imageChunk->CompressedLength;
+        slot->Flags = (imageChunk->Flags & IMAGE_CHUNK_STORED) ? IMAGE_SLOT_STORED : 0;
+
+        RingCommit(ring, slot);
+        slot = NULL;
+    }
+
+    ImagePipelineFinish(&transfer->Pipeline, slot);
+
+    return 0;
+}
+
+static BOOL ImageRestoreWrite(PIMAGE_TRANSFER transfer)
+{
+    PTAPE_IMAGE image = transfer->Image;
+    ULONGLONG object = 0;
+    DWORD partition = MAXDWORD;
+    DWORD chunk;
+    BOOL result = TRUE;
+
+    for (chunk = 0; result; chunk++)
+    {
+        PRING_SLOT slot;
+        PBYTE data;
+        DWORD length;
+
+        slot = ImagePipelineNext(&transfer->Pipeline, chunk, &data, &length);
+
+        if (slot->Flags & RING_SLOT_END)
+            break;
+
+        if ((slot->Flags & RING_SLOT_ERROR) || length != image->Chunks[chunk].Length)
+        {
+            fprintf(stderr, "Chunk %u of the image is corrupt\r\n", chunk);
+            result = FALSE;
+        }
+
+        while (result && object < image->Header.ObjectCount && image->Objects[object].Chunk == chunk)
+        {
+            PIMAGE_OBJECT imageObject = &image->Objects[object];
+            TAPE_SENSE sense;
+
+            // Moving into the next partition. The cartridge has to be partitioned the same way as the one the image
+            // came from, we don't attempt to do that here.
+            if (partition == MAXDWORD || object >= image->Header.Partitions[partition].FirstObject + image->Header.Partitions[partition].ObjectCount)
+            {
+                do
+                {
+                    partition++;
+                } while (partition < image->Header.PartitionCount && !image->Header.Partitions[partition].ObjectCount);
+
+                result = partition < image->Header.PartitionCount && TapeLocate(transfer->Tape, TAPE_LOCATE_BLOCK, partition, 0, NULL);
+
+                if (!result)
+                {
+                    fprintf(stderr, "Cannot move to partition %u. The tape must be partitioned the same as the image.\r\n", partition);
+                    break;
+                }
+            }
+
+            if (imageObject->Length == IMAGE_FILEMARK)
+            {
+                result = TapeWriteFilemarks(transfer->Tape, 1, &sense);
+                transfer->Stats->Filemarks++;
+            }
+            else
+            {
+                result = imageObject->Offset + (ULONGLONG)imageObject->Length <= length &&
+                    TapeWrite(transfer->Tape, data + imageObject->Offset, imageObject->Length, &sense);
+
+                transfer->Stats->Blocks++;
+                transfer->Stats->Bytes += imageObject->Length;
+            }
+
+            if (!result)
+                fprintf(stderr, "Write failed in partition %u at block %llu\r\n", partition, object - image->Header.Partitions[partition].FirstObject);
+
+            object++;
+        }
+
+        RingRelease(&transfer->Pipeline.Ring, slot);
+    }
+
+    if (result && object != image->Header.ObjectCount)
+    {
+        fprintf(stderr, "Image is incomplete\r\n");
+        result = FALSE;
+    }
+
+    if (!result)
+        RingAbort(&transfer->Pipeline.Ring);
+
+    transfer->Stats->PartitionCount = image->Header.PartitionCount;
+
+    return result;
+}
+
+static BOOL ImageAddObject(PTAPE_IMAGE image, DWORD chunk, DWORD offset, DWORD length)
+{
+    PIMAGE_OBJECT object;
+
+    if (image->Header.ObjectCount == image->ObjectCapacity)
+    {
+        ULONGLONG newCapacity = image->ObjectCapacity ? image->ObjectCapacity * 2 : 65536;
+        PIMAGE_OBJECT objects = (PIMAGE_OBJECT)LocalAlloc(LMEM_FIXED, (SIZE_T)(sizeof(IMAGE_OBJECT) * newCapacity));
+
+        if (!objects)
+            return FALSE;
+
+        if (image->Objects)
+        {
+            memcpy(objects, image->Objects, (SIZE_T)(sizeof(IMAGE_OBJECT) * image->Header.ObjectCount));
+            LocalFree(image->Objects);
+        }
+
+        image->Objects = objects;
+        image->ObjectCapacity = newCapacity;
+    }
+
+    object = &image->Objects[image->Header.ObjectCount++];
+    object->Chunk = chunk;
+    object->Offset = offset;
+    object->Length = length;
+
+    return TRUE;
+}
+
+static BOOL ImageAddChunk(PTAPE_IMAGE image, ULONGLONG offset, DWORD compressedLength, DWORD length, DWORD flags)
+{
+    PIMAGE_CHUNK chunk;
+
+    if (image->Header.ChunkCount == image->ChunkCapacity)
+    {
+        DWORD newCapacity = image->ChunkCapacity ? image->ChunkCapacity * 2 : 1024;
+        PIMAGE_CHUNK chunks = (PIMAGE_CHUNK)LocalAlloc(LMEM_FIXED, sizeof(IMAGE_CHUNK) * newCapacity);
+
+        if (!chunks)
+            return FALSE;
+
+        if (image->Chunks)
+        {
+            memcpy(chunks, image->Chunks, sizeof(IMAGE_CHUNK) * image->Header.ChunkCount);
+            LocalFree(image->Chunks);
+        }
+
+        image->Chunks = chunks;
+        image->ChunkCapacity = newCapacity;
+    }
+
+    chunk = &image->Chunks[image->Header.ChunkCount++];
+    chunk->Offset = offset;
+    chunk->CompressedLength = compressedLength;
+    chunk->Length = length;
+    chunk->Flags = flags;
+    chunk->Reserved = 0;
+
+    return TRUE;
+}
+
+static BOOL ImageLoadChunk(PTAPE_IMAGE image, DWORD chunk)
+{
+    PIMAGE_CHUNK imageChunk;
+    SIZE_T length;
+
+    if (image->CachedChunk == chunk)
+        return TRUE;
+
+    if (chunk >= image->Header.ChunkCount)
+        return FALSE;
+
+    imageChunk = &image->Chunks[chunk];
+
+    if (imageChunk->CompressedLength > IMAGE_CHUNK_SIZE || imageChunk->Length > IMAGE_CHUNK_SIZE)
+        return FALSE;
+
+    if (!image->Cache)
+        image->Cache = (PBYTE)LocalAlloc(LMEM_FIXED, IMAGE_CHUNK_SIZE);
+
+    if (!image->CompressedCache)
+        image->CompressedCache = (PBYTE)LocalAlloc(LMEM_FIXED, IMAGE_CHUNK_SIZE);
+
+    if (!image->Cache || !image->CompressedCache)
+        return FALSE;
+
+    image->CachedChunk = MAXDWORD;
+
+    if (imageChunk->Flags & IMAGE_CHUNK_STORED)
+    {
+        if (!ImageReadAll(image->File, imageChunk->Offset, image->Cache, imageChunk->Length))
+            return FALSE;
+    }
+    else
+    {
+        if (!ImageReadAll(image->File, imageChunk->Offset, image->CompressedCache, imageChunk->CompressedLength))
+            return FALSE;
+
+        if (!Decompress(image->Decompressor, image->CompressedCache, imageChunk->CompressedLength, image->Cache, IMAGE_CHUNK_SIZE, &length) ||
+            length != imageChunk->Length)
+            return FALSE;
+    }
+
+    image->CachedChunk = chunk;
+    return TRUE;
+}
+
+static BOOL ImageWriteAll(HANDLE file, const void *data, ULONGLONG length)
+{
+    const BYTE *pos = (const BYTE *)data;
+
+    // WriteFile only takes a DWORD, and the object table for a full cartridge can be bigger than that.
+    while (length)
+    {
+        DWORD chunk = (DWORD)min(length, IMAGE_IO_SIZE);
+        DWORD bytesWritten;
+
+        if (!WriteFile(file, pos, chunk, &bytesWritten, NULL) || bytesWritten != chunk)
+            return FALSE;
+
+        pos += chunk;
+        length -= chunk;
+    }
+
+    return TRUE;
+}
+
+static BOOL ImageReadAll(HANDLE file, ULONGLONG offset, PVOID data, ULONGLONG length)
+{
+    PBYTE pos = (PBYTE)data;
+    LARGE_INTEGER position;
+
+    position.QuadPart = offset;
+
+    if (!SetFilePointerEx(file, position, NULL, FILE_BEGIN))
+        return FALSE;
+
+    while (length)
+    {
+        DWORD chunk = (DWORD)min(length, IMAGE_IO_SIZE);
+        DWORD bytesRead;
+
+        if (!ReadFile(file, pos, chunk, &bytesRead, NULL) || bytesRead != chunk)
+            return FALSE;
+
+        pos += chunk;
+        length -= chunk;
+    }
+
+    return TRUE;
+}
+
+static BOOL ImagePipelineCreate(PIMAGE_PIPELINE pipeline, BOOL decompress)
+{
+    SYSTEM_INFO systemInfo;
+    DWORD workerCount;
+    DWORD i;
+
+    memset(pipeline, 0, sizeof(IMAGE_PIPELINE));
+
+    pipeline->Decompress = decompress;
+
+    if (!RingCreate(&pipeline->Ring, IMAGE_SLOT_COUNT, IMAGE_CHUNK_SIZE))
+        return FALSE;
+
+    pipeline->Output = (PBYTE)VirtualAlloc(NULL, (SIZE_T)IMAGE_SLOT_COUNT * IMAGE_CHUNK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (!pipeline->Output)
+    {
+        RingDestroy(&pipeline->Ring);
+        return FALSE;
+    }
+
+    for (i = 0; i < IMAGE_SLOT_COUNT; i++)
+    {
+        pipeline->Done[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+        if (!pipeline->Done[i])
+        {
+            ImagePipelineDestroy(pipeline);
+            return FALSE;
+        }
+    }
+
+    // One core for each end of the transfer, the rest compress. There must always be fewer workers than slots, as each
+    // worker gets its own end marker and they all have to fit in the ring.
+    GetSystemInfo(&systemInfo);
+    workerCount = min(max(systemInfo.dwNumberOfProcessors, 3) - 2, IMAGE_MAX_WORKERS);
+
+    for (i = 0; i < workerCount; i++)
+    {
+        pipeline->Workers[i] = CreateThread(NULL, 0, ImagePipelineWorker, pipeline, 0, NULL);
+
+        if (!pipeline->Workers[i])
+            break;
+    }
+
+    pipeline->WorkerCount = i;
+
+    if (!pipeline->WorkerCount)
+    {
+        ImagePipelineDestroy(pipeline);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void ImagePipelineFinish(PIMAGE_PIPELINE pipeline, PRING_SLOT slot)
+{
+    DWORD i;
+
+    // One end marker per worker, starting with the slot the producer may still be holding.
+    for (i = 0; i < pipeline->WorkerCount; i++)
+    {
+        if (!slot)
+            slot = RingAcquireFree(&pipeline->Ring);
+
+        if (!slot)
+            return;
+
+        slot->Flags = RING_SLOT_END;
+        RingCommit(&pipeline->Ring, slot);
+        slot = NULL;
+    }
+}
+
+static PRING_SLOT ImagePipelineNext(PIMAGE_PIPELINE pipeline, DWORD chunk, PBYTE *data, PDWORD length)
+{
+    DWORD index = chunk % pipeline->Ring.SlotCount;
+    PRING_SLOT slot = &pipeline->Ring.Slots[index];
+
+    WaitForSingleObject(pipeline->Done[index], INFINITE);
+
+    if (slot->Flags & IMAGE_SLOT_STORED)
+    {
+        *data = slot->Buffer;
+        *length = slot->Length;
+    }
+    else
+    {
+        *data = pipeline->Output + (SIZE_T)index * IMAGE_CHUNK_SIZE;
+        *length = pipeline->OutputLength[index];
+    }
+
+    return slot;
+}
+
+static void ImagePipelineDestroy(PIMAGE_PIPELINE pipeline)
+{
+    DWORD i;
+
+    for (i = 0; i < pipeline->WorkerCount; i++)
+    {
+        WaitForSingleObject(pipeline->Workers[i], INFINITE);
+        CloseHandle(pipeline->Workers[i]);
+    }
+
+    for (i = 0; i < IMAGE_SLOT_COUNT; i++)
+    {
+        if (pipeline->Done[i])
+            CloseHandle(pipeline->Done[i]);
+    }
+
+    if (pipeline->Output)
+        VirtualFree(pipeline->Output, 0, MEM_RELEASE);
+
+    RingDestroy(&pipeline->Ring);
+
+    memset(pipeline, 0, sizeof(IMAGE_PIPELINE));
+}
+
+static DWORD WINAPI ImagePipelineWorker(LPVOID param)
+{
+    PIMAGE_PIPELINE pipeline = (PIMAGE_PIPELINE)param;
+    COMPRESSOR_HANDLE compressor = NULL;
+    DECOMPRESSOR_HANDLE decompressor = NULL;
+    BOOL ready;
+
+    // Compressor handles can't be shared between threads, so each worker has its own.
+    if (pipeline->Decompress)
+        ready = CreateDecompressor(COMPRESS_ALGORITHM_XPRESS, NULL, &decompressor);
+    else
+        ready = CreateCompressor(COMPRESS_ALGORITHM_XPRESS, NULL, &compressor);
+
+    for (;;)
+    {
+        PRING_SLOT slot = RingAcquireFull(&pipeline->Ring);
+        DWORD index;
+        SIZE_T length = 0;
+        BOOL end;
+
+        if (!slot)
+            break;
+
+        index = (DWORD)(slot - pipeline->Ring.Slots);
+        end = (slot->Flags & RING_SLOT_END) != 0;
+
+        if (!end && !(slot->Flags & IMAGE_SLOT_STORED))
+        {
+            PBYTE output = pipeline->Output + (SIZE_T)index * IMAGE_CHUNK_SIZE;
+
+            if (pipeline->Decompress)
+            {
+                if (!ready || !Decompress(decompressor, slot->Buffer, slot->Length, output, IMAGE_CHUNK_SIZE, &length))
+                    slot->Flags |= RING_SLOT_ERROR;
+            }
+            else
+            {
+                // The output buffer is only as big as the input, so anything that won't shrink (already compressed data,
+                // mostly) fails here and is stored as it is instead.
+                if (!slot->Length || !ready || !Compress(compressor, slot->Buffer, slot->Length, output, slot->Length, &length) || length >= slot->Length)
+                    slot->Flags |= IMAGE_SLOT_STORED;
+            }
+        }
+
+        pipeline->OutputLength[index] = (DWORD)length;
+
+        // Done with it. The consumer releases it, after which it can be refilled at any moment, so don't touch it again.
+        SetEvent(pipeline->Done[index]);
+
+        if (end)
+            break;
+    }
+
+    if (compressor)
+        CloseCompressor(compressor);
+
+    if (decompressor)
+        CloseDecompressor(decompressor);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ *   File:   image.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include <compressapi.h>
+#include "ltfsidx.h"
+#include "layout.h"
+
+// Image file layout:
+//
+//   IMAGE_HEADER                 at offset 0, rewritten once the dump is complete
+//   chunk data                   compressed chunks back to back
+//   IMAGE_CHUNK[ChunkCount]      at ChunkTableOffset
+//   IMAGE_OBJECT[ObjectCount]    at ObjectTableOffset
+//
+// Every block and filemark on the tape is one object, in tape order, partition by partition. Logical object N of
+// partition P is therefore Objects[Partitions[P].FirstObject + N], which is the block number LOCATE would use.
+
+#define IMAGE_MAGIC             "LTFSIMG1"
+#define IMAGE_VERSION           1
+#define IMAGE_MAX_PARTITIONS    4
+#define IMAGE_CHUNK_SIZE        (8 * 1024 * 1024)
+#define IMAGE_MAX_BLOCK_SIZE    LTFS_MAX_BLOCK_SIZE
+#define IMAGE_SLOT_COUNT        16
+#define IMAGE_MAX_WORKERS       8
+
+#define IMAGE_FILEMARK          0xFFFFFFFF
+#define IMAGE_CHUNK_STORED      0x01    // Didn't compress, so it's stored as is
+
+typedef struct IMAGE_PARTITION
+{
+    ULONGLONG FirstObject;
+    ULONGLONG ObjectCount;
+} IMAGE_PARTITION, *PIMAGE_PARTITION;
+
+typedef struct IMAGE_HEADER
+{
+    CHAR Magic[8];
+    DWORD Version;
+    DWORD PartitionCount;
+    DWORD ChunkCount;
+    DWORD Reserved;
+    ULONGLONG ObjectCount;
+    ULONGLONG ChunkTableOffset;
+    ULONGLONG ObjectTableOffset;
+    IMAGE_PARTITION Partitions[IMAGE_MAX_PARTITIONS];
+} IMAGE_HEADER, *PIMAGE_HEADER;
+
+typedef struct IMAGE_CHUNK
+{
+    ULONGLONG Offset;
+    DWORD CompressedLength;
+    DWORD Length;
+    DWORD Flags;
+    DWORD Reserved;
+} IMAGE_CHUNK, *PIMAGE_CHUNK;
+
+typedef struct IMAGE_OBJECT
+{
+    DWORD Chunk;
+    DWORD Offset;
+    DWORD Length;   // IMAGE_FILEMARK for a filemark
+} IMAGE_OBJECT, *PIMAGE_OBJECT;
+
+typedef struct TAPE_IMAGE
+{
+    HANDLE File;
+    IMAGE_HEADER Header;
+    PIMAGE_CHUNK Chunks;
+    PIMAGE_OBJECT Objects;
+    ULONGLONG ObjectCapacity;
+    DWORD ChunkCapacity;
+    DWORD CachedChunk;
+    PBYTE Cache;
+    PBYTE CompressedCache;
+    DECOMPRESSOR_HANDLE Decompressor;
+} TAPE_IMAGE, *PTAPE_IMAGE;
+
+typedef struct IMAGE_STATS
+{
+    DWORD PartitionCount;
+    DWORD WorkerCount;
+    ULONGLONG Blocks;
+    ULONGLONG Filemarks;
+    ULONGLONG Bytes;
+    ULONGLONG ImageBytes;
+    ULONGLONG ElapsedMs;
+} IMAGE_STATS, *PIMAGE_STATS;
+
+BOOL ImageDump(LPCSTR tapeDrive, LPCSTR imageFile, PTAPE_LAYOUT layout, PIMAGE_STATS stats);
+BOOL ImageRestore(LPCSTR imageFile, LPCSTR tapeDrive, PIMAGE_STATS stats);
+BOOL ImageOpen(LPCSTR imageFile, PTAPE_IMAGE *image);
+BOOL ImageReadBlock(PTAPE_IMAGE image, DWORD partition, ULONGLONG block, PVOID buffer, DWORD bufferLength, PDWORD bytesRead, PBOOL filemark);
+BOOL ImageReadIndex(PTAPE_IMAGE image, PLTFS_INDEX *index);
+void ImageClose(PTAPE_IMAGE image);
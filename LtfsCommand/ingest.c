@@ -0,0 +1,454 @@
+/*
+ *   File:   ingest.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "ingest.h"
+#include "ring.h"
+#include "util.h"
+
+typedef struct INGEST_FILE
+{
+    LPSTR Path;
+    ULONGLONG Size;
+    CHAR Digest[FIXITY_MAX_DIGEST];
+} INGEST_FILE, *PINGEST_FILE;
+
+struct INGEST_CONTEXT;
+
+typedef struct INGEST_READER
+{
+    struct INGEST_CONTEXT *Context;
+    BUFFER_RING Ring;
+    HANDLE Thread;
+    DWORD Index;
+} INGEST_READER, *PINGEST_READER;
+
+typedef struct INGEST_CONTEXT
+{
+    LPCSTR SourceDir;
+    CHAR TargetRoot[MAX_PATH];
+    DWORD Algorithm;
+    BOOL Recurse;
+    PINGEST_FILE Files;
+    DWORD FileCount;
+    DWORD FileCapacity;
+    DWORD ReaderCount;
+    INGEST_READER Readers[INGEST_MAX_READERS];
+    PINGEST_STATS Stats;
+} INGEST_CONTEXT, *PINGEST_CONTEXT;
+
+static BOOL IngestEnumerate(PINGEST_CONTEXT context, LPCSTR directory);
+static BOOL IngestAddFile(PINGEST_CONTEXT context, LPCSTR path, ULONGLONG size);
+static DWORD WINAPI IngestReader(LPVOID param);
+static void IngestWriteFiles(PINGEST_CONTEXT context);
+static void IngestDestroyFiles(PINGEST_CONTEXT context);
+
+// Files are read from the source by several readers at once, each with its own ring. File N always goes to reader
+// N % ReaderCount, so the writer knows where to find each one and takes them strictly in order. While the writer is busy
+// with one file the readers are already well into the next few, which is what hides the cost of opening lots of small
+// files and the odd slow seek on the source disk. Each reader hashes what it reads before handing it over, so the hash
+// costs the writer nothing.
+//
+// The writer does nothing but write to the volume, in whole slots, so the drive sees long sequential writes. The rings
+// between them add up to a couple of seconds at the drive's native rate: enough to ride out a hiccup on the source,
+// not so much that we sit on gigabytes of memory for nothing.
+
+DWORD IngestNativeRate(LPCSTR mediaDesc)
+{
+    // Native (uncompressed) MB/s by generation. LTO-7 media in an LTO-8 drive (M8) runs at LTO-7 speed.
+    static const DWORD rates[] = { 0, 0, 0, 80, 120, 140, 160, 300, 360, 400 };
+    DWORD generation;
+
+    if (!_strnicmp(mediaDesc, "LTOM8", 5))
+        return rates[7];
+
+    if (_strnicmp(mediaDesc, "LTO", 3) || !isdigit(mediaDesc[3]))
+        return 0;
+
+    generation = mediaDesc[3] - '0';
+
+    return generation < _countof(rates) ? rates[generation] : 0;
+}
+
+BOOL IngestFiles(LPCSTR sourceDir, CHAR driveLetter, LPCSTR targetDir, BOOL recurse, DWORD algorithm, DWORD nativeMBs, PINGEST_STATS stats)
+{
+    INGEST_CONTEXT context;
+    ULONGLONG startTime = GetTickCount64();
+    DWORD slotsPerReader;
+    BOOL result;
+    DWORD i;
+
+    memset(stats, 0, sizeof(INGEST_STATS));
+    memset(&context, 0, sizeof(context));
+
+    context.SourceDir = sourceDir;
+    context.Algorithm = algorithm;
+    context.Recurse = recurse;
+    context.Stats = stats;
+
+    if (targetDir && *targetDir)
+        _snprintf_s(context.TargetRoot, _countof(context.TargetRoot), _TRUNCATE, "%c:\\%s", driveLetter, targetDir);
+    else
+        _snprintf_s(context.TargetRoot, _countof(context.TargetRoot), _TRUNCATE, "%c:", driveLetter);
+
+    result = IngestEnumerate(&context, "");
+    stats->FilesFound = context.FileCount;
+
+    if (result && context.FileCount)
+    {
+        stats->NativeMBs = nativeMBs ? nativeMBs : INGEST_DEFAULT_RATE;
+        context.ReaderCount = min(context.FileCount, INGEST_MAX_READERS);
+
+        slotsPerReader = (DWORD)((ULONGLONG)stats->NativeMBs * 1000000 * INGEST_STAGING_SECONDS / INGEST_SLOT_SIZE / context.ReaderCount);
+        slotsPerReader = max(slotsPerReader, INGEST_MIN_SLOTS);
+
+        for (i = 0; result && i < context.ReaderCount; i++)
+        {
+            context.Readers[i].Context = &context;
+            context.Readers[i].Index = i;
+            result = RingCreate(&context.Readers[i].Ring, slotsPerReader, INGEST_SLOT_SIZE);
+
+            if (result)
+                stats->StagingBytes += (ULONGLONG)slotsPerReader * INGEST_SLOT_SIZE;
+        }
+
+        for (i = 0; result && i < context.ReaderCount; i++)
+        {
+            context.Readers[i].Thread = CreateThread(NULL, 0, IngestReader, &context.Readers[i], 0, NULL);
+            result = context.Readers[i].Thread != NULL;
+        }
+
+        stats->ReaderCount = context.ReaderCount;
+
+        if (result)
+            IngestWriteFiles(&context);
+
+        for (i = 0; i < context.ReaderCount; i++)
+        {
+            if (!result)
+                RingAbort(&context.Readers[i].Ring);
+
+            if (context.Readers[i].Thread)
+            {
+                WaitForSingleObject(context.Readers[i].Thread, INFINITE);
+                CloseHandle(context.Readers[i].Thread);
+            }
+
+            RingDestroy(&context.Readers[i].Ring);
+        }
+    }
+
+    IngestDestroyFiles(&context);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result && !stats->FilesFailed;
+}
+
+static BOOL IngestEnumerate(PINGEST_CONTEXT context, LPCSTR directory)
+{
+    CHAR searchPath[MAX_PATH];
+    WIN32_FIND_DATA findData;
+    HANDLE find;
+    BOOL result = TRUE;
+
+    _snprintf_s(searchPath, _countof(searchPath), _TRUNCATE, "%s\\%s%s*", context->SourceDir, directory, *directory ? "\\" : "");
+
+    find = FindFirstFile(searchPath, &findData);
+
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Cannot read directory %s\\%s\r\n", context->SourceDir, directory);
+        return FALSE;
+    }
+
+    do
+    {
+        CHAR path[MAX_PATH];
+
+        if (!strcmp(findData.cFileName, ".") || !strcmp(findData.cFileName, ".."))
+            continue;
+
+        _snprintf_s(path, _countof(path), _TRUNCATE, "%s%s%s", directory, *directory ? "\\" : "", findData.cFileName);
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            if (context->Recurse)
+                result = IngestEnumerate(context, path);
+        }
+        else
+            result = IngestAddFile(context, path, ((ULONGLONG)findData.nFileSizeHigh << 32) | findData.nFileSizeLow);
+
+    } while (result && FindNextFile(find, &findData));
+
+    FindClose(find);
+
+    return result;
+}
+
+static BOOL IngestAddFile(PINGEST_CONTEXT context, LPCSTR path, ULONGLONG size)
+{
+    size_t length = strlen(path) + 1;
+
+    if (context->FileCount == context->FileCapacity)
+    {
+        DWORD newCapacity = context->FileCapacity ? context->FileCapacity * 2 : 256;
+        PINGEST_FILE files = (PINGEST_FILE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(INGEST_FILE) * newCapacity);
+
+        if (!files)
+            return FALSE;
+
+        if (context->Files)
+        {
+            memcpy(files, context->Files, sizeof(INGEST_FILE) * context->FileCount);
+            LocalFree(context->Files);
+        }
+
+        context->Files = files;
+        context->FileCapacity = newCapacity;
+    }
+
+    context->Files[context->FileCount].Path = (LPSTR)LocalAlloc(LMEM_FIXED, length);
+
+    if (!context->Files[context->FileCount].Path)
+        return FALSE;
+
+    strcpy_s(context->Files[context->FileCount].Path, length, path);
+    context->Files[context->FileCount].Size = size;
+    context->FileCount++;
+
+    return TRUE;
+}
+
+static DWORD WINAPI IngestReader(LPVOID param)
+{
+    PINGEST_READER reader = (PINGEST_READER)param;
+    PINGEST_CONTEXT context = reader->Context;
+    PBUFFER_RING ring = &reader->Ring;
+    BOOL result = TRUE;
+    DWORD i;
+
+    for (i = reader->Index; result && i < context->FileCount; i += context->ReaderCount)
+    {
+        PINGEST_FILE file = &context->Files[i];
+        CHAR sourcePath[MAX_PATH];
+        FIXITY_HASH hash;
+        ULONGLONG offset = 0;
+        PRING_SLOT slot;
+        HANDLE handle;
+        BOOL last = FALSE;
+
+        _snprintf_s(sourcePath, _countof(sourcePath), _TRUNCATE, "%s\\%s", context->SourceDir, file->Path);
+
+        handle = CreateFile(sourcePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            slot = RingAcquireFree(ring);
+            result = slot != NULL;
+
+            if (!result)
+                break;
+
+            slot->Item = i;
+            slot->Flags = RING_SLOT_FIRST | RING_SLOT_LAST | RING_SLOT_ERROR;
+            RingCommit(ring, slot);
+            continue;
+        }
+
+        FixityHashInit(&hash, context->Algorithm);
+
+        do
+        {
+            DWORD bytesRead = 0;
+            BOOL readResult;
+
+            slot = RingAcquireFree(ring);
+            result = slot != NULL;
+
+            if (!result)
+                break;
+
+            readResult = ReadFile(handle, slot->Buffer, ring->SlotSize, &bytesRead, NULL);
+
+            slot->Item = i;
+            slot->Offset = offset;
+            slot->Length = readResult ? bytesRead : 0;
+            slot->Flags = offset == 0 ? RING_SLOT_FIRST : 0;
+
+            offset += slot->Length;
+
+            // Go by the size we enumerated. If the file's changed since then, what we wrote wouldn't be what we listed.
+            last = !readResult || bytesRead == 0 || offset >= file->Size;
+
+            if (!readResult || (last && offset != file->Size))
+                slot->Flags |= RING_SLOT_ERROR;
+
+            FixityHashUpdate(&hash, slot->Buffer, slot->Length);
+
+            // The digest has to be in place before the last chunk is handed over, that's when the writer looks for it.
+            if (last)
+            {
+                FixityHashFinal(&hash, file->Digest, _countof(file->Digest));
+                slot->Flags |= RING_SLOT_LAST;
+            }
+
+            RingCommit(ring, slot);
+
+        } while (!last);
+
+        CloseHandle(handle);
+    }
+
+    if (result && !RingSubmitEnd(ring))
+        RingAbort(ring);
+
+    return 0;
+}
+
+static void IngestWriteFiles(PINGEST_CONTEXT context)
+{
+    PINGEST_STATS stats = context->Stats;
+    LPCSTR attributeName = FixityAttributeName(context->Algorithm);
+    ULONGLONG startTime = 0;
+    BOOL stop = FALSE;
+    DWORD i, j;
+
+    for (i = 0; !stop && i < context->FileCount; i++)
+    {
+        PINGEST_FILE file = &context->Files[i];
+        PBUFFER_RING ring = &context->Readers[i % context->ReaderCount].Ring;
+        HANDLE handle = INVALID_HANDLE_VALUE;
+        CHAR targetPath[MAX_PATH];
+        BOOL failed = FALSE;
+        DWORD flags = 0;
+
+        _snprintf_s(targetPath, _countof(targetPath), _TRUNCATE, "%s\\%s", context->TargetRoot, file->Path);
+
+        while (!(flags & RING_SLOT_LAST))
+        {
+            ULONGLONG waitStart = GetTickCount64();
+            PRING_SLOT slot = RingAcquireFull(ring);
+
+            // Time spent here once we've started is time the drive has nothing to write. Waiting for the very first
+            // chunk doesn't count, the drive isn't doing anything yet either way.
+            if (startTime)
+                stats->WaitMs += GetTickCount64() - waitStart;
+            else
+                startTime = GetTickCount64();
+
+            if (!slot || (slot->Flags & RING_SLOT_END))
+            {
+                stop = TRUE;
+                break;
+            }
+
+            flags = slot->Flags;
+
+            if (flags & RING_SLOT_FIRST)
+            {
+                CHAR directory[MAX_PATH];
+                LPSTR separator;
+
+                strcpy_s(directory, _countof(directory), targetPath);
+                separator = strrchr(directory, '\\');
+
+                if (separator)
+                    *separator = '\0';
+
+                if (CreateDirectoryPath(directory))
+                    handle = CreateFile(targetPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+                if (handle == INVALID_HANDLE_VALUE)
+                {
+                    fprintf(stderr, "Cannot create %s\r\n", targetPath);
+                    failed = TRUE;
+                }
+            }
+
+            if (flags & RING_SLOT_ERROR)
+            {
+                fprintf(stderr, "Failed to read %s\\%s\r\n", context->SourceDir, file->Path);
+                failed = TRUE;
+            }
+
+            if (!failed && slot->Length)
+            {
+                DWORD bytesWritten = 0;
+
+                if (!WriteFile(handle, slot->Buffer, slot->Length, &bytesWritten, NULL) || bytesWritten != slot->Length)
+                {
+                    // Most likely the cartridge is full. Nothing after this is going to fit either.
+                    fprintf(stderr, "Write failed on %s\r\n", targetPath);
+                    failed = TRUE;
+                    stop = TRUE;
+                }
+            }
+
+            RingRelease(ring, slot);
+
+            if (stop)
+                break;
+        }
+
+        if (handle != INVALID_HANDLE_VALUE)
+            CloseHandle(handle);
+
+        // Don't leave half a file on the tape looking like the real thing.
+        if (failed || stop)
+        {
+            if (handle != INVALID_HANDLE_VALUE)
+                DeleteFile(targetPath);
+
+            stats->FilesFailed++;
+        }
+        else
+        {
+            // The hash goes on as an extended attribute, where the fixity check will look for it later.
+            if (!WriteExtendedAttribute(targetPath, attributeName, file->Digest))
+                fprintf(stderr, "Failed to set %s on %s\r\n", attributeName, targetPath);
+
+            stats->FilesWritten++;
+            stats->BytesWritten += file->Size;
+        }
+
+    }
+
+    if (stop)
+    {
+        for (j = 0; j < context->ReaderCount; j++)
+            RingAbort(&context->Readers[j].Ring);
+    }
+
+    if (startTime)
+        stats->WritingMs = GetTickCount64() - startTime;
+}
+
+static void IngestDestroyFiles(PINGEST_CONTEXT context)
+{
+    DWORD i;
+
+    for (i = 0; i < context->FileCount; i++)
+    {
+        if (context->Files[i].Path)
+            LocalFree(context->Files[i].Path);
+    }
+
+    if (context->Files)
+        LocalFree(context->Files);
+}
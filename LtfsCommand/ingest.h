@@ -0,0 +1,45 @@
+/*
+ *   File:   ingest.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "fixity.h"
+
+#define INGEST_MAX_READERS      4
+#define INGEST_SLOT_SIZE        (8 * 1024 * 1024)
+#define INGEST_STAGING_SECONDS  2       // How long the staging buffer could keep the drive going on its own
+#define INGEST_MIN_SLOTS        2       // Per reader
+#define INGEST_DEFAULT_RATE     300     // MB/s, when we can't tell what the drive is
+
+typedef struct INGEST_STATS
+{
+    DWORD FilesFound;
+    DWORD FilesWritten;
+    DWORD FilesFailed;
+    DWORD ReaderCount;
+    DWORD NativeMBs;
+    ULONGLONG StagingBytes;
+    ULONGLONG BytesWritten;
+    ULONGLONG ElapsedMs;
+    ULONGLONG WritingMs;
+    ULONGLONG WaitMs;
+} INGEST_STATS, *PINGEST_STATS;
+
+DWORD IngestNativeRate(LPCSTR mediaDesc);
+BOOL IngestFiles(LPCSTR sourceDir, CHAR driveLetter, LPCSTR targetDir, BOOL recurse, DWORD algorithm, DWORD nativeMBs, PINGEST_STATS stats);
@@ -0,0 +1,350 @@
+/*
+ *   File:   inventory.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include <cfgmgr32.h>
+#include "inventory.h"
+#include "ltfsreg.h"
+#include "crc32c.h"
+
+// The inventory is a plain text file, one record per line, tab separated:
+//
+//   G  <generation>
+//   I  <interface count>  <interface list crc>
+//   D  <device index>  <port:bus:target:lun>  <serial>  <vendor>  <product>
+//
+// The generation goes up every time the file is rewritten. The I record is what the drives were described against,
+// and an inventory without one has been invalidated and is only kept for its generation.
+
+#define MAX_INVENTORY_LINE  512
+
+typedef struct INVENTORY
+{
+    ULONGLONG Generation;
+    BOOL HasSignature;
+    DWORD InterfaceCount;
+    DWORD InterfaceCrc;
+    PTAPE_DRIVE Drives;
+    PTAPE_DRIVE LastDrive;
+    DWORD NumDrives;
+} INVENTORY, *PINVENTORY;
+
+static BOOL InventoryLoad(PINVENTORY inventory);
+static BOOL InventorySave(PINVENTORY inventory);
+static BOOL InventoryGetSignature(PDWORD interfaceCount, PDWORD interfaceCrc);
+static BOOL InventoryIsCurrent(PINVENTORY inventory);
+static BOOL InventoryAddDrive(PINVENTORY inventory, LPSTR devIndex, LPSTR address, LPSTR serialNumber, LPSTR vendorId, LPSTR productId);
+
+// Describing every drive means opening every one of them, and asking the drive itself whenever its driver doesn't
+// keep the answers. Nothing about a drive changes while it stays plugged in, so the answers are kept on disk and used
+// for as long as the set of tape devices Windows has is the same one they were got from. Checking that is one call to
+// the configuration manager, which doesn't go near a drive.
+
+BOOL InventoryGetDriveList(PTAPE_DRIVE *driveList, PDWORD numDrivesFound, BOOL refresh)
+{
+    INVENTORY inventory;
+
+    memset(&inventory, 0, sizeof(inventory));
+
+    *driveList = NULL;
+    *numDrivesFound = 0;
+
+    if (InventoryLoad(&inventory) && !refresh && InventoryIsCurrent(&inventory))
+    {
+        *driveList = inventory.Drives;
+        *numDrivesFound = inventory.NumDrives;
+
+        return inventory.NumDrives > 0;
+    }
+
+    TapeDestroyDriveList(inventory.Drives);
+
+    // Taken before looking at the drives, so anything turning up part way through leaves the saved copy looking out of
+    // date rather than complete.
+    inventory.HasSignature = InventoryGetSignature(&inventory.InterfaceCount, &inventory.InterfaceCrc);
+
+    TapeGetDriveList(&inventory.Drives, &inventory.NumDrives);
+
+    // Not being able to save it just means doing this again next time.
+    inventory.Generation++;
+    InventorySave(&inventory);
+
+    *driveList = inventory.Drives;
+    *numDrivesFound = inventory.NumDrives;
+
+    return inventory.NumDrives > 0;
+}
+
+// Only ever answers from an inventory that's still current, it's for callers that have their own way of finding a
+// drive and just want to skip it when they can.
+
+BOOL InventoryFindDrive(LPCSTR serialNumber, LPSTR tapeDrive, size_t tapeDriveLength, PTAPE_SCSI_ADDRESS address)
+{
+    INVENTORY inventory;
+    PTAPE_DRIVE drive;
+    BOOL found = FALSE;
+
+    memset(&inventory, 0, sizeof(inventory));
+
+    if (InventoryLoad(&inventory) && InventoryIsCurrent(&inventory))
+    {
+        for (drive = inventory.Drives; drive != NULL; drive = drive->Next)
+        {
+            if (strcmp((char *)drive->SerialNumber, serialNumber) == 0)
+            {
+                _snprintf_s(tapeDrive, tapeDriveLength, _TRUNCATE, "TAPE%d", drive->DevIndex);
+
+                if (address)
+                    *address = drive->Address;
+
+                found = TRUE;
+                break;
+            }
+        }
+    }
+
+    TapeDestroyDriveList(inventory.Drives);
+
+    return found;
+}
+
+// For when we're told something changed. The signature check would notice anyway, this just doesn't wait for it.
+
+BOOL InventoryInvalidate()
+{
+    INVENTORY inventory;
+
+    memset(&inventory, 0, sizeof(inventory));
+
+    // Nothing saved is as invalid as it gets.
+    if (!InventoryLoad(&inventory))
+        return TRUE;
+
+    TapeDestroyDriveList(inventory.Drives);
+
+    inventory.Drives = NULL;
+    inventory.NumDrives = 0;
+    inventory.HasSignature = FALSE;
+    inventory.Generation++;
+
+    return InventorySave(&inventory);
+}
+
+static BOOL InventoryLoad(PINVENTORY inventory)
+{
+    FILE *file;
+    CHAR line[MAX_INVENTORY_LINE];
+    BOOL result = TRUE;
+
+    if (fopen_s(&file, INVENTORY_FILE, "r") != 0)
+        return FALSE;
+
+    while (result && fgets(line, sizeof(line), file))
+    {
+        LPSTR context = NULL;
+        LPSTR type;
+        LPSTR first;
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        type = strtok_s(line, "\t", &context);
+        first = strtok_s(NULL, "\t", &context);
+
+        if (!type || !first)
+            continue;
+
+        if (type[0] == 'G')
+        {
+            inventory->Generation = _strtoui64(first, NULL, 10);
+        }
+        else if (type[0] == 'I')
+        {
+            LPSTR crc = strtok_s(NULL, "\t", &context);
+
+            if (!crc)
+                continue;
+
+            inventory->InterfaceCount = strtoul(first, NULL, 10);
+            inventory->InterfaceCrc = strtoul(crc, NULL, 16);
+            inventory->HasSignature = TRUE;
+        }
+        else if (type[0] == 'D')
+        {
+            LPSTR address = strtok_s(NULL, "\t", &context);
+            LPSTR serialNumber = strtok_s(NULL, "\t", &context);
+            LPSTR vendorId = strtok_s(NULL, "\t", &context);
+            LPSTR productId = context;
+
+            if (!address || !serialNumber || !vendorId || !productId)
+                continue;
+
+            result = InventoryAddDrive(inventory, first, address, serialNumber, vendorId, productId);
+        }
+    }
+
+    fclose(file);
+
+    if (!result)
+    {
+        TapeDestroyDriveList(inventory->Drives);
+        inventory->Drives = NULL;
+        inventory->NumDrives = 0;
+    }
+
+    return result;
+}
+
+static BOOL InventorySave(PINVENTORY inventory)
+{
+    CHAR tempFile[MAX_PATH];
+    FILE *file;
+    PTAPE_DRIVE drive;
+    BOOL result;
+
+    // Another copy of us could be doing the same thing, so each writes its own and the last one in wins.
+    _snprintf_s(tempFile, _countof(tempFile), _TRUNCATE, "%s.%u.tmp", INVENTORY_FILE, GetCurrentProcessId());
+
+    if (fopen_s(&file, tempFile, "w") != 0)
+        return FALSE;
+
+    result = fprintf(file, "G\t%llu\n", inventory->Generation) > 0;
+
+    if (result && inventory->HasSignature)
+        result = fprintf(file, "I\t%u\t%08x\n", inventory->InterfaceCount, inventory->InterfaceCrc) > 0;
+
+    for (drive = inventory->Drives; result && drive != NULL; drive = drive->Next)
+    {
+        CHAR address[MAX_SCSI_ADDRESS] = "-";
+
+        if (drive->Address.Valid)
+        {
+            _snprintf_s(address, _countof(address), _TRUNCATE, "%u:%u:%u:%u",
+                drive->Address.PortNumber, drive->Address.PathId, drive->Address.TargetId, drive->Address.Lun);
+        }
+
+        result = fprintf(file, "D\t%u\t%s\t%s\t%s\t%s\n", drive->DevIndex, address, drive->SerialNumber, drive->VendorId, drive->ProductId) > 0;
+    }
+
+    if (fclose(file) != 0)
+        result = FALSE;
+
+    if (result)
+        result = MoveFileEx(tempFile, INVENTORY_FILE, MOVEFILE_REPLACE_EXISTING);
+
+    if (!result)
+        DeleteFile(tempFile);
+
+    return result;
+}
+
+// The configuration manager keeps the list of tape interfaces itself, so reading it doesn't open anything. Each path
+// has the device instance in it, so a drive swapped for another changes the list even when the count stays the same.
+
+static BOOL InventoryGetSignature(PDWORD interfaceCount, PDWORD interfaceCrc)
+{
+    PZZSTR interfaces = NULL;
+    ULONG length = 0;
+    CONFIGRET result;
+    LPSTR path;
+
+    do
+    {
+        if (interfaces)
+            LocalFree(interfaces);
+
+        interfaces = NULL;
+
+        if (CM_Get_Device_Interface_List_Size(&length, (LPGUID)&GUID_DEVINTERFACE_TAPE, NULL, CM_GET_DEVICE_INTERFACE_LIST_PRESENT) != CR_SUCCESS)
+            return FALSE;
+
+        interfaces = (PZZSTR)LocalAlloc(LMEM_FIXED, length);
+
+        if (!interfaces)
+            return FALSE;
+
+        // Something can turn up between asking how big the list is and getting it.
+        result = CM_Get_Device_Interface_List((LPGUID)&GUID_DEVINTERFACE_TAPE, NULL, interfaces, length, CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+
+    } while (result == CR_BUFFER_SMALL);
+
+    if (result == CR_SUCCESS)
+    {
+        *interfaceCount = 0;
+        *interfaceCrc = Crc32c(0, interfaces, length);
+
+        for (path = interfaces; *path; path += strlen(path) + 1)
+            (*interfaceCount)++;
+    }
+
+    LocalFree(interfaces);
+
+    return result == CR_SUCCESS;
+}
+
+static BOOL InventoryIsCurrent(PINVENTORY inventory)
+{
+    DWORD interfaceCount;
+    DWORD interfaceCrc;
+
+    if (!inventory->HasSignature)
+        return FALSE;
+
+    // A drive that couldn't be described last time might be this time.
+    if (inventory->NumDrives != inventory->InterfaceCount)
+        return FALSE;
+
+    if (!InventoryGetSignature(&interfaceCount, &interfaceCrc))
+        return FALSE;
+
+    return interfaceCount == inventory->InterfaceCount && interfaceCrc == inventory->InterfaceCrc;
+}
+
+static BOOL InventoryAddDrive(PINVENTORY inventory, LPSTR devIndex, LPSTR address, LPSTR serialNumber, LPSTR vendorId, LPSTR productId)
+{
+    PTAPE_DRIVE drive = (PTAPE_DRIVE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(TAPE_DRIVE));
+    UINT port, path, target, lun;
+
+    if (!drive)
+        return FALSE;
+
+    drive->DevIndex = strtoul(devIndex, NULL, 10);
+
+    if (sscanf_s(address, "%u:%u:%u:%u", &port, &path, &target, &lun) == 4)
+    {
+        drive->Address.PortNumber = (UCHAR)port;
+        drive->Address.PathId = (UCHAR)path;
+        drive->Address.TargetId = (UCHAR)target;
+        drive->Address.Lun = (UCHAR)lun;
+        drive->Address.Valid = TRUE;
+    }
+
+    strncpy_s((char *)drive->SerialNumber, sizeof(drive->SerialNumber), serialNumber, _TRUNCATE);
+    strncpy_s((char *)drive->VendorId, sizeof(drive->VendorId), vendorId, _TRUNCATE);
+    strncpy_s((char *)drive->ProductId, sizeof(drive->ProductId), productId, _TRUNCATE);
+
+    // Kept in the order they were found in, it's the order everything else lists them in.
+    if (inventory->LastDrive)
+        inventory->LastDrive->Next = drive;
+    else
+        inventory->Drives = drive;
+
+    inventory->LastDrive = drive;
+    inventory->NumDrives++;
+
+    return TRUE;
+}
@@ -0,0 +1,28 @@
+/*
+ *   File:   inventory.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "tape.h"
+
+#define INVENTORY_FILE      "C:\\ProgramData\\Hewlett-Packard\\LTFS\\LtfsCmdDrives.txt"
+
+BOOL InventoryGetDriveList(PTAPE_DRIVE *driveList, PDWORD numDrivesFound, BOOL refresh);
+BOOL InventoryFindDrive(LPCSTR serialNumber, LPSTR tapeDrive, size_t tapeDriveLength, PTAPE_SCSI_ADDRESS address);
+BOOL InventoryInvalidate();
@@ -0,0 +1,321 @@
+/*
+ *   File:   layout.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "layout.h"
+#include "tape.h"
+
+// The map is plain text, one record per line:
+//
+//   P  <partition>  <end of data block>  <file count>  <setmark count>
+//   F  <partition>  <first block>  <block count>  <T if closed by a filemark, U if it runs into EOD>
+//   S  <partition>  <block>
+//
+// Block numbers are logical object numbers as LOCATE takes them, so filemarks and setmarks count as one block each.
+// A partition's files and setmarks always follow its P line, which is how they're loaded back.
+
+#define MAX_LAYOUT_LINE     128
+
+static BOOL LayoutScanFiles(HANDLE handle, DWORD partition, PTAPE_LAYOUT layout);
+static BOOL LayoutScanSetmarks(HANDLE handle, DWORD partition, PTAPE_LAYOUT layout);
+static BOOL LayoutAddFile(PTAPE_LAYOUT layout, DWORD partition, ULONGLONG firstBlock, ULONGLONG blockCount, BOOL terminated);
+static BOOL LayoutAddSetmark(PTAPE_LAYOUT layout, DWORD partition, ULONGLONG block);
+
+BOOL LayoutScan(HANDLE handle, PTAPE_LAYOUT *layout)
+{
+    PTAPE_LAYOUT newLayout;
+    BOOL result = TRUE;
+    DWORD partition;
+
+    newLayout = (PTAPE_LAYOUT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(TAPE_LAYOUT));
+
+    if (!newLayout)
+        return FALSE;
+
+    // There's no cheap way to ask how many partitions there are that works on every drive, so just try to go to each.
+    for (partition = 0; result && partition < LAYOUT_MAX_PARTITIONS; partition++)
+    {
+        if (!TapeLocate(handle, TAPE_LOCATE_BLOCK, partition, 0, NULL))
+        {
+            result = partition > 0;
+            break;
+        }
+
+        newLayout->PartitionCount++;
+
+        result = LayoutScanFiles(handle, partition, newLayout);
+
+        if (result)
+            result = LayoutScanSetmarks(handle, partition, newLayout);
+    }
+
+    if (!result)
+    {
+        LayoutDestroy(newLayout);
+        return FALSE;
+    }
+
+    *layout = newLayout;
+    return TRUE;
+}
+
+// Tapes with no LTFS index have nothing else to say where their files are, so raw recall and imaging go by this.
+
+BOOL LayoutLoad(LPCSTR mapFile, PTAPE_LAYOUT *layout)
+{
+    FILE *file;
+    CHAR line[MAX_LAYOUT_LINE];
+    PTAPE_LAYOUT newLayout;
+    DWORD current = MAXDWORD;
+    BOOL result = TRUE;
+
+    if (fopen_s(&file, mapFile, "r") != 0)
+        return FALSE;
+
+    newLayout = (PTAPE_LAYOUT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(TAPE_LAYOUT));
+
+    if (!newLayout)
+    {
+        fclose(file);
+        return FALSE;
+    }
+
+    while (result && fgets(line, sizeof(line), file))
+    {
+        DWORD partition;
+        ULONGLONG first, second;
+        DWORD files, setmarks;
+        CHAR terminated;
+
+        if (line[0] == 'P' && sscanf_s(line, "P %u %llu %u %u", &partition, &first, &files, &setmarks) == 4)
+        {
+            // In order, each once. Files are found by their number within the partition, so they can't be split up.
+            result = partition < LAYOUT_MAX_PARTITIONS && partition == newLayout->PartitionCount;
+
+            if (result)
+            {
+                newLayout->Partitions[partition].EndOfData = first;
+                newLayout->PartitionCount++;
+                current = partition;
+            }
+        }
+        else if (line[0] == 'F' && sscanf_s(line, "F %u %llu %llu %c", &partition, &first, &second, &terminated, 1) == 4)
+        {
+            result = partition == current && LayoutAddFile(newLayout, partition, first, second, terminated == 'T');
+        }
+        else if (line[0] == 'S' && sscanf_s(line, "S %u %llu", &partition, &first) == 2)
+        {
+            result = partition == current && LayoutAddSetmark(newLayout, partition, first);
+        }
+    }
+
+    fclose(file);
+
+    if (!result || !newLayout->PartitionCount)
+    {
+        LayoutDestroy(newLayout);
+        return FALSE;
+    }
+
+    *layout = newLayout;
+    return TRUE;
+}
+
+BOOL LayoutSave(PTAPE_LAYOUT layout, LPCSTR mapFile)
+{
+    FILE *file;
+
+    if (fopen_s(&file, mapFile, "w") != 0)
+        return FALSE;
+
+    LayoutWrite(layout, file);
+
+    return fclose(file) == 0;
+}
+
+void LayoutWrite(PTAPE_LAYOUT layout, FILE *file)
+{
+    DWORD partition;
+    DWORD i;
+
+    for (partition = 0; partition < layout->PartitionCount; partition++)
+    {
+        PLAYOUT_PARTITION layoutPartition = &layout->Partitions[partition];
+
+        fprintf(file, "P %u %llu %u %u\n", partition, layoutPartition->EndOfData, layoutPartition->FileCount, layoutPartition->SetmarkCount);
+
+        for (i = 0; i < layout->FileCount; i++)
+        {
+            PLAYOUT_FILE layoutFile = &layout->Files[i];
+
+            if (layoutFile->Partition == partition)
+                fprintf(file, "F %u %llu %llu %c\n", partition, layoutFile->FirstBlock, layoutFile->BlockCount, layoutFile->Terminated ? 'T' : 'U');
+        }
+
+        for (i = 0; i < layout->SetmarkCount; i++)
+        {
+            if (layout->Setmarks[i].Partition == partition)
+                fprintf(file, "S %u %llu\n", partition, layout->Setmarks[i].Block);
+        }
+    }
+}
+
+void LayoutDestroy(PTAPE_LAYOUT layout)
+{
+    if (!layout)
+        return;
+
+    if (layout->Files)
+        LocalFree(layout->Files);
+
+    if (layout->Setmarks)
+        LocalFree(layout->Setmarks);
+
+    LocalFree(layout);
+}
+
+static BOOL LayoutScanFiles(HANDLE handle, DWORD partition, PTAPE_LAYOUT layout)
+{
+    TAPE_SENSE sense;
+    TAPE_POSITION position;
+    ULONGLONG fileStart = 0;
+
+    // Hop from filemark to filemark. The drive finds each one from its own directory, so nothing is transferred and
+    // on modern drives most hops are done at locate speed.
+    for (;;)
+    {
+        if (TapeSpace(handle, TAPE_SPACE_FILEMARKS, 1, &sense))
+        {
+            if (!TapeReadPosition(handle, &position, NULL))
+                return FALSE;
+
+            // We're now just past the filemark, which is itself the block before us.
+            if (!LayoutAddFile(layout, partition, fileStart, position.Block - 1 - fileStart, TRUE))
+                return FALSE;
+
+            fileStart = position.Block;
+            continue;
+        }
+
+        // Running into EOD (or the end of the partition) is how every partition finishes. Anything else is a real error.
+        if (sense.SenseKey != SCSI_SENSE_BLANK_CHECK && !sense.EndOfMedium)
+            return FALSE;
+
+        if (!TapeReadPosition(handle, &position, NULL))
+            return FALSE;
+
+        layout->Partitions[partition].EndOfData = position.Block;
+
+        // Data after the last filemark, i.e. a file that was never closed.
+        if (position.Block > fileStart)
+            return LayoutAddFile(layout, partition, fileStart, position.Block - fileStart, FALSE);
+
+        return TRUE;
+    }
+}
+
+static BOOL LayoutScanSetmarks(HANDLE handle, DWORD partition, PTAPE_LAYOUT layout)
+{
+    TAPE_SENSE sense;
+    TAPE_POSITION position;
+
+    if (!TapeLocate(handle, TAPE_LOCATE_BLOCK, partition, 0, NULL))
+        return FALSE;
+
+    for (;;)
+    {
+        if (TapeSpace(handle, TAPE_SPACE_SETMARKS, 1, &sense))
+        {
+            if (!TapeReadPosition(handle, &position, NULL))
+                return FALSE;
+
+            if (!LayoutAddSetmark(layout, partition, position.Block - 1))
+                return FALSE;
+
+            continue;
+        }
+
+        // LTO and most other current drives don't do setmarks at all, which is fine, there just aren't any.
+        return sense.SenseKey == SCSI_SENSE_BLANK_CHECK || sense.SenseKey == SCSI_SENSE_ILLEGAL_REQUEST || sense.EndOfMedium;
+    }
+}
+
+static BOOL LayoutAddFile(PTAPE_LAYOUT layout, DWORD partition, ULONGLONG firstBlock, ULONGLONG blockCount, BOOL terminated)
+{
+    PLAYOUT_FILE layoutFile;
+
+    if (layout->FileCount == layout->FileCapacity)
+    {
+        DWORD newCapacity = layout->FileCapacity ? layout->FileCapacity * 2 : 256;
+        PLAYOUT_FILE files = (PLAYOUT_FILE)LocalAlloc(LMEM_FIXED, sizeof(LAYOUT_FILE) * newCapacity);
+
+        if (!files)
+            return FALSE;
+
+        if (layout->Files)
+        {
+            memcpy(files, layout->Files, sizeof(LAYOUT_FILE) * layout->FileCount);
+            LocalFree(layout->Files);
+        }
+
+        layout->Files = files;
+        layout->FileCapacity = newCapacity;
+    }
+
+    if (!layout->Partitions[partition].FileCount)
+        layout->Partitions[partition].FirstFile = layout->FileCount;
+
+    layoutFile = &layout->Files[layout->FileCount++];
+    layoutFile->Partition = partition;
+    layoutFile->FirstBlock = firstBlock;
+    layoutFile->BlockCount = blockCount;
+    layoutFile->Terminated = terminated;
+
+    layout->Partitions[partition].FileCount++;
+
+    return TRUE;
+}
+
+static BOOL LayoutAddSetmark(PTAPE_LAYOUT layout, DWORD partition, ULONGLONG block)
+{
+    if (layout->SetmarkCount == layout->SetmarkCapacity)
+    {
+        DWORD newCapacity = layout->SetmarkCapacity ? layout->SetmarkCapacity * 2 : 64;
+        PLAYOUT_SETMARK setmarks = (PLAYOUT_SETMARK)LocalAlloc(LMEM_FIXED, sizeof(LAYOUT_SETMARK) * newCapacity);
+
+        if (!setmarks)
+            return FALSE;
+
+        if (layout->Setmarks)
+        {
+            memcpy(setmarks, layout->Setmarks, sizeof(LAYOUT_SETMARK) * layout->SetmarkCount);
+            LocalFree(layout->Setmarks);
+        }
+
+        layout->Setmarks = setmarks;
+        layout->SetmarkCapacity = newCapacity;
+    }
+
+    layout->Setmarks[layout->SetmarkCount].Partition = partition;
+    layout->Setmarks[layout->SetmarkCount].Block = block;
+    layout->SetmarkCount++;
+
+    layout->Partitions[partition].SetmarkCount++;
+
+    return TRUE;
+}
@@ -0,0 +1,63 @@
+/*
+ *   File:   layout.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define LAYOUT_MAX_PARTITIONS   4
+
+typedef struct LAYOUT_FILE
+{
+    DWORD Partition;
+    ULONGLONG FirstBlock;
+    ULONGLONG BlockCount;
+    BOOL Terminated;
+} LAYOUT_FILE, *PLAYOUT_FILE;
+
+typedef struct LAYOUT_SETMARK
+{
+    DWORD Partition;
+    ULONGLONG Block;
+} LAYOUT_SETMARK, *PLAYOUT_SETMARK;
+
+typedef struct LAYOUT_PARTITION
+{
+    ULONGLONG EndOfData;
+    DWORD FirstFile;
+    DWORD FileCount;
+    DWORD SetmarkCount;
+} LAYOUT_PARTITION, *PLAYOUT_PARTITION;
+
+typedef struct TAPE_LAYOUT
+{
+    DWORD PartitionCount;
+    LAYOUT_PARTITION Partitions[LAYOUT_MAX_PARTITIONS];
+    DWORD FileCount;
+    DWORD FileCapacity;
+    PLAYOUT_FILE Files;
+    DWORD SetmarkCount;
+    DWORD SetmarkCapacity;
+    PLAYOUT_SETMARK Setmarks;
+} TAPE_LAYOUT, *PTAPE_LAYOUT;
+
+BOOL LayoutScan(HANDLE handle, PTAPE_LAYOUT *layout);
+BOOL LayoutLoad(LPCSTR mapFile, PTAPE_LAYOUT *layout);
+BOOL LayoutSave(PTAPE_LAYOUT layout, LPCSTR mapFile);
+void LayoutWrite(PTAPE_LAYOUT layout, FILE *file);
+void LayoutDestroy(PTAPE_LAYOUT layout);
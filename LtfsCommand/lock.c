@@ -0,0 +1,144 @@
+/*
+ *   File:   lock.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "lock.h"
+#include "ltfsreg.h"
+
+static void LockDriveName(LPCSTR target, LPSTR name, size_t len);
+static BOOL LockAcquire(LPCSTR name, LPCSTR description, DWORD timeout, PHANDLE lock);
+
+static DWORD LockTimeout = LOCK_DEFAULT_TIMEOUT;
+
+// Named mutexes, so every copy of the tool that's running sees the same ones, and Windows lets go of them if the
+// process holding one dies. They can be taken again by the thread that already holds them, so nothing needs to know
+// whether its caller already has the lock.
+//
+// A drive lock is for anything that sends the drive commands. The config lock is for anything that changes a mapping
+// or starts or stops the service. Drive locks are always taken first, and nothing that holds the config lock takes a
+// drive lock, so the two can't end up waiting on each other.
+
+void LockSetTimeout(DWORD timeout)
+{
+    LockTimeout = timeout;
+}
+
+BOOL LockDrive(LPCSTR target, PHANDLE lock)
+{
+    return LockDriveWithin(target, LockTimeout, lock);
+}
+
+// For those with something better to do than wait, such as showing the last known answer instead.
+
+BOOL LockDriveWithin(LPCSTR target, DWORD timeout, PHANDLE lock)
+{
+    CHAR name[MAX_PATH];
+
+    LockDriveName(target, name, _countof(name));
+
+    return LockAcquire(name, target, timeout, lock);
+}
+
+// Two copies each wanting the same two drives, but the other way round, would each get one and wait forever for the
+// other. Taking them in name order means whoever gets the first gets both.
+
+BOOL LockDrivePair(LPCSTR firstTarget, LPCSTR secondTarget, PHANDLE firstLock, PHANDLE secondLock)
+{
+    CHAR firstName[MAX_PATH];
+    CHAR secondName[MAX_PATH];
+
+    LockDriveName(firstTarget, firstName, _countof(firstName));
+    LockDriveName(secondTarget, secondName, _countof(secondName));
+
+    if (strcmp(firstName, secondName) > 0)
+        return LockDrivePair(secondTarget, firstTarget, secondLock, firstLock);
+
+    if (!LockAcquire(firstName, firstTarget, LockTimeout, firstLock))
+        return FALSE;
+
+    if (!LockAcquire(secondName, secondTarget, LockTimeout, secondLock))
+    {
+        LockRelease(*firstLock);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL LockConfig(PHANDLE lock)
+{
+    return LockAcquire(LOCK_CONFIG_NAME, "mappings or the service", LockTimeout, lock);
+}
+
+void LockRelease(HANDLE lock)
+{
+    if (!lock)
+        return;
+
+    ReleaseMutex(lock);
+    CloseHandle(lock);
+}
+
+// Named after the serial number rather than the letter or directory, two mappings can share a drive. The target is
+// only used when there's no mapping to say, in which case whatever's about to happen will fail by itself.
+
+static void LockDriveName(LPCSTR target, LPSTR name, size_t len)
+{
+    CHAR serialNumber[MAX_SERIAL_NUMBER];
+    LPSTR c;
+
+    if (LtfsRegGetTargetProperties(target, NULL, 0, serialNumber, _countof(serialNumber)) && *serialNumber)
+        _snprintf_s(name, len, _TRUNCATE, "%s%s", LOCK_DRIVE_PREFIX, serialNumber);
+    else
+        _snprintf_s(name, len, _TRUNCATE, "%sTarget%s", LOCK_DRIVE_PREFIX, target);
+
+    // Only the one after Global may have a backslash.
+    for (c = name + strlen(LOCK_DRIVE_PREFIX); *c; c++)
+    {
+        if (*c == '\\')
+            *c = '_';
+    }
+}
+
+static BOOL LockAcquire(LPCSTR name, LPCSTR description, DWORD timeout, PHANDLE lock)
+{
+    HANDLE mutex = CreateMutex(NULL, FALSE, name);
+    DWORD result;
+
+    if (!mutex)
+        return FALSE;
+
+    result = WaitForSingleObject(mutex, min(timeout, LOCK_NOTICE_MS));
+
+    if (result == WAIT_TIMEOUT && timeout > LOCK_NOTICE_MS)
+    {
+        fprintf(stderr, "\r\nWaiting for another operation on %s to finish.\r\n", description);
+        result = WaitForSingleObject(mutex, timeout - LOCK_NOTICE_MS);
+    }
+
+    // Whoever had it died part way through. What they were doing is as finished as it's going to get, and it's ours now.
+    if (result != WAIT_OBJECT_0 && result != WAIT_ABANDONED)
+    {
+        CloseHandle(mutex);
+        return FALSE;
+    }
+
+    *lock = mutex;
+
+    return TRUE;
+}
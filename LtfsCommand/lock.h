@@ -0,0 +1,33 @@
+/*
+ *   File:   lock.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define LOCK_CONFIG_NAME        "Global\\LtfsCmdConfigLock"
+#define LOCK_DRIVE_PREFIX       "Global\\LtfsCmdDriveLock_"
+#define LOCK_DEFAULT_TIMEOUT    (10 * 60 * 1000)    // A load, eject or rewind can take minutes by itself
+#define LOCK_NOTICE_MS          1000                // How long to wait before saying so
+
+void LockSetTimeout(DWORD timeout);
+BOOL LockDrive(LPCSTR target, PHANDLE lock);
+BOOL LockDriveWithin(LPCSTR target, DWORD timeout, PHANDLE lock);
+BOOL LockDrivePair(LPCSTR firstTarget, LPCSTR secondTarget, PHANDLE firstLock, PHANDLE secondLock);
+BOOL LockConfig(PHANDLE lock);
+void LockRelease(HANDLE lock);
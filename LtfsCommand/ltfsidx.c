@@ -0,0 +1,599 @@
+/*
+ *   File:   ltfsidx.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "ltfsidx.h"
+#include "tape.h"
+
+#define MAX_INDEX_DEPTH     256
+#define MAX_INDEX_TAG       32
+
+typedef struct INDEX_PARSER
+{
+    PLTFS_INDEX Index;
+    PLTFS_FILE File;
+    PLTFS_FILE LastFile;
+    LPSTR FileName;
+    LTFS_EXTENT Extent;
+    DWORD ExtentCapacity;
+    LPSTR DirNames[MAX_INDEX_DEPTH];
+    DWORD DirDepth;
+    CHAR Tags[MAX_INDEX_DEPTH][MAX_INDEX_TAG];
+    DWORD Depth;
+    BOOL PercentEncoded;
+} INDEX_PARSER, *PINDEX_PARSER;
+
+static BOOL LtfsIndexStartElement(PINDEX_PARSER parser, LPCSTR tag, LPCSTR attributes, size_t attributesLength);
+static BOOL LtfsIndexEndElement(PINDEX_PARSER parser, LPCSTR tag, LPCSTR text, size_t textLength);
+static LPSTR LtfsIndexDecodeText(LPCSTR text, size_t length, BOOL percentEncoded);
+static BOOL LtfsIndexFinishFile(PINDEX_PARSER parser);
+static int LtfsIndexComparePaths(const void *a, const void *b);
+
+BOOL LtfsIndexLoad(LPCSTR indexFile, PLTFS_INDEX *index)
+{
+    HANDLE handle;
+    LARGE_INTEGER size;
+    LPSTR xml;
+    DWORD bytesRead;
+    BOOL result = FALSE;
+
+    handle = CreateFile(indexFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0 || size.QuadPart >= MAXDWORD)
+    {
+        CloseHandle(handle);
+        return FALSE;
+    }
+
+    xml = (LPSTR)LocalAlloc(LMEM_FIXED, (SIZE_T)size.QuadPart + 1);
+
+    if (xml)
+    {
+        if (ReadFile(handle, xml, (DWORD)size.QuadPart, &bytesRead, NULL) && bytesRead == (DWORD)size.QuadPart)
+        {
+            xml[bytesRead] = '\0';
+            result = LtfsIndexParse(xml, bytesRead, index);
+        }
+
+        LocalFree(xml);
+    }
+
+    CloseHandle(handle);
+
+    return result;
+}
+
+BOOL LtfsIndexReadFromTape(HANDLE handle, PLTFS_INDEX *index)
+{
+    TAPE_SENSE sense;
+    PBYTE xml = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    BOOL result;
+
+    // The index partition always ends ... FM [index] FM EOD. Go to EOD, back over two filemarks, which leaves us just
+    // before the one that precedes the latest index, then forward over it.
+    result = TapeLocate(handle, TAPE_LOCATE_EOD, LTFS_INDEX_PARTITION, 0, &sense);
+
+    if (result)
+        result = TapeSpace(handle, TAPE_SPACE_FILEMARKS, -2, &sense);
+
+    if (result)
+        result = TapeSpace(handle, TAPE_SPACE_FILEMARKS, 1, &sense);
+
+    while (result)
+    {
+        ULONG bytesRead;
+
+        if (capacity - length < LTFS_MAX_BLOCK_SIZE + 1)
+        {
+            size_t newCapacity = capacity ? capacity * 2 : LTFS_MAX_BLOCK_SIZE * 4;
+            PBYTE newXml = (PBYTE)LocalAlloc(LMEM_FIXED, newCapacity);
+
+            if (!newXml)
+            {
+                result = FALSE;
+                break;
+            }
+
+            if (xml)
+            {
+                memcpy(newXml, xml, length);
+                LocalFree(xml);
+            }
+
+            xml = newXml;
+            capacity = newCapacity;
+        }
+
+        if (!TapeRead(handle, xml + length, LTFS_MAX_BLOCK_SIZE, &bytesRead, &sense))
+        {
+            // The filemark after the index is the normal way out of here.
+            result = sense.Filemark && length > 0;
+            break;
+        }
+
+        length += bytesRead;
+    }
+
+    if (result)
+    {
+        xml[length] = '\0';
+        result = LtfsIndexParse((LPCSTR)xml, length, index);
+    }
+
+    if (xml)
+        LocalFree(xml);
+
+    return result;
+}
+
+BOOL LtfsIndexParse(LPCSTR xml, size_t length, PLTFS_INDEX *index)
+{
+    INDEX_PARSER parser;
+    LPCSTR pos = xml;
+    LPCSTR end = xml + length;
+    LPCSTR textStart = NULL;
+    BOOL result = TRUE;
+    DWORD i;
+
+    memset(&parser, 0, sizeof(parser));
+
+    parser.Index = (PLTFS_INDEX)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(LTFS_INDEX));
+
+    if (!parser.Index)
+        return FALSE;
+
+    // This is not a general purpose XML parser. It understands just enough to walk an LTFS index: elements, attributes
+    // we can ignore, comments, processing instructions and character entities. Nothing in the schema needs more than that.
+
+    while (result && pos < end)
+    {
+        LPCSTR tagStart = (LPCSTR)memchr(pos, '<', end - pos);
+        LPCSTR tagEnd;
+
+        if (!tagStart)
+            break;
+
+        if (tagStart + 1 < end && (tagStart[1] == '?' || tagStart[1] == '!'))
+        {
+            LPCSTR closer = (tagStart + 3 < end && strncmp(tagStart, "<!--", 4) == 0) ? strstr(tagStart, "-->") : (LPCSTR)memchr(tagStart, '>', end - tagStart);
+
+            if (!closer)
+            {
+                result = FALSE;
+                break;
+            }
+
+            pos = closer + 1;
+            continue;
+        }
+
+        tagEnd = (LPCSTR)memchr(tagStart, '>', end - tagStart);
+
+        if (!tagEnd)
+        {
+            result = FALSE;
+            break;
+        }
+
+        if (tagStart[1] == '/')
+        {
+            CHAR tag[MAX_INDEX_TAG];
+            size_t tagLength = strcspn(tagStart + 2, " \t\r\n>");
+
+            strncpy_s(tag, sizeof(tag), tagStart + 2, min(tagLength, sizeof(tag) - 1));
+
+            if (parser.Depth == 0 || strcmp(parser.Tags[parser.Depth - 1], tag) != 0)
+            {
+                result = FALSE;
+                break;
+            }
+
+            result = LtfsIndexEndElement(&parser, tag, textStart ? textStart : tagStart, textStart ? (size_t)(tagStart - textStart) : 0);
+            parser.Depth--;
+            textStart = NULL;
+        }
+        else
+        {
+            CHAR tag[MAX_INDEX_TAG];
+            size_t tagLength = strcspn(tagStart + 1, " \t\r\n/>");
+            BOOL selfClosing = tagEnd[-1] == '/';
+            LPCSTR attributes = tagStart + 1 + tagLength;
+
+            strncpy_s(tag, sizeof(tag), tagStart + 1, min(tagLength, sizeof(tag) - 1));
+
+            if (parser.Depth >= MAX_INDEX_DEPTH)
+            {
+                result = FALSE;
+                break;
+            }
+
+            strcpy_s(parser.Tags[parser.Depth++], MAX_INDEX_TAG, tag);
+
+            result = LtfsIndexStartElement(&parser, tag, attributes, tagEnd - attributes);
+
+            if (result && selfClosing)
+            {
+                result = LtfsIndexEndElement(&parser, tag, tagEnd, 0);
+                parser.Depth--;
+                textStart = NULL;
+            }
+            else
+            {
+                textStart = tagEnd + 1;
+            }
+        }
+
+        pos = tagEnd + 1;
+    }
+
+    if (parser.File)
+    {
+        LocalFree(parser.File->Extents);
+        LocalFree(parser.File);
+    }
+
+    if (parser.FileName)
+        LocalFree(parser.FileName);
+
+    for (i = 0; i < parser.DirDepth && i < MAX_INDEX_DEPTH; i++)
+    {
+        if (parser.DirNames[i])
+            LocalFree(parser.DirNames[i]);
+    }
+
+    if (result)
+    {
+        result = parser.Depth == 0 && parser.Index->VolumeUuid[0] != '\0';
+    }
+
+    if (result && parser.Index->FileCount)
+    {
+        PLTFS_FILE file = parser.Index->Files;
+
+        parser.Index->Sorted = (PLTFS_FILE *)LocalAlloc(LMEM_FIXED, sizeof(PLTFS_FILE) * parser.Index->FileCount);
+        result = parser.Index->Sorted != NULL;
+
+        for (i = 0; result && file != NULL; file = file->Next)
+            parser.Index->Sorted[i++] = file;
+
+        if (result)
+            qsort(parser.Index->Sorted, parser.Index->FileCount, sizeof(PLTFS_FILE), LtfsIndexComparePaths);
+    }
+
+    if (!result)
+    {
+        LtfsIndexDestroy(parser.Index);
+        return FALSE;
+    }
+
+    *index = parser.Index;
+    return TRUE;
+}
+
+void LtfsIndexDestroy(PLTFS_INDEX index)
+{
+    PLTFS_FILE file;
+
+    if (!index)
+        return;
+
+    file = index->Files;
+
+    while (file != NULL)
+    {
+        PLTFS_FILE toFree = file;
+        file = file->Next;
+
+        if (toFree->Extents)
+            LocalFree(toFree->Extents);
+
+        if (toFree->Path)
+            LocalFree(toFree->Path);
+
+        LocalFree(toFree);
+    }
+
+    if (index->Sorted)
+        LocalFree(index->Sorted);
+
+    LocalFree(index);
+}
+
+PLTFS_FILE LtfsIndexFindFile(PLTFS_INDEX index, LPCSTR path)
+{
+    CHAR normalised[MAX_PATH * 4];
+    LTFS_FILE key;
+    PLTFS_FILE keyPtr = &key;
+    PLTFS_FILE *found;
+
+    if (!index->Sorted)
+        return NULL;
+
+    LtfsIndexNormalisePath(path, normalised, _countof(normalised));
+    key.Path = normalised;
+
+    found = (PLTFS_FILE *)bsearch(&keyPtr, index->Sorted, index->FileCount, sizeof(PLTFS_FILE), LtfsIndexComparePaths);
+
+    return found ? *found : NULL;
+}
+
+static BOOL LtfsIndexStartElement(PINDEX_PARSER parser, LPCSTR tag, LPCSTR attributes, size_t attributesLength)
+{
+    if (strcmp(tag, "directory") == 0)
+    {
+        if (parser->DirDepth >= MAX_INDEX_DEPTH)
+            return FALSE;
+
+        parser->DirNames[parser->DirDepth++] = NULL;
+    }
+    else if (strcmp(tag, "file") == 0)
+    {
+        if (parser->File)
+            return FALSE;
+
+        parser->File = (PLTFS_FILE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(LTFS_FILE));
+        parser->ExtentCapacity = 0;
+
+        if (!parser->File)
+            return FALSE;
+    }
+    else if (strcmp(tag, "extent") == 0)
+    {
+        memset(&parser->Extent, 0, sizeof(LTFS_EXTENT));
+    }
+    else if (strcmp(tag, "name") == 0)
+    {
+        CHAR attributeText[128];
+
+        strncpy_s(attributeText, sizeof(attributeText), attributes, min(attributesLength, sizeof(attributeText) - 1));
+        parser->PercentEncoded = strstr(attributeText, "percentencoded=\"true\"") != NULL;
+    }
+
+    return TRUE;
+}
+
+static BOOL LtfsIndexEndElement(PINDEX_PARSER parser, LPCSTR tag, LPCSTR text, size_t textLength)
+{
+    LPCSTR parent = parser->Depth >= 2 ? parser->Tags[parser->Depth - 2] : "";
+
+    if (strcmp(tag, "directory") == 0)
+    {
+        parser->DirDepth--;
+
+        if (parser->DirNames[parser->DirDepth])
+        {
+            LocalFree(parser->DirNames[parser->DirDepth]);
+            parser->DirNames[parser->DirDepth] = NULL;
+        }
+    }
+    else if (strcmp(tag, "file") == 0)
+    {
+        return LtfsIndexFinishFile(parser);
+    }
+    else if (strcmp(tag, "name") == 0)
+    {
+        LPSTR name = LtfsIndexDecodeText(text, textLength, parser->PercentEncoded);
+
+        if (!name)
+            return FALSE;
+
+        if (strcmp(parent, "file") == 0 && parser->File)
+        {
+            if (parser->FileName)
+                LocalFree(parser->FileName);
+
+            parser->FileName = name;
+        }
+        else if (strcmp(parent, "directory") == 0 && parser->DirDepth > 0)
+        {
+            if (parser->DirNames[parser->DirDepth - 1])
+                LocalFree(parser->DirNames[parser->DirDepth - 1]);
+
+            parser->DirNames[parser->DirDepth - 1] = name;
+        }
+        else
+        {
+            LocalFree(name);
+        }
+    }
+    else if (strcmp(tag, "length") == 0 && strcmp(parent, "file") == 0 && parser->File)
+    {
+        parser->File->Length = _strtoui64(text, NULL, 10);
+    }
+    else if (strcmp(tag, "volumeuuid") == 0 && strcmp(parent, "ltfsindex") == 0)
+    {
+        strncpy_s(parser->Index->VolumeUuid, sizeof(parser->Index->VolumeUuid), text, min(textLength, LTFS_UUID_LENGTH - 1));
+    }
+    else if (strcmp(tag, "generationnumber") == 0 && strcmp(parent, "ltfsindex") == 0)
+    {
+        parser->Index->Generation = _strtoui64(text, NULL, 10);
+    }
+    else if (strcmp(parent, "extent") == 0)
+    {
+        if (strcmp(tag, "fileoffset") == 0)
+            parser->Extent.FileOffset = _strtoui64(text, NULL, 10);
+        else if (strcmp(tag, "startblock") == 0)
+            parser->Extent.StartBlock = _strtoui64(text, NULL, 10);
+        else if (strcmp(tag, "bytecount") == 0)
+            parser->Extent.ByteCount = _strtoui64(text, NULL, 10);
+        else if (strcmp(tag, "byteoffset") == 0)
+            parser->Extent.ByteOffset = strtoul(text, NULL, 10);
+        else if (strcmp(tag, "partition") == 0)
+            parser->Extent.Partition = (BYTE)(tolower(text[0]) - 'a');
+    }
+    else if (strcmp(tag, "extent") == 0 && parser->File)
+    {
+        PLTFS_FILE file = parser->File;
+
+        if (file->ExtentCount == parser->ExtentCapacity)
+        {
+            DWORD newCapacity = parser->ExtentCapacity ? parser->ExtentCapacity * 2 : 4;
+            PLTFS_EXTENT extents = (PLTFS_EXTENT)LocalAlloc(LMEM_FIXED, sizeof(LTFS_EXTENT) * newCapacity);
+
+            if (!extents)
+                return FALSE;
+
+            if (file->Extents)
+            {
+                memcpy(extents, file->Extents, sizeof(LTFS_EXTENT) * file->ExtentCount);
+                LocalFree(file->Extents);
+            }
+
+            file->Extents = extents;
+            parser->ExtentCapacity = newCapacity;
+        }
+
+        file->Extents[file->ExtentCount++] = parser->Extent;
+    }
+
+    return TRUE;
+}
+
+static BOOL LtfsIndexFinishFile(PINDEX_PARSER parser)
+{
+    PLTFS_FILE file = parser->File;
+    size_t pathLength = 1;
+    DWORD i;
+
+    if (!file || !parser->FileName)
+        return FALSE;
+
+    // The root directory's name is the volume name, so it doesn't form part of the path.
+    for (i = 1; i < parser->DirDepth; i++)
+        pathLength += (parser->DirNames[i] ? strlen(parser->DirNames[i]) : 0) + 1;
+
+    pathLength += strlen(parser->FileName);
+
+    file->Path = (LPSTR)LocalAlloc(LMEM_FIXED, pathLength);
+
+    if (!file->Path)
+        return FALSE;
+
+    file->Path[0] = '\0';
+
+    for (i = 1; i < parser->DirDepth; i++)
+    {
+        if (parser->DirNames[i])
+            strcat_s(file->Path, pathLength, parser->DirNames[i]);
+
+        strcat_s(file->Path, pathLength, "\\");
+    }
+
+    strcat_s(file->Path, pathLength, parser->FileName);
+
+    LocalFree(parser->FileName);
+    parser->FileName = NULL;
+
+    if (parser->LastFile)
+        parser->LastFile->Next = file;
+    else
+        parser->Index->Files = file;
+
+    parser->LastFile = file;
+    parser->Index->FileCount++;
+    parser->File = NULL;
+
+    return TRUE;
+}
+
+static LPSTR LtfsIndexDecodeText(LPCSTR text, size_t length, BOOL percentEncoded)
+{
+    LPSTR result = (LPSTR)LocalAlloc(LMEM_FIXED, length + 1);
+    size_t in = 0;
+    size_t out = 0;
+
+    if (!result)
+        return NULL;
+
+    while (in < length)
+    {
+        if (text[in] == '&')
+        {
+            LPCSTR semi = (LPCSTR)memchr(text + in, ';', length - in);
+
+            if (semi)
+            {
+                size_t entityLength = semi - (text + in) + 1;
+
+                if (strncmp(text + in, "&amp;", entityLength) == 0)
+                    result[out++] = '&';
+                else if (strncmp(text + in, "&lt;", entityLength) == 0)
+                    result[out++] = '<';
+                else if (strncmp(text + in, "&gt;", entityLength) == 0)
+                    result[out++] = '>';
+                else if (strncmp(text + in, "&quot;", entityLength) == 0)
+                    result[out++] = '"';
+                else if (strncmp(text + in, "&apos;", entityLength) == 0)
+                    result[out++] = '\'';
+                else if (text[in + 1] == '#')
+                    result[out++] = (CHAR)(text[in + 2] == 'x' ? strtoul(text + in + 3, NULL, 16) : strtoul(text + in + 2, NULL, 10));
+                else
+                    entityLength = 0;
+
+                if (entityLength)
+                {
+                    in += entityLength;
+                    continue;
+                }
+            }
+        }
+        else if (percentEncoded && text[in] == '%' && in + 2 < length && isxdigit(text[in + 1]) && isxdigit(text[in + 2]))
+        {
+            CHAR hex[3] = { text[in + 1], text[in + 2], '\0' };
+            result[out++] = (CHAR)strtoul(hex, NULL, 16);
+            in += 3;
+            continue;
+        }
+
+        result[out++] = text[in++];
+    }
+
+    result[out] = '\0';
+
+    return result;
+}
+
+static int LtfsIndexComparePaths(const void *a, const void *b)
+{
+    return _stricmp((*(const PLTFS_FILE *)a)->Path, (*(const PLTFS_FILE *)b)->Path);
+}
+
+void LtfsIndexNormalisePath(LPCSTR path, LPSTR buffer, size_t len)
+{
+    LPSTR c;
+
+    // Accept "T:\dir\file", "\dir\file", "dir/file" and so on. Everything is relative to the volume root.
+    if (isalpha(path[0]) && path[1] == ':')
+        path += 2;
+
+    while (*path == '\\' || *path == '/')
+        path++;
+
+    strncpy_s(buffer, len, path, _TRUNCATE);
+
+    for (c = buffer; *c; c++)
+    {
+        if (*c == '/')
+            *c = '\\';
+    }
+}
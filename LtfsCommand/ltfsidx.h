@@ -0,0 +1,60 @@
+/*
+ *   File:   ltfsidx.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define LTFS_UUID_LENGTH        37
+#define LTFS_INDEX_PARTITION    0
+#define LTFS_DATA_PARTITION     1
+#define LTFS_MAX_BLOCK_SIZE     (1024 * 1024)
+
+typedef struct LTFS_EXTENT
+{
+    ULONGLONG FileOffset;
+    ULONGLONG StartBlock;
+    ULONGLONG ByteCount;
+    DWORD ByteOffset;
+    BYTE Partition;
+} LTFS_EXTENT, *PLTFS_EXTENT;
+
+typedef struct LTFS_FILE
+{
+    LPSTR Path;
+    ULONGLONG Length;
+    DWORD ExtentCount;
+    PLTFS_EXTENT Extents;
+    struct LTFS_FILE * Next;
+} LTFS_FILE, *PLTFS_FILE;
+
+typedef struct LTFS_INDEX
+{
+    CHAR VolumeUuid[LTFS_UUID_LENGTH];
+    ULONGLONG Generation;
+    DWORD FileCount;
+    PLTFS_FILE Files;
+    PLTFS_FILE *Sorted;
+} LTFS_INDEX, *PLTFS_INDEX;
+
+BOOL LtfsIndexLoad(LPCSTR indexFile, PLTFS_INDEX *index);
+BOOL LtfsIndexReadFromTape(HANDLE handle, PLTFS_INDEX *index);
+BOOL LtfsIndexParse(LPCSTR xml, size_t length, PLTFS_INDEX *index);
+void LtfsIndexDestroy(PLTFS_INDEX index);
+PLTFS_FILE LtfsIndexFindFile(PLTFS_INDEX index, LPCSTR path);
+void LtfsIndexNormalisePath(LPCSTR path, LPSTR buffer, size_t len);
@@ -20,16 +20,25 @@
 #include "ltfsreg.h"
 #include "util.h"
 
+#define LTFS_MAPPINGS_KEY   "Software\\Hewlett-Packard\\LTFS\\Mappings"
+#define MAX_MAPPING_KEY     (64 + MAX_MOUNT_TARGET)
+
 static BOOL LtfsRegGetInstallDir(LPSTR buffer, USHORT bufferLen);
+static void LtfsRegLetterTarget(CHAR driveLetter, LPSTR target, DWORD targetLength);
+static void LtfsRegKeyName(LPCSTR target, LPSTR keyName, DWORD keyNameLength);
+static void LtfsRegMappingKey(LPCSTR target, LPSTR regKey, DWORD regKeyLength);
 
-BOOL LtfsRegCreateMapping(CHAR driveLetter, LPCSTR tapeDrive, LPCSTR serialNumber, LPCSTR logDir, LPCSTR workDir, BOOL showOffline)
+BOOL LtfsRegCreateTargetMapping(LPCSTR target, LPCSTR tapeDrive, LPCSTR serialNumber, LPCSTR logDir, LPCSTR workDir, BOOL showOffline)
 {
     HKEY key;
     DWORD disposition;
-    CHAR regKey[128];
+    CHAR regKey[MAX_MAPPING_KEY];
+    CHAR keyName[MAX_MOUNT_TARGET];
+    BOOL directory = strlen(target) > 2;
     BOOL success = FALSE;
 
-    _snprintf_s(regKey, _countof(regKey), _TRUNCATE, "Software\\Hewlett-Packard\\LTFS\\Mappings\\%c", driveLetter);
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+    LtfsRegKeyName(target, keyName, _countof(keyName));
 
     // These registry values are read directly by FUSE4WinSvc.exe
     if (RegCreateKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, NULL, 0, KEY_READ | KEY_CREATE_SUB_KEY | KEY_SET_VALUE, NULL, &key, &disposition) == ERROR_SUCCESS)
@@ -49,18 +58,31 @@ BOOL LtfsRegCreateMapping(CHAR driveLetter, LPCSTR tapeDrive, LPCSTR serialNumbe
 
             if (success)
             {
+                CHAR mountPoint[MAX_MOUNT_TARGET + 2];
                 char commandLine[MAX_COMMAND_LINE];
+
+                // The service swaps the T: for the key's drive letter. A directory goes in as it is.
+                if (directory)
+                    _snprintf_s(mountPoint, _countof(mountPoint), _TRUNCATE, "\"%s\"", target);
+                else
+                    strcpy_s(mountPoint, _countof(mountPoint), "T:");
+
                 _snprintf_s(commandLine, _countof(commandLine), _TRUNCATE,
-                    "%s%sltfs.exe T: -o devname=%s -d -o log_directory=%s -o work_directory=%s%s",
-                    installDir, installDir[strlen(installDir) - 1] == '\\' ? "" : "\\", tapeDrive, logDir, workDir, showOffline ? " -o show_offline" : "");
+                    "%s%sltfs.exe %s -o devname=%s -d -o log_directory=%s -o work_directory=%s%s",
+                    installDir, installDir[strlen(installDir) - 1] == '\\' ? "" : "\\", mountPoint, tapeDrive, logDir, workDir, showOffline ? " -o show_offline" : "");
                 success = RegSetKeyValue(key, NULL, "CommandLine", REG_SZ, commandLine, (DWORD)(strlen(commandLine) + 1)) == ERROR_SUCCESS;
             }
         }
 
+        if (success && directory)
+        {
+            success = RegSetKeyValue(key, NULL, "MountPoint", REG_SZ, target, (DWORD)(strlen(target) + 1)) == ERROR_SUCCESS;
+        }
+
         if (success)
         {
-            char traceTarget[MAX_TRACE_TARGET];
-            _snprintf_s(traceTarget, _countof(traceTarget), _TRUNCATE, "\\\\.\\pipe\\%c", driveLetter);
+            char traceTarget[MAX_TRACE_TARGET + MAX_MOUNT_TARGET];
+            _snprintf_s(traceTarget, _countof(traceTarget), _TRUNCATE, "\\\\.\\pipe\\%s", keyName);
             success = RegSetKeyValue(key, NULL, "TraceTarget", REG_SZ, traceTarget, (DWORD)(strlen(traceTarget) + 1)) == ERROR_SUCCESS;
         }
 
@@ -76,16 +98,15 @@ BOOL LtfsRegCreateMapping(CHAR driveLetter, LPCSTR tapeDrive, LPCSTR serialNumbe
     return success;
 }
 
-BOOL LtfsRegUpdateMapping(CHAR driveLetter, LPCSTR newDevName)
+BOOL LtfsRegUpdateTargetMapping(LPCSTR target, LPCSTR newDevName)
 {
     HKEY key;
-    DWORD disposition;
-    CHAR regKey[128];
+    CHAR regKey[MAX_MAPPING_KEY];
     BOOL success = FALSE;
 
-    _snprintf_s(regKey, _countof(regKey), _TRUNCATE, "Software\\Hewlett-Packard\\LTFS\\Mappings\\%c", driveLetter);
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
 
-    if (RegCreateKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, NULL, 0, KEY_READ | KEY_CREATE_SUB_KEY | KEY_SET_VALUE, NULL, &key, &disposition) == ERROR_SUCCESS)
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ | KEY_SET_VALUE, &key) == ERROR_SUCCESS)
     {
         CHAR oldDevName[MAX_DEVICE_NAME];
         DWORD type = REG_SZ;
@@ -109,15 +130,30 @@ BOOL LtfsRegUpdateMapping(CHAR driveLetter, LPCSTR newDevName)
             if (success)
             {
                 // Now fix up the LTFS command line. Let's just sub the devname argument for now, otherwise we have to rebuild this string 
-                // which would be a lot more complicated.
+                // which would be a lot more complicated. It has to be followed by a space or the end of the line, or TAPE1 would
+                // match the front of TAPE12.
 
                 CHAR oldDevArg[MAX_DEVICE_NAME];
                 CHAR newDevArg[MAX_DEVICE_NAME];
+                size_t oldLength, length;
 
-                _snprintf_s(oldDevArg, _countof(regKey), _TRUNCATE, "devname=%s", oldDevName);
-                _snprintf_s(newDevArg, _countof(regKey), _TRUNCATE, "devname=%s", newDevName);
+                _snprintf_s(oldDevArg, _countof(oldDevArg), _TRUNCATE, "devname=%s", oldDevName);
+                _snprintf_s(newDevArg, _countof(newDevArg), _TRUNCATE, "devname=%s", newDevName);
 
-                success = StringReplace(commandLine, oldDevArg, newDevArg, _countof(commandLine)) > 0;
+                oldLength = strlen(oldDevArg);
+                length = strlen(commandLine);
+
+                if (length >= oldLength && !strcmp(commandLine + length - oldLength, oldDevArg))
+                {
+                    success = strcpy_s(commandLine + length - oldLength, _countof(commandLine) - (length - oldLength), newDevArg) == 0;
+                }
+                else
+                {
+                    strcat_s(oldDevArg, _countof(oldDevArg), " ");
+                    strcat_s(newDevArg, _countof(newDevArg), " ");
+
+                    success = StringReplace(commandLine, oldDevArg, newDevArg, _countof(commandLine)) > 0;
+                }
 
                 if (success)
                 {
@@ -132,51 +168,81 @@ BOOL LtfsRegUpdateMapping(CHAR driveLetter, LPCSTR newDevName)
     return success;
 }
 
-BOOL LtfsRegRemoveMapping(CHAR driveLetter)
+BOOL LtfsRegRemoveTargetMapping(LPCSTR target)
 {
-    char regKey[128];
+    CHAR regKey[MAX_MAPPING_KEY];
 
-    _snprintf_s(regKey, _countof(regKey), _TRUNCATE, "Software\\Hewlett-Packard\\LTFS\\Mappings\\%c", driveLetter);
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
 
     return RegDeleteKey(HKEY_LOCAL_MACHINE, regKey) == ERROR_SUCCESS;
 }
 
-BOOL LtfsRegGetMappingCount(BYTE *numMappings)
+BOOL LtfsRegGetMappingCount(PDWORD numMappings)
 {
     HKEY key;
-    BYTE count = 0;
-    char driveLetter;
-    char regKey[128];
+    LRESULT result = RegOpenKeyEx(HKEY_LOCAL_MACHINE, LTFS_MAPPINGS_KEY, 0, KEY_READ, &key);
 
-    for (driveLetter = MIN_DRIVE_LETTER; driveLetter <= MAX_DRIVE_LETTER; driveLetter++)
+    // Nothing has ever been mapped.
+    if (result == ERROR_FILE_NOT_FOUND)
     {
-        _snprintf_s(regKey, _countof(regKey), _TRUNCATE, "Software\\Hewlett-Packard\\LTFS\\Mappings\\%c", driveLetter);
+        *numMappings = 0;
+        return TRUE;
+    }
 
-        LRESULT result = RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ, &key);
+    if (result != ERROR_SUCCESS)
+        return FALSE;
 
-        if (result == ERROR_SUCCESS)
-        {
-            count++;
-            RegCloseKey(key);
-        }
-        else if (result != ERROR_FILE_NOT_FOUND)
+    result = RegQueryInfoKey(key, NULL, NULL, NULL, numMappings, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+
+    RegCloseKey(key);
+
+    return result == ERROR_SUCCESS;
+}
+
+BOOL LtfsRegEnumMappings(DWORD index, LPSTR target, DWORD targetLength)
+{
+    HKEY key;
+    CHAR keyName[MAX_MOUNT_TARGET];
+    DWORD keyNameLength = _countof(keyName);
+    BOOL result = FALSE;
+    DWORD i;
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, LTFS_MAPPINGS_KEY, 0, KEY_READ, &key) != ERROR_SUCCESS)
+        return FALSE;
+
+    result = RegEnumKeyEx(key, index, keyName, &keyNameLength, NULL, NULL, NULL, NULL) == ERROR_SUCCESS;
+
+    RegCloseKey(key);
+
+    if (!result)
+        return FALSE;
+
+    if (keyNameLength == 1)
+    {
+        LtfsRegLetterTarget(keyName[0], target, targetLength);
+        return TRUE;
+    }
+
+    // Key names can't have backslashes in, so Windows paths are stored with forward slashes.
+    if (keyName[1] == ':')
+    {
+        for (i = 0; i < keyNameLength; i++)
         {
-            return FALSE;
+            if (keyName[i] == '/')
+                keyName[i] = '\\';
         }
     }
 
-    *numMappings = count;
-    return TRUE;
+    return strcpy_s(target, targetLength, keyName) == 0;
 }
 
-BOOL LtfsRegGetMappingProperties(CHAR driveLetter, LPSTR deviceName, USHORT deviceNameLength, LPSTR serialNumber, USHORT serialNumberLength)
+BOOL LtfsRegGetTargetProperties(LPCSTR target, LPSTR deviceName, USHORT deviceNameLength, LPSTR serialNumber, USHORT serialNumberLength)
 {
     HKEY key;
-    BYTE count = 0;
     BOOL result = FALSE;
-    char regKey[128];
+    CHAR regKey[MAX_MAPPING_KEY];
 
-    _snprintf_s(regKey, _countof(regKey), _TRUNCATE, "Software\\Hewlett-Packard\\LTFS\\Mappings\\%c", driveLetter);
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
 
     if ((result = (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ, &key) == ERROR_SUCCESS)))
     {
@@ -200,6 +266,176 @@ BOOL LtfsRegGetMappingProperties(CHAR driveLetter, LPSTR deviceName, USHORT devi
     return result;
 }
 
+BOOL LtfsRegSetTargetCompression(LPCSTR target, DWORD policy)
+{
+    HKEY key;
+    BOOL success = FALSE;
+    CHAR regKey[MAX_MAPPING_KEY];
+
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+
+    // Ours rather than FUSE4WinSvc.exe's, it doesn't look at it. Only open the key, a policy is no use without a mapping.
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ | KEY_SET_VALUE, &key) == ERROR_SUCCESS)
+    {
+        success = RegSetKeyValue(key, NULL, "Compression", REG_DWORD, &policy, sizeof(policy)) == ERROR_SUCCESS;
+        RegCloseKey(key);
+    }
+
+    return success;
+}
+
+BOOL LtfsRegGetTargetCompression(LPCSTR target, PDWORD policy)
+{
+    HKEY key;
+    BOOL result = FALSE;
+    CHAR regKey[MAX_MAPPING_KEY];
+
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+
+    if ((result = (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ, &key) == ERROR_SUCCESS)))
+    {
+        DWORD value = sizeof(DWORD);
+        DWORD type = REG_DWORD;
+
+        // Mappings made before there was a policy don't have one.
+        if (RegQueryValueEx(key, "Compression", NULL, &type, policy, &value) != ERROR_SUCCESS || type != REG_DWORD)
+            *policy = LTFS_COMPRESSION_DEFAULT;
+
+        RegCloseKey(key);
+    }
+
+    return result;
+}
+
+BOOL LtfsRegSetScsiAddress(LPCSTR target, LPCSTR address)
+{
+    HKEY key;
+    BOOL success = FALSE;
+    CHAR regKey[MAX_MAPPING_KEY];
+
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+
+    // Also ours. Only a hint for finding the drive again when its device name moves, the serial number is what counts.
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ | KEY_SET_VALUE, &key) == ERROR_SUCCESS)
+    {
+        success = RegSetKeyValue(key, NULL, "ScsiAddress", REG_SZ, address, (DWORD)(strlen(address) + 1)) == ERROR_SUCCESS;
+        RegCloseKey(key);
+    }
+
+    return success;
+}
+
+BOOL LtfsRegGetScsiAddress(LPCSTR target, LPSTR address, USHORT addressLength)
+{
+    HKEY key;
+    BOOL result = FALSE;
+    CHAR regKey[MAX_MAPPING_KEY];
+
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ, &key) == ERROR_SUCCESS)
+    {
+        DWORD value = addressLength;
+        DWORD type = REG_SZ;
+        result = RegQueryValueEx(key, "ScsiAddress", NULL, &type, address, &value) == ERROR_SUCCESS;
+
+        RegCloseKey(key);
+    }
+
+    return result;
+}
+
+BOOL LtfsRegSetMediaCache(LPCSTR target, LPCVOID cache, DWORD cacheLength)
+{
+    HKEY key;
+    BOOL success = FALSE;
+    CHAR regKey[MAX_MAPPING_KEY];
+
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+
+    // Ours as well. The last media check, to save asking the drive again too soon or while it's busy.
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ | KEY_SET_VALUE, &key) == ERROR_SUCCESS)
+    {
+        success = RegSetKeyValue(key, NULL, "MediaCache", REG_BINARY, cache, cacheLength) == ERROR_SUCCESS;
+        RegCloseKey(key);
+    }
+
+    return success;
+}
+
+BOOL LtfsRegGetMediaCache(LPCSTR target, PVOID cache, DWORD cacheLength)
+{
+    HKEY key;
+    BOOL result = FALSE;
+    CHAR regKey[MAX_MAPPING_KEY];
+
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ, &key) == ERROR_SUCCESS)
+    {
+        DWORD value = cacheLength;
+        DWORD type = REG_BINARY;
+
+        // Anything written by a build with a different layout is just ignored.
+        result = RegQueryValueEx(key, "MediaCache", NULL, &type, cache, &value) == ERROR_SUCCESS && type == REG_BINARY && value == cacheLength;
+
+        RegCloseKey(key);
+    }
+
+    return result;
+}
+
+BOOL LtfsRegClearMediaCache(LPCSTR target)
+{
+    HKEY key;
+    BOOL success = FALSE;
+    CHAR regKey[MAX_MAPPING_KEY];
+
+    LtfsRegMappingKey(target, regKey, _countof(regKey));
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ | KEY_SET_VALUE, &key) == ERROR_SUCCESS)
+    {
+        LSTATUS status = RegDeleteValue(key, "MediaCache");
+        success = status == ERROR_SUCCESS || status == ERROR_FILE_NOT_FOUND;
+        RegCloseKey(key);
+    }
+
+    return success;
+}
+
+static void LtfsRegLetterTarget(CHAR driveLetter, LPSTR target, DWORD targetLength)
+{
+    _snprintf_s(target, targetLength, _TRUNCATE, "%c:", driveLetter);
+}
+
+static void LtfsRegKeyName(LPCSTR target, LPSTR keyName, DWORD keyNameLength)
+{
+    DWORD i;
+
+    // Drive letters keep the single letter key FUSE4WinSvc.exe expects.
+    if (strlen(target) == 2)
+    {
+        _snprintf_s(keyName, keyNameLength, _TRUNCATE, "%c", target[0]);
+        return;
+    }
+
+    strcpy_s(keyName, keyNameLength, target);
+
+    for (i = 0; keyName[i]; i++)
+    {
+        if (keyName[i] == '\\')
+            keyName[i] = '/';
+    }
+}
+
+static void LtfsRegMappingKey(LPCSTR target, LPSTR regKey, DWORD regKeyLength)
+{
+    CHAR keyName[MAX_MOUNT_TARGET];
+
+    LtfsRegKeyName(target, keyName, _countof(keyName));
+    _snprintf_s(regKey, regKeyLength, _TRUNCATE, "%s\\%s", LTFS_MAPPINGS_KEY, keyName);
+}
+
 static BOOL LtfsRegGetInstallDir(LPSTR buffer, USHORT bufferLen)
 {
     HKEY key;
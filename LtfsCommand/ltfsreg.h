@@ -27,9 +27,23 @@
 #define MAX_SERIAL_NUMBER   128
 #define MAX_TRACE_TARGET    128
 #define MAX_COMMAND_LINE    1024
+#define MAX_MOUNT_TARGET    MAX_PATH    // Either X: or a directory to mount on
+#define MAX_SCSI_ADDRESS    16          // Port:Bus:Target:Lun
 
-BOOL LtfsRegCreateMapping(CHAR driveLetter, LPCSTR tapeDrive, LPCSTR serialNumber, LPCSTR logDir, LPCSTR workDir, BOOL showOffline);
-BOOL LtfsRegUpdateMapping(CHAR driveLetter, LPCSTR newDevName);
-BOOL LtfsRegRemoveMapping(CHAR driveLetter);
-BOOL LtfsRegGetMappingCount(BYTE *numMappings);
-BOOL LtfsRegGetMappingProperties(CHAR driveLetter, LPSTR deviceName, USHORT deviceNameLength, LPSTR serialNumber, USHORT serialNumberLength);
\ No newline at end of file
+#define LTFS_COMPRESSION_DEFAULT    0   // Whatever the drive does by itself
+#define LTFS_COMPRESSION_ON         1
+#define LTFS_COMPRESSION_OFF        2
+
+BOOL LtfsRegGetMappingCount(PDWORD numMappings);
+BOOL LtfsRegCreateTargetMapping(LPCSTR target, LPCSTR tapeDrive, LPCSTR serialNumber, LPCSTR logDir, LPCSTR workDir, BOOL showOffline);
+BOOL LtfsRegUpdateTargetMapping(LPCSTR target, LPCSTR newDevName);
+BOOL LtfsRegRemoveTargetMapping(LPCSTR target);
+BOOL LtfsRegGetTargetProperties(LPCSTR target, LPSTR deviceName, USHORT deviceNameLength, LPSTR serialNumber, USHORT serialNumberLength);
+BOOL LtfsRegEnumMappings(DWORD index, LPSTR target, DWORD targetLength);
+BOOL LtfsRegSetTargetCompression(LPCSTR target, DWORD policy);
+BOOL LtfsRegGetTargetCompression(LPCSTR target, PDWORD policy);
+BOOL LtfsRegSetScsiAddress(LPCSTR target, LPCSTR address);
+BOOL LtfsRegGetScsiAddress(LPCSTR target, LPSTR address, USHORT addressLength);
+BOOL LtfsRegSetMediaCache(LPCSTR target, LPCVOID cache, DWORD cacheLength);
+BOOL LtfsRegGetMediaCache(LPCSTR target, PVOID cache, DWORD cacheLength);
+BOOL LtfsRegClearMediaCache(LPCSTR target);
\ No newline at end of file
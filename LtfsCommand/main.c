@@ -22,6 +22,27 @@
 #include "fusesvc.h"
 #include "util.h"
 #include "getopt.h"
+#include "ltfsidx.h"
+#include "recall.h"
+#include "catalog.h"
+#include "planner.h"
+#include "seekmodel.h"
+#include "layout.h"
+#include "crc32c.h"
+#include "verify.h"
+#include "fixity.h"
+#include "image.h"
+#include "copy.h"
+#include "ingest.h"
+#include "pack.h"
+#include "archive.h"
+#include "media.h"
+#include "mapping.h"
+#include "watch.h"
+#include "inventory.h"
+#include "status.h"
+#include "board.h"
+#include "lock.h"
 
 #define DEFAULT_LOG_DIR    "C:\\ProgramData\\Hewlett-Packard\\LTFS"
 #define DEFAULT_WORK_DIR   "C:\\tmp\\LTFS"
@@ -40,7 +61,31 @@ typedef enum
     LoadOnly,
     Mount,
     Eject,
-    CheckMedia
+    CheckMedia,
+    Recall,
+    RawRecall,
+    CatalogVolume,
+    RecallPlan,
+    Calibrate,
+    ScanLayout,
+    CrcBench,
+    Verify,
+    Fixity,
+    FixityCheck,
+    DumpImage,
+    RestoreImage,
+    Copy,
+    Ingest,
+    Pack,
+    Unpack,
+    ArchivePlan,
+    Archive,
+    Compression,
+    CompressionStats,
+    Watch,
+    Status,
+    Serve,
+    Board
 } Operation;
 
 static int ListTapeDrives();
@@ -48,12 +93,39 @@ static int ListDriveMappings();
 static int StartLtfsService();
 static int StopLtfsService();
 static int RemapTapeDrives();
-static int MapTapeDrive(CHAR driveLetter, LPCSTR tapeDrive, BYTE tapeIndex, LPCSTR logDir, LPCSTR workDir, BOOL showOffline);
-static int UnmapTapeDrive(CHAR driveLetter);
-static int LoadTapeDrive(CHAR driveLetter, BOOL mount);
-static int EjectTapeDrive(CHAR driveLetter);
-static int MountTapeDrive(CHAR driveLetter);
-static int CheckTapeMedia(CHAR driveLetter);
+static int MapTapeDrive(LPCSTR target, CHAR driveLetter, LPCSTR tapeDrive, DWORD tapeIndex, LPCSTR logDir, LPCSTR workDir, BOOL showOffline, DWORD compression);
+static int UnmapTapeDrive(LPCSTR target);
+static int LoadTapeDrive(LPCSTR target, BOOL mount);
+static int EjectTapeDrive(LPCSTR target, CHAR driveLetter);
+static int MountTapeDrive(LPCSTR target);
+static int CheckTapeMedia(LPCSTR target, BOOL allDrives, DWORD maxAge);
+static void PrintMediaStatus(PMEDIA_STATUS status);
+static void PrintMediaSource(PMEDIA_STATUS status);
+static int RecallFiles(LPCSTR target, CHAR driveLetter, LPCSTR listFile, LPCSTR indexFile, LPCSTR outputDir, BOOL raw, BOOL protect, LPCSTR imageFile, LPCSTR layoutFile);
+static int CatalogTapeVolume(LPCSTR target, LPCSTR catalogFile, LPCSTR indexFile);
+static int RecallFromCatalog(LPCSTR listFile, LPCSTR catalogFile, LPCSTR outputDir, BOOL protect);
+static int CalibrateSeekModel(LPCSTR target, BOOL emulate);
+static int ScanTapeLayout(LPCSTR target, LPCSTR mapFile);
+static int BenchmarkCrc();
+static int VerifyTapeDrive(LPCSTR target);
+static int HashVolumeFiles(LPCSTR target, CHAR driveLetter, LPCSTR algorithmName, LPCSTR indexFile, LPCSTR manifestFile, BOOL check);
+static int TransferTapeImage(LPCSTR target, LPCSTR imageFile, LPCSTR layoutFile, BOOL restore);
+static int CopyTapeDrive(LPCSTR source, LPCSTR destination);
+static int IngestToDrive(LPCSTR target, CHAR driveLetter, LPCSTR sourceDir, LPCSTR targetDir, LPCSTR algorithmName);
+static int PackToDrive(CHAR driveLetter, LPCSTR sourceDir, LPCSTR targetDir, LPCSTR catalogFile, DWORD containerMB);
+static int UnpackFromDrive(CHAR driveLetter, LPCSTR listFile, LPCSTR catalogFile, LPCSTR outputDir);
+static int PlanArchive(LPCSTR sourceDir, LPCSTR planFile);
+static int ArchiveFromPlan(LPCSTR planFile, LPCSTR algorithmName);
+static int SetCompressionPolicy(LPCSTR target, DWORD policy);
+static int ReportCompression(LPCSTR target, BOOL allDrives, DWORD maxAge);
+static void PrintCompressionStatus(PMEDIA_STATUS status);
+static int WatchTapeDrives();
+static int ReportStatus(DWORD maxAge, BOOL json);
+static void PrintStatusText(PSTATUS_REPORT report);
+static void PrintStatusJson(PSTATUS_REPORT report);
+static void PrintJsonString(LPCSTR value);
+static int ServeStatusBoard(DWORD interval);
+static int ReportStatusBoard(BOOL json);
 
 int main(int argc, char *argv[])
 {
@@ -61,12 +133,36 @@ int main(int argc, char *argv[])
     Operation operation = None;
     BOOL showOffline = TRUE;
     BOOL driveLetterArgFound = FALSE;
+    BOOL copyTargetArgFound = FALSE;
     BOOL tapeDriveArgFound = FALSE;
-    BYTE tapeIndex;
-    CHAR driveName[8];
+    BOOL emulate = FALSE;
+    BOOL protect = FALSE;
+    BOOL json = FALSE;
+    DWORD tapeIndex;
+    CHAR driveName[MAX_DEVICE_NAME];
+    CHAR mountTarget[MAX_MOUNT_TARGET];
     CHAR driveLetter;
+    CHAR copyTarget[MAX_MOUNT_TARGET];
+    CHAR copyLetter;
     LPCSTR logDir = DEFAULT_LOG_DIR;
     LPCSTR workDir = DEFAULT_WORK_DIR;
+    LPCSTR listFile = NULL;
+    LPCSTR indexFile = NULL;
+    LPCSTR outputDir = NULL;
+    LPCSTR sourceDir = NULL;
+    LPCSTR catalogFile = NULL;
+    LPCSTR mapFile = NULL;
+    LPCSTR layoutFile = NULL;
+    LPCSTR algorithmName = "sha256";
+    DWORD containerMB = PACK_DEFAULT_CONTAINER_MB;
+    DWORD compression = LTFS_COMPRESSION_DEFAULT;
+    BOOL compressionArgFound = FALSE;
+    DWORD maxAge = 0;
+    BOOL needConfigLock = FALSE;
+    HANDLE driveLock = NULL;
+    HANDLE targetLock = NULL;
+    HANDLE configLock = NULL;
+    int result = EXIT_FAILURE;
 
     if (!IsElevated())
     {
@@ -74,7 +170,7 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    while ((opt = getopt(argc, argv, "o:d:t:l:w:nh?")) != -1)
+    while ((opt = getopt(argc, argv, "o:d:g:t:l:w:f:i:p:s:c:m:b:a:z:x:r:q:nekjh?")) != -1)
     {
         switch (opt)
         {
@@ -104,6 +200,54 @@ int main(int argc, char *argv[])
                 operation = Eject;
             else if (!_stricmp(optarg, "checkmedia"))
                 operation = CheckMedia;
+            else if (!_stricmp(optarg, "recall"))
+                operation = Recall;
+            else if (!_stricmp(optarg, "rawrecall"))
+                operation = RawRecall;
+            else if (!_stricmp(optarg, "catalog"))
+                operation = CatalogVolume;
+            else if (!_stricmp(optarg, "recallplan"))
+                operation = RecallPlan;
+            else if (!_stricmp(optarg, "calibrate"))
+                operation = Calibrate;
+            else if (!_stricmp(optarg, "scanlayout"))
+                operation = ScanLayout;
+            else if (!_stricmp(optarg, "crcbench"))
+                operation = CrcBench;
+            else if (!_stricmp(optarg, "verify"))
+                operation = Verify;
+            else if (!_stricmp(optarg, "fixity"))
+                operation = Fixity;
+            else if (!_stricmp(optarg, "fixitycheck"))
+                operation = FixityCheck;
+            else if (!_stricmp(optarg, "dumpimage"))
+                operation = DumpImage;
+            else if (!_stricmp(optarg, "restoreimage"))
+                operation = RestoreImage;
+            else if (!_stricmp(optarg, "copy"))
+                operation = Copy;
+            else if (!_stricmp(optarg, "ingest"))
+                operation = Ingest;
+            else if (!_stricmp(optarg, "pack"))
+                operation = Pack;
+            else if (!_stricmp(optarg, "unpack"))
+                operation = Unpack;
+            else if (!_stricmp(optarg, "archiveplan"))
+                operation = ArchivePlan;
+            else if (!_stricmp(optarg, "archive"))
+                operation = Archive;
+            else if (!_stricmp(optarg, "compression"))
+                operation = Compression;
+            else if (!_stricmp(optarg, "compstats"))
+                operation = CompressionStats;
+            else if (!_stricmp(optarg, "watch"))
+                operation = Watch;
+            else if (!_stricmp(optarg, "status"))
+                operation = Status;
+            else if (!_stricmp(optarg, "serve"))
+                operation = Serve;
+            else if (!_stricmp(optarg, "board"))
+                operation = Board;
             else
             {
                 fprintf(stderr, "\r\nInvalid operation.\r\n");
@@ -113,21 +257,26 @@ int main(int argc, char *argv[])
         }
         case 'd':
         {
-            if (strlen(optarg) != 2 || optarg[1] != ':')
+            // A drive letter, or for mappings a directory to mount on instead.
+            if (!MappingParseTarget(optarg, mountTarget, _countof(mountTarget), &driveLetter))
             {
-                fprintf(stderr, "\r\nInvalid format for drive letter argument.\r\n");
+                fprintf(stderr, "\r\nInvalid drive letter or mount directory. Use a letter (T:) or a full path (C:\\mnt\\lto12).\r\n");
                 return EXIT_FAILURE;
             }
 
-            driveLetter = toupper(optarg[0]);
-
-            if (optarg[0] < 'D' || optarg[1] > 'Z')
+            driveLetterArgFound = TRUE;
+            break;
+        }
+        case 'g':
+        {
+            // Same as -d, copy only goes through the drive so a directory mapping does as well.
+            if (!MappingParseTarget(optarg, copyTarget, _countof(copyTarget), &copyLetter))
             {
-                fprintf(stderr, "\r\nInvalid drive letter.\r\n");
+                fprintf(stderr, "\r\nInvalid target drive letter or mount directory.\r\n");
                 return EXIT_FAILURE;
             }
 
-            driveLetterArgFound = TRUE;
+            copyTargetArgFound = TRUE;
             break;
         }
         case 'n':
@@ -135,6 +284,21 @@ int main(int argc, char *argv[])
             showOffline = FALSE;
             break;
         }
+        case 'e':
+        {
+            emulate = TRUE;
+            break;
+        }
+        case 'k':
+        {
+            protect = TRUE;
+            break;
+        }
+        case 'j':
+        {
+            json = TRUE;
+            break;
+        }
         case 'l':
         {
             logDir = optarg;
@@ -145,26 +309,109 @@ int main(int argc, char *argv[])
             workDir = optarg;
             break;
         }
+        case 'f':
+        {
+            listFile = optarg;
+            break;
+        }
+        case 'i':
+        {
+            indexFile = optarg;
+            break;
+        }
+        case 'p':
+        {
+            outputDir = optarg;
+            break;
+        }
+        case 's':
+        {
+            sourceDir = optarg;
+            break;
+        }
+        case 'z':
+        {
+            containerMB = strtoul(optarg, NULL, 10);
+
+            if (containerMB < 1)
+            {
+                fprintf(stderr, "\r\nInvalid container size.\r\n");
+                return EXIT_FAILURE;
+            }
+
+            break;
+        }
+        case 'c':
+        {
+            catalogFile = optarg;
+            break;
+        }
+        case 'm':
+        {
+            mapFile = optarg;
+            break;
+        }
+        case 'b':
+        {
+            layoutFile = optarg;
+            break;
+        }
+        case 'a':
+        {
+            algorithmName = optarg;
+            break;
+        }
+        case 'x':
+        {
+            if (!MediaCompressionPolicyFromName(optarg, &compression))
+            {
+                fprintf(stderr, "\r\nInvalid compression policy.\r\n");
+                return EXIT_FAILURE;
+            }
+
+            compressionArgFound = TRUE;
+            break;
+        }
+        case 'r':
+        {
+            maxAge = strtoul(optarg, NULL, 10);
+            break;
+        }
+        case 'q':
+        {
+            LPSTR secondsEnd;
+            ULONGLONG seconds = _strtoui64(optarg, &secondsEnd, 10);
+
+            // Any more and it wraps round in milliseconds to something short, or lands on INFINITE.
+            if (secondsEnd == optarg || *secondsEnd || seconds > MAXDWORD / 1000)
+            {
+                fprintf(stderr, "\r\nInvalid lock timeout, it must be a number of seconds up to %u.\r\n", MAXDWORD / 1000);
+                return EXIT_FAILURE;
+            }
+
+            LockSetTimeout((DWORD)seconds * 1000);
+            break;
+        }
         case 't':
         {
-            strcpy_s(driveName, sizeof(driveName), optarg);
-            _strupr_s(driveName, sizeof(driveName));
+            LPSTR indexEnd;
 
-            if (strlen(driveName) != 5 || strncmp(driveName, "TAPE", 4) != 0)
+            if (strlen(optarg) < 5 || strlen(optarg) >= sizeof(driveName) || _strnicmp(optarg, "TAPE", 4) != 0)
             {
                 fprintf(stderr, "\r\nInvalid format for tape drive argument.\r\n");
                 return EXIT_FAILURE;
             }
 
-            tapeIndex = driveName[4];
+            tapeIndex = strtoul(optarg + 4, &indexEnd, 10);
 
-            if (tapeIndex < '0' || tapeIndex > '9')
+            if (!isdigit(optarg[4]) || *indexEnd)
             {
                 fprintf(stderr, "\r\nInvalid tape drive index\r\n");
                 return EXIT_FAILURE;
             }
 
-            tapeIndex -= '0';
+            // Rebuilt rather than copied so TAPE007 comes out as the TAPE7 the device is actually called.
+            _snprintf_s(driveName, _countof(driveName), _TRUNCATE, "TAPE%u", tapeIndex);
 
             tapeDriveArgFound = TRUE;
             break;
@@ -172,26 +419,57 @@ int main(int argc, char *argv[])
         default:
             {
                 fprintf(stderr, "\r\nUsage: %s -o operation [options]\r\n\r\n"
+                    "Operations that use a drive wait for any other on the same drive\r\n"
+                    "to finish, as do those that change mappings or restart the\r\n"
+                    "service. Pass -q to wait no more than that many seconds (600 by\r\n"
+                    "default).\r\n\r\n"
                     "List tape drives:\r\n\r\n"
                     "\t%s -o listdrives\r\n\r\n"
                     "List mappings:\r\n\r\n"
                     "\t%s -o listmappings\r\n\r\n"
                     "Map tape drive:\r\n\r\n"
-                    "\t%s -o map -d DRIVE: -t TAPEn [-n]\r\n"
-                    "\t\t[-l logdir] [-w workdir]\r\n\r\n"
-                    "\tReplace DRIVE: with your intended drive letter i.e. T:\r\n"
+                    "\t%s -o map -d DRIVE:|DIR -t TAPEn [-n]\r\n"
+                    "\t\t[-l logdir] [-w workdir] [-x on|off|default]\r\n\r\n"
+                    "\tReplace DRIVE: with your intended drive letter i.e. T: or, once\r\n"
+                    "\tthe letters run out, a directory to mount on, given as a full\r\n"
+                    "\tpath from a drive letter i.e. C:\\mnt\\lto12. The operations below\r\n"
+                    "\ttake DIR in place of DRIVE: too, apart from recall, fixity,\r\n"
+                    "\tfixitycheck, ingest, pack and unpack, which go through the drive\r\n"
+                    "\tletter.\r\n"
                     "\tReplace TAPEn with the tape device name returned from the list\r\n"
                     "\tdrives operation i.e. TAPE0.\r\n\r\n"
                     "\tPass -n to show all files as 'online'. Not recommended.\r\n"
                     "\tPass -l and/or -w to override default log and working\r\n"
-                    "\tdirectories.\r\n\r\n"
+                    "\tdirectories. Pass -x to set the compression policy.\r\n\r\n"
                     "Unmap tape drive:\r\n\r\n"
-                    "\t%s -o unmap -d DRIVE:\r\n\r\n"
+                    "\t%s -o unmap -d DRIVE:|DIR\r\n\r\n"
                     "Fix existing mappings:\r\n\r\n"
                     "\t%s -o remap\r\n\r\n"
                     "\tIn some cases, particularly when drives are hot-plugged, the\r\n"
                     "\tdevice index may change i.e. from TAPE0 to TAPE1, breaking an\r\n"
-                    "\texisting mapping. This operation will repair existing mappings.\r\n\r\n"
+                    "\texisting mapping. This operation will repair existing mappings.\r\n"
+                    "\tOther operations on a mapped drive find it again by its serial\r\n"
+                    "\tnumber when it has moved, but only load fixes the mapping (and\r\n"
+                    "\trestarts the service). Otherwise the service keeps the old device\r\n"
+                    "\tuntil this is run, or watch sees the drive arrive.\r\n\r\n"
+                    "Keep mappings fixed up as drives come and go:\r\n\r\n"
+                    "\t%s -o watch\r\n\r\n"
+                    "\tRuns until Ctrl+C. Each drive that appears is matched to its\r\n"
+                    "\tmappings by serial number, and the service is restarted only if\r\n"
+                    "\ta mapping had to change. Run remap first if any are already wrong.\r\n\r\n"
+                    "Show drives, mappings, service and media together:\r\n\r\n"
+                    "\t%s -o status [-r seconds] [-j]\r\n\r\n"
+                    "\tEverything is gathered at once and each mapping checked against\r\n"
+                    "\tthe drives actually attached, with what stands in the way of it\r\n"
+                    "\tmounting. Pass -j for JSON. -r is as for checkmedia.\r\n\r\n"
+                    "Keep status up to date in shared memory for monitors to read:\r\n\r\n"
+                    "\t%s -o serve [-r seconds]\r\n"
+                    "\t%s -o board [-j]\r\n\r\n"
+                    "\tserve runs until Ctrl+C, gathering status every -r seconds (10 by\r\n"
+                    "\tdefault) and straight away when a drive comes or goes. board\r\n"
+                    "\tprints the last status it published without going near a drive\r\n"
+                    "\tor the registry. Other programs can map the board themselves,\r\n"
+                    "\tthe layout is in board.h.\r\n\r\n"
                     "Start FUSE/LTFS service:\r\n\r\n"
                     "\t%s -o start\r\n\r\n"
                     "\tIf the operating system was booted with the tape drive powered\r\n"
@@ -213,9 +491,111 @@ int main(int argc, char *argv[])
                     "\toperating system.\r\n\r\n"
                     "Unmount filesystem and physically eject tape:\r\n\r\n"
                     "\t%s -o eject -d DRIVE:\r\n\r\n"
-                    "Check if a tape is loaded and report type:\r\n\r\n"
-                    "\t%s -o checkmedia -d DRIVE:\r\n\r\n"
-                    , argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+                    "Check if a tape is loaded and report type and capacity:\r\n\r\n"
+                    "\t%s -o checkmedia [-d DRIVE:] [-r seconds]\r\n\r\n"
+                    "\tCapacity is read from the drive, so the volume doesn't need to\r\n"
+                    "\tbe mounted. Without -d every mapped drive is checked at once.\r\n"
+                    "\tWith -r, a check made within that many seconds is reused unless\r\n"
+                    "\ta tape has gone in or out since. Drives in use by LTFS or another\r\n"
+                    "\toperation are never sent anything, the last check is shown instead.\r\n\r\n"
+                    "Set whether the drive compresses what is written to it:\r\n\r\n"
+                    "\t%s -o compression -d DRIVE: -x on|off|default\r\n\r\n"
+                    "\tApplied every time a tape is loaded, and straight away if one\r\n"
+                    "\talready is. default leaves it to the drive. Turning it off\r\n"
+                    "\tsuits data that is already compressed, such as video.\r\n\r\n"
+                    "Report compression for the loaded cartridge:\r\n\r\n"
+                    "\t%s -o compstats [-d DRIVE:] [-r seconds]\r\n\r\n"
+                    "\tBytes written and read against bytes on tape since the tape\r\n"
+                    "\twas loaded. Without -d every mapped drive is reported. -r is\r\n"
+                    "\tas for checkmedia.\r\n\r\n"
+                    "Recall files from a mounted volume in tape order:\r\n\r\n"
+                    "\t%s -o recall -d DRIVE: -f listfile -p outputdir [-i indexfile]\r\n\r\n"
+                    "\tlistfile contains one path per line, relative to the root of\r\n"
+                    "\tthe volume. Files are read in the order they appear on tape,\r\n"
+                    "\ttaken from the ltfs.startblock attribute, or from a saved copy\r\n"
+                    "\tof the LTFS index if -i is passed.\r\n\r\n"
+                    "Recall files directly from tape, bypassing the filesystem:\r\n\r\n"
+                    "\t%s -o rawrecall -d DRIVE: -f listfile -p outputdir [-i indexfile|-b mapfile] [-k]\r\n"
+                    "\t%s -o rawrecall -m imagefile -f listfile -p outputdir [-i indexfile|-b mapfile]\r\n\r\n"
+                    "\tThe tape must be loaded but not mounted. Without -i, the latest\r\n"
+                    "\tindex is read from the index partition. Pass -k to have the\r\n"
+                    "\tdrive send a CRC with every block (logical block protection)\r\n"
+                    "\tand check each one as it arrives. With -m, the files come out\r\n"
+                    "\tof an image made by dumpimage instead, no drive needed.\r\n\r\n"
+                    "\tFor a tape that isn't LTFS, pass the map from scanlayout with -b.\r\n"
+                    "\tlistfile then names tape files as partition/file, counting from\r\n"
+                    "\t0, and each is read from its first block up to its filemark.\r\n\r\n"
+                    "Add a loaded tape to the recall catalog:\r\n\r\n"
+                    "\t%s -o catalog -d DRIVE: -c catalogfile [-i indexfile]\r\n\r\n"
+                    "\tThe tape must be loaded but not mounted. Any existing entries\r\n"
+                    "\tfor the same volume are replaced.\r\n\r\n"
+                    "Recall files spread across many tapes using all mapped drives:\r\n\r\n"
+                    "\t%s -o recallplan -f listfile -c catalogfile -p outputdir [-k]\r\n\r\n"
+                    "\tFiles are grouped by tape and the tapes shared out between\r\n"
+                    "\tdrives. Each drive asks for its next tape as it finishes the\r\n"
+                    "\tlast one.\r\n\r\n"
+                    "Calibrate the seek time model for a drive:\r\n\r\n"
+                    "\t%s -o calibrate -d DRIVE: [-e]\r\n\r\n"
+                    "\tThe tape must be loaded but not mounted, and should be a\r\n"
+                    "\tscratch cartridge with plenty of data written to it. Timed\r\n"
+                    "\tlocates are made all over it and the resulting model is saved\r\n"
+                    "\tfor the drive's model. Pass -e to calibrate against an\r\n"
+                    "\temulated drive instead.\r\n\r\n"
+                    "Map the layout of a tape without reading it:\r\n\r\n"
+                    "\t%s -o scanlayout -d DRIVE: [-m mapfile]\r\n\r\n"
+                    "\tLists partitions, files (by filemark) and setmarks with their\r\n"
+                    "\tblock ranges. The map is written to mapfile if given, and can be\r\n"
+                    "\tpassed to dumpimage or rawrecall with -b.\r\n\r\n"
+                    "Measure CRC32C speed against tape drive streaming rates:\r\n\r\n"
+                    "\t%s -o crcbench\r\n\r\n"
+                    "Read back every block on a cartridge:\r\n\r\n"
+                    "\t%s -o verify -d DRIVE:\r\n\r\n"
+                    "\tThe tape must be loaded but not mounted. Blocks are checked\r\n"
+                    "\tagainst their logical block protection CRC where the drive\r\n"
+                    "\tsupports it. Unreadable ranges are listed at the end.\r\n\r\n"
+                    "Hash every file on a mounted volume:\r\n\r\n"
+                    "\t%s -o fixity -d DRIVE: [-a sha256|xxh64] [-m manifest] [-i indexfile]\r\n\r\n"
+                    "\tFiles are read in tape order and hashed on several threads. The\r\n"
+                    "\tmanifest is in sha256sum/xxhsum format, written to the console\r\n"
+                    "\tif no manifest file is given. sha256 is the default.\r\n\r\n"
+                    "Check every file on a mounted volume against its stored hash:\r\n\r\n"
+                    "\t%s -o fixitycheck -d DRIVE: [-a sha256|xxh64] [-i indexfile]\r\n\r\n"
+                    "\tHashes are compared with the ltfs.hash.sha256sum or\r\n"
+                    "\tltfs.hash.xxh64sum extended attribute of each file.\r\n\r\n"
+                    "Write a directory tree onto a mounted volume:\r\n\r\n"
+                    "\t%s -o ingest -d DRIVE: -s sourcedir [-p targetdir] [-a sha256|xxh64]\r\n\r\n"
+                    "\tSource files are read ahead on several threads so the drive is\r\n"
+                    "\tkept streaming. Each file's hash is stored in its ltfs.hash\r\n"
+                    "\textended attribute. targetdir is relative to the volume root.\r\n\r\n"
+                    "Write a directory tree with small files packed into containers:\r\n\r\n"
+                    "\t%s -o pack -d DRIVE: -s sourcedir -c catalog [-p targetdir] [-z MB]\r\n\r\n"
+                    "\tFiles under 1MB are packed into containers of up to MB megabytes\r\n"
+                    "\t(1024 by default). Larger files are written as normal. Member\r\n"
+                    "\toffsets are added to the catalog.\r\n\r\n"
+                    "Extract packed files listed in a text file:\r\n\r\n"
+                    "\t%s -o unpack -d DRIVE: -c catalog -f listfile -p outputdir\r\n\r\n"
+                    "Plan an archive set too big for one cartridge, then write it:\r\n\r\n"
+                    "\t%s -o archiveplan -s sourcedir -m planfile\r\n"
+                    "\t%s -o archive -m planfile [-a sha256|xxh64]\r\n\r\n"
+                    "\tDirectories are fitted onto the cartridges loaded in the mapped\r\n"
+                    "\tdrives, going by the space left and the compression seen so far,\r\n"
+                    "\tthen onto fresh cartridges as needed. A directory is only split\r\n"
+                    "\tif it can't fit on one cartridge. Drives write in parallel and\r\n"
+                    "\task for a fresh cartridge when they need one. Plan with the\r\n"
+                    "\tcartridges loaded but not mounted (loadonly).\r\n\r\n"
+                    "Copy a whole cartridge to a compressed image file, or back again:\r\n\r\n"
+                    "\t%s -o dumpimage -d DRIVE: -m imagefile [-b mapfile]\r\n"
+                    "\t%s -o restoreimage -d DRIVE: -m imagefile\r\n\r\n"
+                    "\tThe tape must be loaded but not mounted. Every block and filemark\r\n"
+                    "\tof every partition is copied. Restoring overwrites the tape, which\r\n"
+                    "\tmust already be partitioned the same as the original. With -b,\r\n"
+                    "\tonly the partitions in a scanlayout map are read, each up to the\r\n"
+                    "\tend of data the map gives.\r\n\r\n"
+                    "Duplicate a cartridge straight from one drive to another:\r\n\r\n"
+                    "\t%s -o copy -d DRIVE: -g TARGET:|DIR\r\n\r\n"
+                    "\tNeither tape may be mounted. The target is overwritten and must\r\n"
+                    "\talready be partitioned the same as the source.\r\n\r\n"
+                    , argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
                 return EXIT_FAILURE;
             }
         }
@@ -233,7 +613,20 @@ int main(int argc, char *argv[])
         operation == LoadOnly ||
         operation == Mount ||
         operation == Eject ||
-        operation == CheckMedia)
+        operation == Recall ||
+        (operation == RawRecall && !mapFile) ||
+        operation == CatalogVolume ||
+        operation == ScanLayout ||
+        operation == Verify ||
+        operation == Fixity ||
+        operation == FixityCheck ||
+        operation == DumpImage ||
+        operation == RestoreImage ||
+        operation == Copy ||
+        operation == Ingest ||
+        operation == Pack ||
+        operation == Unpack ||
+        operation == Compression)
     {
         if (!driveLetterArgFound)
         {
@@ -242,6 +635,20 @@ int main(int argc, char *argv[])
         }
     }
 
+    // Most only need the mapping to find the drive, but these work on files through the volume, and it's by the drive
+    // letter that they reach it.
+    if (driveLetterArgFound && !driveLetter &&
+        (operation == Recall ||
+        operation == Fixity ||
+        operation == FixityCheck ||
+        operation == Ingest ||
+        operation == Pack ||
+        operation == Unpack))
+    {
+        fprintf(stderr, "\r\nThis operation needs a drive letter rather than a directory.\r\n");
+        return EXIT_FAILURE;
+    }
+
     if (operation == MapDrive)
     {
         if (!tapeDriveArgFound)
@@ -251,44 +658,285 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (operation == Recall || operation == RawRecall || operation == RecallPlan || operation == Unpack)
+    {
+        if (!listFile)
+        {
+            fprintf(stderr, "\r\nFile list not specified.\r\n");
+            return EXIT_FAILURE;
+        }
+
+        if (!outputDir)
+        {
+            fprintf(stderr, "\r\nOutput directory not specified.\r\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (operation == RawRecall && mapFile && protect)
+    {
+        fprintf(stderr, "\r\nBlock protection needs a drive, there's nothing to check from an image.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    if (operation == RawRecall && layoutFile && indexFile)
+    {
+        fprintf(stderr, "\r\nFiles are found either by the LTFS index or by a layout map, not both.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    if (operation == Calibrate && !emulate)
+    {
+        if (!driveLetterArgFound)
+        {
+            fprintf(stderr, "\r\nDrive letter not specified.\r\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (operation == Copy)
+    {
+        if (!copyTargetArgFound)
+        {
+            fprintf(stderr, "\r\nTarget drive letter not specified.\r\n");
+            return EXIT_FAILURE;
+        }
+
+        if (!_stricmp(copyTarget, mountTarget))
+        {
+            fprintf(stderr, "\r\nSource and target drive cannot be the same.\r\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((operation == Ingest || operation == Pack || operation == ArchivePlan) && !sourceDir)
+    {
+        fprintf(stderr, "\r\nSource directory not specified.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    if (operation == CatalogVolume || operation == RecallPlan || operation == Pack || operation == Unpack)
+    {
+        if (!catalogFile)
+        {
+            fprintf(stderr, "\r\nCatalog file not specified.\r\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (operation == Compression && !compressionArgFound)
+    {
+        fprintf(stderr, "\r\nCompression policy not specified.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((operation == ArchivePlan || operation == Archive) && !mapFile)
+    {
+        fprintf(stderr, "\r\nPlan file not specified.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    // Anything that sends a drive commands holds that drive until it's done, so different drives can be worked on at
+    // once while two operations on the same one take turns. Changing mappings or restarting the service holds the
+    // config lock instead.
+    if (operation == Start ||
+        operation == Stop ||
+        operation == MapDrive ||
+        operation == UnmapDrive ||
+        operation == Remap ||
+        operation == Compression)
+    {
+        needConfigLock = TRUE;
+    }
+
+    if (operation == Load ||
+        operation == LoadOnly ||
+        operation == Mount ||
+        operation == Eject ||
+        (operation == RawRecall && !mapFile) ||
+        operation == CatalogVolume ||
+        operation == ScanLayout ||
+        operation == Verify ||
+        operation == DumpImage ||
+        operation == RestoreImage ||
+        operation == Compression ||
+        (operation == Calibrate && !emulate))
+    {
+        if (!LockDrive(mountTarget, &driveLock))
+        {
+            fprintf(stderr, "\r\nTimed out waiting for %s.\r\n", mountTarget);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (operation == Copy)
+    {
+        if (!LockDrivePair(mountTarget, copyTarget, &driveLock, &targetLock))
+        {
+            fprintf(stderr, "\r\nTimed out waiting for %s and %s.\r\n", mountTarget, copyTarget);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (needConfigLock && !LockConfig(&configLock))
+    {
+        fprintf(stderr, "\r\nTimed out waiting for another change to mappings or the service.\r\n");
+        LockRelease(driveLock);
+        return EXIT_FAILURE;
+    }
+
     switch (operation)
     {
     case ListDrives:
-        return ListTapeDrives();
+        result = ListTapeDrives();
+        break;
 
     case ListMappings:
-        return ListDriveMappings();
+        result = ListDriveMappings();
+        break;
 
     case Start:
-        return StartLtfsService();
+        result = StartLtfsService();
+        break;
 
     case Stop:
-        return StopLtfsService();
+        result = StopLtfsService();
+        break;
 
     case MapDrive:
-        return MapTapeDrive(driveLetter, driveName, tapeIndex, logDir, workDir, showOffline);
+        result = MapTapeDrive(mountTarget, driveLetter, driveName, tapeIndex, logDir, workDir, showOffline, compression);
+        break;
 
     case UnmapDrive:
-        return UnmapTapeDrive(driveLetter);
+        result = UnmapTapeDrive(mountTarget);
+        break;
 
     case Remap:
-        return RemapTapeDrives();
+        result = RemapTapeDrives();
+        break;
 
     case Load:
-        return LoadTapeDrive(driveLetter, TRUE);
+        result = LoadTapeDrive(mountTarget, TRUE);
+        break;
 
     case LoadOnly:
-        return LoadTapeDrive(driveLetter, FALSE);
+        result = LoadTapeDrive(mountTarget, FALSE);
+        break;
 
     case Mount:
-        return MountTapeDrive(driveLetter);
+        result = MountTapeDrive(mountTarget);
+        break;
 
     case Eject:
-        return EjectTapeDrive(driveLetter);
+        result = EjectTapeDrive(mountTarget, driveLetter);
+        break;
 
     case CheckMedia:
-        return CheckTapeMedia(driveLetter);
+        result = CheckTapeMedia(mountTarget, !driveLetterArgFound, maxAge);
+        break;
+
+    case Recall:
+        result = RecallFiles(mountTarget, driveLetter, listFile, indexFile, outputDir, FALSE, FALSE, NULL, NULL);
+        break;
+
+    case RawRecall:
+        result = RecallFiles(mountTarget, driveLetter, listFile, indexFile, outputDir, TRUE, protect, mapFile, layoutFile);
+        break;
+
+    case CatalogVolume:
+        result = CatalogTapeVolume(mountTarget, catalogFile, indexFile);
+        break;
+
+    case RecallPlan:
+        result = RecallFromCatalog(listFile, catalogFile, outputDir, protect);
+        break;
+
+    case Calibrate:
+        result = CalibrateSeekModel(mountTarget, emulate);
+        break;
+
+    case ScanLayout:
+        result = ScanTapeLayout(mountTarget, mapFile);
+        break;
+
+    case CrcBench:
+        result = BenchmarkCrc();
+        break;
+
+    case Verify:
+        result = VerifyTapeDrive(mountTarget);
+        break;
+
+    case Fixity:
+        result = HashVolumeFiles(mountTarget, driveLetter, algorithmName, indexFile, mapFile, FALSE);
+        break;
+
+    case FixityCheck:
+        result = HashVolumeFiles(mountTarget, driveLetter, algorithmName, indexFile, NULL, TRUE);
+        break;
+
+    case DumpImage:
+        result = TransferTapeImage(mountTarget, mapFile, layoutFile, FALSE);
+        break;
+
+    case RestoreImage:
+        result = TransferTapeImage(mountTarget, mapFile, NULL, TRUE);
+        break;
+
+    case Copy:
+        result = CopyTapeDrive(mountTarget, copyTarget);
+        break;
+
+    case Ingest:
+        result = IngestToDrive(mountTarget, driveLetter, sourceDir, outputDir, algorithmName);
+        break;
+
+    case Pack:
+        result = PackToDrive(driveLetter, sourceDir, outputDir, catalogFile, containerMB);
+        break;
+
+    case Unpack:
+        result = UnpackFromDrive(driveLetter, listFile, catalogFile, outputDir);
+        break;
+
+    case ArchivePlan:
+        result = PlanArchive(sourceDir, mapFile);
+        break;
+
+    case Archive:
+        result = ArchiveFromPlan(mapFile, algorithmName);
+        break;
+
+    case Compression:
+        result = SetCompressionPolicy(mountTarget, compression);
+        break;
+
+    case CompressionStats:
+        result = ReportCompression(mountTarget, !driveLetterArgFound, maxAge);
+        break;
+
+    case Watch:
+        result = WatchTapeDrives();
+        break;
+
+    case Status:
+        result = ReportStatus(maxAge, json);
+        break;
+
+    case Serve:
+        result = ServeStatusBoard(maxAge ? maxAge : BOARD_DEFAULT_INTERVAL);
+        break;
+
+    case Board:
+        result = ReportStatusBoard(json);
+        break;
     }
+
+    LockRelease(configLock);
+    LockRelease(targetLock);
+    LockRelease(driveLock);
+
+    return result;
 }
 
 static int ListTapeDrives()
@@ -296,7 +944,7 @@ static int ListTapeDrives()
     PTAPE_DRIVE driveList;
     DWORD numDrivesFound;
 
-    if (TapeGetDriveList(&driveList, &numDrivesFound))
+    if (InventoryGetDriveList(&driveList, &numDrivesFound, FALSE))
     {
         printf("\r\nCurrently attached tape drives:\r\n\r\n");
 
@@ -319,34 +967,33 @@ static int ListTapeDrives()
 
 static int ListDriveMappings()
 {
-    CHAR driveLetter;
-    BYTE numMappings;
+    PMAPPING_TABLE table;
+    DWORD i;
 
-    if (!LtfsRegGetMappingCount(&numMappings))
+    if (!MappingTableLoad(&table))
     {
         fprintf(stderr, "\r\nFailed to get mappings from registry.\r\n");
         return EXIT_FAILURE;
     }
 
-    if (!numMappings)
+    if (!table->MappingCount)
     {
         printf("\r\nNo mappings found.\r\n");
+        MappingTableDestroy(table);
         return EXIT_SUCCESS;
     }
 
     printf("\r\nCurrent drive mappings:\r\n\r\n");
 
-    for (driveLetter = MIN_DRIVE_LETTER; driveLetter <= MAX_DRIVE_LETTER; driveLetter++)
+    for (i = 0; i < table->MappingCount; i++)
     {
-        char serialNumber[MAX_SERIAL_NUMBER];
-        char devName[MAX_DEVICE_NAME];
+        PLTFS_MAPPING mapping = &table->Mappings[i];
 
-        if (LtfsRegGetMappingProperties(driveLetter, devName, _countof(devName), serialNumber, _countof(serialNumber)))
-        {
-            printf("%c: %s [%s]\r\n", driveLetter, devName, serialNumber);
-        }
+        printf("%s %s [%s]\r\n", mapping->Target, mapping->DeviceName, mapping->SerialNumber);
     }
 
+    MappingTableDestroy(table);
+
     return EXIT_SUCCESS;
 }
 
@@ -376,20 +1023,20 @@ static int StopLtfsService()
     return EXIT_SUCCESS;
 }
 
-static int MapTapeDrive(CHAR driveLetter, LPCSTR tapeDrive, BYTE tapeIndex, LPCSTR logDir, LPCSTR workDir, BOOL showOffline)
+static int MapTapeDrive(LPCSTR target, CHAR driveLetter, LPCSTR tapeDrive, DWORD tapeIndex, LPCSTR logDir, LPCSTR workDir, BOOL showOffline, DWORD compression)
 {
     PTAPE_DRIVE driveList;
     DWORD numDrivesFound;
     BOOL success = FALSE;
     BOOL driveFound = FALSE;
 
-    if (PollFileSystem(driveLetter))
+    if (driveLetter && PollFileSystem(target))
     {
         fprintf(stderr, "\r\nDrive letter %c: already in use.\r\n", driveLetter);
         return EXIT_FAILURE;
     }
 
-    if (TapeGetDriveList(&driveList, &numDrivesFound))
+    if (InventoryGetDriveList(&driveList, &numDrivesFound, FALSE))
     {
         PTAPE_DRIVE drive = driveList;
 
@@ -399,13 +1046,19 @@ static int MapTapeDrive(CHAR driveLetter, LPCSTR tapeDrive, BYTE tapeIndex, LPCS
             {
                 driveFound = TRUE;
 
-                if (LtfsRegGetMappingProperties(driveLetter, NULL, 0, NULL, 0))
+                if (LtfsRegGetTargetProperties(target, NULL, 0, NULL, 0))
                 {
-                    fprintf(stderr, "\r\nMapping for %c: arleady exists.\r\n", driveLetter);
+                    fprintf(stderr, "\r\nMapping for %s arleady exists.\r\n", target);
                 }
                 else
                 {
-                    success = LtfsRegCreateMapping(driveLetter, tapeDrive, drive->SerialNumber, logDir, workDir, showOffline);
+                    success = LtfsRegCreateTargetMapping(target, tapeDrive, drive->SerialNumber, logDir, workDir, showOffline);
+
+                    if (success && compression != LTFS_COMPRESSION_DEFAULT)
+                        success = LtfsRegSetTargetCompression(target, compression);
+
+                    if (success)
+                        MappingSetAddressHint(target, &drive->Address);
 
                     if (!success)
                         fprintf(stderr, "\r\nFailed to create registry entries.\r\n");
@@ -455,9 +1108,9 @@ static int MapTapeDrive(CHAR driveLetter, LPCSTR tapeDrive, BYTE tapeIndex, LPCS
     return EXIT_FAILURE;
 }
 
-static int UnmapTapeDrive(CHAR driveLetter)
+static int UnmapTapeDrive(LPCSTR target)
 {
-    BYTE numMappings;
+    DWORD numMappings;
     BOOL success;
 
     success = LtfsRegGetMappingCount(&numMappings);
@@ -474,7 +1127,7 @@ static int UnmapTapeDrive(CHAR driveLetter)
         return EXIT_FAILURE;
     }
 
-    success = LtfsRegRemoveMapping(driveLetter);
+    success = LtfsRegRemoveTargetMapping(target);
 
     if (!success)
     {
@@ -508,49 +1161,54 @@ static int UnmapTapeDrive(CHAR driveLetter)
 static int RemapTapeDrives()
 {
     PTAPE_DRIVE driveList;
+    PMAPPING_TABLE table;
     
-    BYTE changesMade = 0;
+    DWORD changesMade = 0;
     DWORD numDrivesFound;
     BOOL success = TRUE;
     BOOL firstOutput = TRUE;
 
-    if (TapeGetDriveList(&driveList, &numDrivesFound))
+    if (!MappingTableLoad(&table))
+    {
+        fprintf(stderr, "\r\nFailed to get mappings from registry.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    // This is what gets run when something looks wrong, so it always goes and looks rather than trust the inventory.
+    if (InventoryGetDriveList(&driveList, &numDrivesFound, TRUE))
     {
         PTAPE_DRIVE drive = driveList;
 
         while (drive != NULL)
         {
-            CHAR driveLetter;
+            PLTFS_MAPPING mapping;
             char devName[MAX_DEVICE_NAME];
             _snprintf_s(devName, _countof(devName), _TRUNCATE, "TAPE%d", drive->DevIndex);
 
-            for (driveLetter = MIN_DRIVE_LETTER; driveLetter <= MAX_DRIVE_LETTER; driveLetter++)
+            for (mapping = MappingFindBySerial(table, drive->SerialNumber); mapping != NULL; mapping = mapping->NextSameSerial)
             {
-                CHAR regSerialNumber[MAX_SERIAL_NUMBER];
-                CHAR regDevName[MAX_DEVICE_NAME];
+                // Kept up to date whether or not the name moved, it's what finds the drive quickly next time.
+                MappingSetAddressHint(mapping->Target, &drive->Address);
 
-                if (LtfsRegGetMappingProperties(driveLetter, regDevName, _countof(regDevName), regSerialNumber, _countof(regSerialNumber)))
+                if (strcmp(mapping->DeviceName, devName) != 0)
                 {
-                    if (strcmp(regSerialNumber, drive->SerialNumber) == 0 && strcmp(regDevName, devName) != 0)
+                    success = LtfsRegUpdateTargetMapping(mapping->Target, devName);
+
+                    if (!success)
                     {
-                        success = LtfsRegUpdateMapping(driveLetter, devName);
+                        fprintf(stderr, "\r\nFailed to update existing mapping for %s\r\n", mapping->Target);
+                    }
 
-                        if (!success)
+                    if (success)
+                    {
+                        if (firstOutput)
                         {
-                            fprintf(stderr, "\r\nFailed to update existing mapping for %c:\r\n", driveLetter);
+                            firstOutput = FALSE;
+                            printf("\r\n");
                         }
 
-                        if (success)
-                        {
-                            if (firstOutput)
-                            {
-                                firstOutput = FALSE;
-                                printf("\r\n");
-                            }
-
-                            printf("%c: %s [%s] -> %s\r\n", driveLetter, regDevName, regSerialNumber, devName);
-                            changesMade++;
-                        }
+                        printf("%s %s [%s] -> %s\r\n", mapping->Target, mapping->DeviceName, mapping->SerialNumber, devName);
+                        changesMade++;
                     }
                 }
             }
@@ -558,7 +1216,9 @@ static int RemapTapeDrives()
             drive = drive->Next;
         }
 
-        printf("\r\n%d mapping(s) updated.\r\n", changesMade);
+        MappingTableDestroy(table);
+
+        printf("\r\n%u mapping(s) updated.\r\n", changesMade);
 
         if (success)
         {
@@ -588,6 +1248,8 @@ static int RemapTapeDrives()
         return EXIT_SUCCESS;
     }
 
+    MappingTableDestroy(table);
+
     // No point in the service running if there are no drives.
     FuseStopService();
 
@@ -595,29 +1257,37 @@ static int RemapTapeDrives()
     return EXIT_FAILURE;
 }
 
-static int LoadTapeDrive(CHAR driveLetter, BOOL mount)
+static int LoadTapeDrive(LPCSTR target, BOOL mount)
 {
     char devName[MAX_DEVICE_NAME];
+    DWORD compression = LTFS_COMPRESSION_DEFAULT;
     BOOL result = FALSE;
 
-    result = LtfsRegGetMappingProperties(driveLetter, devName, _countof(devName), NULL, 0);
+    result = MappingResolveDevice(target, devName, _countof(devName), TRUE);
 
     if (!result)
     {
-        fprintf(stderr, "\r\nMapping for %c: does not exist.\r\n", driveLetter);
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
         return EXIT_FAILURE;
     }
 
     result = TapeLoad(devName);
 
+    // Whatever was checked before is out of date now, loaded or not.
+    MediaInvalidate(target);
+
     if (!result)
     {
         return EXIT_FAILURE;
     }
 
+    // Before the filesystem gets its hands on it, so everything LTFS writes gets the same treatment.
+    if (!MediaApplyCompressionPolicy(target, &compression))
+        fprintf(stderr, "\r\nFailed to set compression %s.\r\n", MediaCompressionPolicyName(compression));
+
     if (mount)
     {
-        result = PollFileSystem(driveLetter);
+        result = PollFileSystem(target);
 
         if (!result)
         {
@@ -629,9 +1299,9 @@ static int LoadTapeDrive(CHAR driveLetter, BOOL mount)
     return EXIT_SUCCESS;
 }
 
-static int MountTapeDrive(CHAR driveLetter)
+static int MountTapeDrive(LPCSTR target)
 {
-    BOOL result = PollFileSystem(driveLetter);
+    BOOL result = PollFileSystem(target);
 
     if (!result)
     {
@@ -642,30 +1312,33 @@ static int MountTapeDrive(CHAR driveLetter)
     return EXIT_SUCCESS;
 }
 
-static int EjectTapeDrive(CHAR driveLetter)
+static int EjectTapeDrive(LPCSTR target, CHAR driveLetter)
 {
     CHAR devName[MAX_DEVICE_NAME];
     BOOL result = FALSE;
 
-    result = LtfsRegGetMappingProperties(driveLetter, devName, _countof(devName), NULL, 0);
+    result = MappingResolveDevice(target, devName, _countof(devName), FALSE);
 
     if (!result)
     {
-        fprintf(stderr, "\r\nMapping for %c: does not exist.\r\n", driveLetter);
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
         return EXIT_FAILURE;
     }
 
     // This could do more detailed error reporting, and perhaps the ability to force dismount if files are still open.
     result = TapeEject(devName);
 
+    MediaInvalidate(target);
+
     if (!result)
     {
         fprintf(stderr, "\r\nFailed to eject tape. Ensure no files are open on the target volume.\r\n");
         return EXIT_FAILURE;
     }
 
-    // Not sure why LTFSConfigurator.exe does this, but we'll do it too.
-    result = PollFileSystem(driveLetter);
+    // Not sure why LTFSConfigurator.exe does this, but we'll do it too. Only for a letter, a directory has no volume
+    // behind it again until the next tape is mounted.
+    result = !driveLetter || PollFileSystem(target);
 
     if (!result)
     {
@@ -675,29 +1348,1306 @@ static int EjectTapeDrive(CHAR driveLetter)
     return EXIT_SUCCESS;
 }
 
-static int CheckTapeMedia(CHAR driveLetter)
+static int CheckTapeMedia(LPCSTR target, BOOL allDrives, DWORD maxAge)
 {
-    CHAR mediaDesc[128];
-    CHAR devName[MAX_DEVICE_NAME];
+    PMEDIA_STATUS statusList;
+    MEDIA_STATUS status;
+    DWORD statusCount;
+    BOOL result = TRUE;
+    DWORD i;
 
-    BOOL result = FALSE;
+    if (allDrives)
+    {
+        if (!MediaCheckAll(maxAge, &statusList, &statusCount))
+            return EXIT_FAILURE;
+
+        if (!statusCount)
+        {
+            fprintf(stderr, "\r\nNo drive mappings.\r\n");
+            MediaDestroyList(statusList);
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < statusCount; i++)
+        {
+            PrintMediaStatus(&statusList[i]);
+            result = result && statusList[i].Checked;
+        }
 
-    result = LtfsRegGetMappingProperties(driveLetter, devName, _countof(devName), NULL, 0);
+        MediaDestroyList(statusList);
 
-    if (!result)
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (!LtfsRegGetTargetProperties(target, NULL, 0, NULL, 0))
     {
-        fprintf(stderr, "\r\nMapping for %c: does not exist.\r\n", driveLetter);
+        fprintf(stderr, "\r\nMapping for %s does not exist.\r\n", target);
         return EXIT_FAILURE;
     }
 
-    result = TapeCheckMedia(devName, mediaDesc, _countof(mediaDesc));
-
-    if (!result)
+    if (!MediaCheck(target, maxAge, &status))
     {
         fprintf(stderr, "\r\nMedia check failed.\r\n");
         return EXIT_FAILURE;
     }
 
-    printf("\r\n%s: %s\r\n", devName, mediaDesc);
+    PrintMediaStatus(&status);
+
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+static void PrintMediaStatus(PMEDIA_STATUS status)
+{
+    DWORD i;
+
+    if (!status->Checked)
+    {
+        printf("\r\n%s (%s) media check failed\r\n", status->Target, status->DeviceName);
+        return;
+    }
+
+    printf("\r\n%s (%s) %s\r\n", status->Target, status->DeviceName, status->MediaDesc);
+    PrintMediaSource(status);
+
+    if (!status->Capacity.Valid)
+        return;
+
+    // LTFS keeps the index in partition a and file data in b.
+    for (i = 0; i < TAPE_CAPACITY_PARTITIONS; i++)
+    {
+        if (!status->Capacity.Maximum[i])
+            continue;
+
+        printf("    Partition %c: %llu MB free of %llu MB (%.1f%% used)\r\n", 'a' + i, status->Capacity.Remaining[i] / 1000000,
+            status->Capacity.Maximum[i] / 1000000, (double)(status->Capacity.Maximum[i] - min(status->Capacity.Remaining[i], status->Capacity.Maximum[i])) * 100.0 / (double)status->Capacity.Maximum[i]);
+    }
+}
+
+static void PrintMediaSource(PMEDIA_STATUS status)
+{
+    if (status->Busy && !status->Cached)
+        printf("    In use, not checked while it was free\r\n");
+    else if (status->Busy)
+        printf("    In use, as checked %llu s ago\r\n", status->AgeSeconds);
+    else if (status->Cached)
+        printf("    As checked %llu s ago\r\n", status->AgeSeconds);
+}
+
+static int RecallFiles(LPCSTR target, CHAR driveLetter, LPCSTR listFile, LPCSTR indexFile, LPCSTR outputDir, BOOL raw, BOOL protect, LPCSTR imageFile, LPCSTR layoutFile)
+{
+    CHAR devName[MAX_DEVICE_NAME];
+    PRECALL_ITEM items;
+    DWORD itemCount;
+    PLTFS_INDEX index = NULL;
+    PTAPE_LAYOUT layout = NULL;
+    RECALL_STATS stats;
+    BOOL result;
+
+    if (!RecallReadFileList(listFile, &items, &itemCount))
+    {
+        fprintf(stderr, "\r\nFailed to read file list %s.\r\n", listFile);
+        return EXIT_FAILURE;
+    }
+
+    if (indexFile && !LtfsIndexLoad(indexFile, &index))
+    {
+        fprintf(stderr, "\r\nFailed to load LTFS index %s.\r\n", indexFile);
+        RecallDestroyFileList(items, itemCount);
+        return EXIT_FAILURE;
+    }
+
+    if (layoutFile && !LayoutLoad(layoutFile, &layout))
+    {
+        fprintf(stderr, "\r\nFailed to load layout map %s.\r\n", layoutFile);
+        LtfsIndexDestroy(index);
+        RecallDestroyFileList(items, itemCount);
+        return EXIT_FAILURE;
+    }
+
+    if (imageFile)
+    {
+        result = TRUE;
+    }
+    else if (raw)
+    {
+        result = MappingResolveDevice(target, devName, _countof(devName), FALSE);
+
+        if (!result)
+            fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
+    }
+    else
+    {
+        result = PollFileSystem(target);
+
+        if (!result)
+            fprintf(stderr, "\r\nCannot start file system. LTFS not running.\r\n");
+    }
+
+    if (!result)
+    {
+        LayoutDestroy(layout);
+        LtfsIndexDestroy(index);
+        RecallDestroyFileList(items, itemCount);
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\nRecalling %u file(s) from %s to %s\r\n\r\n", itemCount, imageFile ? imageFile : target, outputDir);
+
+    if (imageFile)
+        result = RecallRawFromImage(imageFile, items, itemCount, index, layout, outputDir, &stats);
+    else if (raw)
+        result = RecallRaw(devName, items, itemCount, index, layout, outputDir, protect, &stats);
+    else
+        result = RecallFromVolume(driveLetter, items, itemCount, index, outputDir, &stats);
+
+    printf("\r\n%u of %u file(s) recalled, %u failed, %u not placed on tape.\r\n", stats.FilesRecalled, stats.FilesRequested, stats.FilesFailed, stats.FilesUnplaced);
+    printf("%llu MB in %llu seconds (%.1f MB/s)\r\n", stats.BytesRecalled / 1000000, stats.ElapsedMs / 1000,
+        stats.ElapsedMs ? (double)stats.BytesRecalled / 1000.0 / (double)stats.ElapsedMs : 0.0);
+
+    LayoutDestroy(layout);
+    LtfsIndexDestroy(index);
+    RecallDestroyFileList(items, itemCount);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int CatalogTapeVolume(LPCSTR target, LPCSTR catalogFile, LPCSTR indexFile)
+{
+    CHAR devName[MAX_DEVICE_NAME];
+    CHAR barcode[TAPE_MAM_BARCODE_LEN + 1];
+    USHORT barcodeLength = 0;
+    PCATALOG catalog = NULL;
+    PLTFS_INDEX index = NULL;
+    HANDLE handle;
+    BOOL result;
+
+    result = MappingResolveDevice(target, devName, _countof(devName), FALSE);
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
+        return EXIT_FAILURE;
+    }
+
+    handle = TapeOpen(devName);
+
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "\r\nFailed to open %s.\r\n", devName);
+        return EXIT_FAILURE;
+    }
+
+    // No barcode isn't fatal, the volume UUID is what we really key on.
+    if (TapeReadAttribute(handle, 0, TAPE_MAM_BARCODE, (PBYTE)barcode, TAPE_MAM_BARCODE_LEN, &barcodeLength))
+    {
+        while (barcodeLength > 0 && barcode[barcodeLength - 1] == ' ')
+            barcodeLength--;
+    }
+
+    barcode[barcodeLength] = '\0';
+
+    if (indexFile)
+        result = LtfsIndexLoad(indexFile, &index);
+    else
+        result = LtfsIndexReadFromTape(handle, &index);
+
+    CloseHandle(handle);
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\nFailed to read LTFS index.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    result = CatalogLoad(catalogFile, &catalog);
+
+    if (!result)
+        fprintf(stderr, "\r\nFailed to load catalog %s.\r\n", catalogFile);
+
+    if (result)
+    {
+        result = CatalogAddVolume(catalog, index, barcode);
+
+        if (!result)
+            fprintf(stderr, "\r\nFailed to add volume to catalog.\r\n");
+    }
+
+    if (result)
+    {
+        result = CatalogSave(catalog, catalogFile);
+
+        if (!result)
+            fprintf(stderr, "\r\nFailed to save catalog %s.\r\n", catalogFile);
+    }
+
+    if (result)
+        printf("\r\n%s [%s]: %u file(s) catalogued.\r\n", barcode[0] ? barcode : "(no barcode)", index->VolumeUuid, index->FileCount);
+
+    CatalogDestroy(catalog);
+    LtfsIndexDestroy(index);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int RecallFromCatalog(LPCSTR listFile, LPCSTR catalogFile, LPCSTR outputDir, BOOL protect)
+{
+    PRECALL_ITEM items;
+    DWORD itemCount;
+    PCATALOG catalog;
+    PRECALL_PLAN plan;
+    RECALL_STATS stats;
+    BOOL result;
+    DWORD i;
+
+    if (!RecallReadFileList(listFile, &items, &itemCount))
+    {
+        fprintf(stderr, "\r\nFailed to read file list %s.\r\n", listFile);
+        return EXIT_FAILURE;
+    }
+
+    if (!CatalogLoad(catalogFile, &catalog))
+    {
+        fprintf(stderr, "\r\nFailed to load catalog %s.\r\n", catalogFile);
+        RecallDestroyFileList(items, itemCount);
+        return EXIT_FAILURE;
+    }
+
+    if (!PlannerCreate(catalog, items, itemCount, &plan))
+    {
+        CatalogDestroy(catalog);
+        RecallDestroyFileList(items, itemCount);
+        return EXIT_FAILURE;
+    }
+
+    PlannerPrint(plan);
+    printf("\r\n");
+
+    result = PlannerRun(plan, outputDir, protect, &stats);
+
+    printf("\r\n");
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        PPLANNER_DRIVE drive = &plan->Drives[i];
+
+        if (!drive->CartridgeCount)
+            continue;
+
+        printf("%s %u cartridge(s), %u file(s), %llu MB, %.1f MB/s reading, %.1f MB/s overall\r\n", drive->Target,
+            drive->CartridgeCount, drive->Stats.FilesRecalled, drive->Stats.BytesRecalled / 1000000,
+            drive->ReadingMs ? (double)drive->Stats.BytesRecalled / 1000.0 / (double)drive->ReadingMs : 0.0,
+            stats.ElapsedMs ? (double)drive->Stats.BytesRecalled / 1000.0 / (double)stats.ElapsedMs : 0.0);
+    }
+
+    printf("\r\n%u of %u file(s) recalled, %u failed, %u not placed on tape.\r\n", stats.FilesRecalled, stats.FilesRequested, stats.FilesFailed, stats.FilesUnplaced);
+    printf("%llu MB in %llu seconds (%.1f MB/s aggregate)\r\n", stats.BytesRecalled / 1000000, stats.ElapsedMs / 1000,
+        stats.ElapsedMs ? (double)stats.BytesRecalled / 1000.0 / (double)stats.ElapsedMs : 0.0);
+
+    PlannerDestroy(plan);
+    CatalogDestroy(catalog);
+    RecallDestroyFileList(items, itemCount);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int CalibrateSeekModel(LPCSTR target, BOOL emulate)
+{
+    CHAR devName[MAX_DEVICE_NAME];
+    CHAR serialNumber[MAX_SERIAL_NUMBER];
+    SEEK_EMULATED_DRIVE emulatedDrive;
+    SEEK_TAPE_DRIVE tapeDrive;
+    SEEK_DRIVE_OPS ops;
+    SEEK_MODEL model;
+    BOOL result;
+
+    memset(&model, 0, sizeof(model));
+
+    if (emulate)
+    {
+        // Roughly an LTO drive with 1MB blocks, so the fit can be checked against known answers.
+        memset(&emulatedDrive, 0, sizeof(emulatedDrive));
+        strcpy_s(emulatedDrive.Model.ProductId, sizeof(emulatedDrive.Model.ProductId), "EMULATED");
+        emulatedDrive.Model.BlocksPerWrap = 20000;
+        emulatedDrive.Model.FixedMs = 3000.0;
+        emulatedDrive.Model.BlockMs = 0.9;
+        emulatedDrive.Model.WrapMs = 150.0;
+        emulatedDrive.BlockCount = 800000;
+        emulatedDrive.NoiseFraction = 0.05;
+        emulatedDrive.Random = GetTickCount64() | 1;
+
+        strcpy_s(model.ProductId, sizeof(model.ProductId), emulatedDrive.Model.ProductId);
+        SeekModelEmulatedOps(&emulatedDrive, &ops);
+
+        printf("\r\nCalibrating against emulated drive...\r\n");
+
+        result = SeekModelCalibrate(&ops, SEEK_CALIBRATION_SAMPLES, &model);
+    }
+    else
+    {
+        result = MappingResolveDevice(target, devName, _countof(devName), FALSE);
+
+        if (!result)
+        {
+            fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
+            return EXIT_FAILURE;
+        }
+
+        // The model is per drive model, so find out what we're talking to.
+        if (!TapeIdentify(devName, serialNumber, _countof(serialNumber), NULL, model.ProductId, sizeof(model.ProductId)))
+        {
+            fprintf(stderr, "\r\nFailed to identify %s.\r\n", devName);
+            return EXIT_FAILURE;
+        }
+
+        tapeDrive.Handle = TapeOpen(devName);
+
+        if (tapeDrive.Handle == INVALID_HANDLE_VALUE)
+        {
+            fprintf(stderr, "\r\nFailed to open %s.\r\n", devName);
+            return EXIT_FAILURE;
+        }
+
+        SeekModelTapeOps(&tapeDrive, &ops);
+
+        printf("\r\nCalibrating %s (%s) with %u timed locates. This will take a while...\r\n", devName, model.ProductId, SEEK_CALIBRATION_SAMPLES);
+
+        result = SeekModelCalibrate(&ops, SEEK_CALIBRATION_SAMPLES, &model);
+
+        CloseHandle(tapeDrive.Handle);
+    }
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\nCalibration failed. Is there enough data on the tape?\r\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\n%s: %llu blocks per wrap, %.0f ms + %.4f ms/block + %.1f ms/wrap (RMS error %.0f ms over %u samples)\r\n",
+        model.ProductId, model.BlocksPerWrap, model.FixedMs, model.BlockMs, model.WrapMs, model.RmsErrorMs, model.Samples);
+
+    if (emulate)
+    {
+        printf("Emulated: %llu blocks per wrap, %.0f ms + %.4f ms/block + %.1f ms/wrap\r\n",
+            emulatedDrive.Model.BlocksPerWrap, emulatedDrive.Model.FixedMs, emulatedDrive.Model.BlockMs, emulatedDrive.Model.WrapMs);
+
+        if (!SeekModelMatches(&model, &emulatedDrive.Model))
+        {
+            fprintf(stderr, "\r\nFitted model is outside tolerance (%.0f%% on the wrap, %.0f%% on each cost).\r\n",
+                SEEK_WRAP_TOLERANCE * 100.0, SEEK_COST_TOLERANCE * 100.0);
+            return EXIT_FAILURE;
+        }
+
+        printf("Fit is within tolerance.\r\n");
+
+        return EXIT_SUCCESS;
+    }
+
+    if (!SeekModelSave(&model))
+    {
+        fprintf(stderr, "\r\nFailed to save seek model.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int ScanTapeLayout(LPCSTR target, LPCSTR mapFile)
+{
+    CHAR devName[MAX_DEVICE_NAME];
+    PTAPE_LAYOUT layout;
+    ULONGLONG startTime;
+    HANDLE handle;
+    BOOL result;
+    DWORD partition;
+
+    result = MappingResolveDevice(target, devName, _countof(devName), FALSE);
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
+        return EXIT_FAILURE;
+    }
+
+    handle = TapeOpen(devName);
+
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "\r\nFailed to open %s.\r\n", devName);
+        return EXIT_FAILURE;
+    }
+
+    startTime = GetTickCount64();
+    result = LayoutScan(handle, &layout);
+
+    CloseHandle(handle);
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\nLayout scan failed.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\n");
+
+    for (partition = 0; partition < layout->PartitionCount; partition++)
+    {
+        printf("Partition %u: %u file(s), %u setmark(s), end of data at block %llu\r\n", partition, layout->Partitions[partition].FileCount,
+            layout->Partitions[partition].SetmarkCount, layout->Partitions[partition].EndOfData);
+    }
+
+    printf("\r\nScanned in %llu seconds.\r\n", (GetTickCount64() - startTime) / 1000);
+
+    if (mapFile)
+    {
+        result = LayoutSave(layout, mapFile);
+
+        if (!result)
+            fprintf(stderr, "\r\nFailed to write map %s.\r\n", mapFile);
+    }
+    else
+    {
+        printf("\r\n");
+        LayoutWrite(layout, stdout);
+    }
+
+    LayoutDestroy(layout);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int BenchmarkCrc()
+{
+    const size_t bufferSize = 64 * 1024 * 1024;
+    const DWORD passes = 16;
+    const double lto9NativeMBs = 400.0;
+    LARGE_INTEGER frequency, start, end;
+    PBYTE buffer;
+    DWORD portableCrc = 0, hardwareCrc = 0;
+    double portableMBs, hardwareMBs;
+    ULONGLONG random = 0x9E3779B97F4A7C15ULL;
+    size_t i;
+    DWORD pass;
+
+    buffer = (PBYTE)VirtualAlloc(NULL, bufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (!buffer)
+    {
+        fprintf(stderr, "\r\nFailed to allocate buffer.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    // Incompressible junk, not that it matters to a CRC, but it keeps the numbers honest if anyone reuses this.
+    for (i = 0; i < bufferSize; i += sizeof(ULONGLONG))
+    {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        *(PULONGLONG)(buffer + i) = random;
+    }
+
+    // Known answer first.
+    if (Crc32c(0, "123456789", 9) != 0xE3069283)
+    {
+        fprintf(stderr, "\r\nCRC32C self test failed.\r\n");
+        VirtualFree(buffer, 0, MEM_RELEASE);
+        return EXIT_FAILURE;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    QueryPerformanceCounter(&start);
+
+    for (pass = 0; pass < passes; pass++)
+        portableCrc = Crc32cPortable(portableCrc, buffer, bufferSize);
+
+    QueryPerformanceCounter(&end);
+
+    portableMBs = (double)bufferSize * passes / 1000000.0 / ((double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart);
+
+    printf("\r\nPortable (slice by 8): %.0f MB/s, %.1fx LTO-9 native\r\n", portableMBs, portableMBs / lto9NativeMBs);
+
+    if (Crc32cHardwareAvailable())
+    {
+        QueryPerformanceCounter(&start);
+
+        for (pass = 0; pass < passes; pass++)
+            hardwareCrc = Crc32cHardware(hardwareCrc, buffer, bufferSize);
+
+        QueryPerformanceCounter(&end);
+
+        hardwareMBs = (double)bufferSize * passes / 1000000.0 / ((double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart);
+
+        printf("SSE4.2:                %.0f MB/s, %.1fx LTO-9 native\r\n", hardwareMBs, hardwareMBs / lto9NativeMBs);
+
+        if (hardwareCrc != portableCrc)
+        {
+            fprintf(stderr, "\r\nSSE4.2 and portable results differ.\r\n");
+            VirtualFree(buffer, 0, MEM_RELEASE);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        printf("SSE4.2:                not available on this CPU\r\n");
+    }
+
+    VirtualFree(buffer, 0, MEM_RELEASE);
+
+    return EXIT_SUCCESS;
+}
+
+static int VerifyTapeDrive(LPCSTR target)
+{
+    CHAR devName[MAX_DEVICE_NAME];
+    VERIFY_RESULT result;
+    BOOL success;
+    DWORD i;
+
+    success = MappingResolveDevice(target, devName, _countof(devName), FALSE);
+
+    if (!success)
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\nVerifying %s. This reads the whole cartridge and will take a while...\r\n", devName);
+
+    success = VerifyTape(devName, &result);
+
+    if (!success)
+    {
+        fprintf(stderr, "\r\nVerify failed.\r\n");
+        VerifyDestroyResult(&result);
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\n%u partition(s), %llu block(s), %llu filemark(s), %.1f MB read in %llu seconds.\r\n",
+        result.PartitionCount, result.Blocks, result.Filemarks, (double)result.Bytes / 1000000.0, result.ElapsedMs / 1000);
+    printf("Average %.1f MB/s, minimum %.1f MB/s.\r\n", result.AverageMBs, result.MinimumMBs);
+
+    if (!result.Protected)
+        printf("\r\nLogical block protection not available. Blocks were checked for readability only.\r\n");
+
+    for (i = 0; i < result.Unreadable.Count; i++)
+    {
+        printf("Unreadable: partition %u, blocks %llu-%llu\r\n", result.Unreadable.Ranges[i].Partition,
+            result.Unreadable.Ranges[i].FirstBlock, result.Unreadable.Ranges[i].LastBlock);
+    }
+
+    for (i = 0; i < result.CrcErrors.Count; i++)
+    {
+        printf("CRC mismatch: partition %u, blocks %llu-%llu\r\n", result.CrcErrors.Ranges[i].Partition,
+            result.CrcErrors.Ranges[i].FirstBlock, result.CrcErrors.Ranges[i].LastBlock);
+    }
+
+    success = !result.Unreadable.Count && !result.CrcErrors.Count;
+
+    printf("\r\n%s\r\n", success ? "No errors found." : "Errors found.");
+
+    VerifyDestroyResult(&result);
+
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int HashVolumeFiles(LPCSTR target, CHAR driveLetter, LPCSTR algorithmName, LPCSTR indexFile, LPCSTR manifestFile, BOOL check)
+{
+    PLTFS_INDEX index = NULL;
+    FIXITY_STATS stats;
+    FILE *manifest = stdout;
+    DWORD algorithm;
+    BOOL result;
+
+    if (!FixityAlgorithmFromName(algorithmName, &algorithm))
+    {
+        fprintf(stderr, "\r\nUnknown hash algorithm %s.\r\n", algorithmName);
+        return EXIT_FAILURE;
+    }
+
+    if (!PollFileSystem(target))
+    {
+        fprintf(stderr, "\r\nCannot start file system. LTFS not running.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    if (indexFile && !LtfsIndexLoad(indexFile, &index))
+    {
+        fprintf(stderr, "\r\nFailed to load LTFS index %s.\r\n", indexFile);
+        return EXIT_FAILURE;
+    }
+
+    if (manifestFile && fopen_s(&manifest, manifestFile, "w") != 0)
+    {
+        fprintf(stderr, "\r\nFailed to create manifest %s.\r\n", manifestFile);
+        LtfsIndexDestroy(index);
+        return EXIT_FAILURE;
+    }
+
+    if (check)
+        result = FixityCheckAttributes(driveLetter, algorithm, index, &stats);
+    else
+        result = FixityCreateManifest(driveLetter, algorithm, index, manifest, &stats);
+
+    if (manifestFile && fclose(manifest) != 0)
+    {
+        fprintf(stderr, "\r\nFailed to write manifest %s.\r\n", manifestFile);
+        result = FALSE;
+    }
+
+    // The manifest may have gone to stdout, so the summary goes to stderr to keep it clean.
+    fprintf(stderr, "\r\n%u of %u file(s) hashed, %u failed, %u not placed on tape.\r\n", stats.FilesHashed, stats.FilesFound, stats.FilesFailed, stats.FilesUnplaced);
+
+    if (check)
+        fprintf(stderr, "%u matched, %u mismatched, %u without a stored %s hash.\r\n", stats.FilesMatched, stats.FilesMismatched, stats.FilesWithoutHash, algorithmName);
+
+    fprintf(stderr, "%llu MB in %llu seconds (%.1f MB/s) on %u thread(s), %s.\r\n", stats.BytesHashed / 1000000, stats.ElapsedMs / 1000,
+        stats.ElapsedMs ? (double)stats.BytesHashed / 1000.0 / (double)stats.ElapsedMs : 0.0, stats.WorkerCount,
+        algorithm == FIXITY_SHA256 && Sha256HardwareAvailable() ? "SHA extensions" : "software");
+
+    LtfsIndexDestroy(index);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int TransferTapeImage(LPCSTR target, LPCSTR imageFile, LPCSTR layoutFile, BOOL restore)
+{
+    CHAR devName[MAX_DEVICE_NAME];
+    IMAGE_STATS stats;
+    PTAPE_LAYOUT layout = NULL;
+    BOOL result;
+
+    if (!imageFile)
+    {
+        fprintf(stderr, "\r\nImage file not specified.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    result = MappingResolveDevice(target, devName, _countof(devName), FALSE);
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
+        return EXIT_FAILURE;
+    }
+
+    // Everything on it is about to go, so not while LTFS or anything else has it open.
+    if (restore && TapeIsBusy(devName))
+    {
+        fprintf(stderr, "\r\n%s is in use. Unmount the tape before restoring over it.\r\n", devName);
+        return EXIT_FAILURE;
+    }
+
+    if (restore)
+    {
+        printf("\r\nRestoring %s to %s. Everything on the tape will be overwritten...\r\n", imageFile, devName);
+        result = ImageRestore(imageFile, devName, &stats);
+    }
+    else
+    {
+        if (layoutFile && !LayoutLoad(layoutFile, &layout))
+        {
+            fprintf(stderr, "\r\nFailed to load layout map %s.\r\n", layoutFile);
+            return EXIT_FAILURE;
+        }
+
+        printf("\r\nImaging %s to %s...\r\n", devName, imageFile);
+        result = ImageDump(devName, imageFile, layout, &stats);
+
+        LayoutDestroy(layout);
+    }
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\n%s failed.\r\n", restore ? "Restore" : "Imaging");
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\n%u partition(s), %llu block(s), %llu filemark(s).\r\n", stats.PartitionCount, stats.Blocks, stats.Filemarks);
+    printf("%llu MB of tape data, %llu MB image (%.0f%%), %u compression thread(s).\r\n", stats.Bytes / 1000000, stats.ImageBytes / 1000000,
+        stats.Bytes ? (double)stats.ImageBytes * 100.0 / (double)stats.Bytes : 0.0, stats.WorkerCount);
+    printf("%llu seconds (%.1f MB/s)\r\n", stats.ElapsedMs / 1000, stats.ElapsedMs ? (double)stats.Bytes / 1000.0 / (double)stats.ElapsedMs : 0.0);
+
+    return EXIT_SUCCESS;
+}
+
+static int CopyTapeDrive(LPCSTR source, LPCSTR destination)
+{
+    CHAR sourceName[MAX_DEVICE_NAME];
+    CHAR targetName[MAX_DEVICE_NAME];
+    COPY_STATS stats;
+
+    if (!MappingResolveDevice(source, sourceName, _countof(sourceName), FALSE))
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", source);
+        return EXIT_FAILURE;
+    }
+
+    if (!MappingResolveDevice(destination, targetName, _countof(targetName), FALSE))
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", destination);
+        return EXIT_FAILURE;
+    }
+
+    // Two mappings can be for the one drive, which would have us overwriting the tape as we read it.
+    if (!_stricmp(sourceName, targetName))
+    {
+        fprintf(stderr, "\r\n%s and %s are both %s. Source and target drive cannot be the same.\r\n", source, destination, sourceName);
+        return EXIT_FAILURE;
+    }
+
+    if (TapeIsBusy(sourceName))
+    {
+        fprintf(stderr, "\r\n%s is in use. Unmount both tapes before copying.\r\n", sourceName);
+        return EXIT_FAILURE;
+    }
+
+    // The target most of all, everything on it is about to go.
+    if (TapeIsBusy(targetName))
+    {
+        fprintf(stderr, "\r\n%s is in use. Unmount both tapes before copying.\r\n", targetName);
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\nCopying %s to %s. Everything on the target tape will be overwritten...\r\n", sourceName, targetName);
+
+    if (!CopyTape(sourceName, targetName, &stats))
+    {
+        fprintf(stderr, "\r\nCopy failed.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\n%u partition(s), %llu block(s), %llu filemark(s), %.1f MB in %llu seconds (%.1f MB/s).\r\n",
+        stats.PartitionCount, stats.Blocks, stats.Filemarks, (double)stats.Bytes / 1000000.0, stats.ElapsedMs / 1000,
+        stats.ElapsedMs ? (double)stats.Bytes / 1000.0 / (double)stats.ElapsedMs : 0.0);
+    printf("Source waited %u time(s) for %llu seconds, target waited %u time(s) for %llu seconds.\r\n",
+        stats.SourceStalls, stats.SourceWaitMs / 1000, stats.TargetStalls, stats.TargetWaitMs / 1000);
+
+    return EXIT_SUCCESS;
+}
+
+static int IngestToDrive(LPCSTR target, CHAR driveLetter, LPCSTR sourceDir, LPCSTR targetDir, LPCSTR algorithmName)
+{
+    CHAR devName[MAX_DEVICE_NAME];
+    CHAR mediaDesc[64];
+    INGEST_STATS stats;
+    DWORD algorithm;
+    DWORD nativeMBs = 0;
+    BOOL result;
+
+    if (!FixityAlgorithmFromName(algorithmName, &algorithm))
+    {
+        fprintf(stderr, "\r\nUnknown hash algorithm %s.\r\n", algorithmName);
+        return EXIT_FAILURE;
+    }
+
+    if (!MappingResolveDevice(target, devName, _countof(devName), FALSE))
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist or its drive is not attached.\r\n", target);
+        return EXIT_FAILURE;
+    }
+
+    // The staging buffer is sized from this. Not knowing isn't fatal, we just guess.
+    if (MediaGetDescription(target, devName, mediaDesc, _countof(mediaDesc)))
+        nativeMBs = IngestNativeRate(mediaDesc);
+
+    if (!nativeMBs)
+        printf("\r\nCannot tell the drive generation, assuming %u MB/s native.\r\n", INGEST_DEFAULT_RATE);
+
+    printf("\r\nWriting %s to %c:...\r\n", sourceDir, driveLetter);
+
+    result = IngestFiles(sourceDir, driveLetter, targetDir, TRUE, algorithm, nativeMBs, &stats);
+
+    printf("\r\n%u of %u file(s) written, %u failed, %llu MB in %llu seconds.\r\n", stats.FilesWritten, stats.FilesFound, stats.FilesFailed,
+        stats.BytesWritten / 1000000, stats.ElapsedMs / 1000);
+    printf("%u reader(s), %llu MB staging.\r\n", stats.ReaderCount, stats.StagingBytes / 1000000);
+
+    if (stats.WritingMs)
+    {
+        double achievedMBs = (double)stats.BytesWritten / 1000.0 / (double)stats.WritingMs;
+
+        printf("%.1f MB/s achieved, %u MB/s native (%.0f%%). Drive waited for data %.1f%% of the time.\r\n", achievedMBs, stats.NativeMBs,
+            achievedMBs * 100.0 / (double)stats.NativeMBs, (double)stats.WaitMs * 100.0 / (double)stats.WritingMs);
+    }
+
+    if (!result)
+    {
+        fprintf(stderr, "\r\nIngest failed.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int PackToDrive(CHAR driveLetter, LPCSTR sourceDir, LPCSTR targetDir, LPCSTR catalogFile, DWORD containerMB)
+{
+    PCATALOG catalog;
+    PACK_STATS stats;
+    BOOL result;
+
+    if (!CatalogLoad(catalogFile, &catalog))
+    {
+        fprintf(stderr, "\r\nFailed to load catalog %s.\r\n", catalogFile);
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\nPacking %s onto %c:...\r\n", sourceDir, driveLetter);
+
+    result = PackFiles(sourceDir, driveLetter, targetDir, (ULONGLONG)containerMB * 1024 * 1024, catalog, &stats);
+
+    // Whatever containers did make it are on the volume either way, so the catalog needs to know about them.
+    if (stats.Containers && !CatalogSave(catalog, catalogFile))
+    {
+        fprintf(stderr, "\r\nFailed to save catalog %s.\r\n", catalogFile);
+        result = FALSE;
+    }
+
+    printf("\r\n%u file(s): %u packed into %u container(s) (%llu MB), %u written as is (%llu MB), %u failed.\r\n",
+        stats.FilesFound, stats.FilesPacked, stats.Containers, stats.BytesPacked / 1000000, stats.FilesCopied, stats.BytesCopied / 1000000, stats.FilesFailed);
+    printf("%llu seconds\r\n", stats.ElapsedMs / 1000);
+
+    CatalogDestroy(catalog);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int UnpackFromDrive(CHAR driveLetter, LPCSTR listFile, LPCSTR catalogFile, LPCSTR outputDir)
+{
+    PRECALL_ITEM items;
+    DWORD itemCount;
+    PCATALOG catalog;
+    PACK_STATS stats;
+    BOOL result;
+
+    if (!RecallReadFileList(listFile, &items, &itemCount))
+    {
+        fprintf(stderr, "\r\nFailed to read file list %s.\r\n", listFile);
+        return EXIT_FAILURE;
+    }
+
+    if (!CatalogLoad(catalogFile, &catalog))
+    {
+        fprintf(stderr, "\r\nFailed to load catalog %s.\r\n", catalogFile);
+        RecallDestroyFileList(items, itemCount);
+        return EXIT_FAILURE;
+    }
+
+    result = PackExtract(driveLetter, catalog, items, itemCount, outputDir, &stats);
+
+    printf("\r\n%u of %u file(s) extracted from %u container(s), %llu MB in %llu seconds.\r\n", stats.FilesExtracted, stats.FilesFound,
+        stats.Containers, stats.BytesExtracted / 1000000, stats.ElapsedMs / 1000);
+
+    CatalogDestroy(catalog);
+    RecallDestroyFileList(items, itemCount);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int PlanArchive(LPCSTR sourceDir, LPCSTR planFile)
+{
+    PARCHIVE_PLAN plan;
+
+    printf("\r\nScanning %s...\r\n", sourceDir);
+
+    if (!ArchivePlanCreate(sourceDir, &plan))
+    {
+        fprintf(stderr, "\r\nFailed to plan archive of %s.\r\n", sourceDir);
+        return EXIT_FAILURE;
+    }
+
+    ArchivePlanPrint(plan);
+
+    if (!ArchivePlanSave(plan, planFile))
+    {
+        fprintf(stderr, "\r\nFailed to save plan %s.\r\n", planFile);
+        ArchivePlanDestroy(plan);
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\nPlan saved to %s.\r\n", planFile);
+
+    ArchivePlanDestroy(plan);
+
+    return EXIT_SUCCESS;
+}
+
+static int ArchiveFromPlan(LPCSTR planFile, LPCSTR algorithmName)
+{
+    PARCHIVE_PLAN plan;
+    ARCHIVE_STATS stats;
+    DWORD algorithm;
+    BOOL result;
+    DWORD i;
+
+    if (!FixityAlgorithmFromName(algorithmName, &algorithm))
+    {
+        fprintf(stderr, "\r\nUnknown hash algorithm %s.\r\n", algorithmName);
+        return EXIT_FAILURE;
+    }
+
+    if (!ArchivePlanLoad(planFile, &plan))
+    {
+        fprintf(stderr, "\r\nFailed to load plan %s.\r\n", planFile);
+        return EXIT_FAILURE;
+    }
+
+    ArchivePlanPrint(plan);
+    printf("\r\n");
+
+    result = ArchivePlanRun(plan, algorithm, &stats);
+
+    printf("\r\n");
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        PARCHIVE_DRIVE drive = &plan->Drives[i];
+
+        if (!drive->CartridgeCount)
+            continue;
+
+        printf("%c: %u file(s), %llu MB, %.1f MB/s writing, %.1f MB/s overall\r\n", drive->DriveLetter, drive->FilesWritten, drive->BytesWritten / 1000000,
+            drive->WritingMs ? (double)drive->BytesWritten / 1000.0 / (double)drive->WritingMs : 0.0,
+            stats.ElapsedMs ? (double)drive->BytesWritten / 1000.0 / (double)stats.ElapsedMs : 0.0);
+    }
+
+    printf("\r\n%u file(s) written to %u cartridge(s), %u failed, %u unit(s) not placed.\r\n", stats.FilesWritten, stats.Cartridges, stats.FilesFailed, stats.UnitsUnplaced);
+    printf("%llu MB in %llu seconds (%.1f MB/s aggregate)\r\n", stats.BytesWritten / 1000000, stats.ElapsedMs / 1000,
+        stats.ElapsedMs ? (double)stats.BytesWritten / 1000.0 / (double)stats.ElapsedMs : 0.0);
+
+    ArchivePlanDestroy(plan);
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int SetCompressionPolicy(LPCSTR target, DWORD policy)
+{
+    MEDIA_STATUS status;
+
+    if (!LtfsRegSetTargetCompression(target, policy))
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist.\r\n", target);
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\nCompression for %s set to %s.\r\n", target, MediaCompressionPolicyName(policy));
+
+    if (policy == LTFS_COMPRESSION_DEFAULT)
+        return EXIT_SUCCESS;
+
+    // Nothing loaded is fine, it'll be applied on the next load. So is a drive LTFS or anything else has open, which
+    // only has the last known answer to give, and mustn't have its settings changed under it.
+    if (MediaCheck(target, 0, &status) && status.CompressionValid && !status.Busy && !status.Cached)
+    {
+        if (!MediaApplyCompressionPolicy(target, &policy))
+        {
+            fprintf(stderr, "\r\nFailed to apply compression policy to the loaded tape.\r\n");
+            return EXIT_FAILURE;
+        }
+
+        printf("Applied to the loaded tape.\r\n");
+    }
+    else if (status.Busy)
+    {
+        printf("%s is in use, so this takes effect at the next load.\r\n", target);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int ReportCompression(LPCSTR target, BOOL allDrives, DWORD maxAge)
+{
+    PMEDIA_STATUS statusList;
+    MEDIA_STATUS status;
+    DWORD statusCount;
+    DWORD i;
+
+    if (allDrives)
+    {
+        if (!MediaCheckAll(maxAge, &statusList, &statusCount))
+            return EXIT_FAILURE;
+
+        if (!statusCount)
+        {
+            fprintf(stderr, "\r\nNo drive mappings.\r\n");
+            MediaDestroyList(statusList);
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < statusCount; i++)
+            PrintCompressionStatus(&statusList[i]);
+
+        MediaDestroyList(statusList);
+
+        return EXIT_SUCCESS;
+    }
+
+    if (!LtfsRegGetTargetProperties(target, NULL, 0, NULL, 0))
+    {
+        fprintf(stderr, "\r\nMapping for %s does not exist.\r\n", target);
+        return EXIT_FAILURE;
+    }
+
+    MediaCheck(target, maxAge, &status);
+    PrintCompressionStatus(&status);
+
+    return status.CompressionValid || status.Busy ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void PrintCompressionStatus(PMEDIA_STATUS status)
+{
+    PTAPE_COMPRESSION_STATS stats = &status->Compression;
+
+    printf("\r\n%s (%s) %s%s%s\r\n", status->Target, status->DeviceName, status->Checked ? status->MediaDesc : "media check failed",
+        status->Barcode[0] ? ", barcode " : "", status->Barcode);
+
+    if (status->Checked)
+        PrintMediaSource(status);
+
+    if (!status->CompressionValid)
+        return;
+
+    printf("    Compression %s, policy %s\r\n", status->CompressionEnabled ? "on" : "off", MediaCompressionPolicyName(status->CompressionPolicy));
+
+    // Ratios as the drive works them out rather than from the byte counts, which are rounded to the MB on some drives.
+    printf("    Written: %llu MB from host, %llu MB on tape (%.2f:1)\r\n", stats->BytesFromHost / 1000000, stats->BytesWrittenToTape / 1000000,
+        (double)stats->WriteRatio / 100.0);
+    printf("    Read:    %llu MB from tape, %llu MB to host (%.2f:1)\r\n", stats->BytesReadFromTape / 1000000, stats->BytesToHost / 1000000,
+        (double)stats->ReadRatio / 100.0);
+}
+
+static int WatchTapeDrives()
+{
+    WATCH_STATS stats;
+
+    printf("\r\nWatching for tape drives. Press Ctrl+C to stop.\r\n");
+
+    if (!WatchDevices(&stats))
+    {
+        fprintf(stderr, "\r\nFailed to register for device notifications.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\n%u arrival(s), %u removal(s), %u mapping(s) healed, %u service restart(s).\r\n",
+        stats.Arrivals, stats.Removals, stats.MappingsHealed, stats.ServiceRestarts);
+
+    if (stats.LatencySamples)
+    {
+        printf("Time to heal: %llu ms min, %llu ms mean, %llu ms max.\r\n",
+            stats.MinLatencyMs, stats.TotalLatencyMs / stats.LatencySamples, stats.MaxLatencyMs);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int ReportStatus(DWORD maxAge, BOOL json)
+{
+    PSTATUS_REPORT report;
+
+    if (!StatusCollect(maxAge, &report))
+    {
+        fprintf(stderr, "\r\nFailed to collect status.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    if (json)
+        PrintStatusJson(report);
+    else
+        PrintStatusText(report);
+
+    StatusDestroy(report);
+
+    return EXIT_SUCCESS;
+}
+
+static void PrintStatusText(PSTATUS_REPORT report)
+{
+    DWORD i;
+
+    printf("\r\nLTFS service: %s\r\n", report->ServiceValid ? FuseServiceStateName(report->ServiceState) : "not installed or not readable");
+
+    if (report->DriveCount)
+    {
+        printf("\r\nAttached tape drives:\r\n\r\n");
+
+        for (i = 0; i < report->DriveCount; i++)
+        {
+            PSTATUS_DRIVE drive = &report->Drives[i];
+
+            printf("%s: [%s] %s %s%s\r\n", drive->DeviceName, drive->Drive.SerialNumber, drive->Drive.VendorId, drive->Drive.ProductId,
+                drive->MappingCount ? "" : " (not mapped)");
+        }
+    }
+    else
+    {
+        printf("\r\nNo tape drives found.\r\n");
+    }
+
+    if (report->MappingCount)
+    {
+        printf("\r\nMappings:\r\n");
+
+        for (i = 0; i < report->MappingCount; i++)
+        {
+            PSTATUS_MAPPING mapping = &report->Mappings[i];
+
+            printf("\r\n%s %s [%s] %s\r\n", mapping->Target, mapping->DeviceName, mapping->SerialNumber, StatusMountStateName(mapping->MountState));
+
+            if (!mapping->Attached)
+                printf("    No drive with this serial number is attached\r\n");
+            else if (strcmp(mapping->DeviceName, mapping->AttachedAs) != 0)
+                printf("    Now attached as %s, run remap or restart the service\r\n", mapping->AttachedAs);
+
+            if (mapping->MediaValid && mapping->Media.Checked)
+            {
+                printf("    %s%s%s\r\n", mapping->Media.MediaDesc, mapping->Media.Barcode[0] ? ", barcode " : "", mapping->Media.Barcode);
+                PrintMediaSource(&mapping->Media);
+            }
+        }
+    }
+    else
+    {
+        printf("\r\nNo mappings found.\r\n");
+    }
+
+    printf("\r\n%u of %u mapping(s) ready, %u drive(s) not mapped. Gathered in %llu ms.\r\n",
+        report->ReadyCount, report->MappingCount, report->UnmappedDrives, report->ElapsedMs);
+}
+
+static void PrintStatusJson(PSTATUS_REPORT report)
+{
+    DWORD i;
+
+    printf("{\"service\":");
+
+    if (report->ServiceValid)
+        PrintJsonString(FuseServiceStateName(report->ServiceState));
+    else
+        printf("null");
+
+    printf(",\"drives\":[");
+
+    for (i = 0; i < report->DriveCount; i++)
+    {
+        PSTATUS_DRIVE drive = &report->Drives[i];
+
+        printf("%s{\"device\":", i ? "," : "");
+        PrintJsonString(drive->DeviceName);
+        printf(",\"serial\":");
+        PrintJsonString((LPCSTR)drive->Drive.SerialNumber);
+        printf(",\"vendor\":");
+        PrintJsonString((LPCSTR)drive->Drive.VendorId);
+        printf(",\"product\":");
+        PrintJsonString((LPCSTR)drive->Drive.ProductId);
+        printf(",\"mappings\":%u}", drive->MappingCount);
+    }
+
+    printf("],\"mappings\":[");
+
+    for (i = 0; i < report->MappingCount; i++)
+    {
+        PSTATUS_MAPPING mapping = &report->Mappings[i];
+        PMEDIA_STATUS media = &mapping->Media;
+
+        printf("%s{\"target\":", i ? "," : "");
+        PrintJsonString(mapping->Target);
+        printf(",\"device\":");
+        PrintJsonString(mapping->DeviceName);
+        printf(",\"serial\":");
+        PrintJsonString(mapping->SerialNumber);
+        printf(",\"attachedAs\":");
+
+        if (mapping->Attached)
+            PrintJsonString(mapping->AttachedAs);
+        else
+            printf("null");
+
+        printf(",\"mountPoint\":%s,\"state\":", mapping->MountPoint ? "true" : "false");
+        PrintJsonString(StatusMountStateName(mapping->MountState));
+        printf(",\"media\":");
+
+        if (mapping->MediaValid && media->Checked)
+        {
+            printf("{\"loaded\":%s,\"busy\":%s,\"cached\":%s,\"ageSeconds\":%llu,\"type\":", media->Loaded ? "true" : "false",
+                media->Busy ? "true" : "false", media->Cached ? "true" : "false", media->AgeSeconds);
+            PrintJsonString(media->MediaDesc);
+            printf(",\"barcode\":");
+            PrintJsonString(media->Barcode);
+            printf("}");
+        }
+        else
+        {
+            printf("null");
+        }
+
+        printf("}");
+    }
+
+    printf("],\"readyMappings\":%u,\"unmappedDrives\":%u,\"elapsedMs\":%llu,\"ageSeconds\":%llu}\r\n", report->ReadyCount, report->UnmappedDrives,
+        report->ElapsedMs, report->AgeSeconds);
+}
+
+static void PrintJsonString(LPCSTR value)
+{
+    const UCHAR *c;
+
+    putchar('"');
+
+    // Anything outside ASCII came from the ANSI code page rather than UTF-8, so it's escaped as if it were Latin-1
+    // rather than passed through as bytes a JSON parser would choke on.
+    for (c = (const UCHAR *)value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            printf("\\%c", *c);
+        else if (*c < 0x20 || *c >= 0x80)
+            printf("\\u%04x", *c);
+        else
+            putchar(*c);
+    }
+
+    putchar('"');
+}
+
+static int ServeStatusBoard(DWORD interval)
+{
+    BOARD_SERVE_STATS stats;
+
+    printf("\r\nPublishing status every %u s. Press Ctrl+C to stop.\r\n", interval);
+
+    if (!BoardServe(interval, &stats))
+    {
+        fprintf(stderr, "\r\nFailed to create the status board. Is another process already serving it?\r\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\r\n%llu update(s).\r\n", stats.Updates);
+
+    if (stats.Updates)
+        printf("Time to gather: %llu ms mean, %llu ms max.\r\n", stats.TotalCollectMs / stats.Updates, stats.MaxCollectMs);
+
+    return EXIT_SUCCESS;
+}
+
+static int ReportStatusBoard(BOOL json)
+{
+    PSTATUS_REPORT report;
+    DWORD publisherId;
+
+    if (!BoardGetReport(&report, &publisherId))
+    {
+        fprintf(stderr, "\r\nNo status board. Start one with -o serve.\r\n");
+        return EXIT_FAILURE;
+    }
+
+    if (json)
+    {
+        PrintStatusJson(report);
+    }
+    else
+    {
+        printf("\r\nPublished %llu s ago by process %u.\r\n", report->AgeSeconds, publisherId);
+        PrintStatusText(report);
+    }
+
+    StatusDestroy(report);
+
+    return EXIT_SUCCESS;
+}
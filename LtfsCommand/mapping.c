@@ -0,0 +1,310 @@
+/*
+ *   File:   mapping.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "mapping.h"
+#include "inventory.h"
+#include "fusesvc.h"
+#include "lock.h"
+
+#define MAPPING_MIN_BUCKETS     16
+
+static DWORD MappingHash(LPCSTR value, BOOL ignoreCase);
+static PLTFS_MAPPING *MappingFindSlot(PLTFS_MAPPING *buckets, DWORD bucketMask, LPCSTR value, BOOL target);
+static BOOL MappingGetAddressHint(LPCSTR target, PTAPE_SCSI_ADDRESS address);
+
+// The registry is the only record of what's mapped, and walking it a key at a time for every drive we want to match
+// up gets slow once there are a few dozen mappings. Read it in once and look things up by target or serial from there.
+
+BOOL MappingTableLoad(PMAPPING_TABLE *table)
+{
+    PMAPPING_TABLE newTable;
+    DWORD numMappings;
+    DWORD buckets = MAPPING_MIN_BUCKETS;
+    DWORD i;
+
+    if (!LtfsRegGetMappingCount(&numMappings))
+        return FALSE;
+
+    newTable = (PMAPPING_TABLE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(MAPPING_TABLE));
+
+    if (!newTable)
+        return FALSE;
+
+    // At most half full, so probe runs stay short.
+    while (buckets < numMappings * 2)
+        buckets <<= 1;
+
+    newTable->BucketMask = buckets - 1;
+    newTable->Mappings = (PLTFS_MAPPING)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(LTFS_MAPPING) * max(numMappings, 1));
+    newTable->ByTarget = (PLTFS_MAPPING *)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(PLTFS_MAPPING) * buckets);
+    newTable->BySerial = (PLTFS_MAPPING *)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(PLTFS_MAPPING) * buckets);
+
+    if (!newTable->Mappings || !newTable->ByTarget || !newTable->BySerial)
+    {
+        MappingTableDestroy(newTable);
+        return FALSE;
+    }
+
+    for (i = 0; i < numMappings; i++)
+    {
+        PLTFS_MAPPING mapping = &newTable->Mappings[newTable->MappingCount];
+        PLTFS_MAPPING *slot;
+
+        // Someone else removed one while we were reading, so there's less to read.
+        if (!LtfsRegEnumMappings(i, mapping->Target, _countof(mapping->Target)))
+            break;
+
+        // Half written, or not one of ours.
+        if (!LtfsRegGetTargetProperties(mapping->Target, mapping->DeviceName, _countof(mapping->DeviceName),
+                mapping->SerialNumber, _countof(mapping->SerialNumber)))
+            continue;
+
+        mapping->DriveLetter = strlen(mapping->Target) == 2 ? mapping->Target[0] : 0;
+
+        *MappingFindSlot(newTable->ByTarget, newTable->BucketMask, mapping->Target, TRUE) = mapping;
+
+        // Two mappings can point at the same drive. The first takes the slot and the rest hang off it.
+        slot = MappingFindSlot(newTable->BySerial, newTable->BucketMask, mapping->SerialNumber, FALSE);
+
+        if (*slot)
+        {
+            PLTFS_MAPPING last = *slot;
+
+            while (last->NextSameSerial)
+                last = last->NextSameSerial;
+
+            last->NextSameSerial = mapping;
+        }
+        else
+        {
+            *slot = mapping;
+        }
+
+        newTable->MappingCount++;
+    }
+
+    *table = newTable;
+
+    return TRUE;
+}
+
+void MappingTableDestroy(PMAPPING_TABLE table)
+{
+    if (table->Mappings)
+        LocalFree(table->Mappings);
+
+    if (table->ByTarget)
+        LocalFree(table->ByTarget);
+
+    if (table->BySerial)
+        LocalFree(table->BySerial);
+
+    LocalFree(table);
+}
+
+PLTFS_MAPPING MappingFindByTarget(PMAPPING_TABLE table, LPCSTR target)
+{
+    return *MappingFindSlot(table->ByTarget, table->BucketMask, target, TRUE);
+}
+
+PLTFS_MAPPING MappingFindBySerial(PMAPPING_TABLE table, LPCSTR serialNumber)
+{
+    return *MappingFindSlot(table->BySerial, table->BucketMask, serialNumber, FALSE);
+}
+
+BOOL MappingParseTarget(LPCSTR arg, LPSTR target, DWORD targetLength, PCHAR driveLetter)
+{
+    size_t length = strlen(arg);
+    size_t i;
+
+    *driveLetter = 0;
+
+    if (length == 2 && arg[1] == ':')
+    {
+        CHAR letter = toupper(arg[0]);
+
+        if (letter < MIN_DRIVE_LETTER || letter > MAX_DRIVE_LETTER)
+            return FALSE;
+
+        *driveLetter = letter;
+        _snprintf_s(target, targetLength, _TRUNCATE, "%c:", letter);
+
+        return TRUE;
+    }
+
+    // Otherwise it has to be an absolute path to a directory on a drive (C:\mnt\lto12), which is all the service can
+    // mount on. Relative paths, UNC paths and anything else are turned away before they get into the registry.
+    if (!(length > 3 && isalpha(arg[0]) && arg[1] == ':' && (arg[2] == '\\' || arg[2] == '/')))
+        return FALSE;
+
+    if (strcpy_s(target, targetLength, arg) != 0)
+        return FALSE;
+
+    target[0] = toupper(target[0]);
+
+    for (i = 0; i < length; i++)
+    {
+        if (target[i] == '/')
+            target[i] = '\\';
+    }
+
+    // Same directory however it's typed, so drop trailing separators.
+    while (length > 3 && target[length - 1] == '\\')
+        target[--length] = '\0';
+
+    // Leaves us with just the root of a drive.
+    return length > 3;
+}
+
+// TAPEn is handed out in the order Windows finds the drives, so it moves about with every hot-plug and reboot. The
+// serial number never does. The device name in the mapping is only where the drive was last time: it's used if the
+// drive there still gives the right serial, and only when it doesn't are the drives searched.
+//
+// The service only reads the mappings when it starts, so fixing one up means restarting it, and with it every volume
+// it has mounted. That's only worth doing for callers about to go through the service (persist). Everyone else gets
+// the right device for themselves and leaves the mapping for remap or watch to fix.
+
+BOOL MappingResolveDevice(LPCSTR target, LPSTR deviceName, USHORT deviceNameLength, BOOL persist)
+{
+    CHAR serialNumber[MAX_SERIAL_NUMBER];
+    CHAR foundSerial[MAX_SERIAL_NUMBER];
+    CHAR foundName[MAX_DEVICE_NAME];
+    TAPE_SCSI_ADDRESS hint;
+    TAPE_SCSI_ADDRESS address;
+    HANDLE configLock;
+    DWORD serviceState;
+    BOOL updated;
+
+    if (!LtfsRegGetTargetProperties(target, deviceName, deviceNameLength, serialNumber, _countof(serialNumber)))
+        return FALSE;
+
+    // While nothing has come or gone the inventory already knows, and then no drive gets opened at all.
+    if (InventoryFindDrive(serialNumber, foundName, _countof(foundName), &address))
+    {
+        if (strcmp(foundName, deviceName) == 0)
+        {
+            if (address.Valid && !MappingGetAddressHint(target, &hint))
+                MappingSetAddressHint(target, &address);
+
+            return TRUE;
+        }
+    }
+    else if (TapeIdentify(deviceName, foundSerial, _countof(foundSerial), &address, NULL, 0) && strcmp(foundSerial, serialNumber) == 0)
+    {
+        // Mappings made before there were hints get one the first time through.
+        if (address.Valid && !MappingGetAddressHint(target, &hint))
+            MappingSetAddressHint(target, &address);
+
+        return TRUE;
+    }
+    else if (!TapeFindDrive(serialNumber, MappingGetAddressHint(target, &hint) ? &hint : NULL, foundName, _countof(foundName), &address))
+    {
+        return FALSE;
+    }
+
+    if (!persist)
+        return strcpy_s(deviceName, deviceNameLength, foundName) == 0;
+
+    // Same as remap would do, and under the same lock, as remap could be at it as well.
+    if (!LockConfig(&configLock))
+        return FALSE;
+
+    updated = LtfsRegUpdateTargetMapping(target, foundName);
+
+    // Stopped, it'll pick the change up whenever it's next started.
+    if (updated && FuseGetServiceState(&serviceState) && serviceState == SERVICE_RUNNING && (!FuseStopService() || !FuseStartService()))
+        fprintf(stderr, "\r\nFailed to restart LTFS service.\r\n");
+
+    LockRelease(configLock);
+
+    if (!updated)
+        return FALSE;
+
+    MappingSetAddressHint(target, &address);
+
+    // Not on stdout, where it would land in the middle of whatever the caller is printing.
+    fprintf(stderr, "\r\n%s [%s] moved from %s to %s.\r\n", target, serialNumber, deviceName, foundName);
+
+    return strcpy_s(deviceName, deviceNameLength, foundName) == 0;
+}
+
+BOOL MappingSetAddressHint(LPCSTR target, PTAPE_SCSI_ADDRESS address)
+{
+    CHAR addressText[MAX_SCSI_ADDRESS];
+
+    if (!address->Valid)
+        return FALSE;
+
+    _snprintf_s(addressText, _countof(addressText), _TRUNCATE, "%u:%u:%u:%u", address->PortNumber, address->PathId, address->TargetId, address->Lun);
+
+    return LtfsRegSetScsiAddress(target, addressText);
+}
+
+static BOOL MappingGetAddressHint(LPCSTR target, PTAPE_SCSI_ADDRESS address)
+{
+    CHAR addressText[MAX_SCSI_ADDRESS];
+    UINT port, path, targetId, lun;
+
+    memset(address, 0, sizeof(TAPE_SCSI_ADDRESS));
+
+    if (!LtfsRegGetScsiAddress(target, addressText, _countof(addressText)))
+        return FALSE;
+
+    if (sscanf_s(addressText, "%u:%u:%u:%u", &port, &path, &targetId, &lun) != 4)
+        return FALSE;
+
+    address->PortNumber = (UCHAR)port;
+    address->PathId = (UCHAR)path;
+    address->TargetId = (UCHAR)targetId;
+    address->Lun = (UCHAR)lun;
+    address->Valid = TRUE;
+
+    return TRUE;
+}
+
+static DWORD MappingHash(LPCSTR value, BOOL ignoreCase)
+{
+    DWORD hash = 2166136261;
+
+    // FNV-1a. Targets are paths, so C:\Mnt and c:\mnt are the same place.
+    while (*value)
+    {
+        hash ^= (BYTE)(ignoreCase ? toupper(*value) : *value);
+        hash *= 16777619;
+        value++;
+    }
+
+    return hash;
+}
+
+static PLTFS_MAPPING *MappingFindSlot(PLTFS_MAPPING *buckets, DWORD bucketMask, LPCSTR value, BOOL target)
+{
+    DWORD index = MappingHash(value, target) & bucketMask;
+
+    // Never full, so this always finds either the entry or an empty slot.
+    while (buckets[index])
+    {
+        if (target ? !_stricmp(buckets[index]->Target, value) : !strcmp(buckets[index]->SerialNumber, value))
+            break;
+
+        index = (index + 1) & bucketMask;
+    }
+
+    return &buckets[index];
+}
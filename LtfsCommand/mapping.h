@@ -0,0 +1,49 @@
+/*
+ *   File:   mapping.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsreg.h"
+#include "tape.h"
+
+typedef struct LTFS_MAPPING
+{
+    CHAR Target[MAX_MOUNT_TARGET];
+    CHAR DriveLetter;                   // Zero when mounted on a directory
+    CHAR DeviceName[MAX_DEVICE_NAME];
+    CHAR SerialNumber[MAX_SERIAL_NUMBER];
+    struct LTFS_MAPPING *NextSameSerial;
+} LTFS_MAPPING, *PLTFS_MAPPING;
+
+typedef struct MAPPING_TABLE
+{
+    PLTFS_MAPPING Mappings;
+    DWORD MappingCount;
+    PLTFS_MAPPING *ByTarget;
+    PLTFS_MAPPING *BySerial;
+    DWORD BucketMask;
+} MAPPING_TABLE, *PMAPPING_TABLE;
+
+BOOL MappingTableLoad(PMAPPING_TABLE *table);
+void MappingTableDestroy(PMAPPING_TABLE table);
+PLTFS_MAPPING MappingFindByTarget(PMAPPING_TABLE table, LPCSTR target);
+PLTFS_MAPPING MappingFindBySerial(PMAPPING_TABLE table, LPCSTR serialNumber);
+BOOL MappingParseTarget(LPCSTR arg, LPSTR target, DWORD targetLength, PCHAR driveLetter);
+BOOL MappingResolveDevice(LPCSTR target, LPSTR deviceName, USHORT deviceNameLength, BOOL persist);
+BOOL MappingSetAddressHint(LPCSTR target, PTAPE_SCSI_ADDRESS address);
@@ -0,0 +1,373 @@
+/*
+ *   File:   media.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pch.h"
+#include "media.h"
+#include "mapping.h"
+#include "lock.h"
+
+#define MEDIA_TICKS_PER_SECOND  10000000ULL     // FILETIME is in 100ns units
+
+// Kept in the mapping's registry key, one per drive, so a check in one process saves the next one asking.
+typedef struct MEDIA_CACHE
+{
+    DWORD Size;
+    ULONGLONG CheckedTime;
+    BOOL ChangeCountValid;
+    ULONG MediaChangeCount;
+    MEDIA_STATUS Status;
+} MEDIA_CACHE, *PMEDIA_CACHE;
+
+typedef struct MEDIA_CHECK_JOB
+{
+    LPCSTR Target;
+    PMEDIA_STATUS Status;
+    DWORD MaxAge;
+    HANDLE Thread;
+} MEDIA_CHECK_JOB, *PMEDIA_CHECK_JOB;
+
+static DWORD WINAPI MediaCheckWorker(LPVOID param);
+static BOOL MediaLoadCache(LPCSTR target, LPCSTR deviceName, PMEDIA_CACHE cache);
+static void MediaSaveCache(PMEDIA_STATUS status, BOOL changeCountValid, ULONG changeCount);
+static BOOL MediaCacheCurrent(PMEDIA_CACHE cache, LPCSTR deviceName, DWORD maxAge);
+static void MediaFromCache(PMEDIA_CACHE cache, PMEDIA_STATUS status);
+static ULONGLONG MediaNow();
+
+// Each check is a handful of SCSI commands, but a drive that's busy loading or rewinding can sit on them for a long
+// time. One thread per drive means the slowest drive sets the pace rather than the sum of them.
+//
+// With maxAge, a check made no more than that many seconds ago is reused, as long as the drive hasn't seen a tape go
+// in or out since. Windows counts those for every device, from the unit attention the drive raises whoever's command
+// it was, so asking costs a TEST UNIT READY rather than the whole check.
+
+BOOL MediaCheck(LPCSTR target, DWORD maxAge, PMEDIA_STATUS status)
+{
+    ULONGLONG startTime = GetTickCount64();
+    MEDIA_CACHE cache;
+    BOOL haveCache;
+    BOOL changeCountValid;
+    ULONG changeCount = 0;
+    HANDLE driveLock = NULL;
+
+    memset(status, 0, sizeof(MEDIA_STATUS));
+    strcpy_s(status->Target, _countof(status->Target), target);
+
+    LtfsRegGetTargetCompression(target, &status->CompressionPolicy);
+
+    // Leaves the last known device name behind when the drive can't be found, so there's still something to show.
+    if (!MappingResolveDevice(target, status->DeviceName, _countof(status->DeviceName), FALSE))
+        return FALSE;
+
+    // Something has the drive open, LTFS with a volume mounted as often as not, and it could be half way through a long
+    // write. Anything we sent would land in between its commands, so all that's reported is what was in the drive the
+    // last time it was free to be asked.
+    haveCache = MediaLoadCache(target, status->DeviceName, &cache);
+
+    // The same goes for another of our own operations on the drive, between the commands it sends as much as during
+    // them. It's only waited on briefly: the last known answer is more use than holding up a status report for it.
+    if (!LockDriveWithin(target, MEDIA_LOCK_TIMEOUT, &driveLock) || TapeIsBusy(status->DeviceName))
+    {
+        LockRelease(driveLock);
+
+        if (haveCache)
+            MediaFromCache(&cache, status);
+        else
+            strcpy_s(status->MediaDesc, _countof(status->MediaDesc), "Unknown");
+
+        status->Busy = TRUE;
+        status->Checked = TRUE;
+        status->ElapsedMs = GetTickCount64() - startTime;
+
+        return TRUE;
+    }
+
+    if (haveCache && maxAge && MediaCacheCurrent(&cache, status->DeviceName, maxAge))
+    {
+        LockRelease(driveLock);
+        MediaFromCache(&cache, status);
+        status->ElapsedMs = GetTickCount64() - startTime;
+
+        return TRUE;
+    }
+
+    status->Checked = TapeCheckMedia(status->DeviceName, status->MediaDesc, _countof(status->MediaDesc), &status->Capacity);
+
+    // The rest only means anything with a cartridge in, and fails harmlessly without one.
+    if (status->Checked)
+    {
+        HANDLE handle = TapeOpen(status->DeviceName);
+
+        if (handle != INVALID_HANDLE_VALUE)
+        {
+            USHORT barcodeLength = 0;
+
+            if (TapeReadAttribute(handle, 0, TAPE_MAM_BARCODE, (PBYTE)status->Barcode, TAPE_MAM_BARCODE_LEN, &barcodeLength))
+            {
+                // MAM text attributes are padded out with spaces.
+                while (barcodeLength > 0 && status->Barcode[barcodeLength - 1] == ' ')
+                    barcodeLength--;
+
+                status->Barcode[barcodeLength] = '\0';
+            }
+
+            status->CompressionValid = TapeGetCompressionStats(handle, &status->Compression) &&
+                TapeGetCompression(handle, &status->CompressionEnabled);
+
+            CloseHandle(handle);
+        }
+
+        // Asked after the check, so a unit attention the check itself turned up is already counted. It's also the
+        // straight answer on whether there's a tape in, which READ POSITION only gives as a description.
+        changeCountValid = TapeGetMediaChangeCount(status->DeviceName, &changeCount, &status->Loaded);
+
+        if (!changeCountValid)
+            status->Loaded = status->Capacity.Valid;
+
+        MediaSaveCache(status, changeCountValid, changeCount);
+    }
+
+    LockRelease(driveLock);
+
+    status->ElapsedMs = GetTickCount64() - startTime;
+
+    return status->Checked;
+}
+
+// Every mapping, directories included, so there's no knowing how many until the table is loaded.
+
+BOOL MediaCheckAll(DWORD maxAge, PMEDIA_STATUS *statusList, PDWORD statusCount)
+{
+    PMAPPING_TABLE table;
+    PMEDIA_STATUS list;
+    PMEDIA_CHECK_JOB jobs;
+    DWORD i;
+
+    if (!MappingTableLoad(&table))
+        return FALSE;
+
+    // At least one each, so there's still a list to hand back with no mappings.
+    list = (PMEDIA_STATUS)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(MEDIA_STATUS) * max(table->MappingCount, 1));
+    jobs = (PMEDIA_CHECK_JOB)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(MEDIA_CHECK_JOB) * max(table->MappingCount, 1));
+
+    if (!list || !jobs)
+    {
+        if (list)
+            LocalFree(list);
+
+        if (jobs)
+            LocalFree(jobs);
+
+        MappingTableDestroy(table);
+
+        return FALSE;
+    }
+
+    for (i = 0; i < table->MappingCount; i++)
+    {
+        jobs[i].Target = table->Mappings[i].Target;
+        jobs[i].Status = &list[i];
+        jobs[i].MaxAge = maxAge;
+        jobs[i].Thread = CreateThread(NULL, 0, MediaCheckWorker, &jobs[i], 0, NULL);
+
+        // Couldn't start a thread, so just do it here.
+        if (!jobs[i].Thread)
+            MediaCheck(jobs[i].Target, maxAge, &list[i]);
+    }
+
+    for (i = 0; i < table->MappingCount; i++)
+    {
+        if (jobs[i].Thread)
+        {
+            WaitForSingleObject(jobs[i].Thread, INFINITE);
+            CloseHandle(jobs[i].Thread);
+        }
+    }
+
+    *statusList = list;
+    *statusCount = table->MappingCount;
+
+    LocalFree(jobs);
+    MappingTableDestroy(table);
+
+    return TRUE;
+}
+
+// Just the media type, for sizing things by drive generation. Callers about to write through LTFS usually have the
+// volume mounted already, so the drive is busy and the last known answer has to do.
+
+BOOL MediaGetDescription(LPCSTR target, LPCSTR deviceName, LPSTR mediaDesc, size_t len)
+{
+    MEDIA_CACHE cache;
+
+    if (TapeIsBusy(deviceName))
+        return MediaLoadCache(target, deviceName, &cache) && strcpy_s(mediaDesc, len, cache.Status.MediaDesc) == 0;
+
+    return TapeCheckMedia(deviceName, mediaDesc, len, NULL);
+}
+
+void MediaDestroyList(PMEDIA_STATUS statusList)
+{
+    if (statusList)
+        LocalFree(statusList);
+}
+
+// For when we've just loaded or ejected, which the drive's change count would catch anyway, but only once it's asked.
+
+BOOL MediaInvalidate(LPCSTR target)
+{
+    return LtfsRegClearMediaCache(target);
+}
+
+static DWORD WINAPI MediaCheckWorker(LPVOID param)
+{
+    PMEDIA_CHECK_JOB job = (PMEDIA_CHECK_JOB)param;
+
+    MediaCheck(job->Target, job->MaxAge, job->Status);
+
+    return 0;
+}
+
+BOOL MediaApplyCompressionPolicy(LPCSTR target, PDWORD policy)
+{
+    CHAR deviceName[MAX_DEVICE_NAME];
+    HANDLE driveLock;
+    HANDLE handle;
+    BOOL result;
+
+    if (!LtfsRegGetTargetCompression(target, policy) || !MappingResolveDevice(target, deviceName, _countof(deviceName), FALSE))
+        return FALSE;
+
+    // Left to the drive, so nothing to do.
+    if (*policy == LTFS_COMPRESSION_DEFAULT)
+        return TRUE;
+
+    if (!LockDrive(target, &driveLock))
+        return FALSE;
+
+    // A MODE SELECT would land in the middle of whatever has it open. It gets the policy at its next load instead.
+    if (TapeIsBusy(deviceName))
+    {
+        LockRelease(driveLock);
+        return TRUE;
+    }
+
+    handle = TapeOpen(deviceName);
+
+    // Drives go back to their own default with every load, so this has to be done each time.
+    result = handle != INVALID_HANDLE_VALUE && TapeSetCompression(handle, *policy == LTFS_COMPRESSION_ON);
+
+    if (handle != INVALID_HANDLE_VALUE)
+        CloseHandle(handle);
+
+    LockRelease(driveLock);
+
+    // The cached check has the old setting in it.
+    MediaInvalidate(target);
+
+    return result;
+}
+
+LPCSTR MediaCompressionPolicyName(DWORD policy)
+{
+    switch (policy)
+    {
+    case LTFS_COMPRESSION_ON:
+        return "on";
+    case LTFS_COMPRESSION_OFF:
+        return "off";
+    default:
+        return "default";
+    }
+}
+
+BOOL MediaCompressionPolicyFromName(LPCSTR name, PDWORD policy)
+{
+    if (!_stricmp(name, "on"))
+        *policy = LTFS_COMPRESSION_ON;
+    else if (!_stricmp(name, "off"))
+        *policy = LTFS_COMPRESSION_OFF;
+    else if (!_stricmp(name, "default"))
+        *policy = LTFS_COMPRESSION_DEFAULT;
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+static BOOL MediaLoadCache(LPCSTR target, LPCSTR deviceName, PMEDIA_CACHE cache)
+{
+    if (!LtfsRegGetMediaCache(target, cache, sizeof(MEDIA_CACHE)) || cache->Size != sizeof(MEDIA_CACHE))
+        return FALSE;
+
+    // The drive was somewhere else when this was saved, and something happened to move it.
+    return strcmp(cache->Status.DeviceName, deviceName) == 0;
+}
+
+static void MediaSaveCache(PMEDIA_STATUS status, BOOL changeCountValid, ULONG changeCount)
+{
+    MEDIA_CACHE cache;
+
+    memset(&cache, 0, sizeof(cache));
+
+    cache.Size = sizeof(MEDIA_CACHE);
+    cache.CheckedTime = MediaNow();
+    cache.Status = *status;
+    cache.ChangeCountValid = changeCountValid;
+    cache.MediaChangeCount = changeCount;
+
+    LtfsRegSetMediaCache(status->Target, &cache, sizeof(cache));
+}
+
+static BOOL MediaCacheCurrent(PMEDIA_CACHE cache, LPCSTR deviceName, DWORD maxAge)
+{
+    ULONGLONG now = MediaNow();
+    ULONG changeCount;
+    BOOL loaded;
+
+    // Allowing for the clock having gone backwards.
+    if (now < cache->CheckedTime || (now - cache->CheckedTime) / MEDIA_TICKS_PER_SECOND > maxAge)
+        return FALSE;
+
+    if (!cache->ChangeCountValid || !TapeGetMediaChangeCount(deviceName, &changeCount, &loaded))
+        return FALSE;
+
+    if (loaded != cache->Status.Loaded)
+        return FALSE;
+
+    return !loaded || changeCount == cache->MediaChangeCount;
+}
+
+static void MediaFromCache(PMEDIA_CACHE cache, PMEDIA_STATUS status)
+{
+    DWORD policy = status->CompressionPolicy;
+
+    *status = cache->Status;
+
+    // The policy is what's set now, not what was set then.
+    status->CompressionPolicy = policy;
+    status->Cached = TRUE;
+    status->AgeSeconds = MediaNow() > cache->CheckedTime ? (MediaNow() - cache->CheckedTime) / MEDIA_TICKS_PER_SECOND : 0;
+}
+
+static ULONGLONG MediaNow()
+{
+    FILETIME now;
+
+    GetSystemTimeAsFileTime(&now);
+
+    return ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+}
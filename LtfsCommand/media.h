@@ -0,0 +1,53 @@
+/*
+ *   File:   media.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "pch.h"
+#include "ltfsreg.h"
+#include "tape.h"
+
+#define MEDIA_MAX_DESC          64
+#define MEDIA_LOCK_TIMEOUT      1000    // No more than LOCK_NOTICE_MS, a check never says it's waiting
+
+typedef struct MEDIA_STATUS
+{
+    CHAR Target[MAX_MOUNT_TARGET];
+    CHAR DeviceName[MAX_DEVICE_NAME];
+    BOOL Checked;
+    BOOL Loaded;
+    BOOL Busy;
+    BOOL Cached;
+    ULONGLONG AgeSeconds;
+    CHAR MediaDesc[MEDIA_MAX_DESC];
+    TAPE_CAPACITY Capacity;
+    CHAR Barcode[TAPE_MAM_BARCODE_LEN + 1];
+    BOOL CompressionValid;
+    BOOL CompressionEnabled;
+    TAPE_COMPRESSION_STATS Compression;
+    DWORD CompressionPolicy;
+    ULONGLONG ElapsedMs;
+} MEDIA_STATUS, *PMEDIA_STATUS;
+
+BOOL MediaCheck(LPCSTR target, DWORD maxAge, PMEDIA_STATUS status);
+BOOL MediaCheckAll(DWORD maxAge, PMEDIA_STATUS *statusList, PDWORD statusCount);
+BOOL MediaGetDescription(LPCSTR target, LPCSTR deviceName, LPSTR mediaDesc, size_t len);
+void MediaDestroyList(PMEDIA_STATUS statusList);
+BOOL MediaInvalidate(LPCSTR target);
+BOOL MediaApplyCompressionPolicy(LPCSTR target, PDWORD policy);
+LPCSTR MediaCompressionPolicyName(DWORD policy);
+BOOL MediaCompressionPolicyFromName(LPCSTR name, PDWORD policy);
@@ -0,0 +1,592 @@
+/*
+ *   File:   pack.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "pack.h"
+#include "util.h"
+
+typedef struct PACK_CONTAINER
+{
+    HANDLE Handle;
+    CHAR Path[MAX_PATH];
+    ULONGLONG Length;
+    PBYTE Buffer;
+    DWORD Buffered;
+    PCATALOG_MEMBER Members;
+    DWORD MemberCount;
+    DWORD MemberCapacity;
+} PACK_CONTAINER, *PPACK_CONTAINER;
+
+typedef struct PACK_CONTEXT
+{
+    LPCSTR SourceDir;
+    CHAR DriveLetter;
+    LPCSTR TargetDir;
+    ULONGLONG ContainerSize;
+    PCATALOG Catalog;
+    PPACK_STATS Stats;
+    PACK_CONTAINER Container;
+    DWORD Sequence;
+    SYSTEMTIME StartTime;
+} PACK_CONTEXT, *PPACK_CONTEXT;
+
+static BOOL PackDirectory(PPACK_CONTEXT context, LPCSTR directory);
+static BOOL PackFile(PPACK_CONTEXT context, LPCSTR path, ULONGLONG size);
+static BOOL PackCopyFile(PPACK_CONTEXT context, LPCSTR path);
+static BOOL PackOpenContainer(PPACK_CONTEXT context);
+static BOOL PackAppend(PPACK_CONTAINER container, const void *data, DWORD length);
+static BOOL PackFlush(PPACK_CONTAINER container);
+static BOOL PackCloseContainer(PPACK_CONTEXT context);
+static void PackTargetPath(PPACK_CONTEXT context, LPCSTR path, LPSTR buffer, size_t length);
+static BOOL PackExtractMember(HANDLE container, PCATALOG_MEMBER member, LPCSTR outputDir, PBYTE buffer);
+static int PackCompareMembers(const void *a, const void *b);
+
+// Small files are written into containers rather than onto the volume one by one. Every file on an LTFS volume costs
+// an index entry and starts on a fresh block, so a million 4K files means a huge index and most of the tape wasted as
+// padding. Anything a block or more in size gains nothing from packing, so that's written as normal.
+
+BOOL PackFiles(LPCSTR sourceDir, CHAR driveLetter, LPCSTR targetDir, ULONGLONG containerSize, PCATALOG catalog, PPACK_STATS stats)
+{
+    PACK_CONTEXT context;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL result;
+
+    memset(stats, 0, sizeof(PACK_STATS));
+    memset(&context, 0, sizeof(context));
+
+    context.SourceDir = sourceDir;
+    context.DriveLetter = driveLetter;
+    context.TargetDir = targetDir ? targetDir : "";
+    context.ContainerSize = containerSize;
+    context.Catalog = catalog;
+    context.Stats = stats;
+    context.Container.Handle = INVALID_HANDLE_VALUE;
+
+    // Container names only need to be unique across the catalog, which covers every volume, so stamp them with when
+    // the run started.
+    GetSystemTime(&context.StartTime);
+
+    context.Container.Buffer = (PBYTE)VirtualAlloc(NULL, PACK_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    result = context.Container.Buffer != NULL;
+
+    if (result)
+        result = PackDirectory(&context, "");
+
+    if (result)
+        result = PackCloseContainer(&context);
+
+    // A failed container isn't in the catalog, so don't leave it lying around on the volume either.
+    if (context.Container.Handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(context.Container.Handle);
+        DeleteFile(context.Container.Path);
+    }
+
+    if (context.Container.Members)
+    {
+        DWORD i;
+
+        for (i = 0; i < context.Container.MemberCount; i++)
+            LocalFree(context.Container.Members[i].Path);
+
+        LocalFree(context.Container.Members);
+    }
+
+    if (context.Container.Buffer)
+        VirtualFree(context.Container.Buffer, 0, MEM_RELEASE);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result && !stats->FilesFailed;
+}
+
+BOOL PackExtract(CHAR driveLetter, PCATALOG catalog, PRECALL_ITEM items, DWORD itemCount, LPCSTR outputDir, PPACK_STATS stats)
+{
+    PCATALOG_MEMBER *members;
+    PRECALL_ITEM containers;
+    PDWORD runStarts;
+    RECALL_STATS recallStats;
+    ULONGLONG startTime = GetTickCount64();
+    DWORD memberCount = 0;
+    DWORD containerCount = 0;
+    PBYTE buffer;
+    BOOL result;
+    DWORD i, j;
+
+    memset(stats, 0, sizeof(PACK_STATS));
+    stats->FilesFound = itemCount;
+
+    members = (PCATALOG_MEMBER *)LocalAlloc(LMEM_FIXED, sizeof(PCATALOG_MEMBER) * (itemCount + 1));
+    containers = (PRECALL_ITEM)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(RECALL_ITEM) * (itemCount + 1));
+    runStarts = (PDWORD)LocalAlloc(LMEM_FIXED, sizeof(DWORD) * (itemCount + 1));
+    buffer = (PBYTE)VirtualAlloc(NULL, PACK_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    result = members && containers && runStarts && buffer;
+
+    if (result)
+    {
+        for (i = 0; i < itemCount; i++)
+        {
+            PCATALOG_MEMBER member = CatalogFindMember(catalog, items[i].Path);
+
+            if (member)
+            {
+                members[memberCount++] = member;
+            }
+            else
+            {
+                fprintf(stderr, "Not in any container: %s\r\n", items[i].Path);
+                stats->FilesFailed++;
+            }
+        }
+
+        // Group by container and then by offset, so each container is a single pass forwards.
+        qsort(members, memberCount, sizeof(PCATALOG_MEMBER), PackCompareMembers);
+
+        for (i = 0; i < memberCount; i++)
+        {
+            if (i == 0 || _stricmp(members[i]->Container, members[i - 1]->Container) != 0)
+            {
+                containers[containerCount].Path = members[i]->Container;
+                containers[containerCount].Order = containerCount;
+                runStarts[containerCount++] = i;
+            }
+        }
+
+        runStarts[containerCount] = memberCount;
+
+        // Then take the containers in tape order. The paths still belong to the catalog.
+        memset(&recallStats, 0, sizeof(RECALL_STATS));
+        RecallOrderItems(driveLetter, containers, containerCount, NULL, &recallStats);
+
+        for (i = 0; i < containerCount; i++)
+        {
+            DWORD run = containers[i].Order;
+            CHAR containerPath[MAX_PATH];
+            HANDLE handle;
+
+            _snprintf_s(containerPath, _countof(containerPath), _TRUNCATE, "%c:\\%s", driveLetter, containers[i].Path);
+
+            handle = CreateFile(containerPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+
+            for (j = runStarts[run]; j < runStarts[run + 1]; j++)
+            {
+                // One seek to the member and one read of just that much. LTFS only has to find the block it starts in.
+                if (handle != INVALID_HANDLE_VALUE && PackExtractMember(handle, members[j], outputDir, buffer))
+                {
+                    stats->FilesExtracted++;
+                    stats->BytesExtracted += members[j]->Length;
+                }
+                else
+                {
+                    fprintf(stderr, "Failed to extract %s from %s\r\n", members[j]->Path, containers[i].Path);
+                    stats->FilesFailed++;
+                }
+            }
+
+            if (handle != INVALID_HANDLE_VALUE)
+                CloseHandle(handle);
+        }
+    }
+
+    if (buffer)
+        VirtualFree(buffer, 0, MEM_RELEASE);
+
+    if (runStarts)
+        LocalFree(runStarts);
+
+    if (containers)
+        LocalFree(containers);
+
+    if (members)
+        LocalFree(members);
+
+    stats->Containers = containerCount;
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result && !stats->FilesFailed;
+}
+
+static BOOL PackDirectory(PPACK_CONTEXT context, LPCSTR directory)
+{
+    CHAR searchPath[MAX_PATH];
+    WIN32_FIND_DATA findData;
+    HANDLE find;
+    BOOL result = TRUE;
+
+    _snprintf_s(searchPath, _countof(searchPath), _TRUNCATE, "%s\\%s%s*", context->SourceDir, directory, *directory ? "\\" : "");
+
+    find = FindFirstFile(searchPath, &findData);
+
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Cannot read directory %s\\%s\r\n", context->SourceDir, directory);
+        return FALSE;
+    }
+
+    do
+    {
+        CHAR path[MAX_PATH];
+
+        if (!strcmp(findData.cFileName, ".") || !strcmp(findData.cFileName, ".."))
+            continue;
+
+        _snprintf_s(path, _countof(path), _TRUNCATE, "%s%s%s", directory, *directory ? "\\" : "", findData.cFileName);
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            result = PackDirectory(context, path);
+        }
+        else
+        {
+            context->Stats->FilesFound++;
+            result = PackFile(context, path, ((ULONGLONG)findData.nFileSizeHigh << 32) | findData.nFileSizeLow);
+        }
+
+    } while (result && FindNextFile(find, &findData));
+
+    FindClose(find);
+
+    return result;
+}
+
+static BOOL PackFile(PPACK_CONTEXT context, LPCSTR path, ULONGLONG size)
+{
+    PPACK_CONTAINER container = &context->Container;
+    PCATALOG_MEMBER member;
+    CHAR sourcePath[MAX_PATH];
+    CHAR targetPath[MAX_PATH];
+    ULONGLONG offset;
+    HANDLE handle;
+    BOOL result = TRUE;
+
+    if (size >= PACK_SMALL_FILE_SIZE)
+        return PackCopyFile(context, path);
+
+    // Full up. Close this one off and start another.
+    if (container->Handle != INVALID_HANDLE_VALUE && container->Length + size > context->ContainerSize)
+        result = PackCloseContainer(context);
+
+    if (result && container->Handle == INVALID_HANDLE_VALUE)
+        result = PackOpenContainer(context);
+
+    if (!result)
+        return FALSE;
+
+    if (container->MemberCount == container->MemberCapacity)
+    {
+        DWORD newCapacity = container->MemberCapacity ? container->MemberCapacity * 2 : 1024;
+        PCATALOG_MEMBER members = (PCATALOG_MEMBER)LocalAlloc(LMEM_FIXED, sizeof(CATALOG_MEMBER) * newCapacity);
+
+        if (!members)
+            return FALSE;
+
+        if (container->Members)
+        {
+            memcpy(members, container->Members, sizeof(CATALOG_MEMBER) * container->MemberCount);
+            LocalFree(container->Members);
+        }
+
+        container->Members = members;
+        container->MemberCapacity = newCapacity;
+    }
+
+    _snprintf_s(sourcePath, _countof(sourcePath), _TRUNCATE, "%s\\%s", context->SourceDir, path);
+
+    handle = CreateFile(sourcePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    // A source file we can't read is that file's problem, not the container's. Skip it and carry on.
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Failed to read %s\r\n", sourcePath);
+        context->Stats->FilesFailed++;
+        return TRUE;
+    }
+
+    offset = container->Length;
+
+    // Small files go straight into the write buffer, so the volume only ever sees big sequential writes.
+    if (container->Buffered + size > PACK_BUFFER_SIZE)
+        result = PackFlush(container);
+
+    if (result)
+    {
+        DWORD bytesRead = 0;
+
+        if (!ReadFile(handle, container->Buffer + container->Buffered, (DWORD)size, &bytesRead, NULL) || bytesRead != size)
+        {
+            fprintf(stderr, "Failed to read %s\r\n", sourcePath);
+            context->Stats->FilesFailed++;
+        }
+        else
+        {
+            PackTargetPath(context, path, targetPath, _countof(targetPath));
+
+            member = &container->Members[container->MemberCount];
+            member->Path = (LPSTR)LocalAlloc(LMEM_FIXED, strlen(targetPath) + 1);
+            result = member->Path != NULL;
+
+            if (result)
+            {
+                strcpy_s(member->Path, strlen(targetPath) + 1, targetPath);
+                member->Container = NULL;
+                member->Offset = offset;
+                member->Length = size;
+                container->MemberCount++;
+
+                container->Buffered += bytesRead;
+                container->Length += bytesRead;
+
+                context->Stats->FilesPacked++;
+                context->Stats->BytesPacked += size;
+            }
+        }
+    }
+
+    CloseHandle(handle);
+
+    return result;
+}
+
+static BOOL PackCopyFile(PPACK_CONTEXT context, LPCSTR path)
+{
+    CHAR sourcePath[MAX_PATH];
+    CHAR targetPath[MAX_PATH];
+    CHAR fullPath[MAX_PATH];
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    LPSTR separator;
+
+    _snprintf_s(sourcePath, _countof(sourcePath), _TRUNCATE, "%s\\%s", context->SourceDir, path);
+
+    PackTargetPath(context, path, targetPath, _countof(targetPath));
+    _snprintf_s(fullPath, _countof(fullPath), _TRUNCATE, "%c:\\%s", context->DriveLetter, targetPath);
+
+    separator = strrchr(fullPath, '\\');
+    *separator = '\0';
+
+    if (!CreateDirectoryPath(fullPath))
+    {
+        fprintf(stderr, "Cannot create %s\r\n", fullPath);
+        return FALSE;
+    }
+
+    *separator = '\\';
+
+    if (!CopyFile(sourcePath, fullPath, FALSE))
+    {
+        fprintf(stderr, "Failed to copy %s\r\n", sourcePath);
+        context->Stats->FilesFailed++;
+        return TRUE;
+    }
+
+    context->Stats->FilesCopied++;
+
+    if (GetFileAttributesEx(sourcePath, GetFileExInfoStandard, &attributes))
+        context->Stats->BytesCopied += ((ULONGLONG)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+
+    return TRUE;
+}
+
+static BOOL PackOpenContainer(PPACK_CONTEXT context)
+{
+    PPACK_CONTAINER container = &context->Container;
+    CHAR name[64];
+    CHAR fullPath[MAX_PATH];
+    LPSTR separator;
+
+    _snprintf_s(name, _countof(name), _TRUNCATE, "pack-%04u%02u%02u-%02u%02u%02u-%04u." PACK_EXTENSION,
+        context->StartTime.wYear, context->StartTime.wMonth, context->StartTime.wDay,
+        context->StartTime.wHour, context->StartTime.wMinute, context->StartTime.wSecond, ++context->Sequence);
+
+    PackTargetPath(context, name, container->Path, _countof(container->Path));
+    _snprintf_s(fullPath, _countof(fullPath), _TRUNCATE, "%c:\\%s", context->DriveLetter, container->Path);
+
+    separator = strrchr(fullPath, '\\');
+    *separator = '\0';
+
+    if (!CreateDirectoryPath(fullPath))
+    {
+        fprintf(stderr, "Cannot create %s\r\n", fullPath);
+        return FALSE;
+    }
+
+    *separator = '\\';
+
+    container->Handle = CreateFile(fullPath, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (container->Handle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "Cannot create %s\r\n", fullPath);
+        return FALSE;
+    }
+
+    // From here on it's the full path, so it can be deleted if anything goes wrong.
+    strcpy_s(container->Path, _countof(container->Path), fullPath);
+
+    container->Length = 0;
+    container->Buffered = 0;
+    container->MemberCount = 0;
+
+    return TRUE;
+}
+
+static BOOL PackAppend(PPACK_CONTAINER container, const void *data, DWORD length)
+{
+    if (container->Buffered + length > PACK_BUFFER_SIZE && !PackFlush(container))
+        return FALSE;
+
+    memcpy(container->Buffer + container->Buffered, data, length);
+    container->Buffered += length;
+    container->Length += length;
+
+    return TRUE;
+}
+
+static BOOL PackFlush(PPACK_CONTAINER container)
+{
+    DWORD bytesWritten = 0;
+
+    if (!container->Buffered)
+        return TRUE;
+
+    if (!WriteFile(container->Handle, container->Buffer, container->Buffered, &bytesWritten, NULL) || bytesWritten != container->Buffered)
+    {
+        // Most likely the cartridge is full.
+        fprintf(stderr, "Write failed on %s\r\n", container->Path);
+        return FALSE;
+    }
+
+    container->Buffered = 0;
+
+    return TRUE;
+}
+
+static BOOL PackCloseContainer(PPACK_CONTEXT context)
+{
+    PPACK_CONTAINER container = &context->Container;
+    PACK_TRAILER trailer;
+    BOOL result = TRUE;
+    DWORD i;
+
+    if (container->Handle == INVALID_HANDLE_VALUE)
+        return TRUE;
+
+    // Every file that was meant to go in it failed to read. Nothing to keep.
+    if (!container->MemberCount)
+    {
+        CloseHandle(container->Handle);
+        container->Handle = INVALID_HANDLE_VALUE;
+        DeleteFile(container->Path);
+        return TRUE;
+    }
+
+    memset(&trailer, 0, sizeof(trailer));
+    memcpy(trailer.Magic, PACK_MAGIC, sizeof(trailer.Magic));
+    trailer.IndexOffset = container->Length;
+    trailer.MemberCount = container->MemberCount;
+
+    for (i = 0; result && i < container->MemberCount; i++)
+    {
+        CHAR line[MAX_PATH + 64];
+        int length = _snprintf_s(line, _countof(line), _TRUNCATE, "%llu\t%llu\t%s\n", container->Members[i].Offset,
+            container->Members[i].Length, container->Members[i].Path);
+
+        result = length > 0 && PackAppend(container, line, length);
+    }
+
+    trailer.IndexLength = container->Length - trailer.IndexOffset;
+
+    if (result)
+        result = PackAppend(container, &trailer, sizeof(trailer)) && PackFlush(container);
+
+    // The catalog only hears about it once it's completely on the volume.
+    if (result)
+        result = CloseHandle(container->Handle);
+
+    if (!result)
+        return FALSE;
+
+    container->Handle = INVALID_HANDLE_VALUE;
+
+    result = CatalogAddContainer(context->Catalog, container->Path, container->Members, container->MemberCount);
+
+    for (i = 0; i < container->MemberCount; i++)
+        LocalFree(container->Members[i].Path);
+
+    container->MemberCount = 0;
+    context->Stats->Containers++;
+
+    return result;
+}
+
+static void PackTargetPath(PPACK_CONTEXT context, LPCSTR path, LPSTR buffer, size_t length)
+{
+    _snprintf_s(buffer, length, _TRUNCATE, "%s%s%s", context->TargetDir, *context->TargetDir ? "\\" : "", path);
+}
+
+static BOOL PackExtractMember(HANDLE container, PCATALOG_MEMBER member, LPCSTR outputDir, PBYTE buffer)
+{
+    CHAR outputPath[MAX_PATH];
+    ULONGLONG remaining = member->Length;
+    LARGE_INTEGER offset;
+    HANDLE output;
+    BOOL result;
+
+    offset.QuadPart = (LONGLONG)member->Offset;
+
+    if (!SetFilePointerEx(container, offset, NULL, FILE_BEGIN))
+        return FALSE;
+
+    output = RecallCreateOutputFile(outputDir, member->Path, outputPath, _countof(outputPath));
+
+    if (output == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    result = TRUE;
+
+    while (result && remaining)
+    {
+        DWORD chunk = (DWORD)min(remaining, PACK_BUFFER_SIZE);
+        DWORD bytesRead = 0;
+        DWORD bytesWritten = 0;
+
+        result = ReadFile(container, buffer, chunk, &bytesRead, NULL) && bytesRead == chunk &&
+            WriteFile(output, buffer, chunk, &bytesWritten, NULL) && bytesWritten == chunk;
+
+        remaining -= chunk;
+    }
+
+    CloseHandle(output);
+
+    if (!result)
+        DeleteFile(outputPath);
+
+    return result;
+}
+
+static int PackCompareMembers(const void *a, const void *b)
+{
+    const CATALOG_MEMBER *memberA = *(const CATALOG_MEMBER **)a;
+    const CATALOG_MEMBER *memberB = *(const CATALOG_MEMBER **)b;
+    int result = _stricmp(memberA->Container, memberB->Container);
+
+    if (result != 0)
+        return result;
+
+    return memberA->Offset < memberB->Offset ? -1 : (memberA->Offset > memberB->Offset ? 1 : 0);
+}
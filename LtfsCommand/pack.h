@@ -0,0 +1,64 @@
+/*
+ *   File:   pack.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "catalog.h"
+#include "recall.h"
+
+// Container layout:
+//
+//   member data                  back to back, no padding
+//   member index                 one "<offset>\t<length>\t<path>\n" line per member
+//   PACK_TRAILER                 the last sizeof(PACK_TRAILER) bytes of the file
+//
+// Member paths are where the file would have been on the volume had it not been packed. The catalog gets the same
+// offsets, so it can pull a member out without reading the index, but a container still makes sense on its own.
+
+#define PACK_MAGIC                  "LTFSPAK1"
+#define PACK_EXTENSION              "ltfspack"
+#define PACK_SMALL_FILE_SIZE        LTFS_MAX_BLOCK_SIZE     // Anything smaller leaves most of a block empty
+#define PACK_DEFAULT_CONTAINER_MB   1024
+#define PACK_BUFFER_SIZE            (8 * 1024 * 1024)
+
+typedef struct PACK_TRAILER
+{
+    CHAR Magic[8];
+    ULONGLONG IndexOffset;
+    ULONGLONG IndexLength;
+    DWORD MemberCount;
+    DWORD Reserved;
+} PACK_TRAILER, *PPACK_TRAILER;
+
+typedef struct PACK_STATS
+{
+    DWORD FilesFound;
+    DWORD FilesPacked;
+    DWORD FilesCopied;
+    DWORD FilesFailed;
+    DWORD FilesExtracted;
+    DWORD Containers;
+    ULONGLONG BytesPacked;
+    ULONGLONG BytesCopied;
+    ULONGLONG BytesExtracted;
+    ULONGLONG ElapsedMs;
+} PACK_STATS, *PPACK_STATS;
+
+BOOL PackFiles(LPCSTR sourceDir, CHAR driveLetter, LPCSTR targetDir, ULONGLONG containerSize, PCATALOG catalog, PPACK_STATS stats);
+BOOL PackExtract(CHAR driveLetter, PCATALOG catalog, PRECALL_ITEM items, DWORD itemCount, LPCSTR outputDir, PPACK_STATS stats);
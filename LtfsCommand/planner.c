@@ -0,0 +1,592 @@
+/*
+ *   File:   planner.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "planner.h"
+#include "mapping.h"
+#include "tape.h"
+#include "inventory.h"
+#include "media.h"
+#include "lock.h"
+
+typedef struct PLANNER_WORKER
+{
+    PRECALL_PLAN Plan;
+    PPLANNER_DRIVE Drive;
+    LPCSTR OutputDir;
+    BOOL Protect;
+    PCRITICAL_SECTION ConsoleLock;
+} PLANNER_WORKER, *PPLANNER_WORKER;
+
+static BOOL PlannerFindDrives(PRECALL_PLAN plan);
+static BOOL PlannerGroupItems(PRECALL_PLAN plan, PRECALL_ITEM items, DWORD itemCount);
+static BOOL PlannerAssignCartridges(PRECALL_PLAN plan);
+static int PlannerCompareCartridges(void *context, const void *a, const void *b);
+static DWORD WINAPI PlannerDriveWorker(LPVOID param);
+static PLTFS_INDEX PlannerWaitForCartridge(PPLANNER_WORKER worker, PPLANNER_CARTRIDGE cartridge, PHANDLE driveLock);
+static void PlannerDescribeCartridge(PRECALL_PLAN plan, PPLANNER_CARTRIDGE cartridge, LPSTR buffer, size_t len);
+
+BOOL PlannerCreate(PCATALOG catalog, PRECALL_ITEM items, DWORD itemCount, PRECALL_PLAN *plan)
+{
+    PRECALL_PLAN newPlan;
+    BOOL result;
+
+    newPlan = (PRECALL_PLAN)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(RECALL_PLAN));
+
+    if (!newPlan)
+        return FALSE;
+
+    newPlan->Catalog = catalog;
+
+    result = PlannerFindDrives(newPlan);
+
+    if (result)
+        result = PlannerGroupItems(newPlan, items, itemCount);
+
+    if (result)
+        result = PlannerAssignCartridges(newPlan);
+
+    if (!result)
+    {
+        PlannerDestroy(newPlan);
+        return FALSE;
+    }
+
+    *plan = newPlan;
+    return TRUE;
+}
+
+void PlannerPrint(PRECALL_PLAN plan)
+{
+    CHAR description[128];
+    DWORD i, j;
+
+    printf("\r\nRecall plan: %u cartridge(s) across %u drive(s)\r\n", plan->CartridgeCount, plan->DriveCount);
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        PPLANNER_DRIVE drive = &plan->Drives[i];
+
+        printf("\r\n%s (%s) %llu MB\r\n", drive->Target, drive->DeviceName, drive->PlannedBytes / 1000000);
+
+        for (j = 0; j < drive->CartridgeCount; j++)
+        {
+            PPLANNER_CARTRIDGE cartridge = &plan->Cartridges[drive->Cartridges[j]];
+
+            PlannerDescribeCartridge(plan, cartridge, description, _countof(description));
+            printf("    %u. %s - %u file(s), %llu MB\r\n", j + 1, description, cartridge->ItemCount, cartridge->Bytes / 1000000);
+        }
+    }
+
+    if (plan->FilesUncatalogued)
+        printf("\r\n%u file(s) not found in the catalog will be skipped.\r\n", plan->FilesUncatalogued);
+}
+
+BOOL PlannerRun(PRECALL_PLAN plan, LPCSTR outputDir, BOOL protect, PRECALL_STATS stats)
+{
+    CRITICAL_SECTION consoleLock;
+    PPLANNER_WORKER workers;
+    HANDLE *threads;
+    ULONGLONG startTime = GetTickCount64();
+    DWORD threadCount = 0;
+    BOOL result;
+    DWORD i;
+
+    memset(stats, 0, sizeof(RECALL_STATS));
+
+    workers = (PPLANNER_WORKER)LocalAlloc(LMEM_FIXED, sizeof(PLANNER_WORKER) * plan->DriveCount);
+    threads = (HANDLE *)LocalAlloc(LMEM_FIXED, sizeof(HANDLE) * plan->DriveCount);
+
+    result = workers && threads;
+
+    if (result)
+    {
+        InitializeCriticalSection(&consoleLock);
+
+        // One worker per drive, each working through its own list. Cartridges were handed out largest first,
+        // so every drive starts on a long read and the operator (or library) has time to stage the rest.
+        for (i = 0; i < plan->DriveCount; i++)
+        {
+            if (!plan->Drives[i].CartridgeCount)
+                continue;
+
+            workers[threadCount].Plan = plan;
+            workers[threadCount].Drive = &plan->Drives[i];
+            workers[threadCount].OutputDir = outputDir;
+            workers[threadCount].Protect = protect;
+            workers[threadCount].ConsoleLock = &consoleLock;
+
+            threads[threadCount] = CreateThread(NULL, 0, PlannerDriveWorker, &workers[threadCount], 0, NULL);
+
+            if (!threads[threadCount])
+            {
+                result = FALSE;
+                break;
+            }
+
+            threadCount++;
+        }
+
+        for (i = 0; i < threadCount; i++)
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+
+        DeleteCriticalSection(&consoleLock);
+    }
+
+    stats->FilesUnplaced = plan->FilesUncatalogued;
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        PRECALL_STATS driveStats = &plan->Drives[i].Stats;
+
+        stats->FilesRequested += driveStats->FilesRequested;
+        stats->FilesRecalled += driveStats->FilesRecalled;
+        stats->FilesFailed += driveStats->FilesFailed;
+        stats->FilesUnplaced += driveStats->FilesUnplaced;
+        stats->BytesRecalled += driveStats->BytesRecalled;
+    }
+
+    stats->FilesRequested += plan->FilesUncatalogued;
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    if (threads)
+        LocalFree(threads);
+
+    if (workers)
+        LocalFree(workers);
+
+    return result && !stats->FilesFailed;
+}
+
+void PlannerDestroy(PRECALL_PLAN plan)
+{
+    DWORD i;
+
+    if (!plan)
+        return;
+
+    for (i = 0; i < plan->CartridgeCount; i++)
+    {
+        if (plan->Cartridges[i].Items)
+            LocalFree(plan->Cartridges[i].Items);
+    }
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        if (plan->Drives[i].Cartridges)
+            LocalFree(plan->Drives[i].Cartridges);
+    }
+
+    if (plan->Cartridges)
+        LocalFree(plan->Cartridges);
+
+    if (plan->Drives)
+        LocalFree(plan->Drives);
+
+    LocalFree(plan);
+}
+
+static BOOL PlannerFindDrives(PRECALL_PLAN plan)
+{
+    PTAPE_DRIVE driveList;
+    PTAPE_DRIVE drive;
+    PMAPPING_TABLE table;
+    DWORD numDrivesFound;
+
+    if (!InventoryGetDriveList(&driveList, &numDrivesFound, FALSE))
+    {
+        fprintf(stderr, "\r\nNo tape drives found.\r\n");
+        return FALSE;
+    }
+
+    // One per attached drive at most, however many mappings it has.
+    plan->Drives = (PPLANNER_DRIVE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(PLANNER_DRIVE) * max(numDrivesFound, 1));
+
+    if (!plan->Drives || !MappingTableLoad(&table))
+    {
+        TapeDestroyDriveList(driveList);
+        return FALSE;
+    }
+
+    // Only drives that are both mapped and attached right now. Match on serial, as remap does, so a stale
+    // device name in the registry doesn't send us to the wrong drive. Recall goes straight to the drive, so a mapping on
+    // a directory does as well as one on a letter.
+    for (drive = driveList; drive != NULL; drive = drive->Next)
+    {
+        PLTFS_MAPPING mapping;
+        CHAR devName[MAX_DEVICE_NAME];
+
+        _snprintf_s(devName, _countof(devName), _TRUNCATE, "TAPE%d", drive->DevIndex);
+
+        mapping = MappingFindBySerial(table, drive->SerialNumber);
+
+        // Unmapped drives were never candidates, so there's nothing to say about them.
+        if (!mapping)
+            continue;
+
+        // One LTFS has mounted isn't free. Sending it commands from here would pull the tape out from under it.
+        if (TapeIsBusy(devName))
+        {
+            printf("%s (%s) is in use, leaving it out.\r\n", mapping->Target, devName);
+            continue;
+        }
+
+        if (plan->DriveCount < numDrivesFound)
+        {
+            PPLANNER_DRIVE plannerDrive = &plan->Drives[plan->DriveCount++];
+
+            strcpy_s(plannerDrive->Target, _countof(plannerDrive->Target), mapping->Target);
+            strcpy_s(plannerDrive->DeviceName, _countof(plannerDrive->DeviceName), devName);
+        }
+    }
+
+    MappingTableDestroy(table);
+    TapeDestroyDriveList(driveList);
+
+    if (!plan->DriveCount)
+    {
+        fprintf(stderr, "\r\nNo mapped tape drives are attached and free.\r\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static BOOL PlannerGroupItems(PRECALL_PLAN plan, PRECALL_ITEM items, DWORD itemCount)
+{
+    PCATALOG catalog = plan->Catalog;
+    PDWORD volumeCartridge;
+    PCATALOG_ENTRY *entries;
+    BOOL result;
+    DWORD i;
+
+    volumeCartridge = (PDWORD)LocalAlloc(LMEM_FIXED, sizeof(DWORD) * (catalog->VolumeCount + 1));
+    entries = (PCATALOG_ENTRY *)LocalAlloc(LMEM_FIXED, sizeof(PCATALOG_ENTRY) * (itemCount + 1));
+    plan->Cartridges = (PPLANNER_CARTRIDGE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(PLANNER_CARTRIDGE) * (catalog->VolumeCount + 1));
+
+    result = volumeCartridge && entries && plan->Cartridges;
+
+    if (result)
+    {
+        for (i = 0; i < catalog->VolumeCount; i++)
+            volumeCartridge[i] = MAXDWORD;
+
+        // First pass finds each file and counts how many land on each cartridge.
+        for (i = 0; i < itemCount; i++)
+        {
+            PPLANNER_CARTRIDGE cartridge;
+
+            entries[i] = CatalogFindFile(catalog, items[i].Path);
+
+            if (!entries[i])
+            {
+                fprintf(stderr, "Not in catalog: %s\r\n", items[i].Path);
+                plan->FilesUncatalogued++;
+                continue;
+            }
+
+            if (volumeCartridge[entries[i]->Volume] == MAXDWORD)
+            {
+                volumeCartridge[entries[i]->Volume] = plan->CartridgeCount;
+                plan->Cartridges[plan->CartridgeCount++].Volume = entries[i]->Volume;
+            }
+
+            cartridge = &plan->Cartridges[volumeCartridge[entries[i]->Volume]];
+            cartridge->ItemCount++;
+            cartridge->Bytes += entries[i]->Length;
+        }
+
+        for (i = 0; result && i < plan->CartridgeCount; i++)
+        {
+            plan->Cartridges[i].Items = (PRECALL_ITEM)LocalAlloc(LMEM_FIXED, sizeof(RECALL_ITEM) * plan->Cartridges[i].ItemCount);
+            result = plan->Cartridges[i].Items != NULL;
+            plan->Cartridges[i].ItemCount = 0;
+        }
+    }
+
+    if (result)
+    {
+        // Second pass fills them in. Items are copied, but the paths still belong to the caller's list.
+        for (i = 0; i < itemCount; i++)
+        {
+            PPLANNER_CARTRIDGE cartridge;
+
+            if (!entries[i])
+                continue;
+
+            cartridge = &plan->Cartridges[volumeCartridge[entries[i]->Volume]];
+            cartridge->Items[cartridge->ItemCount++] = items[i];
+        }
+    }
+
+    if (entries)
+        LocalFree(entries);
+
+    if (volumeCartridge)
+        LocalFree(volumeCartridge);
+
+    return result;
+}
+
+static BOOL PlannerAssignCartridges(PRECALL_PLAN plan)
+{
+    PDWORD order;
+    DWORD i, j;
+
+    order = (PDWORD)LocalAlloc(LMEM_FIXED, sizeof(DWORD) * (plan->CartridgeCount + 1));
+
+    if (!order)
+        return FALSE;
+
+    for (i = 0; i < plan->DriveCount; i++)
+    {
+        plan->Drives[i].Cartridges = (PDWORD)LocalAlloc(LMEM_FIXED, sizeof(DWORD) * (plan->CartridgeCount + 1));
+
+        if (!plan->Drives[i].Cartridges)
+        {
+            LocalFree(order);
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < plan->CartridgeCount; i++)
+        order[i] = i;
+
+    // Longest processing time first: biggest cartridge goes to whichever drive has the least work so far.
+    // Reading dominates, so bytes are a good enough stand in for time.
+    qsort_s(order, plan->CartridgeCount, sizeof(DWORD), PlannerCompareCartridges, plan);
+
+    for (i = 0; i < plan->CartridgeCount; i++)
+    {
+        PPLANNER_CARTRIDGE cartridge = &plan->Cartridges[order[i]];
+        PPLANNER_DRIVE drive = &plan->Drives[0];
+
+        for (j = 1; j < plan->DriveCount; j++)
+        {
+            if (plan->Drives[j].PlannedBytes < drive->PlannedBytes)
+                drive = &plan->Drives[j];
+        }
+
+        cartridge->Drive = (DWORD)(drive - plan->Drives);
+        drive->Cartridges[drive->CartridgeCount++] = order[i];
+        drive->PlannedBytes += cartridge->Bytes;
+    }
+
+    LocalFree(order);
+
+    return TRUE;
+}
+
+static int PlannerCompareCartridges(void *context, const void *a, const void *b)
+{
+    PRECALL_PLAN plan = (PRECALL_PLAN)context;
+    ULONGLONG bytesA = plan->Cartridges[*(const DWORD *)a].Bytes;
+    ULONGLONG bytesB = plan->Cartridges[*(const DWORD *)b].Bytes;
+
+    return bytesA > bytesB ? -1 : (bytesA < bytesB ? 1 : 0);
+}
+
+static DWORD WINAPI PlannerDriveWorker(LPVOID param)
+{
+    PPLANNER_WORKER worker = (PPLANNER_WORKER)param;
+    PPLANNER_DRIVE drive = worker->Drive;
+    CHAR description[128];
+    DWORD i;
+
+    for (i = 0; i < drive->CartridgeCount; i++)
+    {
+        PPLANNER_CARTRIDGE cartridge = &worker->Plan->Cartridges[drive->Cartridges[i]];
+        PLTFS_INDEX index;
+        RECALL_STATS stats;
+        HANDLE handle;
+        HANDLE driveLock;
+
+        PlannerDescribeCartridge(worker->Plan, cartridge, description, _countof(description));
+
+        index = PlannerWaitForCartridge(worker, cartridge, &driveLock);
+
+        if (!index)
+        {
+            EnterCriticalSection(worker->ConsoleLock);
+            fprintf(stderr, "%s gave up waiting for %s, %u file(s) not recalled.\r\n", drive->Target, description, cartridge->ItemCount);
+            LeaveCriticalSection(worker->ConsoleLock);
+
+            drive->Stats.FilesRequested += cartridge->ItemCount;
+            drive->Stats.FilesFailed += cartridge->ItemCount;
+            continue;
+        }
+
+        EnterCriticalSection(worker->ConsoleLock);
+        printf("%s recalling %u file(s) from %s\r\n", drive->Target, cartridge->ItemCount, description);
+        LeaveCriticalSection(worker->ConsoleLock);
+
+        RecallRaw(drive->DeviceName, cartridge->Items, cartridge->ItemCount, index, NULL, worker->OutputDir, worker->Protect, &stats);
+
+        LtfsIndexDestroy(index);
+
+        drive->Stats.FilesRequested += stats.FilesRequested;
+        drive->Stats.FilesRecalled += stats.FilesRecalled;
+        drive->Stats.FilesFailed += stats.FilesFailed;
+        drive->Stats.FilesUnplaced += stats.FilesUnplaced;
+        drive->Stats.BytesRecalled += stats.BytesRecalled;
+        drive->ReadingMs += stats.ElapsedMs;
+
+        EnterCriticalSection(worker->ConsoleLock);
+        printf("%s finished %s, %u of %u file(s), %.1f MB/s\r\n", drive->Target, description, stats.FilesRecalled, stats.FilesRequested,
+            stats.ElapsedMs ? (double)stats.BytesRecalled / 1000.0 / (double)stats.ElapsedMs : 0.0);
+        LeaveCriticalSection(worker->ConsoleLock);
+
+        // Free the drive for the next cartridge straight away.
+        handle = TapeOpen(drive->DeviceName);
+
+        if (handle != INVALID_HANDLE_VALUE)
+        {
+            TapeUnload(handle);
+            CloseHandle(handle);
+            MediaInvalidate(drive->Target);
+        }
+
+        LockRelease(driveLock);
+    }
+
+    return 0;
+}
+
+// Comes back holding the drive when it has the right cartridge, and the caller lets go once it's been unloaded.
+// Between polls the drive is free for anything else that wants it, such as loading the next cartridge.
+
+static PLTFS_INDEX PlannerWaitForCartridge(PPLANNER_WORKER worker, PPLANNER_CARTRIDGE cartridge, PHANDLE driveLock)
+{
+    PPLANNER_DRIVE drive = worker->Drive;
+    PCATALOG_VOLUME volume = &worker->Plan->Catalog->Volumes[cartridge->Volume];
+    ULONGLONG startTime = GetTickCount64();
+    CHAR description[128];
+    BOOL prompted = FALSE;
+    BOOL warnedBusy = FALSE;
+
+    PlannerDescribeCartridge(worker->Plan, cartridge, description, _countof(description));
+
+    while (GetTickCount64() - startTime < PLANNER_LOAD_TIMEOUT)
+    {
+        HANDLE handle;
+        PLTFS_INDEX index = NULL;
+        BOOL wrongCartridge = FALSE;
+
+        if (!LockDrive(drive->Target, driveLock))
+            continue;
+
+        // Someone may have mounted it while we waited. Leave it be until they're done, rather than reading
+        // or unloading the tape under LTFS.
+        if (TapeIsBusy(drive->DeviceName))
+        {
+            LockRelease(*driveLock);
+
+            if (!warnedBusy)
+            {
+                EnterCriticalSection(worker->ConsoleLock);
+                fprintf(stderr, "%s %s is in use, waiting for it to be unmounted.\r\n", drive->Target, drive->DeviceName);
+                LeaveCriticalSection(worker->ConsoleLock);
+
+                warnedBusy = TRUE;
+            }
+
+            Sleep(PLANNER_POLL_INTERVAL);
+            continue;
+        }
+
+        warnedBusy = FALSE;
+        handle = TapeOpen(drive->DeviceName);
+
+        if (handle != INVALID_HANDLE_VALUE && TapeTestUnitReady(handle, NULL))
+        {
+            CHAR barcode[TAPE_MAM_BARCODE_LEN + 1];
+            USHORT barcodeLength = 0;
+
+            // The barcode is a cheap way to spot the wrong cartridge without reading an index.
+            if (volume->Barcode[0] && TapeReadAttribute(handle, 0, TAPE_MAM_BARCODE, (PBYTE)barcode, TAPE_MAM_BARCODE_LEN, &barcodeLength))
+            {
+                // MAM text attributes are padded out with spaces.
+                while (barcodeLength > 0 && barcode[barcodeLength - 1] == ' ')
+                    barcodeLength--;
+
+                barcode[barcodeLength] = '\0';
+
+                wrongCartridge = barcode[0] && _stricmp(barcode, volume->Barcode) != 0;
+            }
+
+            if (!wrongCartridge)
+            {
+                if (LtfsIndexReadFromTape(handle, &index))
+                {
+                    wrongCartridge = _stricmp(index->VolumeUuid, volume->Uuid) != 0;
+
+                    if (wrongCartridge)
+                    {
+                        LtfsIndexDestroy(index);
+                        index = NULL;
+                    }
+                }
+            }
+
+            if (wrongCartridge)
+            {
+                EnterCriticalSection(worker->ConsoleLock);
+                fprintf(stderr, "%s wrong cartridge loaded, expected %s. Unloading.\r\n", drive->Target, description);
+                LeaveCriticalSection(worker->ConsoleLock);
+
+                TapeUnload(handle);
+                MediaInvalidate(drive->Target);
+                prompted = FALSE;
+            }
+        }
+
+        if (handle != INVALID_HANDLE_VALUE)
+            CloseHandle(handle);
+
+        if (index)
+            return index;
+
+        LockRelease(*driveLock);
+
+        if (!prompted)
+        {
+            EnterCriticalSection(worker->ConsoleLock);
+            printf("%s please load %s into %s\r\n", drive->Target, description, drive->DeviceName);
+            LeaveCriticalSection(worker->ConsoleLock);
+
+            prompted = TRUE;
+        }
+
+        Sleep(PLANNER_POLL_INTERVAL);
+    }
+
+    return NULL;
+}
+
+static void PlannerDescribeCartridge(PRECALL_PLAN plan, PPLANNER_CARTRIDGE cartridge, LPSTR buffer, size_t len)
+{
+    PCATALOG_VOLUME volume = &plan->Catalog->Volumes[cartridge->Volume];
+
+    if (volume->Barcode[0])
+        _snprintf_s(buffer, len, _TRUNCATE, "%s [%s]", volume->Barcode, volume->Uuid);
+    else
+        _snprintf_s(buffer, len, _TRUNCATE, "[%s]", volume->Uuid);
+}
@@ -0,0 +1,62 @@
+/*
+ *   File:   planner.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "catalog.h"
+#include "recall.h"
+#include "ltfsreg.h"
+
+#define PLANNER_POLL_INTERVAL   5000
+#define PLANNER_LOAD_TIMEOUT    (60 * 60 * 1000)
+
+typedef struct PLANNER_CARTRIDGE
+{
+    DWORD Volume;
+    PRECALL_ITEM Items;
+    DWORD ItemCount;
+    ULONGLONG Bytes;
+    DWORD Drive;
+} PLANNER_CARTRIDGE, *PPLANNER_CARTRIDGE;
+
+typedef struct PLANNER_DRIVE
+{
+    CHAR Target[MAX_MOUNT_TARGET];
+    CHAR DeviceName[MAX_DEVICE_NAME];
+    ULONGLONG PlannedBytes;
+    DWORD CartridgeCount;
+    PDWORD Cartridges;
+    RECALL_STATS Stats;
+    ULONGLONG ReadingMs;
+} PLANNER_DRIVE, *PPLANNER_DRIVE;
+
+typedef struct RECALL_PLAN
+{
+    PCATALOG Catalog;
+    DWORD DriveCount;
+    PPLANNER_DRIVE Drives;
+    DWORD CartridgeCount;
+    PPLANNER_CARTRIDGE Cartridges;
+    DWORD FilesUncatalogued;
+} RECALL_PLAN, *PRECALL_PLAN;
+
+BOOL PlannerCreate(PCATALOG catalog, PRECALL_ITEM items, DWORD itemCount, PRECALL_PLAN *plan);
+void PlannerPrint(PRECALL_PLAN plan);
+BOOL PlannerRun(PRECALL_PLAN plan, LPCSTR outputDir, BOOL protect, PRECALL_STATS stats);
+void PlannerDestroy(PRECALL_PLAN plan);
@@ -0,0 +1,1054 @@
+/*
+ *   File:   recall.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "recall.h"
+#include "image.h"
+#include "layout.h"
+#include "ring.h"
+#include "seekmodel.h"
+#include "util.h"
+#include "tape.h"
+
+#define UNPLACED_PARTITION          0xFF
+#define RECALL_SCHEDULE_MAX_EXTENTS 4096
+#define RECALL_ASSUMED_BLOCK_SIZE   (512 * 1024)
+
+typedef struct VOLUME_READER
+{
+    CHAR DriveLetter;
+    PRECALL_ITEM Items;
+    DWORD ItemCount;
+    PBUFFER_RING Ring;
+} VOLUME_READER, *PVOLUME_READER;
+
+typedef struct RAW_EXTENT
+{
+    DWORD Item;
+    LTFS_EXTENT Extent;
+    ULONGLONG BlockCount;   // Off a layout map, where only the blocks are known, read this many instead of a byte count
+} RAW_EXTENT, *PRAW_EXTENT;
+
+typedef struct RAW_READER
+{
+    HANDLE Handle;
+    PTAPE_IMAGE Image;      // Read from here instead of the tape when set
+    PRAW_EXTENT Extents;
+    DWORD ExtentCount;
+    BOOL Protect;
+    PBUFFER_RING Ring;
+} RAW_READER, *PRAW_READER;
+
+static void RecallPlaceItems(CHAR driveLetter, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PRECALL_STATS stats);
+static int RecallCompareItems(const void *a, const void *b);
+static DWORD WINAPI RecallVolumeReader(LPVOID param);
+static BOOL RecallBuildExtents(PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PLTFS_FILE *files, PRAW_EXTENT *extents, PDWORD extentCount, PRECALL_STATS stats);
+static BOOL RecallMapExtents(PRECALL_ITEM items, DWORD itemCount, PTAPE_LAYOUT layout, PRAW_EXTENT *extents, PDWORD extentCount, PRECALL_STATS stats);
+static int RecallCompareExtents(const void *a, const void *b);
+static void RecallScheduleExtents(LPCSTR tapeDrive, PRAW_EXTENT extents, DWORD extentCount);
+static ULONGLONG RecallExtentEnd(PRAW_EXTENT extent);
+static BOOL RecallRawExtract(PRAW_READER reader, LPCSTR tapeDrive, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PTAPE_LAYOUT layout, LPCSTR outputDir, PRECALL_STATS stats);
+static DWORD WINAPI RecallRawReader(LPVOID param);
+static BOOL RecallFinishFile(HANDLE output, PRECALL_ITEM item, PLTFS_FILE file, LPCSTR outputPath, PRECALL_STATS stats);
+
+BOOL RecallReadFileList(LPCSTR listFile, PRECALL_ITEM *items, PDWORD itemCount)
+{
+    FILE *file;
+    CHAR line[MAX_PATH * 4];
+    PRECALL_ITEM list = NULL;
+    DWORD count = 0;
+    DWORD capacity = 0;
+
+    if (fopen_s(&file, listFile, "r") != 0)
+        return FALSE;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        size_t length = strcspn(line, "\r\n");
+        line[length] = '\0';
+
+        if (length == 0)
+            continue;
+
+        if (count == capacity)
+        {
+            DWORD newCapacity = capacity ? capacity * 2 : 256;
+            PRECALL_ITEM newList = (PRECALL_ITEM)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(RECALL_ITEM) * newCapacity);
+
+            if (!newList)
+            {
+                RecallDestroyFileList(list, count);
+                fclose(file);
+                return FALSE;
+            }
+
+            if (list)
+            {
+                memcpy(newList, list, sizeof(RECALL_ITEM) * count);
+                LocalFree(list);
+            }
+
+            list = newList;
+            capacity = newCapacity;
+        }
+
+        // Paths are kept relative to the volume root so they can be used on both sides of the copy.
+        LPCSTR relative = line;
+
+        if (isalpha(relative[0]) && relative[1] == ':')
+            relative += 2;
+
+        while (*relative == '\\' || *relative == '/')
+            relative++;
+
+        list[count].Path = (LPSTR)LocalAlloc(LMEM_FIXED, strlen(relative) + 1);
+
+        if (!list[count].Path)
+        {
+            RecallDestroyFileList(list, count);
+            fclose(file);
+            return FALSE;
+        }
+
+        strcpy_s(list[count].Path, strlen(relative) + 1, relative);
+        list[count].Order = count;
+        count++;
+    }
+
+    fclose(file);
+
+    *items = list;
+    *itemCount = count;
+
+    return count > 0;
+}
+
+void RecallDestroyFileList(PRECALL_ITEM items, DWORD itemCount)
+{
+    DWORD i;
+
+    if (!items)
+        return;
+
+    for (i = 0; i < itemCount; i++)
+    {
+        if (items[i].Path)
+            LocalFree(items[i].Path);
+    }
+
+    LocalFree(items);
+}
+
+void RecallOrderItems(CHAR driveLetter, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PRECALL_STATS stats)
+{
+    RecallPlaceItems(driveLetter, items, itemCount, index, stats);
+
+    // Logical blocks are laid down along the serpentine, so ascending block order within a partition is a single forward
+    // pass over the wraps. Files we couldn't place sort to the end and are read in list order.
+    qsort(items, itemCount, sizeof(RECALL_ITEM), RecallCompareItems);
+}
+
+BOOL RecallFromVolume(CHAR driveLetter, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, LPCSTR outputDir, PRECALL_STATS stats)
+{
+    BUFFER_RING ring;
+    VOLUME_READER reader;
+    HANDLE readerThread;
+    HANDLE output = INVALID_HANDLE_VALUE;
+    CHAR outputPath[MAX_PATH];
+    ULONGLONG startTime = GetTickCount64();
+
+    memset(stats, 0, sizeof(RECALL_STATS));
+    stats->FilesRequested = itemCount;
+
+    RecallOrderItems(driveLetter, items, itemCount, index, stats);
+
+    if (!RingCreate(&ring, RECALL_SLOT_COUNT, RECALL_SLOT_SIZE))
+        return FALSE;
+
+    reader.DriveLetter = driveLetter;
+    reader.Items = items;
+    reader.ItemCount = itemCount;
+    reader.Ring = &ring;
+
+    readerThread = CreateThread(NULL, 0, RecallVolumeReader, &reader, 0, NULL);
+
+    if (!readerThread)
+    {
+        RingDestroy(&ring);
+        return FALSE;
+    }
+
+    // The tape side runs ahead on its own thread, this one just drains the ring onto the destination disk.
+    for (;;)
+    {
+        PRING_SLOT slot = RingAcquireFull(&ring);
+        PRECALL_ITEM item;
+
+        if (!slot)
+            break;
+
+        if (slot->Flags & RING_SLOT_END)
+        {
+            RingRelease(&ring, slot);
+            break;
+        }
+
+        item = &items[slot->Item];
+
+        if (slot->Flags & RING_SLOT_FIRST)
+        {
+            output = RecallCreateOutputFile(outputDir, item->Path, outputPath, _countof(outputPath));
+
+            if (output == INVALID_HANDLE_VALUE)
+                item->Failed = TRUE;
+        }
+
+        if (slot->Flags & RING_SLOT_ERROR)
+            item->Failed = TRUE;
+
+        if (!item->Failed && slot->Length)
+        {
+            DWORD bytesWritten;
+
+            if (WriteFile(output, slot->Buffer, slot->Length, &bytesWritten, NULL) && bytesWritten == slot->Length)
+                stats->BytesRecalled += bytesWritten;
+            else
+                item->Failed = TRUE;
+        }
+
+        if (slot->Flags & RING_SLOT_LAST)
+        {
+            if (output != INVALID_HANDLE_VALUE)
+            {
+                CloseHandle(output);
+                output = INVALID_HANDLE_VALUE;
+
+                if (item->Failed)
+                    DeleteFile(outputPath);
+            }
+
+            if (item->Failed)
+            {
+                fprintf(stderr, "Failed to recall %s\r\n", item->Path);
+                stats->FilesFailed++;
+            }
+            else
+            {
+                stats->FilesRecalled++;
+            }
+        }
+
+        RingRelease(&ring, slot);
+    }
+
+    WaitForSingleObject(readerThread, INFINITE);
+    CloseHandle(readerThread);
+
+    if (output != INVALID_HANDLE_VALUE)
+        CloseHandle(output);
+
+    RingDestroy(&ring);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return stats->FilesFailed == 0;
+}
+
+BOOL RecallRaw(LPCSTR tapeDrive, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PTAPE_LAYOUT layout, LPCSTR outputDir, BOOL protect, PRECALL_STATS stats)
+{
+    HANDLE handle;
+    RAW_READER reader;
+    PLTFS_INDEX tapeIndex = NULL;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL protectionWasEnabled = FALSE;
+    BOOL result;
+
+    memset(stats, 0, sizeof(RECALL_STATS));
+    stats->FilesRequested = itemCount;
+
+    handle = TapeOpen(tapeDrive);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    // Before protection goes on, the index is read with plain READs that know nothing of CRCs on the end of blocks. A
+    // tape with a layout map isn't LTFS and has no index to read.
+    if (!index && !layout)
+    {
+        if (!LtfsIndexReadFromTape(handle, &tapeIndex))
+        {
+            fprintf(stderr, "Failed to read LTFS index from %s\r\n", tapeDrive);
+            CloseHandle(handle);
+            return FALSE;
+        }
+
+        index = tapeIndex;
+    }
+
+    if (protect && !TapeSetProtection(handle, TRUE, &protectionWasEnabled))
+    {
+        fprintf(stderr, "Failed to enable logical block protection on %s\r\n", tapeDrive);
+        LtfsIndexDestroy(tapeIndex);
+        CloseHandle(handle);
+        return FALSE;
+    }
+
+    memset(&reader, 0, sizeof(reader));
+    reader.Handle = handle;
+    reader.Protect = protect;
+
+    result = RecallRawExtract(&reader, tapeDrive, items, itemCount, index, layout, outputDir, stats);
+
+    if (tapeIndex)
+        LtfsIndexDestroy(tapeIndex);
+
+    // Put it back how we found it, LTFS may not be expecting CRCs on the end of its blocks.
+    if (protect && !protectionWasEnabled)
+        TapeSetProtection(handle, FALSE, NULL);
+
+    CloseHandle(handle);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result;
+}
+
+// Same as off the tape, but every block is looked up in the image instead. There's nothing to wind, so no point
+// scheduling, and no drive to send CRCs.
+
+BOOL RecallRawFromImage(LPCSTR imageFile, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PTAPE_LAYOUT layout, LPCSTR outputDir, PRECALL_STATS stats)
+{
+    PTAPE_IMAGE image;
+    RAW_READER reader;
+    PLTFS_INDEX imageIndex = NULL;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL result;
+
+    memset(stats, 0, sizeof(RECALL_STATS));
+    stats->FilesRequested = itemCount;
+
+    if (!ImageOpen(imageFile, &image))
+        return FALSE;
+
+    if (!index && !layout)
+    {
+        if (!ImageReadIndex(image, &imageIndex))
+        {
+            fprintf(stderr, "Failed to read LTFS index from %s\r\n", imageFile);
+            ImageClose(image);
+            return FALSE;
+        }
+
+        index = imageIndex;
+    }
+
+    memset(&reader, 0, sizeof(reader));
+    reader.Handle = INVALID_HANDLE_VALUE;
+    reader.Image = image;
+
+    result = RecallRawExtract(&reader, NULL, items, itemCount, index, layout, outputDir, stats);
+
+    if (imageIndex)
+        LtfsIndexDestroy(imageIndex);
+
+    ImageClose(image);
+
+    stats->ElapsedMs = GetTickCount64() - startTime;
+
+    return result;
+}
+
+static void RecallPlaceItems(CHAR driveLetter, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PRECALL_STATS stats)
+{
+    DWORD i;
+
+    for (i = 0; i < itemCount; i++)
+    {
+        PRECALL_ITEM item = &items[i];
+        BOOL placed = FALSE;
+
+        item->Partition = UNPLACED_PARTITION;
+        item->StartBlock = MAXULONGLONG;
+
+        if (index)
+        {
+            PLTFS_FILE file = LtfsIndexFindFile(index, item->Path);
+
+            if (file && file->ExtentCount)
+            {
+                item->Partition = file->Extents[0].Partition;
+                item->StartBlock = file->Extents[0].StartBlock;
+                placed = TRUE;
+            }
+        }
+        else
+        {
+            CHAR sourcePath[MAX_PATH];
+            CHAR value[32];
+
+            _snprintf_s(sourcePath, _countof(sourcePath), _TRUNCATE, "%c:\\%s", driveLetter, item->Path);
+
+            if (ReadExtendedAttribute(sourcePath, "ltfs.startblock", value, sizeof(value)))
+            {
+                item->StartBlock = _strtoui64(value, NULL, 10);
+                item->Partition = 1;
+                placed = TRUE;
+
+                if (ReadExtendedAttribute(sourcePath, "ltfs.partition", value, sizeof(value)))
+                    item->Partition = (BYTE)(tolower(value[0]) - 'a');
+            }
+        }
+
+        if (!placed)
+            stats->FilesUnplaced++;
+    }
+}
+
+static int RecallCompareItems(const void *a, const void *b)
+{
+    const RECALL_ITEM *itemA = (const RECALL_ITEM *)a;
+    const RECALL_ITEM *itemB = (const RECALL_ITEM *)b;
+
+    if (itemA->Partition != itemB->Partition)
+        return itemA->Partition < itemB->Partition ? -1 : 1;
+
+    if (itemA->StartBlock != itemB->StartBlock)
+        return itemA->StartBlock < itemB->StartBlock ? -1 : 1;
+
+    // qsort isn't stable, so fall back to list order.
+    return itemA->Order < itemB->Order ? -1 : (itemA->Order > itemB->Order ? 1 : 0);
+}
+
+static DWORD WINAPI RecallVolumeReader(LPVOID param)
+{
+    PVOLUME_READER reader = (PVOLUME_READER)param;
+    DWORD i;
+
+    for (i = 0; i < reader->ItemCount; i++)
+    {
+        CHAR sourcePath[MAX_PATH];
+        LARGE_INTEGER fileSize;
+        ULONGLONG offset = 0;
+        HANDLE handle;
+        PRING_SLOT slot;
+        BOOL last = FALSE;
+
+        _snprintf_s(sourcePath, _countof(sourcePath), _TRUNCATE, "%c:\\%s", reader->DriveLetter, reader->Items[i].Path);
+
+        handle = CreateFile(sourcePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+        if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &fileSize))
+        {
+            if (handle != INVALID_HANDLE_VALUE)
+                CloseHandle(handle);
+
+            slot = RingAcquireFree(reader->Ring);
+
+            if (!slot)
+                return 1;
+
+            slot->Item = i;
+            slot->Flags = RING_SLOT_FIRST | RING_SLOT_LAST | RING_SLOT_ERROR;
+            RingCommit(reader->Ring, slot);
+            continue;
+        }
+
+        do
+        {
+            DWORD bytesRead = 0;
+            BOOL result;
+
+            slot = RingAcquireFree(reader->Ring);
+
+            if (!slot)
+            {
+                CloseHandle(handle);
+                return 1;
+            }
+
+            result = ReadFile(handle, slot->Buffer, reader->Ring->SlotSize, &bytesRead, NULL);
+
+            slot->Item = i;
+            slot->Offset = offset;
+            slot->Length = result ? bytesRead : 0;
+            slot->Flags = offset == 0 ? RING_SLOT_FIRST : 0;
+
+            offset += slot->Length;
+            last = !result || bytesRead == 0 || offset >= (ULONGLONG)fileSize.QuadPart;
+
+            if (!result || (bytesRead == 0 && offset < (ULONGLONG)fileSize.QuadPart))
+                slot->Flags |= RING_SLOT_ERROR;
+
+            if (last)
+                slot->Flags |= RING_SLOT_LAST;
+
+            RingCommit(reader->Ring, slot);
+
+        } while (!last);
+
+        CloseHandle(handle);
+    }
+
+    RingSubmitEnd(reader->Ring);
+
+    return 0;
+}
+
+static BOOL RecallBuildExtents(PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PLTFS_FILE *files, PRAW_EXTENT *extents, PDWORD extentCount, PRECALL_STATS stats)
+{
+    PRAW_EXTENT list;
+    DWORD count = 0;
+    DWORD i, j;
+
+    for (i = 0; i < itemCount; i++)
+    {
+        files[i] = LtfsIndexFindFile(index, items[i].Path);
+
+        if (!files[i])
+        {
+            fprintf(stderr, "%s not found in index\r\n", items[i].Path);
+            items[i].Failed = TRUE;
+            stats->FilesUnplaced++;
+            stats->FilesFailed++;
+            continue;
+        }
+
+        count += files[i]->ExtentCount;
+    }
+
+    list = (PRAW_EXTENT)LocalAlloc(LMEM_FIXED, sizeof(RAW_EXTENT) * (count ? count : 1));
+
+    if (!list)
+        return FALSE;
+
+    count = 0;
+
+    for (i = 0; i < itemCount; i++)
+    {
+        if (!files[i])
+            continue;
+
+        for (j = 0; j < files[i]->ExtentCount; j++)
+        {
+            list[count].Item = i;
+            list[count].Extent = files[i]->Extents[j];
+            count++;
+        }
+    }
+
+    // Every extent of every file in one pass, in tape order. A file split across the tape is put back together by offset.
+    qsort(list, count, sizeof(RAW_EXTENT), RecallCompareExtents);
+
+    *extents = list;
+    *extentCount = count;
+
+    return TRUE;
+}
+
+// Without an index, files are named by where they are: partition/file, counting tape files (runs of blocks between
+// filemarks) from 0 in each partition. Each is one extent, read block by block from the start the map gives.
+
+static BOOL RecallMapExtents(PRECALL_ITEM items, DWORD itemCount, PTAPE_LAYOUT layout, PRAW_EXTENT *extents, PDWORD extentCount, PRECALL_STATS stats)
+{
+    PRAW_EXTENT list;
+    DWORD count = 0;
+    DWORD i;
+
+    list = (PRAW_EXTENT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(RAW_EXTENT) * (itemCount ? itemCount : 1));
+
+    if (!list)
+        return FALSE;
+
+    for (i = 0; i < itemCount; i++)
+    {
+        PLAYOUT_FILE layoutFile;
+        DWORD partition, fileNumber;
+        CHAR extra;
+
+        if (sscanf_s(items[i].Path, "%u/%u%c", &partition, &fileNumber, &extra, 1) != 2 ||
+            partition >= layout->PartitionCount || fileNumber >= layout->Partitions[partition].FileCount)
+        {
+            fprintf(stderr, "%s not found in map\r\n", items[i].Path);
+            items[i].Failed = TRUE;
+            stats->FilesUnplaced++;
+            stats->FilesFailed++;
+            continue;
+        }
+
+        layoutFile = &layout->Files[layout->Partitions[partition].FirstFile + fileNumber];
+
+        // Two filemarks in a row, nothing to read.
+        if (!layoutFile->BlockCount)
+            continue;
+
+        list[count].Item = i;
+        list[count].Extent.Partition = (BYTE)partition;
+        list[count].Extent.StartBlock = layoutFile->FirstBlock;
+        list[count].Extent.ByteCount = MAXULONGLONG;     // All of it, however much that turns out to be
+        list[count].BlockCount = layoutFile->BlockCount;
+        count++;
+    }
+
+    qsort(list, count, sizeof(RAW_EXTENT), RecallCompareExtents);
+
+    *extents = list;
+    *extentCount = count;
+
+    return TRUE;
+}
+
+static int RecallCompareExtents(const void *a, const void *b)
+{
+    const RAW_EXTENT *extentA = (const RAW_EXTENT *)a;
+    const RAW_EXTENT *extentB = (const RAW_EXTENT *)b;
+
+    if (extentA->Extent.Partition != extentB->Extent.Partition)
+        return extentA->Extent.Partition < extentB->Extent.Partition ? -1 : 1;
+
+    if (extentA->Extent.StartBlock != extentB->Extent.StartBlock)
+        return extentA->Extent.StartBlock < extentB->Extent.StartBlock ? -1 : 1;
+
+    return 0;
+}
+
+// With a seek model calibrated for this drive, visit extents in whichever order costs the least positioning rather
+// than plain block order. On a serpentine tape the next extent along can be most of a wrap away while one on the next
+// wrap over is right by the head.
+
+static void RecallScheduleExtents(LPCSTR tapeDrive, PRAW_EXTENT extents, DWORD extentCount)
+{
+    CHAR devicePath[64];
+    TAPE_DRIVE drive;
+    SEEK_MODEL model;
+    PRAW_EXTENT scheduled;
+    PBOOL taken;
+    DWORD first, last, i, j;
+
+    _snprintf_s(devicePath, _countof(devicePath), _TRUNCATE, "\\\\.\\%s", tapeDrive);
+
+    // Not calibrated is the usual case, and block order is a fine answer then.
+    if (extentCount < 3 || !TapeDescribeDevice(devicePath, &drive) || !SeekModelLoad((LPCSTR)drive.ProductId, &model) || !model.BlocksPerWrap)
+        return;
+
+    scheduled = (PRAW_EXTENT)LocalAlloc(LMEM_FIXED, sizeof(RAW_EXTENT) * extentCount);
+    taken = (PBOOL)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(BOOL) * extentCount);
+
+    // The model only knows about one partition, so each partition's run of extents is scheduled on its own.
+    for (first = 0; scheduled && taken && first < extentCount; first = last)
+    {
+        ULONGLONG position = 0;
+        double sortedCost = 0.0;
+        double nearestCost = 0.0;
+
+        for (last = first; last < extentCount && extents[last].Extent.Partition == extents[first].Extent.Partition; last++)
+        {
+            sortedCost += SeekModelEstimate(&model, position, extents[last].Extent.StartBlock);
+            position = RecallExtentEnd(&extents[last]);
+        }
+
+        // Goes as the square of the count, and a list that long is most of the tape anyway.
+        if (last - first > RECALL_SCHEDULE_MAX_EXTENTS)
+            continue;
+
+        position = 0;
+
+        // Nearest first. Not optimal, but it finds the cheap hops across wraps that block order walks straight past.
+        for (i = first; i < last; i++)
+        {
+            DWORD nearest = MAXDWORD;
+            double cost = 0.0;
+
+            for (j = first; j < last; j++)
+            {
+                double estimate;
+
+                if (taken[j])
+                    continue;
+
+                estimate = SeekModelEstimate(&model, position, extents[j].Extent.StartBlock);
+
+                if (nearest == MAXDWORD || estimate < cost)
+                {
+                    nearest = j;
+                    cost = estimate;
+                }
+            }
+
+            taken[nearest] = TRUE;
+            scheduled[i] = extents[nearest];
+            nearestCost += cost;
+            position = RecallExtentEnd(&extents[nearest]);
+        }
+
+        // A long sequential run is hard to beat, so only take it when the model says it's cheaper.
+        if (nearestCost < sortedCost)
+            memcpy(&extents[first], &scheduled[first], sizeof(RAW_EXTENT) * (last - first));
+    }
+
+    if (scheduled)
+        LocalFree(scheduled);
+
+    if (taken)
+        LocalFree(taken);
+}
+
+// Where the head ends up after reading an extent. The index doesn't say what block size the volume was written with,
+// so this assumes the LTFS default. Near enough to cost the next locate. Off a layout map it's exact.
+
+static ULONGLONG RecallExtentEnd(PRAW_EXTENT extent)
+{
+    ULONGLONG bytes;
+
+    if (extent->BlockCount)
+        return extent->Extent.StartBlock + extent->BlockCount;
+
+    bytes = extent->Extent.ByteOffset + extent->Extent.ByteCount;
+
+    return extent->Extent.StartBlock + (bytes + RECALL_ASSUMED_BLOCK_SIZE - 1) / RECALL_ASSUMED_BLOCK_SIZE;
+}
+
+// Reads every extent of the wanted files through the reader, which comes with its source already set up, and writes
+// them out. Pass the tape drive to have the extents put in the order that's cheapest to seek.
+
+static BOOL RecallRawExtract(PRAW_READER reader, LPCSTR tapeDrive, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PTAPE_LAYOUT layout, LPCSTR outputDir, PRECALL_STATS stats)
+{
+    BUFFER_RING ring;
+    HANDLE readerThread;
+    PLTFS_FILE *files;
+    HANDLE *outputs;
+    PDWORD extentsLeft;
+    PRAW_EXTENT extents = NULL;
+    DWORD extentCount = 0;
+    CHAR outputPath[MAX_PATH];
+    BOOL result;
+    DWORD i;
+
+    files = (PLTFS_FILE *)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(PLTFS_FILE) * itemCount);
+    outputs = (HANDLE *)LocalAlloc(LMEM_FIXED, sizeof(HANDLE) * itemCount);
+    extentsLeft = (PDWORD)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(DWORD) * itemCount);
+
+    result = files && outputs && extentsLeft;
+
+    if (result)
+    {
+        for (i = 0; i < itemCount; i++)
+            outputs[i] = INVALID_HANDLE_VALUE;
+
+        if (layout)
+            result = RecallMapExtents(items, itemCount, layout, &extents, &extentCount, stats);
+        else
+            result = RecallBuildExtents(items, itemCount, index, files, &extents, &extentCount, stats);
+    }
+
+    if (result && tapeDrive)
+        RecallScheduleExtents(tapeDrive, extents, extentCount);
+
+    if (result)
+    {
+        for (i = 0; i < extentCount; i++)
+            extentsLeft[extents[i].Item]++;
+
+        for (i = 0; i < itemCount; i++)
+        {
+            // Empty (or entirely sparse) files never come off tape, so finish them now. Anything not found has already
+            // been counted as failed.
+            if (!items[i].Failed && !extentsLeft[i])
+            {
+                HANDLE output = RecallCreateOutputFile(outputDir, items[i].Path, outputPath, _countof(outputPath));
+                RecallFinishFile(output, &items[i], files[i], outputPath, stats);
+            }
+        }
+
+        result = RingCreate(&ring, RAW_RECALL_SLOT_COUNT, LTFS_MAX_BLOCK_SIZE + (reader->Protect ? TAPE_LBP_LENGTH : 0));
+    }
+
+    if (result)
+    {
+        reader->Extents = extents;
+        reader->ExtentCount = extentCount;
+        reader->Ring = &ring;
+
+        readerThread = CreateThread(NULL, 0, RecallRawReader, reader, 0, NULL);
+        result = readerThread != NULL;
+
+        if (!result)
+            RingDestroy(&ring);
+    }
+
+    if (result)
+    {
+        for (;;)
+        {
+            PRING_SLOT slot = RingAcquireFull(&ring);
+            PRAW_EXTENT extent;
+            PRECALL_ITEM item;
+            DWORD itemIndex;
+
+            if (!slot)
+                break;
+
+            if (slot->Flags & RING_SLOT_END)
+            {
+                RingRelease(&ring, slot);
+                break;
+            }
+
+            extent = &extents[slot->Item];
+            itemIndex = extent->Item;
+            item = &items[itemIndex];
+
+            if (!item->Failed && outputs[itemIndex] == INVALID_HANDLE_VALUE)
+            {
+                outputs[itemIndex] = RecallCreateOutputFile(outputDir, item->Path, outputPath, _countof(outputPath));
+
+                if (outputs[itemIndex] == INVALID_HANDLE_VALUE)
+                    item->Failed = TRUE;
+            }
+
+            if (slot->Flags & RING_SLOT_ERROR)
+                item->Failed = TRUE;
+
+            if (!item->Failed)
+            {
+                // The block holds [Offset, Offset + Length) of the extent's byte stream, of which we want
+                // [ByteOffset, ByteOffset + ByteCount). Write the overlap straight out of the ring buffer.
+                ULONGLONG wantedStart = extent->Extent.ByteOffset;
+                ULONGLONG wantedEnd = wantedStart + extent->Extent.ByteCount;
+                ULONGLONG start = max(slot->Offset, wantedStart);
+                ULONGLONG end = min(slot->Offset + slot->Length, wantedEnd);
+
+                if (end > start)
+                {
+                    LARGE_INTEGER filePosition;
+                    DWORD bytesWritten;
+
+                    filePosition.QuadPart = (LONGLONG)(extent->Extent.FileOffset + (start - wantedStart));
+
+                    if (SetFilePointerEx(outputs[itemIndex], filePosition, NULL, FILE_BEGIN) &&
+                        WriteFile(outputs[itemIndex], slot->Buffer + (start - slot->Offset), (DWORD)(end - start), &bytesWritten, NULL) &&
+                        bytesWritten == (DWORD)(end - start))
+                    {
+                        stats->BytesRecalled += bytesWritten;
+                    }
+                    else
+                    {
+                        item->Failed = TRUE;
+                    }
+                }
+            }
+
+            if ((slot->Flags & RING_SLOT_LAST) && --extentsLeft[itemIndex] == 0)
+            {
+                _snprintf_s(outputPath, _countof(outputPath), _TRUNCATE, "%s%s%s", outputDir, outputDir[strlen(outputDir) - 1] == '\\' ? "" : "\\", item->Path);
+                RecallFinishFile(outputs[itemIndex], item, files[itemIndex], outputPath, stats);
+                outputs[itemIndex] = INVALID_HANDLE_VALUE;
+            }
+
+            RingRelease(&ring, slot);
+        }
+
+        WaitForSingleObject(readerThread, INFINITE);
+        CloseHandle(readerThread);
+        RingDestroy(&ring);
+
+        result = stats->FilesFailed == 0;
+    }
+
+    if (outputs)
+    {
+        for (i = 0; i < itemCount; i++)
+        {
+            if (outputs[i] != INVALID_HANDLE_VALUE)
+                CloseHandle(outputs[i]);
+        }
+
+        LocalFree(outputs);
+    }
+
+    if (files)
+        LocalFree(files);
+
+    if (extentsLeft)
+        LocalFree(extentsLeft);
+
+    if (extents)
+        LocalFree(extents);
+
+    return result;
+}
+
+static DWORD WINAPI RecallRawReader(LPVOID param)
+{
+    PRAW_READER reader = (PRAW_READER)param;
+    DWORD partition = MAXDWORD;
+    ULONGLONG block = 0;
+    BOOL result;
+    DWORD i;
+
+    for (i = 0; i < reader->ExtentCount; i++)
+    {
+        PLTFS_EXTENT extent = &reader->Extents[i].Extent;
+        ULONGLONG blockCount = reader->Extents[i].BlockCount;
+        ULONGLONG needed = extent->ByteOffset + extent->ByteCount;
+        ULONGLONG consumed = 0;
+        BOOL last = FALSE;
+        TAPE_SENSE sense;
+        PRING_SLOT slot;
+
+        // Only locate when the extent doesn't carry on from where the last one left off. Most don't need it, and an
+        // image never does.
+        if (extent->Partition != partition || extent->StartBlock != block)
+        {
+            if (!reader->Image && !TapeLocate(reader->Handle, TAPE_LOCATE_BLOCK, extent->Partition, extent->StartBlock, &sense))
+            {
+                partition = MAXDWORD;
+
+                slot = RingAcquireFree(reader->Ring);
+
+                if (!slot)
+                    return 1;
+
+                slot->Item = i;
+                slot->Flags = RING_SLOT_FIRST | RING_SLOT_LAST | RING_SLOT_ERROR;
+                RingCommit(reader->Ring, slot);
+                continue;
+            }
+
+            partition = extent->Partition;
+            block = extent->StartBlock;
+        }
+
+        do
+        {
+            ULONG bytesRead = 0;
+            BOOL filemark;
+
+            slot = RingAcquireFree(reader->Ring);
+
+            if (!slot)
+                return 1;
+
+            slot->Item = i;
+            slot->Offset = consumed;
+            slot->Flags = consumed == 0 ? RING_SLOT_FIRST : 0;
+
+            // A filemark where data should be comes back as nothing read, same as off the tape.
+            if (reader->Image)
+                result = ImageReadBlock(reader->Image, partition, block, slot->Buffer, reader->Ring->SlotSize, &bytesRead, &filemark);
+            else if (reader->Protect)
+                result = TapeReadProtected(reader->Handle, slot->Buffer, reader->Ring->SlotSize, &bytesRead, &sense);
+            else
+                result = TapeRead(reader->Handle, slot->Buffer, reader->Ring->SlotSize, &bytesRead, &sense);
+
+            if (!result || bytesRead == 0)
+            {
+                if (!reader->Image && sense.ProtectionError)
+                    fprintf(stderr, "CRC mismatch at block %llu\r\n", block);
+
+                slot->Flags |= RING_SLOT_LAST | RING_SLOT_ERROR;
+                RingCommit(reader->Ring, slot);
+                partition = MAXDWORD;
+                break;
+            }
+
+            block++;
+            slot->Length = bytesRead;
+            consumed += bytesRead;
+
+            last = blockCount ? block - extent->StartBlock >= blockCount : consumed >= needed;
+
+            if (last)
+                slot->Flags |= RING_SLOT_LAST;
+
+            RingCommit(reader->Ring, slot);
+
+        } while (!last);
+    }
+
+    RingSubmitEnd(reader->Ring);
+
+    return 0;
+}
+
+static BOOL RecallFinishFile(HANDLE output, PRECALL_ITEM item, PLTFS_FILE file, LPCSTR outputPath, PRECALL_STATS stats)
+{
+    if (output == INVALID_HANDLE_VALUE)
+    {
+        item->Failed = TRUE;
+    }
+    else
+    {
+        LARGE_INTEGER length;
+
+        // Sparse regions have no extents, so the length has to be set explicitly. Off a layout map there's no index
+        // entry, and the file is just whatever its blocks held.
+        if (file)
+        {
+            length.QuadPart = (LONGLONG)file->Length;
+
+            if (!item->Failed && !(SetFilePointerEx(output, length, NULL, FILE_BEGIN) && SetEndOfFile(output)))
+                item->Failed = TRUE;
+        }
+
+        CloseHandle(output);
+
+        if (item->Failed)
+            DeleteFile(outputPath);
+    }
+
+    if (item->Failed)
+    {
+        fprintf(stderr, "Failed to recall %s\r\n", item->Path);
+        stats->FilesFailed++;
+        return FALSE;
+    }
+
+    stats->FilesRecalled++;
+    return TRUE;
+}
+
+HANDLE RecallCreateOutputFile(LPCSTR outputDir, LPCSTR path, LPSTR outputPath, size_t outputPathLength)
+{
+    LPSTR separator;
+    LPSTR slash;
+
+    _snprintf_s(outputPath, outputPathLength, _TRUNCATE, "%s%s%s", outputDir, outputDir[strlen(outputDir) - 1] == '\\' ? "" : "\\", path);
+
+    separator = strrchr(outputPath, '\\');
+    slash = strrchr(outputPath, '/');
+
+    // List paths can be written either way round.
+    if (slash && (!separator || slash > separator))
+        separator = slash;
+
+    if (separator)
+    {
+        CHAR saved = *separator;
+        *separator = '\0';
+
+        if (!CreateDirectoryPath(outputPath))
+        {
+            *separator = saved;
+            return INVALID_HANDLE_VALUE;
+        }
+
+        *separator = saved;
+    }
+
+    return CreateFile(outputPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+}
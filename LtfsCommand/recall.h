@@ -0,0 +1,54 @@
+/*
+ *   File:   recall.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsidx.h"
+#include "layout.h"
+
+#define RECALL_SLOT_COUNT       16
+#define RECALL_SLOT_SIZE        (4 * 1024 * 1024)
+#define RAW_RECALL_SLOT_COUNT   32
+
+typedef struct RECALL_ITEM
+{
+    LPSTR Path;
+    BYTE Partition;
+    ULONGLONG StartBlock;
+    DWORD Order;
+    BOOL Failed;
+} RECALL_ITEM, *PRECALL_ITEM;
+
+typedef struct RECALL_STATS
+{
+    DWORD FilesRequested;
+    DWORD FilesRecalled;
+    DWORD FilesFailed;
+    DWORD FilesUnplaced;
+    ULONGLONG BytesRecalled;
+    ULONGLONG ElapsedMs;
+} RECALL_STATS, *PRECALL_STATS;
+
+BOOL RecallReadFileList(LPCSTR listFile, PRECALL_ITEM *items, PDWORD itemCount);
+void RecallDestroyFileList(PRECALL_ITEM items, DWORD itemCount);
+void RecallOrderItems(CHAR driveLetter, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PRECALL_STATS stats);
+BOOL RecallFromVolume(CHAR driveLetter, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, LPCSTR outputDir, PRECALL_STATS stats);
+HANDLE RecallCreateOutputFile(LPCSTR outputDir, LPCSTR path, LPSTR outputPath, size_t outputPathLength);
+BOOL RecallRaw(LPCSTR tapeDrive, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PTAPE_LAYOUT layout, LPCSTR outputDir, BOOL protect, PRECALL_STATS stats);
+BOOL RecallRawFromImage(LPCSTR imageFile, PRECALL_ITEM items, DWORD itemCount, PLTFS_INDEX index, PTAPE_LAYOUT layout, LPCSTR outputDir, PRECALL_STATS stats);
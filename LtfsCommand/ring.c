@@ -0,0 +1,179 @@
+/*
+ *   File:   ring.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "ring.h"
+
+// A fixed ring of page aligned buffers shared between the tape side and the disk side of a transfer.
+//
+// Producers and consumers each take a ticket with an interlocked increment, and the ticket selects the slot. Every slot has
+// its own pair of auto-reset events, so a producer only ever waits for the one slot it is about to fill and a consumer only
+// for the one it is about to drain. Slots are therefore handed out and consumed strictly in ticket order, which keeps a
+// stream of chunks in sequence, even with several threads on either side.
+
+BOOL RingCreate(PBUFFER_RING ring, DWORD slotCount, DWORD slotSize)
+{
+    DWORD i;
+
+    memset(ring, 0, sizeof(BUFFER_RING));
+
+    ring->Slots = (PRING_SLOT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(RING_SLOT) * slotCount);
+
+    if (!ring->Slots)
+        return FALSE;
+
+    // VirtualAlloc hands back page aligned memory, which both SCSI pass through and unbuffered file I/O are happy with.
+    ring->Memory = (PBYTE)VirtualAlloc(NULL, (SIZE_T)slotCount * slotSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (!ring->Memory)
+    {
+        LocalFree(ring->Slots);
+        ring->Slots = NULL;
+        return FALSE;
+    }
+
+    ring->SlotCount = slotCount;
+    ring->SlotSize = slotSize;
+
+    for (i = 0; i < slotCount; i++)
+    {
+        ring->Slots[i].Buffer = ring->Memory + ((SIZE_T)i * slotSize);
+        ring->Slots[i].Free = CreateEvent(NULL, FALSE, TRUE, NULL);
+        ring->Slots[i].Full = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+        if (!ring->Slots[i].Free || !ring->Slots[i].Full)
+        {
+            RingDestroy(ring);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void RingDestroy(PBUFFER_RING ring)
+{
+    DWORD i;
+
+    if (ring->Slots)
+    {
+        for (i = 0; i < ring->SlotCount; i++)
+        {
+            if (ring->Slots[i].Free)
+                CloseHandle(ring->Slots[i].Free);
+
+            if (ring->Slots[i].Full)
+                CloseHandle(ring->Slots[i].Full);
+        }
+
+        LocalFree(ring->Slots);
+    }
+
+    if (ring->Memory)
+        VirtualFree(ring->Memory, 0, MEM_RELEASE);
+
+    memset(ring, 0, sizeof(BUFFER_RING));
+}
+
+void RingAbort(PBUFFER_RING ring)
+{
+    DWORD i;
+
+    InterlockedExchange(&ring->Aborted, TRUE);
+
+    // Wake everybody. Anyone who then finds the ring aborted backs out with NULL.
+    for (i = 0; i < ring->SlotCount; i++)
+    {
+        SetEvent(ring->Slots[i].Free);
+        SetEvent(ring->Slots[i].Full);
+    }
+}
+
+PRING_SLOT RingAcquireFree(PBUFFER_RING ring)
+{
+    LONG64 ticket;
+    PRING_SLOT slot;
+
+    if (ring->Aborted)
+        return NULL;
+
+    ticket = InterlockedIncrement64(&ring->Head) - 1;
+    slot = &ring->Slots[ticket % ring->SlotCount];
+
+    WaitForSingleObject(slot->Free, INFINITE);
+
+    if (ring->Aborted)
+    {
+        SetEvent(slot->Free);
+        return NULL;
+    }
+
+    slot->Length = 0;
+    slot->Flags = 0;
+    slot->Item = 0;
+    slot->Offset = 0;
+
+    return slot;
+}
+
+void RingCommit(PBUFFER_RING ring, PRING_SLOT slot)
+{
+    UNREFERENCED_PARAMETER(ring);
+    SetEvent(slot->Full);
+}
+
+PRING_SLOT RingAcquireFull(PBUFFER_RING ring)
+{
+    LONG64 ticket;
+    PRING_SLOT slot;
+
+    if (ring->Aborted)
+        return NULL;
+
+    ticket = InterlockedIncrement64(&ring->Tail) - 1;
+    slot = &ring->Slots[ticket % ring->SlotCount];
+
+    WaitForSingleObject(slot->Full, INFINITE);
+
+    if (ring->Aborted)
+    {
+        SetEvent(slot->Full);
+        return NULL;
+    }
+
+    return slot;
+}
+
+void RingRelease(PBUFFER_RING ring, PRING_SLOT slot)
+{
+    UNREFERENCED_PARAMETER(ring);
+    SetEvent(slot->Free);
+}
+
+BOOL RingSubmitEnd(PBUFFER_RING ring)
+{
+    PRING_SLOT slot = RingAcquireFree(ring);
+
+    if (!slot)
+        return FALSE;
+
+    slot->Flags = RING_SLOT_END;
+    RingCommit(ring, slot);
+
+    return TRUE;
+}
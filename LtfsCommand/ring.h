@@ -0,0 +1,57 @@
+/*
+ *   File:   ring.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define RING_SLOT_FIRST     0x01    // First chunk of an item
+#define RING_SLOT_LAST      0x02    // Last chunk of an item
+#define RING_SLOT_ERROR     0x04    // Producer failed on this item
+#define RING_SLOT_END       0x08    // End of stream, no data
+
+typedef struct RING_SLOT
+{
+    PBYTE Buffer;
+    DWORD Length;
+    DWORD Flags;
+    DWORD Item;
+    ULONGLONG Offset;
+    HANDLE Free;
+    HANDLE Full;
+} RING_SLOT, *PRING_SLOT;
+
+typedef struct BUFFER_RING
+{
+    PRING_SLOT Slots;
+    DWORD SlotCount;
+    DWORD SlotSize;
+    PBYTE Memory;
+    volatile LONG64 Head;
+    volatile LONG64 Tail;
+    volatile LONG Aborted;
+} BUFFER_RING, *PBUFFER_RING;
+
+BOOL RingCreate(PBUFFER_RING ring, DWORD slotCount, DWORD slotSize);
+void RingDestroy(PBUFFER_RING ring);
+void RingAbort(PBUFFER_RING ring);
+PRING_SLOT RingAcquireFree(PBUFFER_RING ring);
+void RingCommit(PBUFFER_RING ring, PRING_SLOT slot);
+PRING_SLOT RingAcquireFull(PBUFFER_RING ring);
+void RingRelease(PBUFFER_RING ring, PRING_SLOT slot);
+BOOL RingSubmitEnd(PBUFFER_RING ring);
@@ -0,0 +1,455 @@
+/*
+ *   File:   seekmodel.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "seekmodel.h"
+#include <math.h>
+
+#define SEEK_MODEL_KEY          "Software\\LtfsCommand\\SeekModels"
+#define SEEK_MAX_WRAPS          400
+#define SEEK_WRAP_GRID_STEP     1.02    // Any coarser and now and then the search settles somewhere well away from the real wrap
+
+typedef struct SEEK_SAMPLE
+{
+    ULONGLONG From;
+    ULONGLONG To;
+    double Ms;
+} SEEK_SAMPLE, *PSEEK_SAMPLE;
+
+static BOOL SeekModelFit(PSEEK_SAMPLE samples, DWORD sampleCount, ULONGLONG blocksPerWrap, PSEEK_MODEL model, double *sse);
+static void SeekModelDistance(ULONGLONG blocksPerWrap, ULONGLONG fromBlock, ULONGLONG toBlock, double *longitudinal, double *wraps);
+static ULONGLONG SeekModelRandom(PULONGLONG state);
+static BOOL SeekModelClose(double value, double expected, double tolerance);
+static void SeekModelKeyName(LPCSTR productId, LPSTR buffer, size_t len);
+static BOOL SeekTapeGetBlockCount(PVOID context, PULONGLONG blockCount);
+static double SeekTapeSeek(PVOID context, ULONGLONG block);
+static BOOL SeekEmulatedGetBlockCount(PVOID context, PULONGLONG blockCount);
+static double SeekEmulatedSeek(PVOID context, ULONGLONG block);
+
+BOOL SeekModelCalibrate(PSEEK_DRIVE_OPS ops, DWORD sampleCount, PSEEK_MODEL model)
+{
+    PSEEK_SAMPLE samples;
+    SEEK_MODEL best;
+    ULONGLONG blockCount;
+    ULONGLONG blocksPerWrap;
+    ULONGLONG position = 0;
+    ULONGLONG step;
+    ULONGLONG random = GetTickCount64() | 1;
+    double bestSse = -1.0;
+    BOOL result;
+    DWORD i;
+
+    memset(&best, 0, sizeof(best));
+
+    if (!ops->GetBlockCount(ops->Context, &blockCount) || blockCount < SEEK_MIN_BLOCKS)
+        return FALSE;
+
+    samples = (PSEEK_SAMPLE)LocalAlloc(LMEM_FIXED, sizeof(SEEK_SAMPLE) * sampleCount);
+
+    if (!samples)
+        return FALSE;
+
+    result = ops->Seek(ops->Context, 0) >= 0.0;
+
+    // Random targets across everything written, so we see short hops, long hauls and every wrap.
+    for (i = 0; result && i < sampleCount; i++)
+    {
+        ULONGLONG target = SeekModelRandom(&random) % blockCount;
+        double ms = ops->Seek(ops->Context, target);
+
+        result = ms >= 0.0;
+
+        samples[i].From = position;
+        samples[i].To = target;
+        samples[i].Ms = ms;
+
+        position = target;
+    }
+
+    // The wrap length isn't something the drive will tell us, so search for the one that best explains the timings.
+    // Under the right one, the longitudinal and wrap terms separate cleanly and the residual drops.
+    for (blocksPerWrap = max(blockCount / SEEK_MAX_WRAPS, 64); result && blocksPerWrap < blockCount;
+        blocksPerWrap = (ULONGLONG)(blocksPerWrap * SEEK_WRAP_GRID_STEP) + 1)
+    {
+        SEEK_MODEL candidate;
+        double sse;
+
+        if (SeekModelFit(samples, sampleCount, blocksPerWrap, &candidate, &sse) && (bestSse < 0.0 || sse < bestSse))
+        {
+            bestSse = sse;
+            best = candidate;
+        }
+    }
+
+    // The grid only gets us close, and a few blocks out per wrap adds up over a whole tape. Hill climb the rest of the way.
+    for (step = bestSse >= 0.0 ? (ULONGLONG)(best.BlocksPerWrap * (SEEK_WRAP_GRID_STEP - 1.0)) : 0; result && step > 0; )
+    {
+        SEEK_MODEL candidate;
+        double sse;
+
+        if (SeekModelFit(samples, sampleCount, best.BlocksPerWrap + step, &candidate, &sse) && sse < bestSse)
+        {
+            bestSse = sse;
+            best = candidate;
+        }
+        else if (best.BlocksPerWrap > step && SeekModelFit(samples, sampleCount, best.BlocksPerWrap - step, &candidate, &sse) && sse < bestSse)
+        {
+            bestSse = sse;
+            best = candidate;
+        }
+        else
+        {
+            step /= 2;
+        }
+    }
+
+    if (result && bestSse >= 0.0)
+    {
+        model->BlocksPerWrap = best.BlocksPerWrap;
+        model->FixedMs = best.FixedMs;
+        model->BlockMs = best.BlockMs;
+        model->WrapMs = best.WrapMs;
+        model->Samples = sampleCount;
+        model->RmsErrorMs = sqrt(bestSse / sampleCount);
+    }
+
+    LocalFree(samples);
+
+    return result && bestSse >= 0.0;
+}
+
+double SeekModelEstimate(PSEEK_MODEL model, ULONGLONG fromBlock, ULONGLONG toBlock)
+{
+    double longitudinal;
+    double wraps;
+
+    if (fromBlock == toBlock)
+        return 0.0;
+
+    SeekModelDistance(model->BlocksPerWrap, fromBlock, toBlock, &longitudinal, &wraps);
+
+    return model->FixedMs + model->BlockMs * longitudinal + model->WrapMs * wraps;
+}
+
+BOOL SeekModelLoad(LPCSTR productId, PSEEK_MODEL model)
+{
+    HKEY key;
+    CHAR regKey[128];
+    DWORD blocksPerWrap, fixedUs, blockNs, wrapUs, samples, rmsUs;
+    DWORD valueLen;
+    BOOL success = FALSE;
+
+    SeekModelKeyName(productId, regKey, _countof(regKey));
+
+    if (RegOpenKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, KEY_READ, &key) == ERROR_SUCCESS)
+    {
+        valueLen = sizeof(DWORD);
+        success = RegGetValue(key, NULL, "BlocksPerWrap", RRF_RT_REG_DWORD, NULL, &blocksPerWrap, &valueLen) == ERROR_SUCCESS;
+
+        if (success)
+        {
+            valueLen = sizeof(DWORD);
+            success = RegGetValue(key, NULL, "FixedUs", RRF_RT_REG_DWORD, NULL, &fixedUs, &valueLen) == ERROR_SUCCESS;
+        }
+
+        if (success)
+        {
+            valueLen = sizeof(DWORD);
+            success = RegGetValue(key, NULL, "BlockNs", RRF_RT_REG_DWORD, NULL, &blockNs, &valueLen) == ERROR_SUCCESS;
+        }
+
+        if (success)
+        {
+            valueLen = sizeof(DWORD);
+            success = RegGetValue(key, NULL, "WrapUs", RRF_RT_REG_DWORD, NULL, &wrapUs, &valueLen) == ERROR_SUCCESS;
+        }
+
+        if (success)
+        {
+            // Informational only, don't fail if they're missing.
+            valueLen = sizeof(DWORD);
+            if (RegGetValue(key, NULL, "Samples", RRF_RT_REG_DWORD, NULL, &samples, &valueLen) != ERROR_SUCCESS)
+                samples = 0;
+
+            valueLen = sizeof(DWORD);
+            if (RegGetValue(key, NULL, "RmsErrorUs", RRF_RT_REG_DWORD, NULL, &rmsUs, &valueLen) != ERROR_SUCCESS)
+                rmsUs = 0;
+
+            strncpy_s(model->ProductId, sizeof(model->ProductId), productId, _TRUNCATE);
+            model->BlocksPerWrap = blocksPerWrap;
+            model->FixedMs = fixedUs / 1000.0;
+            model->BlockMs = blockNs / 1000000.0;
+            model->WrapMs = wrapUs / 1000.0;
+            model->Samples = samples;
+            model->RmsErrorMs = rmsUs / 1000.0;
+        }
+
+        RegCloseKey(key);
+    }
+
+    return success;
+}
+
+BOOL SeekModelSave(PSEEK_MODEL model)
+{
+    HKEY key;
+    DWORD disposition;
+    CHAR regKey[128];
+    DWORD blocksPerWrap = (DWORD)model->BlocksPerWrap;
+    DWORD fixedUs = (DWORD)(model->FixedMs * 1000.0);
+    DWORD blockNs = (DWORD)(model->BlockMs * 1000000.0);
+    DWORD wrapUs = (DWORD)(model->WrapMs * 1000.0);
+    DWORD rmsUs = (DWORD)(model->RmsErrorMs * 1000.0);
+    BOOL success = FALSE;
+
+    SeekModelKeyName(model->ProductId, regKey, _countof(regKey));
+
+    // Stored as integers in fine units rather than REG_BINARY doubles, so they can be read and tweaked in regedit.
+    if (RegCreateKeyEx(HKEY_LOCAL_MACHINE, regKey, 0, NULL, 0, KEY_READ | KEY_CREATE_SUB_KEY | KEY_SET_VALUE, NULL, &key, &disposition) == ERROR_SUCCESS)
+    {
+        success = RegSetKeyValue(key, NULL, "BlocksPerWrap", REG_DWORD, &blocksPerWrap, sizeof(DWORD)) == ERROR_SUCCESS;
+
+        if (success)
+            success = RegSetKeyValue(key, NULL, "FixedUs", REG_DWORD, &fixedUs, sizeof(DWORD)) == ERROR_SUCCESS;
+
+        if (success)
+            success = RegSetKeyValue(key, NULL, "BlockNs", REG_DWORD, &blockNs, sizeof(DWORD)) == ERROR_SUCCESS;
+
+        if (success)
+            success = RegSetKeyValue(key, NULL, "WrapUs", REG_DWORD, &wrapUs, sizeof(DWORD)) == ERROR_SUCCESS;
+
+        if (success)
+            success = RegSetKeyValue(key, NULL, "Samples", REG_DWORD, &model->Samples, sizeof(DWORD)) == ERROR_SUCCESS;
+
+        if (success)
+            success = RegSetKeyValue(key, NULL, "RmsErrorUs", REG_DWORD, &rmsUs, sizeof(DWORD)) == ERROR_SUCCESS;
+
+        RegCloseKey(key);
+    }
+
+    return success;
+}
+
+// For checking a fit against an emulated drive, where the right answer is known.
+
+BOOL SeekModelMatches(PSEEK_MODEL fitted, PSEEK_MODEL expected)
+{
+    return SeekModelClose((double)fitted->BlocksPerWrap, (double)expected->BlocksPerWrap, SEEK_WRAP_TOLERANCE) &&
+        SeekModelClose(fitted->FixedMs, expected->FixedMs, SEEK_COST_TOLERANCE) &&
+        SeekModelClose(fitted->BlockMs, expected->BlockMs, SEEK_COST_TOLERANCE) &&
+        SeekModelClose(fitted->WrapMs, expected->WrapMs, SEEK_COST_TOLERANCE);
+}
+
+void SeekModelTapeOps(PSEEK_TAPE_DRIVE drive, PSEEK_DRIVE_OPS ops)
+{
+    ops->GetBlockCount = SeekTapeGetBlockCount;
+    ops->Seek = SeekTapeSeek;
+    ops->Context = drive;
+}
+
+void SeekModelEmulatedOps(PSEEK_EMULATED_DRIVE drive, PSEEK_DRIVE_OPS ops)
+{
+    ops->GetBlockCount = SeekEmulatedGetBlockCount;
+    ops->Seek = SeekEmulatedSeek;
+    ops->Context = drive;
+}
+
+static BOOL SeekModelFit(PSEEK_SAMPLE samples, DWORD sampleCount, ULONGLONG blocksPerWrap, PSEEK_MODEL model, double *sse)
+{
+    double a[3][3];
+    double b[3];
+    double x[3];
+    double det;
+    DWORD i;
+    int j, k;
+
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+
+    // Ordinary least squares on [1, longitudinal, wraps], via the 3x3 normal equations.
+    for (i = 0; i < sampleCount; i++)
+    {
+        double f[3];
+
+        f[0] = 1.0;
+        SeekModelDistance(blocksPerWrap, samples[i].From, samples[i].To, &f[1], &f[2]);
+
+        for (j = 0; j < 3; j++)
+        {
+            for (k = 0; k < 3; k++)
+                a[j][k] += f[j] * f[k];
+
+            b[j] += f[j] * samples[i].Ms;
+        }
+    }
+
+    det = a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+        - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+        + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+
+    if (fabs(det) < 1e-9)
+        return FALSE;
+
+    // Cramer's rule, swapping b into each column in turn.
+    for (j = 0; j < 3; j++)
+    {
+        double m[3][3];
+
+        memcpy(m, a, sizeof(m));
+
+        for (k = 0; k < 3; k++)
+            m[k][j] = b[k];
+
+        x[j] = (m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+            - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+            + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])) / det;
+    }
+
+    // A negative cost means this wrap length doesn't describe the drive, whatever the residual says.
+    if (x[0] < 0.0 || x[1] < 0.0 || x[2] < 0.0)
+        return FALSE;
+
+    model->BlocksPerWrap = blocksPerWrap;
+    model->FixedMs = x[0];
+    model->BlockMs = x[1];
+    model->WrapMs = x[2];
+
+    *sse = 0.0;
+
+    for (i = 0; i < sampleCount; i++)
+    {
+        double error = SeekModelEstimate(model, samples[i].From, samples[i].To) - samples[i].Ms;
+        *sse += error * error;
+    }
+
+    return TRUE;
+}
+
+static void SeekModelDistance(ULONGLONG blocksPerWrap, ULONGLONG fromBlock, ULONGLONG toBlock, double *longitudinal, double *wraps)
+{
+    ULONGLONG fromWrap = fromBlock / blocksPerWrap;
+    ULONGLONG toWrap = toBlock / blocksPerWrap;
+    ULONGLONG fromOffset = fromBlock % blocksPerWrap;
+    ULONGLONG toOffset = toBlock % blocksPerWrap;
+
+    // Serpentine: odd wraps run back towards the beginning of tape.
+    if (fromWrap & 1)
+        fromOffset = blocksPerWrap - 1 - fromOffset;
+
+    if (toWrap & 1)
+        toOffset = blocksPerWrap - 1 - toOffset;
+
+    *longitudinal = fromOffset > toOffset ? (double)(fromOffset - toOffset) : (double)(toOffset - fromOffset);
+    *wraps = fromWrap > toWrap ? (double)(fromWrap - toWrap) : (double)(toWrap - fromWrap);
+}
+
+static ULONGLONG SeekModelRandom(PULONGLONG state)
+{
+    // xorshift64. Only needs to scatter targets, nothing more.
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static BOOL SeekModelClose(double value, double expected, double tolerance)
+{
+    return fabs(value - expected) <= fabs(expected) * tolerance;
+}
+
+static void SeekModelKeyName(LPCSTR productId, LPSTR buffer, size_t len)
+{
+    size_t keyLength;
+
+    // INQUIRY pads the product ID with spaces, which would be a nuisance in a key name.
+    _snprintf_s(buffer, len, _TRUNCATE, SEEK_MODEL_KEY "\\%s", productId);
+
+    keyLength = strlen(buffer);
+
+    while (keyLength > 0 && buffer[keyLength - 1] == ' ')
+        buffer[--keyLength] = '\0';
+}
+
+static BOOL SeekTapeGetBlockCount(PVOID context, PULONGLONG blockCount)
+{
+    PSEEK_TAPE_DRIVE drive = (PSEEK_TAPE_DRIVE)context;
+    TAPE_POSITION position;
+    int partition;
+
+    // Prefer the data partition of an LTFS formatted cartridge, otherwise whatever is on partition 0.
+    for (partition = 1; partition >= 0; partition--)
+    {
+        if (TapeLocate(drive->Handle, TAPE_LOCATE_EOD, partition, 0, NULL) &&
+            TapeReadPosition(drive->Handle, &position, NULL) &&
+            position.Block >= SEEK_MIN_BLOCKS)
+        {
+            drive->Partition = partition;
+            *blockCount = position.Block;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static double SeekTapeSeek(PVOID context, ULONGLONG block)
+{
+    PSEEK_TAPE_DRIVE drive = (PSEEK_TAPE_DRIVE)context;
+    TAPE_POSITION position;
+    LARGE_INTEGER frequency, start, end;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    // LOCATE returns once positioned, READ POSITION confirms we're where we asked to be.
+    if (!TapeLocate(drive->Handle, TAPE_LOCATE_BLOCK, drive->Partition, block, NULL))
+        return -1.0;
+
+    if (!TapeReadPosition(drive->Handle, &position, NULL) || position.Block != block)
+        return -1.0;
+
+    QueryPerformanceCounter(&end);
+
+    return (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+}
+
+static BOOL SeekEmulatedGetBlockCount(PVOID context, PULONGLONG blockCount)
+{
+    PSEEK_EMULATED_DRIVE drive = (PSEEK_EMULATED_DRIVE)context;
+
+    *blockCount = drive->BlockCount;
+    return TRUE;
+}
+
+static double SeekEmulatedSeek(PVOID context, ULONGLONG block)
+{
+    PSEEK_EMULATED_DRIVE drive = (PSEEK_EMULATED_DRIVE)context;
+    double ms;
+    double noise;
+
+    if (block >= drive->BlockCount)
+        return -1.0;
+
+    ms = SeekModelEstimate(&drive->Model, drive->Position, block);
+    noise = (double)(SeekModelRandom(&drive->Random) % 2001) / 1000.0 - 1.0;
+
+    drive->Position = block;
+
+    return ms * (1.0 + noise * drive->NoiseFraction);
+}
@@ -0,0 +1,75 @@
+/*
+ *   File:   seekmodel.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "tape.h"
+
+#define SEEK_CALIBRATION_SAMPLES    120
+#define SEEK_MIN_BLOCKS             10000
+#define SEEK_PRODUCT_ID_LENGTH      MEMBER_SIZE(TAPE_DRIVE, ProductId)
+#define SEEK_WRAP_TOLERANCE         0.01    // How close an emulated calibration has to get to the wrap length
+#define SEEK_COST_TOLERANCE         0.20    // and to each cost term, which take up the timing noise between them
+
+// Locate cost from block A to block B, for a serpentine layout with a fixed number of blocks per wrap:
+//
+//   FixedMs + BlockMs * |longitudinal distance| + WrapMs * |wraps crossed|
+//
+typedef struct SEEK_MODEL
+{
+    CHAR ProductId[SEEK_PRODUCT_ID_LENGTH];
+    ULONGLONG BlocksPerWrap;
+    double FixedMs;
+    double BlockMs;
+    double WrapMs;
+    DWORD Samples;
+    double RmsErrorMs;
+} SEEK_MODEL, *PSEEK_MODEL;
+
+// Calibration talks to the drive through this, so it can be pointed at an emulated one.
+// Seek moves to the given block and returns how long it took in ms, or a negative value on failure.
+typedef struct SEEK_DRIVE_OPS
+{
+    BOOL (*GetBlockCount)(PVOID context, PULONGLONG blockCount);
+    double (*Seek)(PVOID context, ULONGLONG block);
+    PVOID Context;
+} SEEK_DRIVE_OPS, *PSEEK_DRIVE_OPS;
+
+typedef struct SEEK_TAPE_DRIVE
+{
+    HANDLE Handle;
+    DWORD Partition;
+} SEEK_TAPE_DRIVE, *PSEEK_TAPE_DRIVE;
+
+typedef struct SEEK_EMULATED_DRIVE
+{
+    SEEK_MODEL Model;
+    ULONGLONG BlockCount;
+    ULONGLONG Position;
+    double NoiseFraction;
+    ULONGLONG Random;
+} SEEK_EMULATED_DRIVE, *PSEEK_EMULATED_DRIVE;
+
+BOOL SeekModelCalibrate(PSEEK_DRIVE_OPS ops, DWORD sampleCount, PSEEK_MODEL model);
+double SeekModelEstimate(PSEEK_MODEL model, ULONGLONG fromBlock, ULONGLONG toBlock);
+BOOL SeekModelLoad(LPCSTR productId, PSEEK_MODEL model);
+BOOL SeekModelSave(PSEEK_MODEL model);
+BOOL SeekModelMatches(PSEEK_MODEL fitted, PSEEK_MODEL expected);
+void SeekModelTapeOps(PSEEK_TAPE_DRIVE drive, PSEEK_DRIVE_OPS ops);
+void SeekModelEmulatedOps(PSEEK_EMULATED_DRIVE drive, PSEEK_DRIVE_OPS ops);
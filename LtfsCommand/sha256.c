@@ -0,0 +1,287 @@
+/*
+ *   File:   sha256.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "sha256.h"
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#define SHA256_HAVE_SHANI
+#endif
+
+#define ROTR32(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const DWORD Sha256K[64] =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static INIT_ONCE Sha256InitOnce = INIT_ONCE_STATIC_INIT;
+static BOOL Sha256UseHardware;
+
+static BOOL CALLBACK Sha256DetectHardware(PINIT_ONCE initOnce, PVOID parameter, PVOID *context);
+static void Sha256Compress(PDWORD state, const BYTE *data, size_t blocks);
+static void Sha256CompressPortable(PDWORD state, const BYTE *data, size_t blocks);
+#ifdef SHA256_HAVE_SHANI
+static void Sha256CompressHardware(PDWORD state, const BYTE *data, size_t blocks);
+#endif
+
+void Sha256Init(PSHA256_CONTEXT context)
+{
+    InitOnceExecuteOnce(&Sha256InitOnce, Sha256DetectHardware, NULL, NULL);
+
+    context->State[0] = 0x6A09E667;
+    context->State[1] = 0xBB67AE85;
+    context->State[2] = 0x3C6EF372;
+    context->State[3] = 0xA54FF53A;
+    context->State[4] = 0x510E527F;
+    context->State[5] = 0x9B05688C;
+    context->State[6] = 0x1F83D9AB;
+    context->State[7] = 0x5BE0CD19;
+    context->Length = 0;
+    context->Buffered = 0;
+}
+
+void Sha256Update(PSHA256_CONTEXT context, const void *data, size_t length)
+{
+    const BYTE *pos = (const BYTE *)data;
+    size_t blocks;
+
+    context->Length += length;
+
+    if (context->Buffered)
+    {
+        size_t needed = min(SHA256_BLOCK_LENGTH - context->Buffered, length);
+
+        memcpy(context->Buffer + context->Buffered, pos, needed);
+        context->Buffered += (DWORD)needed;
+        pos += needed;
+        length -= needed;
+
+        if (context->Buffered < SHA256_BLOCK_LENGTH)
+            return;
+
+        Sha256Compress(context->State, context->Buffer, 1);
+        context->Buffered = 0;
+    }
+
+    // Whole blocks straight from the caller's buffer, which for us is always the bulk of it.
+    blocks = length / SHA256_BLOCK_LENGTH;
+
+    if (blocks)
+    {
+        Sha256Compress(context->State, pos, blocks);
+        pos += blocks * SHA256_BLOCK_LENGTH;
+        length -= blocks * SHA256_BLOCK_LENGTH;
+    }
+
+    if (length)
+    {
+        memcpy(context->Buffer, pos, length);
+        context->Buffered = (DWORD)length;
+    }
+}
+
+void Sha256Final(PSHA256_CONTEXT context, PBYTE digest)
+{
+    ULONGLONG bits = context->Length * 8;
+    DWORD i;
+
+    context->Buffer[context->Buffered++] = 0x80;
+
+    if (context->Buffered > SHA256_BLOCK_LENGTH - 8)
+    {
+        memset(context->Buffer + context->Buffered, 0, SHA256_BLOCK_LENGTH - context->Buffered);
+        Sha256Compress(context->State, context->Buffer, 1);
+        context->Buffered = 0;
+    }
+
+    memset(context->Buffer + context->Buffered, 0, SHA256_BLOCK_LENGTH - 8 - context->Buffered);
+
+    for (i = 0; i < 8; i++)
+        context->Buffer[SHA256_BLOCK_LENGTH - 1 - i] = (BYTE)(bits >> (i * 8));
+
+    Sha256Compress(context->State, context->Buffer, 1);
+
+    for (i = 0; i < 8; i++)
+    {
+        digest[i * 4] = (BYTE)(context->State[i] >> 24);
+        digest[i * 4 + 1] = (BYTE)(context->State[i] >> 16);
+        digest[i * 4 + 2] = (BYTE)(context->State[i] >> 8);
+        digest[i * 4 + 3] = (BYTE)context->State[i];
+    }
+}
+
+BOOL Sha256HardwareAvailable()
+{
+    InitOnceExecuteOnce(&Sha256InitOnce, Sha256DetectHardware, NULL, NULL);
+
+    return Sha256UseHardware;
+}
+
+static void Sha256Compress(PDWORD state, const BYTE *data, size_t blocks)
+{
+#ifdef SHA256_HAVE_SHANI
+    if (Sha256UseHardware)
+    {
+        Sha256CompressHardware(state, data, blocks);
+        return;
+    }
+#endif
+
+    Sha256CompressPortable(state, data, blocks);
+}
+
+static void Sha256CompressPortable(PDWORD state, const BYTE *data, size_t blocks)
+{
+    DWORD w[64];
+    DWORD i;
+
+    while (blocks--)
+    {
+        DWORD a = state[0], b = state[1], c = state[2], d = state[3];
+        DWORD e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (i = 0; i < 16; i++)
+            w[i] = ((DWORD)data[i * 4] << 24) | ((DWORD)data[i * 4 + 1] << 16) | ((DWORD)data[i * 4 + 2] << 8) | (DWORD)data[i * 4 + 3];
+
+        for (i = 16; i < 64; i++)
+        {
+            DWORD s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            DWORD s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        for (i = 0; i < 64; i++)
+        {
+            DWORD t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + Sha256K[i] + w[i];
+            DWORD t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+
+        data += SHA256_BLOCK_LENGTH;
+    }
+}
+
+#ifdef SHA256_HAVE_SHANI
+static void Sha256CompressHardware(PDWORD state, const BYTE *data, size_t blocks)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+    __m128i state0, state1, saved0, saved1, msg, tmp;
+    __m128i w[4];
+    DWORD i;
+
+    // The SHA extensions want the state as ABEF and CDGH rather than ABCD and EFGH.
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks--)
+    {
+        saved0 = state0;
+        saved1 = state1;
+
+        // Four rounds per pass, two per sha256rnds2. The message schedule is run three groups ahead of the rounds
+        // that use it: msg1 on the group just used, msg2 to finish the group after next.
+        for (i = 0; i < 16; i++)
+        {
+            if (i < 4)
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), byteSwap);
+
+            msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&Sha256K[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+            if (i >= 3 && i < 15)
+            {
+                tmp = _mm_alignr_epi8(w[i & 3], w[(i - 1) & 3], 4);
+                w[(i + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(w[(i + 1) & 3], tmp), w[i & 3]);
+            }
+
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+            if (i >= 1 && i < 13)
+                w[(i - 1) & 3] = _mm_sha256msg1_epu32(w[(i - 1) & 3], w[i & 3]);
+        }
+
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+
+        data += SHA256_BLOCK_LENGTH;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
+
+static BOOL CALLBACK Sha256DetectHardware(PINIT_ONCE initOnce, PVOID parameter, PVOID *context)
+{
+#ifdef SHA256_HAVE_SHANI
+    int cpuInfo[4];
+    BOOL ssse3, sse41;
+
+    // CPUID leaf 1, ECX bits 9 and 19 are SSSE3 and SSE4.1, which the shuffles and blends need.
+    // Leaf 7, EBX bit 29 is the SHA extensions themselves.
+    __cpuid(cpuInfo, 1);
+    ssse3 = (cpuInfo[2] & (1 << 9)) != 0;
+    sse41 = (cpuInfo[2] & (1 << 19)) != 0;
+
+    __cpuid(cpuInfo, 0);
+
+    if (cpuInfo[0] >= 7)
+    {
+        __cpuidex(cpuInfo, 7, 0);
+        Sha256UseHardware = ssse3 && sse41 && (cpuInfo[1] & (1 << 29)) != 0;
+    }
+#endif
+
+    return TRUE;
+}
@@ -0,0 +1,37 @@
+/*
+ *   File:   sha256.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define SHA256_DIGEST_LENGTH    32
+#define SHA256_BLOCK_LENGTH     64
+
+typedef struct SHA256_CONTEXT
+{
+    DWORD State[8];
+    ULONGLONG Length;
+    BYTE Buffer[SHA256_BLOCK_LENGTH];
+    DWORD Buffered;
+} SHA256_CONTEXT, *PSHA256_CONTEXT;
+
+void Sha256Init(PSHA256_CONTEXT context);
+void Sha256Update(PSHA256_CONTEXT context, const void *data, size_t length);
+void Sha256Final(PSHA256_CONTEXT context, PBYTE digest);
+BOOL Sha256HardwareAvailable();
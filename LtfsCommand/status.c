@@ -0,0 +1,294 @@
+/*
+ *   File:   status.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "status.h"
+#include "mapping.h"
+#include "inventory.h"
+#include "fusesvc.h"
+
+// Filled in by the workers, one part each, so none of them need to lock.
+typedef struct STATUS_SOURCES
+{
+    DWORD MaxAge;
+    PTAPE_DRIVE DriveList;
+    DWORD DriveCount;
+    BOOL ServiceValid;
+    DWORD ServiceState;
+    BOOL MediaValid;
+    PMEDIA_STATUS MediaList;
+    DWORD MediaCount;
+} STATUS_SOURCES, *PSTATUS_SOURCES;
+
+static DWORD WINAPI StatusDrivesWorker(LPVOID param);
+static DWORD WINAPI StatusServiceWorker(LPVOID param);
+static DWORD WINAPI StatusMediaWorker(LPVOID param);
+static BOOL StatusBuild(PSTATUS_SOURCES sources, PMAPPING_TABLE table, PSTATUS_REPORT report);
+static BOOL StatusHasMountPoint(PSTATUS_MAPPING mapping, DWORD logicalDrives);
+static DWORD StatusMountState(PSTATUS_REPORT report, PSTATUS_MAPPING mapping);
+
+// Drives, service and media don't depend on each other, and the media checks go out to every drive, so they're all
+// asked at once and the slowest sets the pace. Nothing is compared until everything is in, which is what lets a
+// mapping be held up against the drives and media as they were at the same moment rather than one after the other.
+
+BOOL StatusCollect(DWORD maxAge, PSTATUS_REPORT *report)
+{
+    static const LPTHREAD_START_ROUTINE workers[] = { StatusDrivesWorker, StatusServiceWorker, StatusMediaWorker };
+    ULONGLONG startTime = GetTickCount64();
+    HANDLE threads[_countof(workers)];
+    STATUS_SOURCES sources;
+    PMAPPING_TABLE table = NULL;
+    PSTATUS_REPORT newReport = NULL;
+    BOOL success;
+    DWORD i;
+
+    memset(&sources, 0, sizeof(sources));
+    sources.MaxAge = maxAge;
+
+    // First, so it's the mappings as they were before the media checks fix up any drive that has moved.
+    success = MappingTableLoad(&table);
+
+    for (i = 0; i < _countof(workers); i++)
+    {
+        threads[i] = CreateThread(NULL, 0, workers[i], &sources, 0, NULL);
+
+        // Couldn't start a thread, so just do it here.
+        if (!threads[i])
+            workers[i](&sources);
+    }
+
+    for (i = 0; i < _countof(workers); i++)
+    {
+        if (threads[i])
+        {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+
+    if (success)
+    {
+        newReport = (PSTATUS_REPORT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(STATUS_REPORT));
+        success = newReport && StatusBuild(&sources, table, newReport);
+    }
+
+    TapeDestroyDriveList(sources.DriveList);
+    MediaDestroyList(sources.MediaList);
+
+    if (table)
+        MappingTableDestroy(table);
+
+    if (!success)
+    {
+        StatusDestroy(newReport);
+        return FALSE;
+    }
+
+    newReport->ElapsedMs = GetTickCount64() - startTime;
+    *report = newReport;
+
+    return TRUE;
+}
+
+void StatusDestroy(PSTATUS_REPORT report)
+{
+    if (!report)
+        return;
+
+    if (report->Drives)
+        LocalFree(report->Drives);
+
+    if (report->Mappings)
+        LocalFree(report->Mappings);
+
+    LocalFree(report);
+}
+
+LPCSTR StatusMountStateName(DWORD mountState)
+{
+    switch (mountState)
+    {
+    case STATUS_MOUNT_READY:
+        return "ready";
+    case STATUS_MOUNT_IN_USE:
+        return "in-use";
+    case STATUS_MOUNT_NO_TAPE:
+        return "no-tape";
+    case STATUS_MOUNT_MEDIA_UNKNOWN:
+        return "media-unknown";
+    case STATUS_MOUNT_NO_MOUNT_POINT:
+        return "no-mount-point";
+    case STATUS_MOUNT_MOVED:
+        return "moved";
+    case STATUS_MOUNT_SERVICE_DOWN:
+        return "service-down";
+    case STATUS_MOUNT_NOT_ATTACHED:
+        return "not-attached";
+    default:
+        return "unknown";
+    }
+}
+
+static DWORD WINAPI StatusDrivesWorker(LPVOID param)
+{
+    PSTATUS_SOURCES sources = (PSTATUS_SOURCES)param;
+
+    // No drives and no inventory look the same from here, either way there's nothing attached to report.
+    InventoryGetDriveList(&sources->DriveList, &sources->DriveCount, FALSE);
+
+    return 0;
+}
+
+static DWORD WINAPI StatusServiceWorker(LPVOID param)
+{
+    PSTATUS_SOURCES sources = (PSTATUS_SOURCES)param;
+
+    sources->ServiceValid = FuseGetServiceState(&sources->ServiceState);
+
+    return 0;
+}
+
+static DWORD WINAPI StatusMediaWorker(LPVOID param)
+{
+    PSTATUS_SOURCES sources = (PSTATUS_SOURCES)param;
+
+    sources->MediaValid = MediaCheckAll(sources->MaxAge, &sources->MediaList, &sources->MediaCount);
+
+    return 0;
+}
+
+static BOOL StatusBuild(PSTATUS_SOURCES sources, PMAPPING_TABLE table, PSTATUS_REPORT report)
+{
+    DWORD logicalDrives = GetLogicalDrives();
+    PTAPE_DRIVE drive;
+    DWORD i;
+    DWORD j;
+
+    report->ServiceValid = sources->ServiceValid;
+    report->ServiceState = sources->ServiceState;
+
+    report->Drives = (PSTATUS_DRIVE)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(STATUS_DRIVE) * max(sources->DriveCount, 1));
+    report->Mappings = (PSTATUS_MAPPING)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(STATUS_MAPPING) * max(table->MappingCount, 1));
+
+    if (!report->Drives || !report->Mappings)
+        return FALSE;
+
+    for (i = 0; i < table->MappingCount; i++)
+    {
+        PLTFS_MAPPING mapping = &table->Mappings[i];
+        PSTATUS_MAPPING entry = &report->Mappings[i];
+
+        strcpy_s(entry->Target, _countof(entry->Target), mapping->Target);
+        strcpy_s(entry->DeviceName, _countof(entry->DeviceName), mapping->DeviceName);
+        strcpy_s(entry->SerialNumber, _countof(entry->SerialNumber), mapping->SerialNumber);
+        entry->DriveLetter = mapping->DriveLetter;
+        entry->MountPoint = StatusHasMountPoint(entry, logicalDrives);
+    }
+
+    report->MappingCount = table->MappingCount;
+
+    // Matched up by serial number, the one thing about a drive that doesn't move.
+    for (drive = sources->DriveList; drive != NULL && report->DriveCount < sources->DriveCount; drive = drive->Next)
+    {
+        PSTATUS_DRIVE entry = &report->Drives[report->DriveCount++];
+        PLTFS_MAPPING mapping;
+
+        entry->Drive = *drive;
+        entry->Drive.Next = NULL;
+        _snprintf_s(entry->DeviceName, _countof(entry->DeviceName), _TRUNCATE, "TAPE%d", drive->DevIndex);
+
+        for (mapping = MappingFindBySerial(table, (char *)drive->SerialNumber); mapping != NULL; mapping = mapping->NextSameSerial)
+        {
+            PSTATUS_MAPPING mapped = &report->Mappings[mapping - table->Mappings];
+
+            mapped->Attached = TRUE;
+            strcpy_s(mapped->AttachedAs, _countof(mapped->AttachedAs), entry->DeviceName);
+            entry->MappingCount++;
+        }
+
+        if (!entry->MappingCount)
+            report->UnmappedDrives++;
+    }
+
+    // A mapping that's gone from the registry since being checked doesn't match anything and drops out here.
+    for (i = 0; sources->MediaValid && i < sources->MediaCount; i++)
+    {
+        for (j = 0; j < report->MappingCount; j++)
+        {
+            if (!_stricmp(report->Mappings[j].Target, sources->MediaList[i].Target))
+            {
+                report->Mappings[j].MediaValid = TRUE;
+                report->Mappings[j].Media = sources->MediaList[i];
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < report->MappingCount; i++)
+    {
+        report->Mappings[i].MountState = StatusMountState(report, &report->Mappings[i]);
+
+        if (report->Mappings[i].MountState == STATUS_MOUNT_READY)
+            report->ReadyCount++;
+    }
+
+    return TRUE;
+}
+
+static BOOL StatusHasMountPoint(PSTATUS_MAPPING mapping, DWORD logicalDrives)
+{
+    DWORD attributes;
+
+    // Not PollFileSystem, opening the volume is what gets LTFS to go and read the tape.
+    if (mapping->DriveLetter)
+        return (logicalDrives & (1 << (mapping->DriveLetter - 'A'))) != 0;
+
+    // A volume mounted on a directory shows up as a reparse point on it.
+    attributes = GetFileAttributes(mapping->Target);
+
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_REPARSE_POINT);
+}
+
+// Worst first, so each mapping gets the one thing standing between it and a mount.
+
+static DWORD StatusMountState(PSTATUS_REPORT report, PSTATUS_MAPPING mapping)
+{
+    if (!mapping->Attached)
+        return STATUS_MOUNT_NOT_ATTACHED;
+
+    if (!report->ServiceValid || report->ServiceState != SERVICE_RUNNING)
+        return STATUS_MOUNT_SERVICE_DOWN;
+
+    // The service opens the device name it was given at start up, which now belongs to another drive or none.
+    if (strcmp(mapping->DeviceName, mapping->AttachedAs) != 0)
+        return STATUS_MOUNT_MOVED;
+
+    if (!mapping->MountPoint)
+        return STATUS_MOUNT_NO_MOUNT_POINT;
+
+    if (mapping->MediaValid && mapping->Media.Busy)
+        return STATUS_MOUNT_IN_USE;
+
+    if (!mapping->MediaValid || !mapping->Media.Checked)
+        return STATUS_MOUNT_MEDIA_UNKNOWN;
+
+    if (!mapping->Media.Loaded)
+        return STATUS_MOUNT_NO_TAPE;
+
+    return STATUS_MOUNT_READY;
+}
@@ -0,0 +1,73 @@
+/*
+ *   File:   status.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+#include "ltfsreg.h"
+#include "tape.h"
+#include "media.h"
+
+#define STATUS_MOUNT_READY          0   // Attached, service running, tape in and nothing using it
+#define STATUS_MOUNT_IN_USE         1   // Something has the drive open, a mounted volume as often as not
+#define STATUS_MOUNT_NO_TAPE        2
+#define STATUS_MOUNT_MEDIA_UNKNOWN  3   // Couldn't be checked, or mounted on a directory where it isn't
+#define STATUS_MOUNT_NO_MOUNT_POINT 4   // Service is running but hasn't put the letter or directory up
+#define STATUS_MOUNT_MOVED          5   // Attached, but not as the device name the service was given
+#define STATUS_MOUNT_SERVICE_DOWN   6
+#define STATUS_MOUNT_NOT_ATTACHED   7   // No drive with the mapping's serial number
+
+typedef struct STATUS_DRIVE
+{
+    TAPE_DRIVE Drive;
+    CHAR DeviceName[MAX_DEVICE_NAME];
+    DWORD MappingCount;
+} STATUS_DRIVE, *PSTATUS_DRIVE;
+
+typedef struct STATUS_MAPPING
+{
+    CHAR Target[MAX_MOUNT_TARGET];
+    CHAR DriveLetter;
+    CHAR DeviceName[MAX_DEVICE_NAME];   // As the service was given it
+    CHAR SerialNumber[MAX_SERIAL_NUMBER];
+    BOOL Attached;
+    CHAR AttachedAs[MAX_DEVICE_NAME];   // What the drive with that serial is called now
+    BOOL MountPoint;
+    BOOL MediaValid;
+    MEDIA_STATUS Media;
+    DWORD MountState;
+} STATUS_MAPPING, *PSTATUS_MAPPING;
+
+typedef struct STATUS_REPORT
+{
+    BOOL DrivesValid;
+    PSTATUS_DRIVE Drives;
+    DWORD DriveCount;
+    DWORD UnmappedDrives;
+    BOOL ServiceValid;
+    DWORD ServiceState;
+    PSTATUS_MAPPING Mappings;
+    DWORD MappingCount;
+    DWORD ReadyCount;
+    ULONGLONG ElapsedMs;
+    ULONGLONG AgeSeconds;               // Zero unless it's come off the status board
+} STATUS_REPORT, *PSTATUS_REPORT;
+
+BOOL StatusCollect(DWORD maxAge, PSTATUS_REPORT *report);
+void StatusDestroy(PSTATUS_REPORT report);
+LPCSTR StatusMountStateName(DWORD mountState);
@@ -18,17 +18,66 @@
 
 #include "pch.h"
 #include "tape.h"
+#include "crc32c.h"
 
 #define TC_MP_PC_CURRENT                 0x00
 #define TC_MP_PC_CHANGEABLE              0x40
 
 #define TC_MP_MEDIUM_CONFIGURATION       0x1D
-#define TC_MP_MEDIUM_PARTITION           0x11
 #define TC_MP_MEDIUM_PARTITION_SIZE      28
+#define TC_MP_CONTROL                    0x0A
+#define TC_MP_SUB_DATA_PROTECTION        0xF0
+#define TC_MP_SPF                        0x40
+#define TC_MP_DATA_COMPRESSION           0x0F
+#define TC_MP_DCE                        0x80
+#define TC_MP_DDE                        0x80
+
+#define TC_LBP_METHOD_CRC32C             0x02
+#define TC_LBP_W                         0x80
+#define TC_LBP_R                         0x40
 
 #define SENSE_INFO_LEN                   64
 
-static BOOL ScsiIoControl(HANDLE hFile, DWORD deviceNumber, PVOID cdb, UCHAR cdbLength, PVOID dataBuffer, USHORT bufferLength, BYTE dataIn, ULONG timeoutValue, PVOID senseBuffer);
+#define TC_SENSE_FILEMARK                0x80
+#define TC_SENSE_EOM                     0x40
+#define TC_SENSE_ILI                     0x20
+
+#define TC_READ_POSITION_LONG            0x06
+#define TC_READ_POSITION_LONG_LEN        32
+
+#define TC_TIMEOUT_SHORT                 60
+#define TC_TIMEOUT_LOCATE                1800
+#define TC_TIMEOUT_READ_WRITE            900
+
+#define TC_ATTRIBUTE_HEADER_LEN          4
+#define TC_ATTRIBUTE_ENTRY_HEADER_LEN    5
+#define TC_ATTRIBUTE_REMAINING_CAPACITY  0x0000
+#define TC_ATTRIBUTE_MAXIMUM_CAPACITY    0x0001
+
+#define TC_LP_PC_CUMULATIVE              0x40
+#define TC_LP_TAPE_CAPACITY              0x31
+#define TC_LP_DATA_COMPRESSION           0x1B
+#define TC_LP_HEADER_LEN                 4
+#define TC_LP_PARAMETER_HEADER_LEN       4
+#define TC_LP_READ_COMPRESSION_RATIO     0x0000
+#define TC_LP_WRITE_COMPRESSION_RATIO    0x0001
+#define TC_LP_MB_TO_HOST                 0x0002
+#define TC_LP_MB_READ_FROM_TAPE          0x0004
+#define TC_LP_MB_FROM_HOST               0x0006
+#define TC_LP_MB_WRITTEN_TO_TAPE         0x0008
+
+static BOOL ScsiIoControl(HANDLE hFile, DWORD deviceNumber, PVOID cdb, UCHAR cdbLength, PVOID dataBuffer, ULONG bufferLength, BYTE dataIn, ULONG timeoutValue, PVOID senseBuffer, PUCHAR scsiStatus);
+static BOOL TapeCommand(HANDLE handle, PVOID cdb, UCHAR cdbLength, PVOID dataBuffer, ULONG bufferLength, BYTE dataIn, ULONG timeoutValue, PTAPE_SENSE sense);
+static BOOL TapeLogSense(HANDLE handle, BYTE pageCode, PBYTE dataBuffer, USHORT bufferLength);
+static BOOL TapeLogParameter(PBYTE page, USHORT bufferLength, USHORT parameterCode, PULONGLONG value);
+static ULONGLONG TapeLogByteCount(PBYTE page, USHORT bufferLength, USHORT megabyteParameter);
+static BOOL TapeSenseCompressionPage(HANDLE handle, PBYTE dataBuffer, USHORT bufferLength, PBYTE *page);
+static BOOL TapeQueryDescriptor(HANDLE handle, PTAPE_DRIVE drive);
+static BOOL TapeQueryString(PBYTE descriptor, DWORD descriptorLength, DWORD offset, LPSTR value, size_t valueLength);
+static BOOL TapeInquiryIdentity(HANDLE handle, DWORD deviceNumber, PTAPE_DRIVE drive);
+static BOOL TapeInquirySerial(HANDLE handle, DWORD deviceNumber, LPSTR serialNumber, size_t serialNumberLength);
+static BOOL TapeGetScsiAddress(HANDLE handle, PTAPE_SCSI_ADDRESS address);
+static BOOL TapePathBusy(LPCSTR devicePath);
 
 BOOL TapeGetDriveList(PTAPE_DRIVE *driveList, PDWORD numDrivesFound)
 {
@@ -56,92 +105,23 @@ BOOL TapeGetDriveList(PTAPE_DRIVE *driveList, PDWORD numDrivesFound)
 
                 if (SetupDiGetDeviceInterfaceDetail(devInfo, &devData, devDetail, dwRequiredSize, &dwRequiredSize, NULL) == TRUE)
                 {
-                    HANDLE handle = CreateFile(devDetail->DevicePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
-                    if (handle != INVALID_HANDLE_VALUE)
+                    PTAPE_DRIVE driveData = (PTAPE_DRIVE)LocalAlloc(LMEM_FIXED, sizeof(TAPE_DRIVE));
+
+                    if (driveData && TapeDescribeDevice(devDetail->DevicePath, driveData))
                     {
-                        BOOL result = FALSE;
-                        BYTE dataBuffer[1024];
-                        BYTE cdb[6];
-                        STORAGE_DEVICE_NUMBER devNum;
-
-                        PTAPE_DRIVE driveData = (PTAPE_DRIVE)LocalAlloc(LMEM_FIXED, sizeof(TAPE_DRIVE));
-                        driveData->Next = NULL;
-
-                        DWORD lpBytesReturned;
-                        result = DeviceIoControl(handle, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0, &devNum, sizeof(STORAGE_DEVICE_NUMBER), &lpBytesReturned, NULL);
-
-                        driveData->DevIndex = devNum.DeviceNumber;
-
-                        if (result)
-                        {
-                            memset(dataBuffer, 0, sizeof(dataBuffer));
-                            memset(cdb, 0, sizeof(cdb));
-
-                            ((PCDB)(cdb))->CDB6INQUIRY.OperationCode = SCSIOP_INQUIRY;
-                            ((PCDB)(cdb))->CDB6INQUIRY.IReserved = 4;
-
-                            result = ScsiIoControl(handle, devNum.DeviceNumber, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 10, NULL);
-
-                            if (result)
-                            {
-                                PINQUIRYDATA inquiryResult = (PINQUIRYDATA)dataBuffer;
-                                strncpy_s((char *)driveData->VendorId, sizeof(driveData->VendorId), (char *)inquiryResult->VendorId, MEMBER_SIZE(INQUIRYDATA, VendorId));
-                                strncpy_s((char *)driveData->ProductId, sizeof(driveData->ProductId), (char *)inquiryResult->ProductId, MEMBER_SIZE(INQUIRYDATA, ProductId));
-                            }
-                        }
-
-                        if (result)
-                        {
-                            memset(dataBuffer, 0, sizeof(dataBuffer));
-                            memset(cdb, 0, sizeof(cdb));
-
-                            ((PCDB)(cdb))->CDB6INQUIRY.OperationCode = SCSIOP_INQUIRY;
-                            ((PCDB)(cdb))->CDB6INQUIRY.IReserved = 4;
-                            ((PCDB)(cdb))->CDB6INQUIRY.PageCode = 0x80;
-                            ((PCDB)(cdb))->CDB6INQUIRY.Reserved1 = 1;
-
-                            BOOL result = ScsiIoControl(handle, devNum.DeviceNumber, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 10, NULL);
-
-                            if (result)
-                            {
-                                PVPD_SERIAL_NUMBER_PAGE inquiryResult = (PVPD_SERIAL_NUMBER_PAGE)dataBuffer;
-                                strncpy_s((char *)driveData->SerialNumber, sizeof(driveData->SerialNumber), (char *)inquiryResult->SerialNumber, inquiryResult->PageLength);
-                            }
-                        }
-
-                        if (result)
-                        {
-                            memset(dataBuffer, 0, sizeof(dataBuffer));
-                            memset(cdb, 0, sizeof(cdb));
-
-                            ((PCDB)(cdb))->MODE_SENSE.OperationCode = SCSIOP_MODE_SENSE;
-                            ((PCDB)(cdb))->MODE_SENSE.PageCode = TC_MP_MEDIUM_PARTITION;
-                            ((PCDB)(cdb))->MODE_SENSE.AllocationLength = 255;
-
-                            BOOL result = ScsiIoControl(handle, devNum.DeviceNumber, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 10, NULL);
-
-                            // Fuck knows. LTFSConfigurator.exe performs this operation (and others), which it appears may be able to tell us whether or not the 
-                            // drive is compatible with LTFS. I have yet to figure out how to parse this data to perform this test, so we're not doing it at present.
-                        }
-
-                        if (result)
-                        {
-                            if (listLast)
-                                listLast->Next = driveData;
-
-                            if (listHead == NULL)
-                                listHead = driveData;
-
-                            listLast = driveData;
-                            devsFound++;
-                        }
-                        else
-                        {
-                            LocalFree(driveData);
-                        }
-                    }
+                        if (listLast)
+                            listLast->Next = driveData;
 
-                    CloseHandle(handle);
+                        if (listHead == NULL)
+                            listHead = driveData;
+
+                        listLast = driveData;
+                        devsFound++;
+                    }
+                    else if (driveData)
+                    {
+                        LocalFree(driveData);
+                    }
                 }
 
                 LocalFree(devDetail);
@@ -172,7 +152,203 @@ void TapeDestroyDriveList(PTAPE_DRIVE driveList)
     }
 }
 
-BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len)
+BOOL TapeIdentify(LPCSTR tapeDrive, LPSTR serialNumber, size_t serialNumberLength, PTAPE_SCSI_ADDRESS address, LPSTR productId, size_t productIdLength)
+{
+    CHAR drivePath[64];
+    TAPE_DRIVE drive;
+
+    _snprintf_s(drivePath, _countof(drivePath), _TRUNCATE, "\\\\.\\%s", tapeDrive);
+
+    if (!TapeDescribeDevice(drivePath, &drive))
+        return FALSE;
+
+    if (address)
+        *address = drive.Address;
+
+    if (productId && strcpy_s(productId, productIdLength, (char *)drive.ProductId) != 0)
+        return FALSE;
+
+    return strcpy_s(serialNumber, serialNumberLength, (char *)drive.SerialNumber) == 0;
+}
+
+BOOL TapeFindDrive(LPCSTR serialNumber, PTAPE_SCSI_ADDRESS addressHint, LPSTR tapeDrive, size_t tapeDriveLength, PTAPE_SCSI_ADDRESS address)
+{
+    HDEVINFO devInfo = SetupDiGetClassDevs(&GUID_DEVINTERFACE_TAPE, NULL, NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT);
+    SP_DEVICE_INTERFACE_DATA devData;
+    BOOL found = FALSE;
+    DWORD pass;
+
+    if (devInfo == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    if (addressHint && !addressHint->Valid)
+        addressHint = NULL;
+
+    // The first pass only looks at whatever is sat where the drive was last seen, which is nearly always it. Everything
+    // else is looked at on the second pass, should the drive have gone somewhere else entirely. Most drivers can answer
+    // for the drive without troubling it, but some can't, and then a library full of busy drives would get an INQUIRY
+    // each every time one of them moved.
+    for (pass = addressHint ? 0 : 1; pass < 2 && !found; pass++)
+    {
+        DWORD devIndex;
+
+        devData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+        for (devIndex = 0; !found && SetupDiEnumDeviceInterfaces(devInfo, NULL, &GUID_DEVINTERFACE_TAPE, devIndex, &devData); devIndex++)
+        {
+            PSP_DEVICE_INTERFACE_DETAIL_DATA devDetail;
+            TAPE_DRIVE drive;
+            DWORD requiredSize = 0;
+            BOOL atHint;
+
+            SetupDiGetDeviceInterfaceDetail(devInfo, &devData, NULL, 0, &requiredSize, NULL);
+
+            if (!requiredSize || !(devDetail = (PSP_DEVICE_INTERFACE_DETAIL_DATA)LocalAlloc(LMEM_FIXED, requiredSize)))
+                continue;
+
+            devDetail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+
+            if (SetupDiGetDeviceInterfaceDetail(devInfo, &devData, devDetail, requiredSize, &requiredSize, NULL))
+            {
+                HANDLE handle = CreateFile(devDetail->DevicePath, 0, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+                TAPE_SCSI_ADDRESS devAddress;
+
+                memset(&devAddress, 0, sizeof(devAddress));
+
+                // Where it is comes first, that's always a question for the HBA driver.
+                if (handle != INVALID_HANDLE_VALUE)
+                {
+                    TapeGetScsiAddress(handle, &devAddress);
+                    CloseHandle(handle);
+                }
+
+                atHint = addressHint && devAddress.Valid &&
+                    devAddress.PortNumber == addressHint->PortNumber && devAddress.PathId == addressHint->PathId &&
+                    devAddress.TargetId == addressHint->TargetId && devAddress.Lun == addressHint->Lun;
+
+                if ((pass == 0) == atHint && TapeDescribeDevice(devDetail->DevicePath, &drive) && strcmp((char *)drive.SerialNumber, serialNumber) == 0)
+                {
+                    _snprintf_s(tapeDrive, tapeDriveLength, _TRUNCATE, "TAPE%d", drive.DevIndex);
+
+                    if (address)
+                        *address = drive.Address;
+
+                    found = TRUE;
+                }
+            }
+
+            LocalFree(devDetail);
+        }
+    }
+
+    SetupDiDestroyDeviceInfoList(devInfo);
+
+    return found;
+}
+
+// Listing drives used to mean an INQUIRY to every one of them, which a drive busy writing for LTFS has to stop and
+// answer, and which can't be sent at all while LTFS has it open exclusively. The storage stack already asked each drive
+// the same questions when it found it, and will hand the answers out to anyone who opens the device without asking for
+// any access. So that's what's done, and the drive itself is only asked when its driver didn't keep the answers.
+
+BOOL TapeDescribeDevice(LPCSTR devicePath, PTAPE_DRIVE drive)
+{
+    STORAGE_DEVICE_NUMBER devNum;
+    DWORD bytesReturned;
+    HANDLE handle;
+    BOOL described = FALSE;
+    BOOL result;
+
+    memset(drive, 0, sizeof(TAPE_DRIVE));
+
+    handle = CreateFile(devicePath, 0, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    result = DeviceIoControl(handle, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0, &devNum, sizeof(STORAGE_DEVICE_NUMBER), &bytesReturned, NULL);
+
+    if (result)
+    {
+        drive->DevIndex = devNum.DeviceNumber;
+        TapeGetScsiAddress(handle, &drive->Address);
+        described = TapeQueryDescriptor(handle, drive);
+    }
+
+    CloseHandle(handle);
+
+    if (!result)
+        return FALSE;
+
+    if (described)
+        return TRUE;
+
+    // An INQUIRY would go in between whatever the drive is doing for someone else, so it waits until they're done.
+    if (TapePathBusy(devicePath))
+        return FALSE;
+
+    handle = CreateFile(devicePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    result = TapeInquiryIdentity(handle, devNum.DeviceNumber, drive);
+
+    CloseHandle(handle);
+
+    return result;
+}
+
+BOOL TapeIsBusy(LPCSTR tapeDrive)
+{
+    CHAR drivePath[64];
+
+    _snprintf_s(drivePath, _countof(drivePath), _TRUNCATE, "\\\\.\\%s", tapeDrive);
+
+    return TapePathBusy(drivePath);
+}
+
+// The class driver counts every medium change the drive reports, whichever command it was reported to. Getting the count
+// costs a TEST UNIT READY at most, and works on a handle with no access, same as describing the drive.
+
+BOOL TapeGetMediaChangeCount(LPCSTR tapeDrive, PULONG changeCount, PBOOL loaded)
+{
+    CHAR drivePath[64];
+    DWORD bytesReturned = 0;
+    HANDLE handle;
+    BOOL result;
+    DWORD error;
+
+    _snprintf_s(drivePath, _countof(drivePath), _TRUNCATE, "\\\\.\\%s", tapeDrive);
+
+    handle = CreateFile(drivePath, 0, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    *changeCount = 0;
+    result = DeviceIoControl(handle, IOCTL_STORAGE_CHECK_VERIFY2, NULL, 0, changeCount, sizeof(ULONG), &bytesReturned, NULL);
+    error = GetLastError();
+
+    CloseHandle(handle);
+
+    if (result)
+    {
+        *loaded = TRUE;
+        return bytesReturned >= sizeof(ULONG);
+    }
+
+    // No tape is an answer as well.
+    if (error == ERROR_NOT_READY || error == ERROR_NO_MEDIA_IN_DRIVE)
+    {
+        *loaded = FALSE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len, PTAPE_CAPACITY capacity)
 {
     CHAR drivePath[64];
     HANDLE handle;
@@ -181,6 +357,9 @@ BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len)
     BYTE dataBuffer[64];
     BYTE senseBuffer[SENSE_INFO_LEN];
 
+    if (capacity)
+        memset(capacity, 0, sizeof(TAPE_CAPACITY));
+
     _snprintf_s(drivePath, _countof(drivePath), _TRUNCATE, "\\\\.\\%s", tapeDrive);
 
     handle = CreateFile(drivePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
@@ -198,7 +377,7 @@ BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len)
     ((PCDB)(cdb))->READ_POSITION.Operation = SCSIOP_READ_POSITION;
     ((PCDB)(cdb))->READ_POSITION.Reserved1 = 0x03;
 
-    result = ScsiIoControl(handle, 0, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 300, senseBuffer);
+    result = ScsiIoControl(handle, 0, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 300, senseBuffer, NULL);
 
     if (!result)
     {
@@ -224,7 +403,7 @@ BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len)
     ((PCDB)(cdb))->MODE_SENSE10.AllocationLength[0] = sizeof(dataBuffer) >> 8;
     ((PCDB)(cdb))->MODE_SENSE10.AllocationLength[1] = sizeof(dataBuffer) & 0xFF;
 
-    result = ScsiIoControl(handle, 0, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 300, NULL);
+    result = ScsiIoControl(handle, 0, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 300, NULL, NULL);
 
     if (result)
     {
@@ -304,6 +483,11 @@ BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len)
         }
     }
 
+    // Also fine with a mounted volume, and a lot quicker than mounting one to ask Windows how full it is. Not every
+    // drive has the page, so the media check doesn't fail over it.
+    if (result && capacity)
+        TapeReadCapacity(handle, capacity);
+
     CloseHandle(handle);
 
     return result;
@@ -328,7 +512,7 @@ BOOL TapeLoad(LPCSTR tapeDrive)
     ((PCDB)(cdb))->START_STOP.OperationCode = SCSIOP_LOAD_UNLOAD;
     ((PCDB)(cdb))->START_STOP.Start = 1;
 
-    result = ScsiIoControl(handle, 0, cdb, sizeof(cdb), NULL, 0, SCSI_IOCTL_DATA_UNSPECIFIED, 300, NULL);
+    result = ScsiIoControl(handle, 0, cdb, sizeof(cdb), NULL, 0, SCSI_IOCTL_DATA_UNSPECIFIED, 300, NULL, NULL);
     
     CloseHandle(handle);
 
@@ -367,7 +551,767 @@ BOOL TapeEject(LPCSTR tapeDrive)
 }
 
 
-static BOOL ScsiIoControl(HANDLE hFile, DWORD deviceNumber, PVOID cdb, UCHAR cdbLength, PVOID dataBuffer, USHORT bufferLength, BYTE dataIn, ULONG timeoutValue, PVOID senseBuffer)
+HANDLE TapeOpen(LPCSTR tapeDrive)
+{
+    CHAR drivePath[64];
+
+    _snprintf_s(drivePath, _countof(drivePath), _TRUNCATE, "\\\\.\\%s", tapeDrive);
+
+    return CreateFile(drivePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+}
+
+BOOL TapeLocate(HANDLE handle, BYTE destType, DWORD partition, ULONGLONG block, PTAPE_SENSE sense)
+{
+    BYTE cdb[16];
+    int i;
+
+    memset(cdb, 0, sizeof(cdb));
+
+    // LOCATE(16). Always set CP, the partition is cheap to restate and saves us tracking it.
+    cdb[0] = SCSIOP_LOCATE16;
+    cdb[1] = (BYTE)((destType << 3) | 0x02);
+    cdb[3] = (BYTE)partition;
+
+    for (i = 0; i < 8; i++)
+        cdb[4 + i] = (BYTE)(block >> (56 - (i * 8)));
+
+    return TapeCommand(handle, cdb, sizeof(cdb), NULL, 0, SCSI_IOCTL_DATA_UNSPECIFIED, TC_TIMEOUT_LOCATE, sense);
+}
+
+BOOL TapeReadPosition(HANDLE handle, PTAPE_POSITION position, PTAPE_SENSE sense)
+{
+    BYTE cdb[10];
+    BYTE dataBuffer[TC_READ_POSITION_LONG_LEN];
+    BOOL result;
+    int i;
+
+    memset(cdb, 0, sizeof(cdb));
+    memset(dataBuffer, 0, sizeof(dataBuffer));
+
+    cdb[0] = SCSIOP_READ_POSITION;
+    cdb[1] = TC_READ_POSITION_LONG;
+
+    result = TapeCommand(handle, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, TC_TIMEOUT_SHORT, sense);
+
+    if (result)
+    {
+        memset(position, 0, sizeof(TAPE_POSITION));
+
+        position->BeginningOfPartition = (dataBuffer[0] & 0x80) != 0;
+        position->EndOfPartition = (dataBuffer[0] & 0x40) != 0;
+        position->Partition = ((DWORD)dataBuffer[4] << 24) | ((DWORD)dataBuffer[5] << 16) | ((DWORD)dataBuffer[6] << 8) | dataBuffer[7];
+
+        for (i = 0; i < 8; i++)
+        {
+            position->Block = (position->Block << 8) | dataBuffer[8 + i];
+            position->File = (position->File << 8) | dataBuffer[16 + i];
+            position->Set = (position->Set << 8) | dataBuffer[24 + i];
+        }
+    }
+
+    return result;
+}
+
+BOOL TapeRead(HANDLE handle, PVOID buffer, ULONG bufferLength, PULONG bytesRead, PTAPE_SENSE sense)
+{
+    BYTE cdb[6];
+    TAPE_SENSE localSense;
+    BOOL result;
+
+    if (!sense)
+        sense = &localSense;
+
+    memset(cdb, 0, sizeof(cdb));
+
+    // Variable block mode, one block per command. SILI is left clear so that a short block is reported to us
+    // with the residue in the information field, which is how we find out how long the block actually was.
+    cdb[0] = SCSIOP_READ6;
+    cdb[2] = (BYTE)(bufferLength >> 16);
+    cdb[3] = (BYTE)(bufferLength >> 8);
+    cdb[4] = (BYTE)bufferLength;
+
+    result = TapeCommand(handle, cdb, sizeof(cdb), buffer, bufferLength, SCSI_IOCTL_DATA_IN, TC_TIMEOUT_READ_WRITE, sense);
+
+    *bytesRead = result ? bufferLength : 0;
+
+    if (!result && sense->ScsiStatus == SCSISTAT_CHECK_CONDITION)
+    {
+        if (sense->IncorrectLength && sense->Information > 0 && !sense->Filemark)
+        {
+            // Short block. Anything else with ILI set means the block didn't fit in the buffer, which is an error.
+            *bytesRead = bufferLength - (ULONG)sense->Information;
+            result = (sense->SenseKey == SCSI_SENSE_NO_SENSE);
+        }
+    }
+
+    return result;
+}
+
+BOOL TapeSetProtection(HANDLE handle, BOOL enable, PBOOL wasEnabled)
+{
+    BYTE cdb[10];
+    BYTE dataBuffer[64];
+    PBYTE page;
+    USHORT pageOffset;
+    USHORT parameterLength;
+    BOOL result;
+
+    memset(cdb, 0, sizeof(cdb));
+    memset(dataBuffer, 0, sizeof(dataBuffer));
+
+    // Control Data Protection is a subpage of the Control page, so the subpage code has to go in by hand.
+    cdb[0] = SCSIOP_MODE_SENSE10;
+    cdb[1] = 0x08;
+    cdb[2] = TC_MP_PC_CURRENT | TC_MP_CONTROL;
+    cdb[3] = TC_MP_SUB_DATA_PROTECTION;
+    cdb[7] = sizeof(dataBuffer) >> 8;
+    cdb[8] = sizeof(dataBuffer) & 0xFF;
+
+    result = TapeCommand(handle, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, TC_TIMEOUT_SHORT, NULL);
+
+    if (!result)
+        return FALSE;
+
+    pageOffset = 8 + (((USHORT)dataBuffer[6] << 8) | dataBuffer[7]);
+    page = dataBuffer + pageOffset;
+
+    if (pageOffset + 8 > sizeof(dataBuffer) || (page[0] & 0x3F) != TC_MP_CONTROL || page[1] != TC_MP_SUB_DATA_PROTECTION)
+        return FALSE;
+
+    if (wasEnabled)
+        *wasEnabled = page[4] == TC_LBP_METHOD_CRC32C && (page[6] & (TC_LBP_W | TC_LBP_R)) == (TC_LBP_W | TC_LBP_R);
+
+    // CRC32C, four bytes on the end of every block, checked by the drive on write and sent to us on read.
+    page[0] &= 0x7F;
+    page[4] = enable ? TC_LBP_METHOD_CRC32C : 0;
+    page[5] = enable ? TAPE_LBP_LENGTH : 0;
+    page[6] = enable ? (TC_LBP_W | TC_LBP_R) : 0;
+
+    // Mode data length is reserved for MODE SELECT.
+    dataBuffer[0] = 0;
+    dataBuffer[1] = 0;
+
+    parameterLength = pageOffset + 4 + (((USHORT)page[2] << 8) | page[3]);
+
+    // Only what was sensed can go back, and half a page would be refused anyway.
+    if (parameterLength > sizeof(dataBuffer))
+        return FALSE;
+
+    memset(cdb, 0, sizeof(cdb));
+
+    cdb[0] = SCSIOP_MODE_SELECT10;
+    cdb[1] = 0x10;
+    cdb[7] = (BYTE)(parameterLength >> 8);
+    cdb[8] = (BYTE)parameterLength;
+
+    return TapeCommand(handle, cdb, sizeof(cdb), dataBuffer, parameterLength, SCSI_IOCTL_DATA_OUT, TC_TIMEOUT_SHORT, NULL);
+}
+
+BOOL TapeReadProtected(HANDLE handle, PVOID buffer, ULONG bufferLength, PULONG bytesRead, PTAPE_SENSE sense)
+{
+    TAPE_SENSE localSense;
+    ULONG dataLength;
+    DWORD expected;
+    PBYTE crc;
+    BOOL result;
+
+    if (!sense)
+        sense = &localSense;
+
+    // With LBP on, every block comes with its CRC on the end, so the buffer has to have room for it.
+    result = TapeRead(handle, buffer, bufferLength, bytesRead, sense);
+
+    if (!result)
+        return FALSE;
+
+    if (*bytesRead < TAPE_LBP_LENGTH)
+    {
+        sense->ProtectionError = TRUE;
+        return FALSE;
+    }
+
+    dataLength = *bytesRead - TAPE_LBP_LENGTH;
+    crc = (PBYTE)buffer + dataLength;
+    expected = (DWORD)crc[0] | ((DWORD)crc[1] << 8) | ((DWORD)crc[2] << 16) | ((DWORD)crc[3] << 24);
+
+    if (Crc32c(0, buffer, dataLength) != expected)
+    {
+        sense->ProtectionError = TRUE;
+        return FALSE;
+    }
+
+    *bytesRead = dataLength;
+    return TRUE;
+}
+
+BOOL TapeSpace(HANDLE handle, BYTE code, LONG count, PTAPE_SENSE sense)
+{
+    BYTE cdb[6];
+
+    memset(cdb, 0, sizeof(cdb));
+
+    cdb[0] = SCSIOP_SPACE;
+    cdb[1] = code & 0x0F;
+    cdb[2] = (BYTE)(count >> 16);
+    cdb[3] = (BYTE)(count >> 8);
+    cdb[4] = (BYTE)count;
+
+    return TapeCommand(handle, cdb, sizeof(cdb), NULL, 0, SCSI_IOCTL_DATA_UNSPECIFIED, TC_TIMEOUT_LOCATE, sense);
+}
+
+BOOL TapeWrite(HANDLE handle, PVOID buffer, ULONG bufferLength, PTAPE_SENSE sense)
+{
+    BYTE cdb[6];
+    TAPE_SENSE localSense;
+    BOOL result;
+
+    if (!sense)
+        sense = &localSense;
+
+    memset(cdb, 0, sizeof(cdb));
+
+    // Variable block mode, one block per command, same as TapeRead.
+    cdb[0] = SCSIOP_WRITE6;
+    cdb[2] = (BYTE)(bufferLength >> 16);
+    cdb[3] = (BYTE)(bufferLength >> 8);
+    cdb[4] = (BYTE)bufferLength;
+
+    result = TapeCommand(handle, cdb, sizeof(cdb), buffer, bufferLength, SCSI_IOCTL_DATA_OUT, TC_TIMEOUT_READ_WRITE, sense);
+
+    // Early warning. The block was written, the caller can check EndOfMedium if it cares.
+    if (!result && sense->ScsiStatus == SCSISTAT_CHECK_CONDITION && sense->SenseKey == SCSI_SENSE_NO_SENSE && sense->EndOfMedium)
+        result = TRUE;
+
+    return result;
+}
+
+BOOL TapeWriteFilemarks(HANDLE handle, LONG count, PTAPE_SENSE sense)
+{
+    BYTE cdb[6];
+    TAPE_SENSE localSense;
+    BOOL result;
+
+    if (!sense)
+        sense = &localSense;
+
+    memset(cdb, 0, sizeof(cdb));
+
+    // Immed clear, so anything still buffered is on tape by the time this returns.
+    cdb[0] = SCSIOP_WRITE_FILEMARKS;
+    cdb[2] = (BYTE)(count >> 16);
+    cdb[3] = (BYTE)(count >> 8);
+    cdb[4] = (BYTE)count;
+
+    result = TapeCommand(handle, cdb, sizeof(cdb), NULL, 0, SCSI_IOCTL_DATA_UNSPECIFIED, TC_TIMEOUT_READ_WRITE, sense);
+
+    if (!result && sense->ScsiStatus == SCSISTAT_CHECK_CONDITION && sense->SenseKey == SCSI_SENSE_NO_SENSE && sense->EndOfMedium)
+        result = TRUE;
+
+    return result;
+}
+
+BOOL TapeTestUnitReady(HANDLE handle, PTAPE_SENSE sense)
+{
+    BYTE cdb[6];
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = SCSIOP_TEST_UNIT_READY;
+
+    return TapeCommand(handle, cdb, sizeof(cdb), NULL, 0, SCSI_IOCTL_DATA_UNSPECIFIED, TC_TIMEOUT_SHORT, sense);
+}
+
+BOOL TapeUnload(HANDLE handle)
+{
+    BYTE cdb[6];
+
+    memset(cdb, 0, sizeof(cdb));
+
+    // Same as TapeLoad with the load bit clear. Only for use when the filesystem isn't mounted, otherwise use TapeEject.
+    ((PCDB)(cdb))->START_STOP.OperationCode = SCSIOP_LOAD_UNLOAD;
+
+    return TapeCommand(handle, cdb, sizeof(cdb), NULL, 0, SCSI_IOCTL_DATA_UNSPECIFIED, 300, NULL);
+}
+
+BOOL TapeReadAttribute(HANDLE handle, DWORD partition, USHORT attributeId, PBYTE value, USHORT valueLength, PUSHORT actualLength)
+{
+    BYTE cdb[16];
+    BYTE dataBuffer[512];
+    USHORT attributeLength;
+    BOOL result;
+
+    memset(cdb, 0, sizeof(cdb));
+    memset(dataBuffer, 0, sizeof(dataBuffer));
+
+    // READ ATTRIBUTE, service action 0 (attribute values), starting at the one we want.
+    cdb[0] = SCSIOP_READ_ATTRIBUTES;
+    cdb[7] = (BYTE)partition;
+    cdb[8] = (BYTE)(attributeId >> 8);
+    cdb[9] = (BYTE)attributeId;
+    cdb[12] = sizeof(dataBuffer) >> 8;
+    cdb[13] = sizeof(dataBuffer) & 0xFF;
+
+    result = TapeCommand(handle, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, TC_TIMEOUT_SHORT, NULL);
+
+    if (result)
+    {
+        PBYTE attribute = dataBuffer + TC_ATTRIBUTE_HEADER_LEN;
+
+        result = ((USHORT)attribute[0] << 8 | attribute[1]) == attributeId;
+        attributeLength = (USHORT)attribute[3] << 8 | attribute[4];
+
+        if (result)
+        {
+            attributeLength = min(attributeLength, (USHORT)(sizeof(dataBuffer) - TC_ATTRIBUTE_HEADER_LEN - TC_ATTRIBUTE_ENTRY_HEADER_LEN));
+            attributeLength = min(attributeLength, valueLength);
+
+            memcpy(value, attribute + TC_ATTRIBUTE_ENTRY_HEADER_LEN, attributeLength);
+
+            if (actualLength)
+                *actualLength = attributeLength;
+        }
+    }
+
+    return result;
+}
+
+BOOL TapeReadCapacity(HANDLE handle, PTAPE_CAPACITY capacity)
+{
+    BYTE dataBuffer[256];
+    ULONGLONG value = 0;
+    BOOL result;
+    DWORD i;
+
+    memset(capacity, 0, sizeof(TAPE_CAPACITY));
+
+    // Tape capacity log page. Parameters 1 & 2 are remaining capacity in partition 0 & 1, 3 & 4 are the maximums. Units are MiB.
+    // Both partitions come back in the one LOG SENSE.
+    result = TapeLogSense(handle, TC_LP_TAPE_CAPACITY, dataBuffer, sizeof(dataBuffer));
+
+    for (i = 0; result && i < TAPE_CAPACITY_PARTITIONS; i++)
+    {
+        result = TapeLogParameter(dataBuffer, sizeof(dataBuffer), (USHORT)(1 + i), &value);
+        capacity->Remaining[i] = value * 1024 * 1024;
+
+        if (result)
+        {
+            result = TapeLogParameter(dataBuffer, sizeof(dataBuffer), (USHORT)(1 + TAPE_CAPACITY_PARTITIONS + i), &value);
+            capacity->Maximum[i] = value * 1024 * 1024;
+        }
+    }
+
+    capacity->Valid = result;
+
+    return result;
+}
+
+BOOL TapeGetCapacity(HANDLE handle, DWORD partition, PULONGLONG remaining, PULONGLONG maximum)
+{
+    TAPE_CAPACITY capacity;
+    BYTE value[8];
+    USHORT actualLength = 0;
+    ULONGLONG remainingMB = 0;
+    ULONGLONG maximumMB = 0;
+    BOOL result;
+    DWORD i;
+
+    result = partition < TAPE_CAPACITY_PARTITIONS && TapeReadCapacity(handle, &capacity);
+
+    if (result)
+    {
+        remainingMB = capacity.Remaining[partition] / (1024 * 1024);
+        maximumMB = capacity.Maximum[partition] / (1024 * 1024);
+    }
+    else
+    {
+        // Not every drive has that page. The MAM has the same numbers (also in MiB), just per partition.
+        memset(value, 0, sizeof(value));
+        result = TapeReadAttribute(handle, partition, TC_ATTRIBUTE_REMAINING_CAPACITY, value, sizeof(value), &actualLength) && actualLength == sizeof(value);
+
+        if (result)
+        {
+            remainingMB = 0;
+
+            for (i = 0; i < sizeof(value); i++)
+                remainingMB = (remainingMB << 8) | value[i];
+        }
+
+        // Only a failure if the caller wanted it, rather than passing zero off as the maximum.
+        if (result && maximum)
+        {
+            memset(value, 0, sizeof(value));
+            result = TapeReadAttribute(handle, partition, TC_ATTRIBUTE_MAXIMUM_CAPACITY, value, sizeof(value), &actualLength) && actualLength == sizeof(value);
+
+            if (result)
+            {
+                for (i = 0; i < sizeof(value); i++)
+                    maximumMB = (maximumMB << 8) | value[i];
+            }
+        }
+    }
+
+    if (result)
+    {
+        if (remaining)
+            *remaining = remainingMB * 1024 * 1024;
+
+        if (maximum)
+            *maximum = maximumMB * 1024 * 1024;
+    }
+
+    return result;
+}
+
+BOOL TapeGetCompressionRatio(HANDLE handle, PDWORD writeRatio)
+{
+    TAPE_COMPRESSION_STATS stats;
+
+    if (!TapeGetCompressionStats(handle, &stats))
+        return FALSE;
+
+    *writeRatio = stats.WriteRatio;
+
+    return TRUE;
+}
+
+BOOL TapeGetCompressionStats(HANDLE handle, PTAPE_COMPRESSION_STATS stats)
+{
+    BYTE dataBuffer[256];
+    ULONGLONG value = 0;
+    BOOL result;
+
+    memset(stats, 0, sizeof(TAPE_COMPRESSION_STATS));
+
+    // Data compression log page. Ratios are scaled by 100 and are zero until something has gone through. The counters
+    // start again every time a cartridge is loaded.
+    result = TapeLogSense(handle, TC_LP_DATA_COMPRESSION, dataBuffer, sizeof(dataBuffer));
+
+    if (result)
+    {
+        if (TapeLogParameter(dataBuffer, sizeof(dataBuffer), TC_LP_READ_COMPRESSION_RATIO, &value))
+            stats->ReadRatio = (DWORD)value;
+
+        if (TapeLogParameter(dataBuffer, sizeof(dataBuffer), TC_LP_WRITE_COMPRESSION_RATIO, &value))
+            stats->WriteRatio = (DWORD)value;
+
+        stats->BytesFromHost = TapeLogByteCount(dataBuffer, sizeof(dataBuffer), TC_LP_MB_FROM_HOST);
+        stats->BytesWrittenToTape = TapeLogByteCount(dataBuffer, sizeof(dataBuffer), TC_LP_MB_WRITTEN_TO_TAPE);
+        stats->BytesToHost = TapeLogByteCount(dataBuffer, sizeof(dataBuffer), TC_LP_MB_TO_HOST);
+        stats->BytesReadFromTape = TapeLogByteCount(dataBuffer, sizeof(dataBuffer), TC_LP_MB_READ_FROM_TAPE);
+    }
+
+    return result;
+}
+
+BOOL TapeGetCompression(HANDLE handle, PBOOL enabled)
+{
+    BYTE dataBuffer[64];
+    PBYTE page;
+
+    if (!TapeSenseCompressionPage(handle, dataBuffer, sizeof(dataBuffer), &page))
+        return FALSE;
+
+    *enabled = (page[2] & TC_MP_DCE) != 0;
+
+    return TRUE;
+}
+
+BOOL TapeSetCompression(HANDLE handle, BOOL enable)
+{
+    BYTE cdb[10];
+    BYTE dataBuffer[64];
+    USHORT parameterLength;
+    PBYTE page;
+
+    if (!TapeSenseCompressionPage(handle, dataBuffer, sizeof(dataBuffer), &page))
+        return FALSE;
+
+    // DCE turns compression on writes on or off. Decompression on reads is always left on, or anything already
+    // written compressed couldn't be read back.
+    page[0] &= 0x3F;
+    page[2] = enable ? (page[2] | TC_MP_DCE) : (page[2] & ~TC_MP_DCE);
+    page[3] |= TC_MP_DDE;
+
+    // Mode data length is reserved for MODE SELECT.
+    dataBuffer[0] = 0;
+    dataBuffer[1] = 0;
+
+    parameterLength = (USHORT)(page - dataBuffer) + 2 + page[1];
+
+    memset(cdb, 0, sizeof(cdb));
+
+    cdb[0] = SCSIOP_MODE_SELECT10;
+    cdb[1] = 0x10;
+    cdb[7] = (BYTE)(parameterLength >> 8);
+    cdb[8] = (BYTE)parameterLength;
+
+    return TapeCommand(handle, cdb, sizeof(cdb), dataBuffer, min(parameterLength, sizeof(dataBuffer)), SCSI_IOCTL_DATA_OUT, TC_TIMEOUT_SHORT, NULL);
+}
+
+static BOOL TapeSenseCompressionPage(HANDLE handle, PBYTE dataBuffer, USHORT bufferLength, PBYTE *page)
+{
+    BYTE cdb[10];
+    USHORT pageOffset;
+
+    memset(cdb, 0, sizeof(cdb));
+    memset(dataBuffer, 0, bufferLength);
+
+    cdb[0] = SCSIOP_MODE_SENSE10;
+    cdb[2] = TC_MP_PC_CURRENT | TC_MP_DATA_COMPRESSION;
+    cdb[7] = (BYTE)(bufferLength >> 8);
+    cdb[8] = (BYTE)bufferLength;
+
+    if (!TapeCommand(handle, cdb, sizeof(cdb), dataBuffer, bufferLength, SCSI_IOCTL_DATA_IN, TC_TIMEOUT_SHORT, NULL))
+        return FALSE;
+
+    pageOffset = 8 + (((USHORT)dataBuffer[6] << 8) | dataBuffer[7]);
+    *page = dataBuffer + pageOffset;
+
+    return pageOffset + 4 <= bufferLength && ((*page)[0] & 0x3F) == TC_MP_DATA_COMPRESSION && pageOffset + 2 + (*page)[1] <= bufferLength;
+}
+
+static BOOL TapeLogSense(HANDLE handle, BYTE pageCode, PBYTE dataBuffer, USHORT bufferLength)
+{
+    BYTE cdb[10];
+    BOOL result;
+
+    memset(cdb, 0, sizeof(cdb));
+    memset(dataBuffer, 0, bufferLength);
+
+    cdb[0] = SCSIOP_LOG_SENSE;
+    cdb[2] = TC_LP_PC_CUMULATIVE | pageCode;
+    cdb[7] = (BYTE)(bufferLength >> 8);
+    cdb[8] = (BYTE)bufferLength;
+
+    result = TapeCommand(handle, cdb, sizeof(cdb), dataBuffer, bufferLength, SCSI_IOCTL_DATA_IN, TC_TIMEOUT_SHORT, NULL);
+
+    if (result)
+        result = (dataBuffer[0] & 0x3F) == pageCode;
+
+    return result;
+}
+
+static BOOL TapeLogParameter(PBYTE page, USHORT bufferLength, USHORT parameterCode, PULONGLONG value)
+{
+    USHORT pageLength = (USHORT)page[2] << 8 | page[3];
+    PBYTE parameter = page + TC_LP_HEADER_LEN;
+    PBYTE end = page + min((USHORT)(pageLength + TC_LP_HEADER_LEN), bufferLength);
+    BYTE i;
+
+    while (parameter + TC_LP_PARAMETER_HEADER_LEN <= end)
+    {
+        USHORT code = (USHORT)parameter[0] << 8 | parameter[1];
+        BYTE length = parameter[3];
+
+        if (parameter + TC_LP_PARAMETER_HEADER_LEN + length > end)
+            break;
+
+        if (code == parameterCode)
+        {
+            *value = 0;
+
+            for (i = 0; i < length && i < sizeof(ULONGLONG); i++)
+                *value = (*value << 8) | parameter[TC_LP_PARAMETER_HEADER_LEN + i];
+
+            return TRUE;
+        }
+
+        parameter += TC_LP_PARAMETER_HEADER_LEN + length;
+    }
+
+    return FALSE;
+}
+
+static ULONGLONG TapeLogByteCount(PBYTE page, USHORT bufferLength, USHORT megabyteParameter)
+{
+    ULONGLONG megabytes = 0;
+    ULONGLONG bytes = 0;
+
+    // Counters come in pairs: whole MiB, then the bytes left over in the parameter after it.
+    TapeLogParameter(page, bufferLength, megabyteParameter, &megabytes);
+    TapeLogParameter(page, bufferLength, megabyteParameter + 1, &bytes);
+
+    return megabytes * 1024 * 1024 + bytes;
+}
+
+static BOOL TapeQueryDescriptor(HANDLE handle, PTAPE_DRIVE drive)
+{
+    STORAGE_PROPERTY_QUERY query;
+    BYTE dataBuffer[1024];
+    PSTORAGE_DEVICE_DESCRIPTOR descriptor = (PSTORAGE_DEVICE_DESCRIPTOR)dataBuffer;
+    DWORD bytesReturned = 0;
+
+    memset(&query, 0, sizeof(query));
+    memset(dataBuffer, 0, sizeof(dataBuffer));
+
+    query.PropertyId = StorageDeviceProperty;
+    query.QueryType = PropertyStandardQuery;
+
+    if (!DeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), dataBuffer, sizeof(dataBuffer), &bytesReturned, NULL))
+        return FALSE;
+
+    bytesReturned = min(bytesReturned, descriptor->Size);
+
+    if (bytesReturned < sizeof(STORAGE_DEVICE_DESCRIPTOR))
+        return FALSE;
+
+    // All three or none, a drive we can't put a serial number to is no use for mapping.
+    return TapeQueryString(dataBuffer, bytesReturned, descriptor->VendorIdOffset, (char *)drive->VendorId, sizeof(drive->VendorId)) &&
+        TapeQueryString(dataBuffer, bytesReturned, descriptor->ProductIdOffset, (char *)drive->ProductId, sizeof(drive->ProductId)) &&
+        TapeQueryString(dataBuffer, bytesReturned, descriptor->SerialNumberOffset, (char *)drive->SerialNumber, sizeof(drive->SerialNumber));
+}
+
+static BOOL TapeQueryString(PBYTE descriptor, DWORD descriptorLength, DWORD offset, LPSTR value, size_t valueLength)
+{
+    size_t length = 0;
+
+    // Zero means the driver doesn't know.
+    if (!offset || offset >= descriptorLength)
+        return FALSE;
+
+    while (offset + length < descriptorLength && descriptor[offset + length] && length < valueLength - 1)
+    {
+        // Some drivers give the serial number as hex, or as whatever binary the drive sent. Neither would match what
+        // INQUIRY gives, which is what's in the mappings.
+        if (descriptor[offset + length] < 0x20 || descriptor[offset + length] > 0x7E)
+            return FALSE;
+
+        value[length] = descriptor[offset + length];
+        length++;
+    }
+
+    value[length] = '\0';
+
+    return length > 0;
+}
+
+static BOOL TapeInquiryIdentity(HANDLE handle, DWORD deviceNumber, PTAPE_DRIVE drive)
+{
+    BYTE dataBuffer[1024];
+    BYTE cdb[6];
+    BOOL result;
+
+    memset(dataBuffer, 0, sizeof(dataBuffer));
+    memset(cdb, 0, sizeof(cdb));
+
+    ((PCDB)(cdb))->CDB6INQUIRY.OperationCode = SCSIOP_INQUIRY;
+    ((PCDB)(cdb))->CDB6INQUIRY.IReserved = 4;
+
+    result = ScsiIoControl(handle, deviceNumber, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 10, NULL, NULL);
+
+    if (result)
+    {
+        PINQUIRYDATA inquiryResult = (PINQUIRYDATA)dataBuffer;
+        strncpy_s((char *)drive->VendorId, sizeof(drive->VendorId), (char *)inquiryResult->VendorId, MEMBER_SIZE(INQUIRYDATA, VendorId));
+        strncpy_s((char *)drive->ProductId, sizeof(drive->ProductId), (char *)inquiryResult->ProductId, MEMBER_SIZE(INQUIRYDATA, ProductId));
+
+        TapeInquirySerial(handle, deviceNumber, (char *)drive->SerialNumber, sizeof(drive->SerialNumber));
+    }
+
+    return result;
+}
+
+static BOOL TapeInquirySerial(HANDLE handle, DWORD deviceNumber, LPSTR serialNumber, size_t serialNumberLength)
+{
+    BYTE dataBuffer[1024];
+    BYTE cdb[6];
+    BOOL result;
+
+    memset(dataBuffer, 0, sizeof(dataBuffer));
+    memset(cdb, 0, sizeof(cdb));
+
+    *serialNumber = '\0';
+
+    ((PCDB)(cdb))->CDB6INQUIRY.OperationCode = SCSIOP_INQUIRY;
+    ((PCDB)(cdb))->CDB6INQUIRY.IReserved = 4;
+    ((PCDB)(cdb))->CDB6INQUIRY.PageCode = 0x80;
+    ((PCDB)(cdb))->CDB6INQUIRY.Reserved1 = 1;
+
+    result = ScsiIoControl(handle, deviceNumber, cdb, sizeof(cdb), dataBuffer, sizeof(dataBuffer), SCSI_IOCTL_DATA_IN, 10, NULL, NULL);
+
+    if (result)
+    {
+        PVPD_SERIAL_NUMBER_PAGE inquiryResult = (PVPD_SERIAL_NUMBER_PAGE)dataBuffer;
+        strncpy_s(serialNumber, serialNumberLength, (char *)inquiryResult->SerialNumber, min(inquiryResult->PageLength, serialNumberLength - 1));
+    }
+
+    return result;
+}
+
+static BOOL TapeGetScsiAddress(HANDLE handle, PTAPE_SCSI_ADDRESS address)
+{
+    SCSI_ADDRESS scsiAddress;
+    DWORD bytesReturned;
+
+    memset(address, 0, sizeof(TAPE_SCSI_ADDRESS));
+    memset(&scsiAddress, 0, sizeof(scsiAddress));
+
+    scsiAddress.Length = sizeof(scsiAddress);
+
+    if (!DeviceIoControl(handle, IOCTL_SCSI_GET_ADDRESS, NULL, 0, &scsiAddress, sizeof(scsiAddress), &bytesReturned, NULL))
+        return FALSE;
+
+    address->PortNumber = scsiAddress.PortNumber;
+    address->PathId = scsiAddress.PathId;
+    address->TargetId = scsiAddress.TargetId;
+    address->Lun = scsiAddress.Lun;
+    address->Valid = TRUE;
+
+    return TRUE;
+}
+
+// Whether anyone else has the drive open, which is nearly always LTFS with a volume mounted. An exclusive open is
+// refused if anybody has it open at all, and if nobody has then there's nobody to get in the way of. Nothing is sent to
+// the drive either way. A persistent reservation would say the same thing, but reading it is itself a command.
+
+static BOOL TapePathBusy(LPCSTR devicePath)
+{
+    HANDLE handle = CreateFile(devicePath, GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(handle);
+        return FALSE;
+    }
+
+    return GetLastError() == ERROR_SHARING_VIOLATION;
+}
+
+static BOOL TapeCommand(HANDLE handle, PVOID cdb, UCHAR cdbLength, PVOID dataBuffer, ULONG bufferLength, BYTE dataIn, ULONG timeoutValue, PTAPE_SENSE sense)
+{
+    BYTE senseBuffer[SENSE_INFO_LEN];
+    UCHAR scsiStatus = 0;
+    BOOL result;
+
+    memset(senseBuffer, 0, sizeof(senseBuffer));
+
+    result = ScsiIoControl(handle, 0, cdb, cdbLength, dataBuffer, bufferLength, dataIn, timeoutValue, senseBuffer, &scsiStatus);
+
+    if (sense)
+    {
+        memset(sense, 0, sizeof(TAPE_SENSE));
+
+        sense->ScsiStatus = result ? scsiStatus : 0xFF;
+
+        // Fixed format sense data only. Tape drives don't use the descriptor format for anything we care about.
+        if (result && scsiStatus == SCSISTAT_CHECK_CONDITION && (senseBuffer[0] & 0x7E) == 0x70)
+        {
+            sense->SenseKey = senseBuffer[2] & 0x0F;
+            sense->Filemark = (senseBuffer[2] & TC_SENSE_FILEMARK) != 0;
+            sense->EndOfMedium = (senseBuffer[2] & TC_SENSE_EOM) != 0;
+            sense->IncorrectLength = (senseBuffer[2] & TC_SENSE_ILI) != 0;
+            sense->Asc = senseBuffer[12];
+            sense->Ascq = senseBuffer[13];
+
+            if (senseBuffer[0] & 0x80)
+                sense->Information = (LONG)(((DWORD)senseBuffer[3] << 24) | ((DWORD)senseBuffer[4] << 16) | ((DWORD)senseBuffer[5] << 8) | senseBuffer[6]);
+        }
+    }
+
+    return result && scsiStatus == SCSISTAT_GOOD;
+}
+
+
+static BOOL ScsiIoControl(HANDLE hFile, DWORD deviceNumber, PVOID cdb, UCHAR cdbLength, PVOID dataBuffer, ULONG bufferLength, BYTE dataIn, ULONG timeoutValue, PVOID senseBuffer, PUCHAR scsiStatus)
 {
     DWORD bytesReturned;
     BOOL result = FALSE;
@@ -392,5 +1336,8 @@ static BOOL ScsiIoControl(HANDLE hFile, DWORD deviceNumber, PVOID cdb, UCHAR cdb
     if (senseBuffer)
         memcpy(senseBuffer, scsiBuffer + sizeof(SCSI_PASS_THROUGH_DIRECT), SENSE_INFO_LEN);
 
+    if (scsiStatus)
+        *scsiStatus = scsiDirect->ScsiStatus;
+
     return result;
 }
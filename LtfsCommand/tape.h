@@ -22,17 +22,106 @@
 
 #define MEMBER_SIZE(type, member) sizeof(((type *)NULL)->member)
 
+typedef struct TAPE_SCSI_ADDRESS
+{
+    BOOL Valid;
+    UCHAR PortNumber;
+    UCHAR PathId;
+    UCHAR TargetId;
+    UCHAR Lun;
+} TAPE_SCSI_ADDRESS, *PTAPE_SCSI_ADDRESS;
+
 typedef struct TAPE_DRIVE
 {
     UCHAR VendorId[MEMBER_SIZE(INQUIRYDATA, VendorId) + 1];
     UCHAR ProductId[MEMBER_SIZE(INQUIRYDATA, ProductId) + 1];
     UCHAR SerialNumber[128];
     DWORD DevIndex;
+    TAPE_SCSI_ADDRESS Address;
     struct TAPE_DRIVE * Next;
 } TAPE_DRIVE, *PTAPE_DRIVE;
 
+typedef struct TAPE_SENSE
+{
+    UCHAR ScsiStatus;
+    UCHAR SenseKey;
+    UCHAR Asc;
+    UCHAR Ascq;
+    BOOL Filemark;
+    BOOL EndOfMedium;
+    BOOL IncorrectLength;
+    LONG Information;
+    BOOL ProtectionError;
+} TAPE_SENSE, *PTAPE_SENSE;
+
+typedef struct TAPE_POSITION
+{
+    DWORD Partition;
+    ULONGLONG Block;
+    ULONGLONG File;
+    ULONGLONG Set;
+    BOOL BeginningOfPartition;
+    BOOL EndOfPartition;
+} TAPE_POSITION, *PTAPE_POSITION;
+
+#define TAPE_LOCATE_BLOCK       0x00
+#define TAPE_LOCATE_FILEMARK    0x01
+#define TAPE_LOCATE_EOD         0x03
+
+#define TAPE_SPACE_BLOCKS       0x00
+#define TAPE_SPACE_FILEMARKS    0x01
+#define TAPE_SPACE_EOD          0x03
+#define TAPE_SPACE_SETMARKS     0x04
+
+#define TAPE_MAM_BARCODE        0x0806
+#define TAPE_MAM_BARCODE_LEN    32
+
+#define TAPE_LBP_LENGTH         4
+
+#define TAPE_CAPACITY_PARTITIONS    2
+
+typedef struct TAPE_CAPACITY
+{
+    BOOL Valid;
+    ULONGLONG Remaining[TAPE_CAPACITY_PARTITIONS];
+    ULONGLONG Maximum[TAPE_CAPACITY_PARTITIONS];
+} TAPE_CAPACITY, *PTAPE_CAPACITY;
+
+typedef struct TAPE_COMPRESSION_STATS
+{
+    DWORD ReadRatio;        // x100
+    DWORD WriteRatio;       // x100
+    ULONGLONG BytesFromHost;
+    ULONGLONG BytesWrittenToTape;
+    ULONGLONG BytesToHost;
+    ULONGLONG BytesReadFromTape;
+} TAPE_COMPRESSION_STATS, *PTAPE_COMPRESSION_STATS;
+
 BOOL TapeGetDriveList(PTAPE_DRIVE *driveList, PDWORD numDrivesFound);
 void TapeDestroyDriveList(PTAPE_DRIVE driveList);
+BOOL TapeDescribeDevice(LPCSTR devicePath, PTAPE_DRIVE drive);
+BOOL TapeIsBusy(LPCSTR tapeDrive);
+BOOL TapeGetMediaChangeCount(LPCSTR tapeDrive, PULONG changeCount, PBOOL loaded);
+BOOL TapeIdentify(LPCSTR tapeDrive, LPSTR serialNumber, size_t serialNumberLength, PTAPE_SCSI_ADDRESS address, LPSTR productId, size_t productIdLength);
+BOOL TapeFindDrive(LPCSTR serialNumber, PTAPE_SCSI_ADDRESS addressHint, LPSTR tapeDrive, size_t tapeDriveLength, PTAPE_SCSI_ADDRESS address);
 BOOL TapeLoad(LPCSTR tapeDrive);
 BOOL TapeEject(LPCSTR tapeDrive);
-BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len);
\ No newline at end of file
+BOOL TapeCheckMedia(LPCSTR tapeDrive, LPSTR mediaDesc, size_t len, PTAPE_CAPACITY capacity);
+HANDLE TapeOpen(LPCSTR tapeDrive);
+BOOL TapeLocate(HANDLE handle, BYTE destType, DWORD partition, ULONGLONG block, PTAPE_SENSE sense);
+BOOL TapeReadPosition(HANDLE handle, PTAPE_POSITION position, PTAPE_SENSE sense);
+BOOL TapeRead(HANDLE handle, PVOID buffer, ULONG bufferLength, PULONG bytesRead, PTAPE_SENSE sense);
+BOOL TapeSpace(HANDLE handle, BYTE code, LONG count, PTAPE_SENSE sense);
+BOOL TapeWrite(HANDLE handle, PVOID buffer, ULONG bufferLength, PTAPE_SENSE sense);
+BOOL TapeWriteFilemarks(HANDLE handle, LONG count, PTAPE_SENSE sense);
+BOOL TapeTestUnitReady(HANDLE handle, PTAPE_SENSE sense);
+BOOL TapeUnload(HANDLE handle);
+BOOL TapeSetProtection(HANDLE handle, BOOL enable, PBOOL wasEnabled);
+BOOL TapeReadProtected(HANDLE handle, PVOID buffer, ULONG bufferLength, PULONG bytesRead, PTAPE_SENSE sense);
+BOOL TapeReadAttribute(HANDLE handle, DWORD partition, USHORT attributeId, PBYTE value, USHORT valueLength, PUSHORT actualLength);
+BOOL TapeReadCapacity(HANDLE handle, PTAPE_CAPACITY capacity);
+BOOL TapeGetCapacity(HANDLE handle, DWORD partition, PULONGLONG remaining, PULONGLONG maximum);
+BOOL TapeGetCompressionRatio(HANDLE handle, PDWORD writeRatio);
+BOOL TapeGetCompressionStats(HANDLE handle, PTAPE_COMPRESSION_STATS stats);
+BOOL TapeGetCompression(HANDLE handle, PBOOL enabled);
+BOOL TapeSetCompression(HANDLE handle, BOOL enable);
@@ -19,11 +19,31 @@
 #include "pch.h"
 #include "util.h"
 
-BOOL PollFileSystem(CHAR driveLetter)
+// A directory only has a volume behind it while something's mounted on it. Its volume name comes with a trailing
+// backslash, which would open the root directory instead of the volume.
+
+BOOL PollFileSystem(LPCSTR target)
 {
-    char path[64];
+    char path[MAX_PATH];
+    char mountPoint[MAX_PATH];
+    size_t length;
+
+    if (strlen(target) == 2)
+    {
+        _snprintf_s(path, _countof(path), _TRUNCATE, "\\\\.\\%s", target);
+    }
+    else
+    {
+        _snprintf_s(mountPoint, _countof(mountPoint), _TRUNCATE, "%s\\", target);
 
-    _snprintf_s(path, _countof(path), _TRUNCATE, "\\\\.\\%c:", driveLetter);
+        if (!GetVolumeNameForVolumeMountPoint(mountPoint, path, (DWORD)_countof(path)))
+            return FALSE;
+
+        length = strlen(path);
+
+        if (length && path[length - 1] == '\\')
+            path[length - 1] = '\0';
+    }
 
     HANDLE handle = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
     if (handle != INVALID_HANDLE_VALUE)
@@ -117,3 +137,104 @@ size_t StringReplace(LPSTR lpszBuf, LPCSTR lpszOld, LPCSTR lpszNew, DWORD newBuf
 
     return nCount;
 }
+
+BOOL CreateDirectoryPath(LPCSTR path)
+{
+    CHAR partial[MAX_PATH];
+    LPSTR c;
+
+    strncpy_s(partial, _countof(partial), path, _TRUNCATE);
+
+    // Skip over the drive or UNC prefix, there's nothing to create there.
+    c = partial;
+
+    if (isalpha(c[0]) && c[1] == ':')
+    {
+        c += 2;
+    }
+    else if (c[0] == '\\' && c[1] == '\\')
+    {
+        DWORD separators = 0;
+
+        // \\server\share\ has to exist already, only what's below it can be created.
+        for (c += 2; *c && separators < 2; c++)
+        {
+            if (*c == '\\' || *c == '/')
+                separators++;
+        }
+    }
+
+    while (*c == '\\')
+        c++;
+
+    for (; *c; c++)
+    {
+        if (*c == '\\' || *c == '/')
+        {
+            CHAR saved = *c;
+            *c = '\0';
+
+            if (!CreateDirectory(partial, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+                return FALSE;
+
+            *c = saved;
+        }
+    }
+
+    if (!CreateDirectory(partial, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+        return FALSE;
+
+    return TRUE;
+}
+
+BOOL ReadExtendedAttribute(LPCSTR path, LPCSTR name, LPSTR value, DWORD valueLength)
+{
+    CHAR streamPath[MAX_PATH * 2];
+    DWORD bytesRead = 0;
+    BOOL result = FALSE;
+    HANDLE handle;
+
+    // LTFS exposes extended attributes, including the virtual ltfs.* ones, as alternate data streams on Windows.
+    _snprintf_s(streamPath, _countof(streamPath), _TRUNCATE, "%s:%s", path, name);
+
+    handle = CreateFile(streamPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    result = ReadFile(handle, value, valueLength - 1, &bytesRead, NULL);
+
+    if (result)
+    {
+        value[bytesRead] = '\0';
+
+        while (bytesRead > 0 && (value[bytesRead - 1] == '\r' || value[bytesRead - 1] == '\n' || value[bytesRead - 1] == '\0'))
+            value[--bytesRead] = '\0';
+    }
+
+    CloseHandle(handle);
+
+    return result;
+}
+
+BOOL WriteExtendedAttribute(LPCSTR path, LPCSTR name, LPCSTR value)
+{
+    CHAR streamPath[MAX_PATH * 2];
+    DWORD length = (DWORD)strlen(value);
+    DWORD bytesWritten = 0;
+    BOOL result;
+    HANDLE handle;
+
+    _snprintf_s(streamPath, _countof(streamPath), _TRUNCATE, "%s:%s", path, name);
+
+    handle = CreateFile(streamPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    result = WriteFile(handle, value, length, &bytesWritten, NULL) && bytesWritten == length;
+
+    CloseHandle(handle);
+
+    return result;
+}
@@ -20,6 +20,9 @@
 
 #include "pch.h"
 
-BOOL PollFileSystem(CHAR driveLetter);
+BOOL PollFileSystem(LPCSTR target);
 BOOL IsElevated();
 size_t StringReplace(LPSTR lpszBuf, LPCSTR lpszOld, LPCSTR lpszNew, DWORD newBufferLen);
+BOOL CreateDirectoryPath(LPCSTR path);
+BOOL ReadExtendedAttribute(LPCSTR path, LPCSTR name, LPSTR value, DWORD valueLength);
+BOOL WriteExtendedAttribute(LPCSTR path, LPCSTR name, LPCSTR value);
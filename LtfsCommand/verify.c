@@ -0,0 +1,363 @@
+/*
+ *   File:   verify.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "verify.h"
+#include "ring.h"
+#include "tape.h"
+#include "crc32c.h"
+#include "ltfsidx.h"
+
+typedef struct VERIFY_CONTEXT
+{
+    HANDLE Handle;
+    PVERIFY_RESULT Result;
+    BUFFER_RING Ring;
+    DWORD WorkerCount;
+    CRITICAL_SECTION Lock;
+} VERIFY_CONTEXT, *PVERIFY_CONTEXT;
+
+static void VerifyReadTape(PVERIFY_CONTEXT context);
+static DWORD WINAPI VerifyWorker(LPVOID param);
+static BOOL VerifyAddBlock(PVERIFY_CONTEXT context, PVERIFY_RANGE_LIST list, DWORD partition, ULONGLONG block);
+static void VerifyMergeRanges(PVERIFY_RANGE_LIST list);
+static int VerifyCompareRanges(const void *a, const void *b);
+
+BOOL VerifyTape(LPCSTR tapeDrive, PVERIFY_RESULT result)
+{
+    VERIFY_CONTEXT context;
+    SYSTEM_INFO systemInfo;
+    HANDLE *workers;
+    BOOL protectionWasEnabled = FALSE;
+    ULONGLONG startTime = GetTickCount64();
+    BOOL success;
+    DWORD i;
+
+    memset(result, 0, sizeof(VERIFY_RESULT));
+    memset(&context, 0, sizeof(context));
+
+    context.Result = result;
+    context.Handle = TapeOpen(tapeDrive);
+
+    if (context.Handle == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    // With LBP the drive hands us its own CRC for every block, which is as close to end to end as we can get.
+    // Without it (older drives, or media that doesn't support it) we can still prove every block reads back.
+    result->Protected = TapeSetProtection(context.Handle, TRUE, &protectionWasEnabled);
+
+    // Leave one core for the reader. The CRC is fast enough that two workers will do on any machine, but they're cheap.
+    // Never more than there are slots though, each one needs a slot for its end marker.
+    GetSystemInfo(&systemInfo);
+    context.WorkerCount = min(max(systemInfo.dwNumberOfProcessors - 1, 1), VERIFY_SLOT_COUNT);
+
+    workers = (HANDLE *)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(HANDLE) * context.WorkerCount);
+    success = workers != NULL;
+
+    if (success)
+        success = RingCreate(&context.Ring, VERIFY_SLOT_COUNT, LTFS_MAX_BLOCK_SIZE + TAPE_LBP_LENGTH);
+
+    if (success)
+    {
+        InitializeCriticalSection(&context.Lock);
+
+        for (i = 0; i < context.WorkerCount; i++)
+        {
+            workers[i] = CreateThread(NULL, 0, VerifyWorker, &context, 0, NULL);
+
+            if (!workers[i])
+            {
+                context.WorkerCount = i;
+                break;
+            }
+        }
+
+        success = context.WorkerCount > 0;
+
+        if (success)
+            VerifyReadTape(&context);
+        else
+            RingAbort(&context.Ring);
+
+        for (i = 0; i < context.WorkerCount; i++)
+        {
+            WaitForSingleObject(workers[i], INFINITE);
+            CloseHandle(workers[i]);
+        }
+
+        DeleteCriticalSection(&context.Lock);
+        RingDestroy(&context.Ring);
+    }
+
+    if (workers)
+        LocalFree(workers);
+
+    if (result->Protected && !protectionWasEnabled)
+        TapeSetProtection(context.Handle, FALSE, NULL);
+
+    CloseHandle(context.Handle);
+
+    VerifyMergeRanges(&result->Unreadable);
+    VerifyMergeRanges(&result->CrcErrors);
+
+    result->ElapsedMs = GetTickCount64() - startTime;
+    result->AverageMBs = result->ElapsedMs ? (double)result->Bytes / 1000.0 / (double)result->ElapsedMs : 0.0;
+
+    return success && result->PartitionCount > 0;
+}
+
+void VerifyDestroyResult(PVERIFY_RESULT result)
+{
+    if (result->Unreadable.Ranges)
+        LocalFree(result->Unreadable.Ranges);
+
+    if (result->CrcErrors.Ranges)
+        LocalFree(result->CrcErrors.Ranges);
+
+    memset(result, 0, sizeof(VERIFY_RESULT));
+}
+
+static void VerifyReadTape(PVERIFY_CONTEXT context)
+{
+    PVERIFY_RESULT result = context->Result;
+    PRING_SLOT slot = NULL;
+    DWORD partition;
+    DWORD i;
+
+    for (partition = 0; partition < VERIFY_MAX_PARTITIONS; partition++)
+    {
+        ULONGLONG block = 0;
+        ULONGLONG windowStart = 0;
+        ULONGLONG windowBytes = 0;
+        DWORD badBlocks = 0;
+
+        if (!TapeLocate(context->Handle, TAPE_LOCATE_BLOCK, partition, 0, NULL))
+            break;
+
+        result->PartitionCount++;
+
+        for (;;)
+        {
+            TAPE_SENSE sense;
+            ULONG bytesRead;
+            ULONGLONG now;
+
+            if (!slot)
+                slot = RingAcquireFree(&context->Ring);
+
+            if (!slot)
+                return;
+
+            // Plain READ even with LBP on: the CRC stays on the end of the buffer and the workers check it,
+            // so the drive never waits on us.
+            if (TapeRead(context->Handle, slot->Buffer, context->Ring.SlotSize, &bytesRead, &sense))
+            {
+                slot->Item = partition;
+                slot->Offset = block;
+                slot->Length = bytesRead;
+                RingCommit(&context->Ring, slot);
+                slot = NULL;
+
+                result->Blocks++;
+                result->Bytes += bytesRead;
+                block++;
+                badBlocks = 0;
+
+                // Throughput is sampled over fixed windows so a stall shows up in the minimum rather than disappearing
+                // into the average. The first window of each partition starts after the first block, so the locate doesn't count.
+                now = GetTickCount64();
+
+                if (!windowStart)
+                {
+                    windowStart = now;
+                    windowBytes = 0;
+                }
+                else
+                {
+                    windowBytes += bytesRead;
+
+                    if (now - windowStart >= VERIFY_WINDOW_MS)
+                    {
+                        double mbs = (double)windowBytes / 1000.0 / (double)(now - windowStart);
+
+                        if (result->MinimumMBs == 0.0 || mbs < result->MinimumMBs)
+                            result->MinimumMBs = mbs;
+
+                        windowStart = now;
+                        windowBytes = 0;
+                    }
+                }
+
+                continue;
+            }
+
+            if (sense.Filemark)
+            {
+                result->Filemarks++;
+                block++;
+                continue;
+            }
+
+            if (sense.SenseKey == SCSI_SENSE_BLANK_CHECK || (sense.EndOfMedium && sense.SenseKey != SCSI_SENSE_MEDIUM_ERROR))
+                break;
+
+            // Anything else and this block can't be read. Note it, step over it and carry on. A run of them
+            // long enough means the rest of the partition is gone, and we'd be here all week finding that out.
+            VerifyAddBlock(context, &result->Unreadable, partition, block);
+            block++;
+            windowStart = 0;
+
+            if (++badBlocks >= VERIFY_MAX_BAD_BLOCKS || !TapeLocate(context->Handle, TAPE_LOCATE_BLOCK, partition, block, NULL))
+                break;
+        }
+    }
+
+    // One end marker per worker, the first of which can use the slot we're already holding.
+    for (i = 0; i < context->WorkerCount; i++)
+    {
+        if (!slot)
+            slot = RingAcquireFree(&context->Ring);
+
+        if (!slot)
+            return;
+
+        slot->Flags = RING_SLOT_END;
+        RingCommit(&context->Ring, slot);
+        slot = NULL;
+    }
+}
+
+static DWORD WINAPI VerifyWorker(LPVOID param)
+{
+    PVERIFY_CONTEXT context = (PVERIFY_CONTEXT)param;
+    PVERIFY_RESULT result = context->Result;
+
+    for (;;)
+    {
+        PRING_SLOT slot = RingAcquireFull(&context->Ring);
+
+        if (!slot)
+            break;
+
+        if (slot->Flags & RING_SLOT_END)
+        {
+            RingRelease(&context->Ring, slot);
+            break;
+        }
+
+        if (result->Protected)
+        {
+            // Too short to even hold the CRC is as bad as a wrong one.
+            if (slot->Length < TAPE_LBP_LENGTH)
+            {
+                VerifyAddBlock(context, &result->CrcErrors, slot->Item, slot->Offset);
+            }
+            else
+            {
+                PBYTE crc = slot->Buffer + slot->Length - TAPE_LBP_LENGTH;
+                DWORD expected = (DWORD)crc[0] | ((DWORD)crc[1] << 8) | ((DWORD)crc[2] << 16) | ((DWORD)crc[3] << 24);
+
+                if (Crc32c(0, slot->Buffer, slot->Length - TAPE_LBP_LENGTH) != expected)
+                    VerifyAddBlock(context, &result->CrcErrors, slot->Item, slot->Offset);
+            }
+        }
+
+        RingRelease(&context->Ring, slot);
+    }
+
+    return 0;
+}
+
+static BOOL VerifyAddBlock(PVERIFY_CONTEXT context, PVERIFY_RANGE_LIST list, DWORD partition, ULONGLONG block)
+{
+    BOOL result = TRUE;
+
+    EnterCriticalSection(&context->Lock);
+
+    // Extend the last range if this block follows on from it, which is the usual case for a bad patch of tape.
+    if (list->Count && list->Ranges[list->Count - 1].Partition == partition && list->Ranges[list->Count - 1].LastBlock + 1 == block)
+    {
+        list->Ranges[list->Count - 1].LastBlock = block;
+    }
+    else
+    {
+        if (list->Count == list->Capacity)
+        {
+            DWORD newCapacity = list->Capacity ? list->Capacity * 2 : 64;
+            PVERIFY_RANGE ranges = (PVERIFY_RANGE)LocalAlloc(LMEM_FIXED, sizeof(VERIFY_RANGE) * newCapacity);
+
+            if (ranges)
+            {
+                if (list->Ranges)
+                {
+                    memcpy(ranges, list->Ranges, sizeof(VERIFY_RANGE) * list->Count);
+                    LocalFree(list->Ranges);
+                }
+
+                list->Ranges = ranges;
+                list->Capacity = newCapacity;
+            }
+        }
+
+        result = list->Count < list->Capacity;
+
+        if (result)
+        {
+            list->Ranges[list->Count].Partition = partition;
+            list->Ranges[list->Count].FirstBlock = block;
+            list->Ranges[list->Count].LastBlock = block;
+            list->Count++;
+        }
+    }
+
+    LeaveCriticalSection(&context->Lock);
+
+    return result;
+}
+
+static void VerifyMergeRanges(PVERIFY_RANGE_LIST list)
+{
+    DWORD i, j;
+
+    if (list->Count < 2)
+        return;
+
+    // Workers finish out of order, so CRC errors can arrive shuffled.
+    qsort(list->Ranges, list->Count, sizeof(VERIFY_RANGE), VerifyCompareRanges);
+
+    for (i = 1, j = 0; i < list->Count; i++)
+    {
+        if (list->Ranges[i].Partition == list->Ranges[j].Partition && list->Ranges[i].FirstBlock <= list->Ranges[j].LastBlock + 1)
+            list->Ranges[j].LastBlock = max(list->Ranges[j].LastBlock, list->Ranges[i].LastBlock);
+        else
+            list->Ranges[++j] = list->Ranges[i];
+    }
+
+    list->Count = j + 1;
+}
+
+static int VerifyCompareRanges(const void *a, const void *b)
+{
+    const VERIFY_RANGE *rangeA = (const VERIFY_RANGE *)a;
+    const VERIFY_RANGE *rangeB = (const VERIFY_RANGE *)b;
+
+    if (rangeA->Partition != rangeB->Partition)
+        return rangeA->Partition < rangeB->Partition ? -1 : 1;
+
+    return rangeA->FirstBlock < rangeB->FirstBlock ? -1 : (rangeA->FirstBlock > rangeB->FirstBlock ? 1 : 0);
+}
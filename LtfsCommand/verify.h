@@ -0,0 +1,57 @@
+/*
+ *   File:   verify.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define VERIFY_SLOT_COUNT       64
+#define VERIFY_MAX_PARTITIONS   4
+#define VERIFY_MAX_BAD_BLOCKS   1000
+#define VERIFY_WINDOW_MS        1000
+
+typedef struct VERIFY_RANGE
+{
+    DWORD Partition;
+    ULONGLONG FirstBlock;
+    ULONGLONG LastBlock;
+} VERIFY_RANGE, *PVERIFY_RANGE;
+
+typedef struct VERIFY_RANGE_LIST
+{
+    DWORD Count;
+    DWORD Capacity;
+    PVERIFY_RANGE Ranges;
+} VERIFY_RANGE_LIST, *PVERIFY_RANGE_LIST;
+
+typedef struct VERIFY_RESULT
+{
+    BOOL Protected;
+    DWORD PartitionCount;
+    ULONGLONG Blocks;
+    ULONGLONG Filemarks;
+    ULONGLONG Bytes;
+    VERIFY_RANGE_LIST Unreadable;
+    VERIFY_RANGE_LIST CrcErrors;
+    double AverageMBs;
+    double MinimumMBs;
+    ULONGLONG ElapsedMs;
+} VERIFY_RESULT, *PVERIFY_RESULT;
+
+BOOL VerifyTape(LPCSTR tapeDrive, PVERIFY_RESULT result);
+void VerifyDestroyResult(PVERIFY_RESULT result);
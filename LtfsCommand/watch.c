@@ -0,0 +1,313 @@
+/*
+ *   File:   watch.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include <cfgmgr32.h>
+#include "watch.h"
+#include "mapping.h"
+#include "fusesvc.h"
+#include "inventory.h"
+#include "lock.h"
+
+typedef struct WATCH_EVENT
+{
+    BOOL Arrival;
+    BOOL Healed;
+    ULONGLONG Time;
+    CHAR DevicePath[MAX_PATH];
+    struct WATCH_EVENT *Next;
+} WATCH_EVENT, *PWATCH_EVENT;
+
+typedef struct WATCH_QUEUE
+{
+    CRITICAL_SECTION Lock;
+    HANDLE Signal;
+    PWATCH_EVENT Head;
+    PWATCH_EVENT Tail;
+    volatile LONG Stop;
+} WATCH_QUEUE, *PWATCH_QUEUE;
+
+static DWORD CALLBACK WatchNotify(HCMNOTIFICATION notification, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA eventData, DWORD eventDataSize);
+static BOOL WINAPI WatchCtrlHandler(DWORD ctrlType);
+static void WatchProcessEvents(PWATCH_EVENT events, PWATCH_STATS stats);
+static BOOL WatchHealArrival(PMAPPING_TABLE table, PWATCH_EVENT event, PWATCH_STATS stats);
+
+// The console control handler doesn't get a context, so the queue has to live here.
+static WATCH_QUEUE WatchQueue;
+
+// Windows tells us when a tape device comes or goes, along with the device path. That's all it takes to describe the
+// one drive that changed and fix up whichever mappings have its serial number, rather than go round every drive as
+// remap does. Events come in bursts (a library powering up, a drive going and coming back on a re-cable) so nothing
+// is done until things have gone quiet, and then the service is restarted at most once, and only if a mapping moved.
+
+BOOL WatchDevices(PWATCH_STATS stats)
+{
+    CM_NOTIFY_FILTER filter;
+    HCMNOTIFICATION notification;
+    HANDLE configLock;
+
+    memset(stats, 0, sizeof(WATCH_STATS));
+    memset(&WatchQueue, 0, sizeof(WatchQueue));
+
+    WatchQueue.Signal = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if (!WatchQueue.Signal)
+        return FALSE;
+
+    InitializeCriticalSection(&WatchQueue.Lock);
+
+    memset(&filter, 0, sizeof(filter));
+    filter.cbSize = sizeof(filter);
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    filter.u.DeviceInterface.ClassGuid = GUID_DEVINTERFACE_TAPE;
+
+    if (CM_Register_Notification(&filter, &WatchQueue, WatchNotify, &notification) != CR_SUCCESS)
+    {
+        DeleteCriticalSection(&WatchQueue.Lock);
+        CloseHandle(WatchQueue.Signal);
+        return FALSE;
+    }
+
+    SetConsoleCtrlHandler(WatchCtrlHandler, TRUE);
+
+    while (!WatchQueue.Stop)
+    {
+        PWATCH_EVENT events;
+
+        WaitForSingleObject(WatchQueue.Signal, INFINITE);
+
+        // Anything else turning up restarts the wait.
+        while (!WatchQueue.Stop && WaitForSingleObject(WatchQueue.Signal, WATCH_SETTLE_MS) == WAIT_OBJECT_0);
+
+        EnterCriticalSection(&WatchQueue.Lock);
+        events = WatchQueue.Head;
+        WatchQueue.Head = NULL;
+        WatchQueue.Tail = NULL;
+        LeaveCriticalSection(&WatchQueue.Lock);
+
+        if (!events)
+            continue;
+
+        // Held from reading the mappings to restarting the service, so a map or remap can't land in between.
+        if (LockConfig(&configLock))
+        {
+            WatchProcessEvents(events, stats);
+            LockRelease(configLock);
+            continue;
+        }
+
+        fprintf(stderr, "\r\nTimed out waiting for another change to mappings or the service, run remap.\r\n");
+
+        while (events)
+        {
+            PWATCH_EVENT toFree = events;
+            events = toFree->Next;
+            LocalFree(toFree);
+        }
+    }
+
+    // No more callbacks once this returns, so the queue can go.
+    CM_Unregister_Notification(notification);
+    SetConsoleCtrlHandler(WatchCtrlHandler, FALSE);
+
+    while (WatchQueue.Head)
+    {
+        PWATCH_EVENT toFree = WatchQueue.Head;
+        WatchQueue.Head = toFree->Next;
+        LocalFree(toFree);
+    }
+
+    DeleteCriticalSection(&WatchQueue.Lock);
+    CloseHandle(WatchQueue.Signal);
+
+    return TRUE;
+}
+
+static DWORD CALLBACK WatchNotify(HCMNOTIFICATION notification, PVOID context, CM_NOTIFY_ACTION action, PCM_NOTIFY_EVENT_DATA eventData, DWORD eventDataSize)
+{
+    PWATCH_QUEUE queue = (PWATCH_QUEUE)context;
+    PWATCH_EVENT event;
+
+    if (action != CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL && action != CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL)
+        return ERROR_SUCCESS;
+
+    event = (PWATCH_EVENT)LocalAlloc(LMEM_FIXED | LMEM_ZEROINIT, sizeof(WATCH_EVENT));
+
+    if (!event)
+        return ERROR_SUCCESS;
+
+    // Timed from here, it's as close to the drive appearing as we get.
+    event->Time = GetTickCount64();
+    event->Arrival = action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL;
+
+    WideCharToMultiByte(CP_ACP, 0, eventData->u.DeviceInterface.SymbolicLink, -1, event->DevicePath, _countof(event->DevicePath), NULL, NULL);
+
+    EnterCriticalSection(&queue->Lock);
+
+    if (queue->Tail)
+        queue->Tail->Next = event;
+    else
+        queue->Head = event;
+
+    queue->Tail = event;
+
+    LeaveCriticalSection(&queue->Lock);
+
+    SetEvent(queue->Signal);
+
+    return ERROR_SUCCESS;
+}
+
+static BOOL WINAPI WatchCtrlHandler(DWORD ctrlType)
+{
+    InterlockedExchange(&WatchQueue.Stop, TRUE);
+    SetEvent(WatchQueue.Signal);
+
+    return TRUE;
+}
+
+static void WatchProcessEvents(PWATCH_EVENT events, PWATCH_STATS stats)
+{
+    PMAPPING_TABLE table = NULL;
+    PWATCH_EVENT event;
+    BOOL changed = FALSE;
+    ULONGLONG healedTime;
+
+    // Whatever happened, the saved inventory is from before it.
+    InventoryInvalidate();
+
+    for (event = events; event != NULL; event = event->Next)
+    {
+        if (!event->Arrival)
+        {
+            // Nothing to fix until it comes back, and that's another event.
+            printf("\r\nTape device removed: %s\r\n", event->DevicePath);
+            stats->Removals++;
+            continue;
+        }
+
+        stats->Arrivals++;
+
+        // Read once per batch, and only if something turned up.
+        if (!table && !MappingTableLoad(&table))
+        {
+            fprintf(stderr, "\r\nFailed to get mappings from registry.\r\n");
+            break;
+        }
+
+        changed = WatchHealArrival(table, event, stats) || changed;
+    }
+
+    if (changed)
+    {
+        if (!FuseStopService() || !FuseStartService())
+        {
+            fprintf(stderr, "\r\nFailed to restart LTFS service.\r\n");
+        }
+        else
+        {
+            stats->ServiceRestarts++;
+
+            // Healed means the service has the new device name, so that's where the clock stops.
+            healedTime = GetTickCount64();
+
+            for (event = events; event != NULL; event = event->Next)
+            {
+                ULONGLONG latency;
+
+                if (!event->Healed)
+                    continue;
+
+                latency = healedTime - event->Time;
+
+                if (!stats->LatencySamples || latency < stats->MinLatencyMs)
+                    stats->MinLatencyMs = latency;
+
+                if (latency > stats->MaxLatencyMs)
+                    stats->MaxLatencyMs = latency;
+
+                stats->TotalLatencyMs += latency;
+                stats->LatencySamples++;
+
+                printf("Healed %llu ms after the drive appeared.\r\n", latency);
+            }
+        }
+    }
+
+    if (table)
+        MappingTableDestroy(table);
+
+    while (events)
+    {
+        PWATCH_EVENT toFree = events;
+        events = toFree->Next;
+        LocalFree(toFree);
+    }
+}
+
+static BOOL WatchHealArrival(PMAPPING_TABLE table, PWATCH_EVENT event, PWATCH_STATS stats)
+{
+    PLTFS_MAPPING mapping;
+    TAPE_DRIVE drive;
+    CHAR devName[MAX_DEVICE_NAME];
+    BOOL changed = FALSE;
+
+    if (!TapeDescribeDevice(event->DevicePath, &drive))
+    {
+        fprintf(stderr, "\r\nTape device arrived but could not be identified: %s\r\n", event->DevicePath);
+        return FALSE;
+    }
+
+    _snprintf_s(devName, _countof(devName), _TRUNCATE, "TAPE%d", drive.DevIndex);
+
+    mapping = MappingFindBySerial(table, (char *)drive.SerialNumber);
+
+    if (!mapping)
+    {
+        printf("\r\n%s: [%s] %s %s arrived, not mapped.\r\n", devName, drive.SerialNumber, drive.VendorId, drive.ProductId);
+        return FALSE;
+    }
+
+    for (; mapping != NULL; mapping = mapping->NextSameSerial)
+    {
+        MappingSetAddressHint(mapping->Target, &drive.Address);
+
+        if (strcmp(mapping->DeviceName, devName) == 0)
+        {
+            printf("\r\n%s %s [%s] is back where it was.\r\n", mapping->Target, devName, mapping->SerialNumber);
+            continue;
+        }
+
+        if (!LtfsRegUpdateTargetMapping(mapping->Target, devName))
+        {
+            fprintf(stderr, "\r\nFailed to update existing mapping for %s\r\n", mapping->Target);
+            continue;
+        }
+
+        printf("\r\n%s %s [%s] -> %s\r\n", mapping->Target, mapping->DeviceName, mapping->SerialNumber, devName);
+
+        // A later event in the same batch could be for the same drive.
+        strcpy_s(mapping->DeviceName, _countof(mapping->DeviceName), devName);
+
+        stats->MappingsHealed++;
+        event->Healed = TRUE;
+        changed = TRUE;
+    }
+
+    return changed;
+}
@@ -0,0 +1,37 @@
+/*
+ *   File:   watch.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define WATCH_SETTLE_MS     2000    // Quiet time after the last event before acting on any of them
+
+typedef struct WATCH_STATS
+{
+    DWORD Arrivals;
+    DWORD Removals;
+    DWORD MappingsHealed;
+    DWORD ServiceRestarts;
+    DWORD LatencySamples;
+    ULONGLONG MinLatencyMs;
+    ULONGLONG MaxLatencyMs;
+    ULONGLONG TotalLatencyMs;
+} WATCH_STATS, *PWATCH_STATS;
+
+BOOL WatchDevices(PWATCH_STATS stats);
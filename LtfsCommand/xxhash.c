@@ -0,0 +1,189 @@
+/*
+ *   File:   xxhash.c
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pch.h"
+#include "xxhash.h"
+
+#define XXH_PRIME64_1   0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3   0x165667B19E3779F9ULL
+#define XXH_PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5   0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, n)    (((x) << (n)) | ((x) >> (64 - (n))))
+
+static ULONGLONG Xxh64Round(ULONGLONG acc, ULONGLONG input);
+static ULONGLONG Xxh64MergeRound(ULONGLONG acc, ULONGLONG value);
+static void Xxh64Stripes(PXXH64_CONTEXT context, const BYTE *data, size_t stripes);
+static ULONGLONG Xxh64Read64(const BYTE *data);
+static DWORD Xxh64Read32(const BYTE *data);
+
+void Xxh64Init(PXXH64_CONTEXT context, ULONGLONG seed)
+{
+    context->Seed = seed;
+    context->Length = 0;
+    context->Acc[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    context->Acc[1] = seed + XXH_PRIME64_2;
+    context->Acc[2] = seed;
+    context->Acc[3] = seed - XXH_PRIME64_1;
+    context->Buffered = 0;
+}
+
+void Xxh64Update(PXXH64_CONTEXT context, const void *data, size_t length)
+{
+    const BYTE *pos = (const BYTE *)data;
+    size_t stripes;
+
+    context->Length += length;
+
+    if (context->Buffered)
+    {
+        size_t needed = min(XXH64_STRIPE_LENGTH - context->Buffered, length);
+
+        memcpy(context->Buffer + context->Buffered, pos, needed);
+        context->Buffered += (DWORD)needed;
+        pos += needed;
+        length -= needed;
+
+        if (context->Buffered < XXH64_STRIPE_LENGTH)
+            return;
+
+        Xxh64Stripes(context, context->Buffer, 1);
+        context->Buffered = 0;
+    }
+
+    stripes = length / XXH64_STRIPE_LENGTH;
+
+    if (stripes)
+    {
+        Xxh64Stripes(context, pos, stripes);
+        pos += stripes * XXH64_STRIPE_LENGTH;
+        length -= stripes * XXH64_STRIPE_LENGTH;
+    }
+
+    if (length)
+    {
+        memcpy(context->Buffer, pos, length);
+        context->Buffered = (DWORD)length;
+    }
+}
+
+ULONGLONG Xxh64Final(PXXH64_CONTEXT context)
+{
+    const BYTE *pos = context->Buffer;
+    DWORD remaining = context->Buffered;
+    ULONGLONG hash;
+
+    if (context->Length >= XXH64_STRIPE_LENGTH)
+    {
+        hash = ROTL64(context->Acc[0], 1) + ROTL64(context->Acc[1], 7) + ROTL64(context->Acc[2], 12) + ROTL64(context->Acc[3], 18);
+        hash = Xxh64MergeRound(hash, context->Acc[0]);
+        hash = Xxh64MergeRound(hash, context->Acc[1]);
+        hash = Xxh64MergeRound(hash, context->Acc[2]);
+        hash = Xxh64MergeRound(hash, context->Acc[3]);
+    }
+    else
+    {
+        hash = context->Seed + XXH_PRIME64_5;
+    }
+
+    hash += context->Length;
+
+    while (remaining >= 8)
+    {
+        hash ^= Xxh64Round(0, Xxh64Read64(pos));
+        hash = ROTL64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        pos += 8;
+        remaining -= 8;
+    }
+
+    if (remaining >= 4)
+    {
+        hash ^= (ULONGLONG)Xxh64Read32(pos) * XXH_PRIME64_1;
+        hash = ROTL64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        pos += 4;
+        remaining -= 4;
+    }
+
+    while (remaining--)
+    {
+        hash ^= (ULONGLONG)(*pos++) * XXH_PRIME64_5;
+        hash = ROTL64(hash, 11) * XXH_PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+static ULONGLONG Xxh64Round(ULONGLONG acc, ULONGLONG input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static ULONGLONG Xxh64MergeRound(ULONGLONG acc, ULONGLONG value)
+{
+    acc ^= Xxh64Round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void Xxh64Stripes(PXXH64_CONTEXT context, const BYTE *data, size_t stripes)
+{
+    // Four independent lanes, kept in locals so the compiler can keep them all in registers and overlap the multiplies.
+    ULONGLONG acc0 = context->Acc[0];
+    ULONGLONG acc1 = context->Acc[1];
+    ULONGLONG acc2 = context->Acc[2];
+    ULONGLONG acc3 = context->Acc[3];
+
+    while (stripes--)
+    {
+        acc0 = Xxh64Round(acc0, Xxh64Read64(data));
+        acc1 = Xxh64Round(acc1, Xxh64Read64(data + 8));
+        acc2 = Xxh64Round(acc2, Xxh64Read64(data + 16));
+        acc3 = Xxh64Round(acc3, Xxh64Read64(data + 24));
+        data += XXH64_STRIPE_LENGTH;
+    }
+
+    context->Acc[0] = acc0;
+    context->Acc[1] = acc1;
+    context->Acc[2] = acc2;
+    context->Acc[3] = acc3;
+}
+
+static ULONGLONG Xxh64Read64(const BYTE *data)
+{
+    ULONGLONG value;
+
+    // Little endian, as Windows is. memcpy keeps it legal for unaligned data and compiles to a plain load.
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static DWORD Xxh64Read32(const BYTE *data)
+{
+    DWORD value;
+
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
@@ -0,0 +1,39 @@
+/*
+ *   File:   xxhash.h
+ *   Author: Matthew Millman (inaxeon@hotmail.com)
+ *
+ *   Command line LTFS Configurator for Windows
+ *
+ *   This is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 2 of the License, or
+ *   (at your option) any later version.
+ *   This software is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *   You should have received a copy of the GNU General Public License
+ *   along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pch.h"
+
+#define XXH64_DIGEST_LENGTH     8
+#define XXH64_STRIPE_LENGTH     32
+
+// xxHash64. Not cryptographic, but several times faster than SHA-256 and good enough to catch bit rot.
+
+typedef struct XXH64_CONTEXT
+{
+    ULONGLONG Seed;
+    ULONGLONG Length;
+    ULONGLONG Acc[4];
+    BYTE Buffer[XXH64_STRIPE_LENGTH];
+    DWORD Buffered;
+} XXH64_CONTEXT, *PXXH64_CONTEXT;
+
+void Xxh64Init(PXXH64_CONTEXT context, ULONGLONG seed);
+void Xxh64Update(PXXH64_CONTEXT context, const void *data, size_t length);
+ULONGLONG Xxh64Final(PXXH64_CONTEXT context);